@@ -25,6 +25,15 @@ namespace compilerlib
     CompileResult compile(const std::vector<std::string>& args,
                           OutputMode mode = OutputMode::ToFile, bool instrument = false);
 
+    // Does the setup the first compile() of a process would otherwise do
+    // (target registration, clang, resource dir and sysroot lookup), so
+    // that processes forked afterwards start with it done.
+    void prepareCompiler();
+
+    // Hit/miss counters and size of the instrumented object cache in
+    // CT_CACHE_DIR, as printed by `cc --ct-cache-stats`.
+    std::string objectCacheStats();
+
 #ifdef __cplusplus
     extern "C"
     {
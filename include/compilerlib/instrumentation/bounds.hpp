@@ -10,7 +10,9 @@ namespace llvm
 namespace compilerlib
 {
 
-    void instrumentMemoryAccesses(llvm::Module& module);
+    // With inlineShadow, fixed-size accesses first test their shadow bytes
+    // inline and only call the runtime when a byte is not fully addressable.
+    void instrumentMemoryAccesses(llvm::Module& module, bool inlineShadow);
 
 } // namespace compilerlib
 
@@ -7,6 +7,7 @@
 namespace llvm
 {
     class Function;
+    class FunctionCallee;
     class Instruction;
 } // namespace llvm
 
@@ -16,6 +17,18 @@ namespace compilerlib
     bool shouldInstrument(const llvm::Function& func);
     std::string formatSiteString(const llvm::Instruction& inst);
 
+    // Declares what the runtime guarantees for a hook: it never unwinds (the
+    // runtime defines it noexcept) and may read any memory but only writes
+    // runtime-owned state, unless writesModuleMemory. Hooks that cannot
+    // abort also return. Leaves hooks the module itself defines alone.
+    void setRuntimeHookAttributes(llvm::FunctionCallee hook, bool mayAbort,
+                                  bool writesModuleMemory);
+
+    // How a hook uses pointer argument argNo: read through during the call
+    // or not at all, and whether it keeps the pointer once it returns.
+    void setRuntimeHookPointerArg(llvm::FunctionCallee hook, unsigned argNo, bool read,
+                                  bool kept);
+
 } // namespace compilerlib
 
 #endif // COMPILERLIB_INSTRUMENTATION_COMMON_HPP
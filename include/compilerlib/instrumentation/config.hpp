@@ -17,6 +17,7 @@ namespace compilerlib
     {
         bool shadow_enabled = false;
         bool shadow_aggressive = false;
+        bool shadow_inline = false;
         bool bounds_no_abort = false;
         bool trace_enabled = true;
         bool alloc_enabled = true;
@@ -28,6 +29,13 @@ namespace compilerlib
         bool alloc_trace_enabled = true;
         bool bounds_without_alloc = false;
         bool optnone_enabled = false;
+        // Re-optimize the module after instrumentation (at the -O level).
+        bool post_opt_enabled = false;
+        // Inline the runtime hook fast paths into object file output.
+        bool inline_runtime_enabled = true;
+        // log2 of the runtime's initial allocation table size; 0 keeps the
+        // runtime default.
+        unsigned alloc_table_bits = 0;
     };
 
     void extractRuntimeConfig(const std::vector<std::string>& input,
@@ -35,6 +43,10 @@ namespace compilerlib
 
     void emitRuntimeConfigGlobals(llvm::Module& module, const RuntimeConfig& config);
 
+    // Every field of config in a stable textual form; part of the object
+    // cache key, so a new field must be added here as well.
+    std::string describeRuntimeConfig(const RuntimeConfig& config);
+
 } // namespace compilerlib
 
 #endif // COMPILERLIB_INSTRUMENTATION_CONFIG_HPP
@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: Apache-2.0
+#ifndef COMPILERLIB_INSTRUMENTATION_PASSES_HPP
+#define COMPILERLIB_INSTRUMENTATION_PASSES_HPP
+
+#include "compilerlib/instrumentation/config.hpp"
+
+#include <llvm/IR/PassManager.h>
+
+namespace llvm
+{
+    class Module;
+    class PassBuilder;
+} // namespace llvm
+
+namespace compilerlib
+{
+
+    // Runs the instrumentation config selects, in the order trace, alloc,
+    // bounds, vtable, then records config for the runtime.
+    void runInstrumentation(llvm::Module& module, const RuntimeConfig& config);
+
+    struct TraceInstrumentationPass : llvm::PassInfoMixin<TraceInstrumentationPass>
+    {
+        llvm::PreservedAnalyses run(llvm::Module& module, llvm::ModuleAnalysisManager& analyses);
+    };
+
+    struct AllocInstrumentationPass : llvm::PassInfoMixin<AllocInstrumentationPass>
+    {
+        llvm::PreservedAnalyses run(llvm::Module& module, llvm::ModuleAnalysisManager& analyses);
+    };
+
+    struct BoundsInstrumentationPass : llvm::PassInfoMixin<BoundsInstrumentationPass>
+    {
+        bool inlineShadow = false;
+
+        llvm::PreservedAnalyses run(llvm::Module& module, llvm::ModuleAnalysisManager& analyses);
+    };
+
+    struct VirtualCallInstrumentationPass : llvm::PassInfoMixin<VirtualCallInstrumentationPass>
+    {
+        bool traceCalls = true;
+        bool dumpVtable = false;
+
+        llvm::PreservedAnalyses run(llvm::Module& module, llvm::ModuleAnalysisManager& analyses);
+    };
+
+    // runInstrumentation() as a pass. A module is only instrumented once, so
+    // the pass can sit in both the pre-link and post-link LTO pipelines.
+    struct InstrumentationPass : llvm::PassInfoMixin<InstrumentationPass>
+    {
+        RuntimeConfig config;
+
+        llvm::PreservedAnalyses run(llvm::Module& module, llvm::ModuleAnalysisManager& analyses);
+
+        static bool isRequired()
+        {
+            return true;
+        }
+    };
+
+    // Makes the passes available to -passes= as ct-trace, ct-alloc,
+    // ct-bounds, ct-vcall and coretrace (all of config). With addToPipeline,
+    // coretrace also runs at the start of the module optimization pipeline of
+    // every default pipeline, including -O0, so the optimizations that follow
+    // clean up after it.
+    void registerInstrumentationPasses(llvm::PassBuilder& builder, const RuntimeConfig& config,
+                                       bool addToPipeline);
+
+} // namespace compilerlib
+
+#endif // COMPILERLIB_INSTRUMENTATION_PASSES_HPP
@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: Apache-2.0
+#ifndef COMPILERLIB_INSTRUMENTATION_RUNTIME_FASTPATH_HPP
+#define COMPILERLIB_INSTRUMENTATION_RUNTIME_FASTPATH_HPP
+
+#include <llvm/ADT/StringRef.h>
+
+namespace llvm
+{
+    class Module;
+} // namespace llvm
+
+namespace compilerlib
+{
+
+    // Links the runtime hook fast paths from bitcodePath into module and
+    // inlines them at every call site. Calls stay out of line when the
+    // bitcode is missing, unreadable or built for another target. Returns
+    // whether any call was inlined.
+    bool linkRuntimeFastPaths(llvm::Module& module, llvm::StringRef bitcodePath);
+
+} // namespace compilerlib
+
+#endif // COMPILERLIB_INSTRUMENTATION_RUNTIME_FASTPATH_HPP
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: Apache-2.0
+#ifndef COMPILERLIB_SESSION_HPP
+#define COMPILERLIB_SESSION_HPP
+
+#include "compilerlib/attributes.hpp"
+#include "compilerlib/compiler.h"
+
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace compilerlib
+{
+
+    struct CompileJob
+    {
+        std::vector<std::string> args;
+        OutputMode mode = OutputMode::ToFile;
+        bool instrument = false;
+    };
+
+    // Runs many compilations in one process on a pool of worker threads.
+    // What does not depend on the input is set up once: the LLVM targets,
+    // the clang, resource dir and sysroot lookups, and on each worker a
+    // clang::FileManager whose stat cache carries over from one job to the
+    // next. As with clang's own ClangTool, files must not change while the
+    // session has seen them; call clearFileCache() after changing some.
+    class CompilerSession
+    {
+      public:
+        // threads == 0 means one per hardware thread.
+        explicit CompilerSession(unsigned threads = 0);
+        ~CompilerSession();
+
+        CompilerSession(const CompilerSession&) = delete;
+        CompilerSession& operator=(const CompilerSession&) = delete;
+
+        CT_NODISCARD CompileResult compile(const std::vector<std::string>& args,
+                                           OutputMode mode = OutputMode::ToFile,
+                                           bool instrument = false);
+
+        // Queues job on the pool; the future is ready once it has compiled.
+        CT_NODISCARD std::future<CompileResult> compileAsync(CompileJob job);
+
+        // Compiles jobs concurrently; results are in job order.
+        CT_NODISCARD std::vector<CompileResult> compileMany(const std::vector<CompileJob>& jobs);
+
+        // Drops the cached file information of every worker, from the next
+        // job each one starts; jobs already running keep theirs.
+        void clearFileCache();
+
+        CT_NODISCARD unsigned threadCount() const;
+
+      private:
+        struct Impl;
+        std::unique_ptr<Impl> impl_;
+    };
+
+} // namespace compilerlib
+
+#endif // COMPILERLIB_SESSION_HPP
@@ -31,6 +31,22 @@ namespace cli
                 return result;
             }
 
+            if (arg == "--ct-cache-stats")
+            {
+                result.outcome = ParseOutcome::CacheStats;
+                return result;
+            }
+
+            if (arg == "--server" || arg.rfind("--server=", 0) == 0)
+            {
+                result.outcome = ParseOutcome::Server;
+                if (arg != "--server")
+                {
+                    result.server_socket = arg.substr(sizeof("--server=") - 1);
+                }
+                return result;
+            }
+
             if (arg == "--")
             {
                 result.compiler_args.push_back(arg);
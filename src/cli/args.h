@@ -13,6 +13,8 @@ namespace cli
     {
         Ok,
         Help,
+        CacheStats,
+        Server,
         Error,
     };
 
@@ -22,6 +24,8 @@ namespace cli
         compilerlib::OutputMode mode = compilerlib::OutputMode::ToFile;
         bool instrument = false;
         std::vector<std::string> compiler_args;
+        // --server=<path>; empty means CT_SERVER_SOCKET.
+        std::string server_socket;
         std::string error;
     };
 
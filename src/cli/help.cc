@@ -31,13 +31,23 @@ namespace cli
             << "  --instrument             Enable CoreTrace instrumentation (required for "
                "--ct-*).\n"
             << "  --in-mem, --in-memory     Print LLVM IR to stdout (use with -emit-llvm).\n"
+            << "  -j<n>, -j <n>, -j         Compile sources on n threads (-j: all cores; "
+               "CT_JOBS).\n"
+            << "  --ct-cache-stats          Print object cache statistics (CT_CACHE_DIR) and "
+               "exit.\n"
+            << "  --server[=<path>]         Serve compilations on a Unix socket "
+               "(CT_SERVER_SOCKET).\n"
             << "\n"
             << "Instrumentation toggles:\n"
             << "  --ct-modules=<list>       Comma-separated list: trace,alloc,bounds,vtable,all.\n"
             << "  --ct-shadow               Enable shadow memory.\n"
             << "  --ct-shadow-aggressive    Enable aggressive shadow mode.\n"
             << "  --ct-shadow=aggressive    Same as --ct-shadow-aggressive.\n"
+            << "  --ct-shadow-inline        Shadow mode with inline shadow checks.\n"
             << "  --ct-bounds-no-abort      Do not abort on bounds errors.\n"
+            << "  --ct-alloc-table-bits=<n> Initial allocation table size (2^n, n <= 26).\n"
+            << "  --ct-post-opt             Optimize again after instrumentation (-O1 and up).\n"
+            << "  --ct-no-inline-runtime    Do not inline the runtime hook fast paths.\n"
             << "  --ct-no-trace / --ct-trace\n"
             << "  --ct-no-alloc / --ct-alloc\n"
             << "  --ct-no-bounds / --ct-bounds\n"
@@ -58,6 +68,8 @@ namespace cli
             << "Notes:\n"
             << "  - All other arguments are forwarded to clang.\n"
             << "  - Output defaults to a.out when linking (override with -o or -o=<path>).\n"
+            << "  - With CT_CACHE_DIR set, instrumented objects are cached there.\n"
+            << "  - With CT_SERVER_SOCKET set, compilations run on the server listening there.\n"
             << "\n"
             << "Examples:\n"
             << "  " << name << " --instrument -o app main.c\n"
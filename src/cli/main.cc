@@ -1,42 +1,20 @@
 // SPDX-License-Identifier: Apache-2.0
-#include "compilerlib/compiler.h"
-#include <iostream>
-
 #include "cli/args.h"
-#include "cli/help.h"
+#include "cli/run.h"
+#include "cli/server.h"
 
 int main(int argc, char* argv[])
 {
     auto parsed = cli::parseArgs(argc, argv);
-    if (parsed.outcome == cli::ParseOutcome::Help)
-    {
-        cli::printHelp(argv[0]);
-        return 0;
-    }
-    if (parsed.outcome == cli::ParseOutcome::Error)
+    if (parsed.outcome == cli::ParseOutcome::Server)
     {
-        std::cerr << parsed.error;
-        return 1;
+        return cli::runServer(parsed.server_socket);
     }
 
-    auto res = compilerlib::compile(parsed.compiler_args, parsed.mode, parsed.instrument);
-    if (!res.diagnostics.empty())
-    {
-        std::cerr << res.diagnostics;
-        if (res.diagnostics.back() != '\n')
-        {
-            std::cerr << '\n';
-        }
-    }
-    if (!res.success)
+    int status = 0;
+    if (cli::forwardToServer(argc, argv, status))
     {
-        return 1;
+        return status;
     }
-
-    if (parsed.mode == compilerlib::OutputMode::ToMemory && !res.llvmIR.empty())
-    {
-        std::cout << res.llvmIR << std::endl;
-    }
-
-    return 0;
+    return cli::run(argv[0], parsed);
 }
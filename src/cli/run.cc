@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "cli/run.h"
+
+#include "cli/help.h"
+#include "compilerlib/compiler.h"
+
+#include <iostream>
+
+namespace cli
+{
+    int run(const char* argv0, const ParseResult& parsed)
+    {
+        if (parsed.outcome == ParseOutcome::Help)
+        {
+            printHelp(argv0);
+            return 0;
+        }
+        if (parsed.outcome == ParseOutcome::CacheStats)
+        {
+            std::cout << compilerlib::objectCacheStats();
+            return 0;
+        }
+        if (parsed.outcome == ParseOutcome::Server)
+        {
+            std::cerr << "--server cannot be combined with a compilation\n";
+            return 1;
+        }
+        if (parsed.outcome == ParseOutcome::Error)
+        {
+            std::cerr << parsed.error;
+            return 1;
+        }
+
+        auto res = compilerlib::compile(parsed.compiler_args, parsed.mode, parsed.instrument);
+        if (!res.diagnostics.empty())
+        {
+            std::cerr << res.diagnostics;
+            if (res.diagnostics.back() != '\n')
+            {
+                std::cerr << '\n';
+            }
+        }
+        if (!res.success)
+        {
+            return 1;
+        }
+
+        if (parsed.mode == compilerlib::OutputMode::ToMemory && !res.llvmIR.empty())
+        {
+            std::cout << res.llvmIR << std::endl;
+        }
+
+        return 0;
+    }
+} // namespace cli
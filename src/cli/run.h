@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: Apache-2.0
+#ifndef CORETRACE_CLI_RUN_H
+#define CORETRACE_CLI_RUN_H
+
+#include "cli/args.h"
+
+namespace cli
+{
+    // Carries out a parsed command line in this process and returns the
+    // exit code. Shared by main and the compile server.
+    int run(const char* argv0, const ParseResult& parsed);
+} // namespace cli
+
+#endif // CORETRACE_CLI_RUN_H
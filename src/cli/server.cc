@@ -0,0 +1,604 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "cli/server.h"
+
+#include "cli/args.h"
+#include "cli/run.h"
+#include "compilerlib/compiler.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+namespace cli
+{
+#ifndef _WIN32
+    namespace
+    {
+        // Sent with the client's stdin, stdout and stderr attached, ahead of
+        // the request. Bump the digit when the request layout changes.
+        constexpr char kRequestMagic[4] = {'C', 'T', 'S', '1'};
+        // Bound on the request size, against garbage on the socket.
+        constexpr uint32_t kMaxRequestSize = 64u << 20;
+
+#ifdef MSG_NOSIGNAL
+        constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+        constexpr int kSendFlags = 0;
+#endif
+
+        // What the client forwards besides its stdio. Encoded as a u32 size
+        // followed by argv, cwd and env; a string is a u32 length and its
+        // bytes, a list a u32 count and its strings.
+        struct Request
+        {
+            std::vector<std::string> argv;
+            std::string cwd;
+            std::vector<std::string> env;
+        };
+
+        void putU32(std::string& out, uint32_t value)
+        {
+            out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+
+        void putString(std::string& out, const std::string& value)
+        {
+            putU32(out, static_cast<uint32_t>(value.size()));
+            out += value;
+        }
+
+        void putList(std::string& out, const std::vector<std::string>& values)
+        {
+            putU32(out, static_cast<uint32_t>(values.size()));
+            for (const std::string& value : values)
+            {
+                putString(out, value);
+            }
+        }
+
+        std::string encodeRequest(const Request& request)
+        {
+            std::string body;
+            putList(body, request.argv);
+            putString(body, request.cwd);
+            putList(body, request.env);
+
+            std::string out;
+            putU32(out, static_cast<uint32_t>(body.size()));
+            out += body;
+            return out;
+        }
+
+        class RequestReader
+        {
+          public:
+            explicit RequestReader(const std::string& data) : data_(data) {}
+
+            bool readString(std::string& out)
+            {
+                uint32_t size = 0;
+                if (!readU32(size) || size > data_.size() - pos_)
+                {
+                    return false;
+                }
+                out.assign(data_, pos_, size);
+                pos_ += size;
+                return true;
+            }
+
+            bool readList(std::vector<std::string>& out)
+            {
+                uint32_t count = 0;
+                // Every string takes at least its length field.
+                if (!readU32(count) || count > (data_.size() - pos_) / sizeof(uint32_t))
+                {
+                    return false;
+                }
+                out.resize(count);
+                for (std::string& value : out)
+                {
+                    if (!readString(value))
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            bool atEnd() const
+            {
+                return pos_ == data_.size();
+            }
+
+          private:
+            bool readU32(uint32_t& value)
+            {
+                if (data_.size() - pos_ < sizeof(value))
+                {
+                    return false;
+                }
+                std::memcpy(&value, data_.data() + pos_, sizeof(value));
+                pos_ += sizeof(value);
+                return true;
+            }
+
+            const std::string& data_;
+            size_t pos_ = 0;
+        };
+
+        bool decodeRequest(const std::string& data, Request& request)
+        {
+            RequestReader reader(data);
+            return reader.readList(request.argv) && reader.readString(request.cwd) &&
+                   reader.readList(request.env) && reader.atEnd() && !request.argv.empty();
+        }
+
+        bool sendAll(int fd, const char* data, size_t size)
+        {
+            while (size > 0)
+            {
+                ssize_t n = ::send(fd, data, size, kSendFlags);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return false;
+                }
+                data += n;
+                size -= static_cast<size_t>(n);
+            }
+            return true;
+        }
+
+        bool readAll(int fd, char* data, size_t size)
+        {
+            while (size > 0)
+            {
+                ssize_t n = ::read(fd, data, size);
+                if (n < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (n <= 0)
+                {
+                    return false;
+                }
+                data += n;
+                size -= static_cast<size_t>(n);
+            }
+            return true;
+        }
+
+        bool sendStdio(int fd)
+        {
+            int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+            alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+
+            struct iovec iov = {};
+            iov.iov_base = const_cast<char*>(kRequestMagic);
+            iov.iov_len = sizeof(kRequestMagic);
+            struct msghdr msg = {};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+            std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+            ssize_t n;
+            do
+            {
+                n = ::sendmsg(fd, &msg, kSendFlags);
+            } while (n < 0 && errno == EINTR);
+            return n == static_cast<ssize_t>(sizeof(kRequestMagic));
+        }
+
+        bool receiveStdio(int fd, int (&fds)[3])
+        {
+            char magic[sizeof(kRequestMagic)] = {};
+            alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+
+            struct iovec iov = {};
+            iov.iov_base = magic;
+            iov.iov_len = sizeof(magic);
+            struct msghdr msg = {};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            ssize_t n;
+            do
+            {
+                n = ::recvmsg(fd, &msg, 0);
+            } while (n < 0 && errno == EINTR);
+            if (n != static_cast<ssize_t>(sizeof(magic)) ||
+                std::memcmp(magic, kRequestMagic, sizeof(magic)) != 0)
+            {
+                return false;
+            }
+
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+                cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+            {
+                return false;
+            }
+            std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+            return true;
+        }
+
+        bool makeAddress(const std::string& path, struct sockaddr_un& addr)
+        {
+            std::memset(&addr, 0, sizeof(addr));
+            if (path.size() >= sizeof(addr.sun_path))
+            {
+                return false;
+            }
+            addr.sun_family = AF_UNIX;
+            std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+            return true;
+        }
+
+        int connectTo(const std::string& path)
+        {
+            struct sockaddr_un addr;
+            if (!makeAddress(path, addr))
+            {
+                return -1;
+            }
+            int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0)
+            {
+                return -1;
+            }
+#ifdef SO_NOSIGPIPE
+            int on = 1;
+            (void)::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+            if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0)
+            {
+                ::close(fd);
+                return -1;
+            }
+            return fd;
+        }
+
+        // Whether the process at the other end of fd runs as this user. The
+        // socket's permissions say nothing once a path can be replaced, and
+        // a server run by someone else would get this user's environment.
+        bool peerIsThisUser(int fd)
+        {
+#if defined(__linux__)
+            struct ucred cred = {};
+            socklen_t size = sizeof(cred);
+            if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &size) != 0)
+            {
+                return false;
+            }
+            uid_t uid = cred.uid;
+#else
+            uid_t uid = 0;
+            gid_t gid = 0;
+            if (::getpeereid(fd, &uid, &gid) != 0)
+            {
+                return false;
+            }
+#endif
+            return uid == ::geteuid();
+        }
+
+        // The client sends nothing after its request, so conn turning
+        // readable means it went away. Then the compilation and the tools it
+        // started (the linker) are killed instead of running to the end for
+        // nobody. done is set once the exit code is about to be sent.
+        void killOnHangup(int conn, const std::atomic<bool>& done)
+        {
+            std::thread(
+                [conn, &done]
+                {
+                    struct pollfd pfd = {};
+                    pfd.fd = conn;
+                    pfd.events = POLLIN;
+                    while (::poll(&pfd, 1, -1) < 0 && errno == EINTR)
+                    {
+                    }
+                    if (!done.load())
+                    {
+                        ::kill(0, SIGKILL);
+                    }
+                })
+                .detach();
+        }
+
+        std::string currentDirectory()
+        {
+            std::vector<char> buffer(1024);
+            while (!::getcwd(buffer.data(), buffer.size()))
+            {
+                if (errno != ERANGE)
+                {
+                    return {};
+                }
+                buffer.resize(buffer.size() * 2);
+            }
+            return buffer.data();
+        }
+
+        void replaceEnvironment(const std::vector<std::string>& env)
+        {
+            std::vector<std::string> names;
+            for (char** entry = environ; entry && *entry; ++entry)
+            {
+                std::string text = *entry;
+                names.push_back(text.substr(0, text.find('=')));
+            }
+            for (const std::string& name : names)
+            {
+                ::unsetenv(name.c_str());
+            }
+            for (const std::string& entry : env)
+            {
+                size_t eq = entry.find('=');
+                if (eq == std::string::npos || eq == 0)
+                {
+                    continue;
+                }
+                ::setenv(entry.substr(0, eq).c_str(), entry.c_str() + eq + 1, 1);
+            }
+        }
+
+        // Descriptors 0-2 must be taken, so that the client's stdio received
+        // later never lands on them.
+        void occupyStdio()
+        {
+            for (int fd = STDIN_FILENO; fd <= STDERR_FILENO; ++fd)
+            {
+                if (::fcntl(fd, F_GETFD) == -1)
+                {
+                    (void)::open("/dev/null", O_RDWR);
+                }
+            }
+        }
+
+        // Runs in the process forked for conn: takes on the client's stdio,
+        // directory and environment, compiles, and sends back the exit code.
+        // Returning without sending it tells the client the job was dropped.
+        int serveConnection(int conn)
+        {
+            // The server ignores both; the compilation and the tools it runs
+            // (the linker) need the defaults back.
+            std::signal(SIGCHLD, SIG_DFL);
+            std::signal(SIGPIPE, SIG_DFL);
+
+            int fds[3] = {-1, -1, -1};
+            if (!peerIsThisUser(conn) || !receiveStdio(conn, fds))
+            {
+                return 1;
+            }
+
+            Request request;
+            uint32_t size = 0;
+            std::string body;
+            bool ok = readAll(conn, reinterpret_cast<char*>(&size), sizeof(size)) &&
+                      size <= kMaxRequestSize;
+            if (ok)
+            {
+                body.resize(size);
+                ok = readAll(conn, body.data(), size) && decodeRequest(body, request) &&
+                     ::chdir(request.cwd.c_str()) == 0;
+            }
+            if (!ok)
+            {
+                return 1;
+            }
+
+            // In a group of its own, so that a hang-up kills exactly this
+            // compilation and what it started.
+            static std::atomic<bool> done{false};
+            (void)::setpgid(0, 0);
+            killOnHangup(conn, done);
+
+            replaceEnvironment(request.env);
+            for (int fd = STDIN_FILENO; fd <= STDERR_FILENO; ++fd)
+            {
+                ::dup2(fds[fd], fd);
+                ::close(fds[fd]);
+            }
+
+            std::vector<char*> argv;
+            for (std::string& arg : request.argv)
+            {
+                argv.push_back(arg.data());
+            }
+            argv.push_back(nullptr);
+
+            ParseResult parsed = parseArgs(static_cast<int>(request.argv.size()), argv.data());
+            int32_t status = run(argv[0], parsed);
+            std::cout.flush();
+            std::cerr.flush();
+            std::fflush(nullptr);
+            done.store(true);
+            (void)sendAll(conn, reinterpret_cast<const char*>(&status), sizeof(status));
+            return 0;
+        }
+    } // namespace
+
+    int runServer(std::string socketPath)
+    {
+        if (socketPath.empty())
+        {
+            if (const char* env = std::getenv("CT_SERVER_SOCKET"))
+            {
+                socketPath = env;
+            }
+        }
+        if (socketPath.empty())
+        {
+            std::cerr << "--server needs a socket: pass --server=<path> or set CT_SERVER_SOCKET\n";
+            return 1;
+        }
+
+        struct sockaddr_un addr;
+        if (!makeAddress(socketPath, addr))
+        {
+            std::cerr << "socket path too long: " << socketPath << '\n';
+            return 1;
+        }
+
+        int running = connectTo(socketPath);
+        if (running >= 0)
+        {
+            ::close(running);
+            std::cerr << "a compile server is already listening on " << socketPath << '\n';
+            return 1;
+        }
+        // Left behind by a server that did not shut down cleanly.
+        struct stat st;
+        if (::lstat(socketPath.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+        {
+            ::unlink(socketPath.c_str());
+        }
+
+        int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0)
+        {
+            std::cerr << "cannot create socket: " << std::strerror(errno) << '\n';
+            return 1;
+        }
+        // Whoever can connect runs compilations as this user, so only this
+        // user may.
+        mode_t oldMask = ::umask(0077);
+        int bound = ::bind(listener, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+        ::umask(oldMask);
+        if (bound != 0 || ::listen(listener, SOMAXCONN) != 0)
+        {
+            std::cerr << "cannot listen on " << socketPath << ": " << std::strerror(errno) << '\n';
+            ::close(listener);
+            return 1;
+        }
+
+        occupyStdio();
+        compilerlib::prepareCompiler();
+        // Children are never waited for, and a client that goes away must
+        // not take the server with it.
+        std::signal(SIGCHLD, SIG_IGN);
+        std::signal(SIGPIPE, SIG_IGN);
+        std::cerr << "compile server listening on " << socketPath << '\n';
+
+        for (;;)
+        {
+            int conn = ::accept(listener, nullptr, nullptr);
+            if (conn < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                {
+                    continue;
+                }
+                std::cerr << "accept failed: " << std::strerror(errno) << '\n';
+                ::close(listener);
+                return 1;
+            }
+
+            pid_t pid = ::fork();
+            if (pid == 0)
+            {
+                ::close(listener);
+                ::_exit(serveConnection(conn));
+            }
+            if (pid < 0)
+            {
+                std::cerr << "fork failed: " << std::strerror(errno) << '\n';
+            }
+            ::close(conn);
+        }
+    }
+
+    bool forwardToServer(int argc, char* argv[], int& status)
+    {
+        const char* socketPath = std::getenv("CT_SERVER_SOCKET");
+        if (!socketPath || !*socketPath)
+        {
+            return false;
+        }
+        int fd = connectTo(socketPath);
+        if (fd < 0)
+        {
+            return false;
+        }
+        if (!peerIsThisUser(fd))
+        {
+            ::close(fd);
+            std::cerr << "warning: ignoring compile server on " << socketPath
+                      << ": it runs as another user\n";
+            return false;
+        }
+
+        Request request;
+        request.argv.assign(argv, argv + argc);
+        request.cwd = currentDirectory();
+        for (char** entry = environ; entry && *entry; ++entry)
+        {
+            request.env.emplace_back(*entry);
+        }
+        std::string payload = encodeRequest(request);
+
+        // Until the whole request is sent the server compiles nothing, so
+        // compiling here instead is still safe.
+        if (request.cwd.empty() || !sendStdio(fd) ||
+            !sendAll(fd, payload.data(), payload.size()))
+        {
+            ::close(fd);
+            return false;
+        }
+
+        int32_t code = 1;
+        bool answered = readAll(fd, reinterpret_cast<char*>(&code), sizeof(code));
+        ::close(fd);
+        if (!answered)
+        {
+            std::cerr << "compile server on " << socketPath << " dropped the compilation\n";
+            code = 1;
+        }
+        status = code;
+        return true;
+    }
+#else
+    int runServer(std::string)
+    {
+        std::cerr << "--server is only supported on Unix-like systems\n";
+        return 1;
+    }
+
+    bool forwardToServer(int, char*[], int&)
+    {
+        return false;
+    }
+#endif
+} // namespace cli
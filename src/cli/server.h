@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: Apache-2.0
+#ifndef CORETRACE_CLI_SERVER_H
+#define CORETRACE_CLI_SERVER_H
+
+#include <string>
+
+namespace cli
+{
+    // Serves compilations forwarded by forwardToServer on the Unix socket
+    // socketPath (CT_SERVER_SOCKET when empty) until killed. Each one runs
+    // in a process forked from the server, so the setup a fresh cc process
+    // pays for is done only once. Only clients running as the same user
+    // are served, and a compilation is killed when its client goes away.
+    int runServer(std::string socketPath);
+
+    // When CT_SERVER_SOCKET names a listening server run by this user, runs
+    // this invocation there with this process's stdio, directory and
+    // environment, and sets status to its exit code. Returns false, having
+    // sent nothing, when no such server answers.
+    bool forwardToServer(int argc, char* argv[], int& status);
+} // namespace cli
+
+#endif // CORETRACE_CLI_SERVER_H
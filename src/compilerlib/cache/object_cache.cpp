@@ -0,0 +1,412 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "object_cache.hpp"
+#include "compilerlib/compiler.h"
+
+#include <clang/Basic/Version.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/FrontendAction.h>
+#include <clang/Frontend/PreprocessorOutputOptions.h>
+#include <clang/Frontend/Utils.h>
+#include <clang/Lex/HeaderSearchOptions.h>
+#include <clang/Lex/PreprocessorOptions.h>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/SHA256.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+namespace compilerlib::cache
+{
+    namespace
+    {
+        // Bump when the entry layout or what goes into a key changes.
+        constexpr llvm::StringLiteral kCacheFormat = "coretrace-object-cache-1";
+
+        constexpr llvm::StringLiteral kEntrySuffix = ".out";
+        constexpr llvm::StringLiteral kDiagSuffix = ".diag";
+        constexpr llvm::StringLiteral kHitsFile = "stats.hits";
+        constexpr llvm::StringLiteral kMissesFile = "stats.misses";
+        constexpr llvm::StringLiteral kUncacheableFile = "stats.uncacheable";
+        // Counters are stored as this many zero-padded decimal digits.
+        constexpr size_t kCounterWidth = 20;
+
+        // Values of these cc1 options name where outputs go, not what they
+        // contain.
+        constexpr llvm::StringLiteral kOutputPathOptions[] = {"-o", "-dependency-file"};
+
+        class PreprocessToStringAction : public clang::PreprocessorFrontendAction
+        {
+          public:
+            explicit PreprocessToStringAction(llvm::raw_ostream& os) : os_(os) {}
+
+          protected:
+            void ExecuteAction() override
+            {
+                clang::CompilerInstance& ci = getCompilerInstance();
+                clang::PreprocessorOutputOptions opts = ci.getPreprocessorOutputOpts();
+                opts.ShowCPP = 1;
+                opts.ShowLineMarkers = 1;
+                clang::DoPrintPreprocessedInput(ci.getPreprocessor(), &os_, opts);
+            }
+
+          private:
+            llvm::raw_ostream& os_;
+        };
+
+        // Fields are length-prefixed so that no two field lists hash alike.
+        class KeyHasher
+        {
+          public:
+            void add(llvm::StringRef field)
+            {
+                uint64_t size = field.size();
+                hasher_.update(llvm::ArrayRef<uint8_t>(reinterpret_cast<const uint8_t*>(&size),
+                                                       sizeof(size)));
+                hasher_.update(field);
+            }
+
+            CT_NODISCARD std::string finish()
+            {
+                return llvm::toHex(hasher_.final(), /*LowerCase=*/true);
+            }
+
+          private:
+            llvm::SHA256 hasher_;
+        };
+
+        // Size and modification time of path, so that rebuilding a file
+        // the output depends on invalidates the entries made with it.
+        std::string fileStamp(llvm::StringRef path)
+        {
+            llvm::sys::fs::file_status status;
+            if (path.empty() || llvm::sys::fs::status(path, status))
+            {
+                return "missing";
+            }
+            return std::to_string(status.getSize()) + ":" +
+                   std::to_string(status.getLastModificationTime().time_since_epoch().count());
+        }
+
+        // The compiler and runtime every entry depends on; computed once.
+        const std::string& toolchainIdentity()
+        {
+            static const std::string identity = []
+            {
+                std::string id = kCacheFormat.str();
+                id += ";llvm=" LLVM_VERSION_STRING;
+                id += ";clang=" + clang::getClangFullVersion();
+                static int anchor;
+                id += ";cc=" + fileStamp(llvm::sys::fs::getMainExecutable(nullptr, &anchor));
+#ifdef CT_RUNTIME_LIB_PATH
+                id += ";runtime=" + fileStamp(CT_RUNTIME_LIB_PATH);
+#endif
+#ifdef CT_RUNTIME_FASTPATH_BC_PATH
+                id += ";fastpath=" + fileStamp(CT_RUNTIME_FASTPATH_BC_PATH);
+#endif
+                return id;
+            }();
+            return identity;
+        }
+
+        // Module imports and PCHs are not part of the preprocessed text.
+        bool usesPrecompiledInput(clang::CompilerInstance& ci)
+        {
+            const clang::HeaderSearchOptions& search = ci.getHeaderSearchOpts();
+            return ci.getLangOpts().Modules || !ci.getFrontendOpts().ModuleFiles.empty() ||
+                   !search.PrebuiltModuleFiles.empty() || !search.PrebuiltModulePaths.empty() ||
+                   !ci.getPreprocessorOpts().ImplicitPCHInclude.empty();
+        }
+
+        bool isOutputPathOption(llvm::StringRef arg)
+        {
+            for (llvm::StringRef opt : kOutputPathOptions)
+            {
+                if (arg == opt)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::string joinPath(llvm::StringRef dir, llvm::StringRef name)
+        {
+            llvm::SmallString<256> path(dir);
+            llvm::sys::path::append(path, name);
+            return std::string(path.str());
+        }
+
+        // The value of a counter file open as fd. Earlier versions appended
+        // one byte per event, which such a file still counts.
+        uint64_t counterValue(int fd)
+        {
+            char buffer[kCounterWidth + 1];
+            auto read = llvm::sys::fs::readNativeFileSlice(
+                llvm::sys::fs::convertFDToNativeFile(fd), buffer, 0);
+            if (!read)
+            {
+                llvm::consumeError(read.takeError());
+                return 0;
+            }
+            uint64_t value = 0;
+            if (!llvm::StringRef(buffer, *read).trim().getAsInteger(10, value))
+            {
+                return value;
+            }
+            llvm::sys::fs::file_status status;
+            return llvm::sys::fs::status(fd, status) ? 0 : status.getSize();
+        }
+
+        // Rewrites the counter file name in place under an exclusive lock,
+        // so it keeps a fixed size and concurrent compilations sharing the
+        // directory lose no counts.
+        void bumpCounter(llvm::StringRef dir, llvm::StringRef name)
+        {
+            if (llvm::sys::fs::create_directories(dir))
+            {
+                return;
+            }
+            int fd = -1;
+            if (llvm::sys::fs::openFileForReadWrite(joinPath(dir, name), fd,
+                                                    llvm::sys::fs::CD_OpenAlways,
+                                                    llvm::sys::fs::OF_None))
+            {
+                return;
+            }
+            if (!llvm::sys::fs::lockFile(fd))
+            {
+                std::string text = std::to_string(counterValue(fd) + 1);
+                text.insert(0, kCounterWidth - text.size(), '0');
+                {
+                    llvm::raw_fd_ostream os(fd, /*shouldClose=*/false);
+                    os.seek(0);
+                    os << text;
+                    os.flush();
+                    if (os.has_error())
+                    {
+                        os.clear_error();
+                    }
+                }
+                (void)llvm::sys::fs::resize_file(fd, kCounterWidth);
+                (void)llvm::sys::fs::unlockFile(fd);
+            }
+            (void)llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+        }
+
+        uint64_t readCounter(llvm::StringRef dir, llvm::StringRef name)
+        {
+            int fd = -1;
+            if (llvm::sys::fs::openFileForRead(joinPath(dir, name), fd))
+            {
+                return 0;
+            }
+            uint64_t value = counterValue(fd);
+            (void)llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+            return value;
+        }
+
+        CT_NODISCARD bool writeAtomically(llvm::StringRef dir, llvm::StringRef path,
+                                          llvm::StringRef contents)
+        {
+            int fd = -1;
+            llvm::SmallString<256> tmpPath;
+            if (llvm::sys::fs::createUniqueFile(joinPath(dir, "tmp-%%%%%%%%%%%%"), fd, tmpPath))
+            {
+                return false;
+            }
+            {
+                llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+                os << contents;
+                os.close();
+                if (os.has_error())
+                {
+                    os.clear_error();
+                    (void)llvm::sys::fs::remove(tmpPath);
+                    return false;
+                }
+            }
+            if (llvm::sys::fs::rename(tmpPath, path))
+            {
+                (void)llvm::sys::fs::remove(tmpPath);
+                return false;
+            }
+            return true;
+        }
+
+        CT_NODISCARD bool writeFile(llvm::StringRef path, llvm::StringRef contents)
+        {
+            std::error_code ec;
+            llvm::raw_fd_ostream os(path, ec, llvm::sys::fs::OF_None);
+            if (ec)
+            {
+                return false;
+            }
+            os << contents;
+            os.close();
+            if (os.has_error())
+            {
+                os.clear_error();
+                return false;
+            }
+            return true;
+        }
+    } // namespace
+
+    ObjectCache ObjectCache::fromEnvironment()
+    {
+        const char* dir = std::getenv("CT_CACHE_DIR");
+        return ObjectCache(dir ? dir : "");
+    }
+
+    bool ObjectCache::computeKey(clang::CompilerInstance& ci,
+                                 const llvm::opt::ArgStringList& ccArgs,
+                                 const RuntimeConfig& config, std::string& key) const
+    {
+        const char* outputPath = nullptr;
+        for (size_t i = 0; i + 1 < ccArgs.size(); ++i)
+        {
+            if (llvm::StringRef(ccArgs[i]) == "-o")
+            {
+                outputPath = ccArgs[i + 1];
+            }
+        }
+
+        if (!outputPath || llvm::StringRef(outputPath) == "-" || usesPrecompiledInput(ci))
+        {
+            bumpCounter(dir_, kUncacheableFile);
+            return false;
+        }
+
+        std::string preprocessed;
+        llvm::raw_string_ostream os(preprocessed);
+        PreprocessToStringAction action(os);
+        if (!ci.ExecuteAction(action) || ci.getDiagnostics().hasErrorOccurred())
+        {
+            bumpCounter(dir_, kUncacheableFile);
+            return false;
+        }
+        os.flush();
+
+        KeyHasher hasher;
+        hasher.add(toolchainIdentity());
+        hasher.add(describeRuntimeConfig(config));
+        for (size_t i = 0; i < ccArgs.size(); ++i)
+        {
+            llvm::StringRef arg = ccArgs[i];
+            hasher.add(arg);
+            if (isOutputPathOption(arg))
+            {
+                ++i;
+            }
+        }
+        hasher.add(preprocessed);
+        key = hasher.finish();
+        return true;
+    }
+
+    bool ObjectCache::fetch(llvm::StringRef key, llvm::StringRef outputPath,
+                            std::string& diagnostics) const
+    {
+        auto entry = llvm::MemoryBuffer::getFile(joinPath(dir_, key.str() + kEntrySuffix.str()),
+                                                 /*IsText=*/false,
+                                                 /*RequiresNullTerminator=*/false);
+        // The diagnostics are written first, so they exist whenever the
+        // entry does unless someone removed them by hand.
+        auto diags = llvm::MemoryBuffer::getFile(joinPath(dir_, key.str() + kDiagSuffix.str()),
+                                                 /*IsText=*/false,
+                                                 /*RequiresNullTerminator=*/false);
+        if (!entry || !diags || !writeFile(outputPath, (*entry)->getBuffer()))
+        {
+            bumpCounter(dir_, kMissesFile);
+            return false;
+        }
+
+        diagnostics = (*diags)->getBuffer().str();
+        bumpCounter(dir_, kHitsFile);
+        return true;
+    }
+
+    void ObjectCache::store(llvm::StringRef key, llvm::StringRef outputPath,
+                            llvm::StringRef diagnostics) const
+    {
+        auto output = llvm::MemoryBuffer::getFile(outputPath, /*IsText=*/false,
+                                                  /*RequiresNullTerminator=*/false);
+        if (!output || llvm::sys::fs::create_directories(dir_))
+        {
+            return;
+        }
+        if (!writeAtomically(dir_, joinPath(dir_, key.str() + kDiagSuffix.str()), diagnostics))
+        {
+            return;
+        }
+        (void)writeAtomically(dir_, joinPath(dir_, key.str() + kEntrySuffix.str()),
+                              (*output)->getBuffer());
+    }
+
+} // namespace compilerlib::cache
+
+namespace compilerlib
+{
+
+    std::string objectCacheStats()
+    {
+        const char* dirEnv = std::getenv("CT_CACHE_DIR");
+        if (!dirEnv || !*dirEnv)
+        {
+            return "object cache: disabled (set CT_CACHE_DIR to enable it)\n";
+        }
+
+        llvm::StringRef dir = dirEnv;
+        uint64_t entries = 0;
+        uint64_t bytes = 0;
+        std::error_code ec;
+        for (llvm::sys::fs::directory_iterator it(dir, ec), end; it != end && !ec;
+             it.increment(ec))
+        {
+            llvm::StringRef path = it->path();
+            if (!path.ends_with(cache::kEntrySuffix) && !path.ends_with(cache::kDiagSuffix))
+            {
+                continue;
+            }
+            uint64_t size = 0;
+            if (!llvm::sys::fs::file_size(path, size))
+            {
+                bytes += size;
+            }
+            if (path.ends_with(cache::kEntrySuffix))
+            {
+                ++entries;
+            }
+        }
+
+        uint64_t hits = cache::readCounter(dir, cache::kHitsFile);
+        uint64_t misses = cache::readCounter(dir, cache::kMissesFile);
+        uint64_t uncacheable = cache::readCounter(dir, cache::kUncacheableFile);
+
+        std::string out;
+        llvm::raw_string_ostream os(out);
+        os << "object cache: " << dir << '\n';
+        os << "  hits:        " << hits << '\n';
+        os << "  misses:      " << misses << '\n';
+        os << "  uncacheable: " << uncacheable << '\n';
+        if (hits + misses != 0)
+        {
+            os << "  hit rate:    " << llvm::format("%.1f%%", 100.0 * hits / (hits + misses))
+               << '\n';
+        }
+        os << "  entries:     " << entries << " (" << (bytes + 1023) / 1024 << " KiB)\n";
+        os.flush();
+        return out;
+    }
+
+} // namespace compilerlib
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include "compilerlib/attributes.hpp"
+#include "compilerlib/instrumentation/config.hpp"
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Option/ArgList.h>
+
+#include <string>
+#include <utility>
+
+namespace clang
+{
+    class CompilerInstance;
+}
+
+namespace compilerlib::cache
+{
+    // Instrumented cc1 outputs stored under CT_CACHE_DIR as <key>.out, with
+    // the warnings the compilation printed in <key>.diag. Entries are written
+    // to a temporary file and renamed, so concurrent compilations sharing a
+    // directory only ever see complete entries.
+    class ObjectCache
+    {
+      public:
+        // The cache in CT_CACHE_DIR; disabled when it is unset or empty.
+        CT_NODISCARD static ObjectCache fromEnvironment();
+
+        CT_NODISCARD bool enabled() const
+        {
+            return !dir_.empty();
+        }
+
+        // Hashes the preprocessed source of ci, ccArgs without the output
+        // paths, config, and the compiler and runtime the output depends on.
+        // Preprocessing also writes the dependency file the job asks for,
+        // which a hit would otherwise skip. Returns false, counting the job
+        // as uncacheable, when it uses modules or a PCH, writes to stdout or
+        // fails to preprocess; the job then compiles as usual.
+        CT_NODISCARD bool computeKey(clang::CompilerInstance& ci,
+                                     const llvm::opt::ArgStringList& ccArgs,
+                                     const RuntimeConfig& config, std::string& key) const;
+
+        // Copies the entry for key to outputPath and sets diagnostics to
+        // what the compilation that stored it printed. Counts a hit or a miss.
+        CT_NODISCARD bool fetch(llvm::StringRef key, llvm::StringRef outputPath,
+                                std::string& diagnostics) const;
+
+        // Stores outputPath under key. Failures are ignored: the next
+        // compilation of the same input just misses again.
+        void store(llvm::StringRef key, llvm::StringRef outputPath,
+                   llvm::StringRef diagnostics) const;
+
+      private:
+        explicit ObjectCache(std::string dir) : dir_(std::move(dir)) {}
+
+        std::string dir_;
+    };
+} // namespace compilerlib::cache
@@ -4,12 +4,12 @@
 #include "compilerlib/toolchain.hpp"
 
 #include "compilerlib/frontend/optnone_action.hpp"
-#include "compilerlib/instrumentation/alloc.hpp"
-#include "compilerlib/instrumentation/bounds.hpp"
 #include "compilerlib/instrumentation/config.hpp"
-#include "compilerlib/instrumentation/trace.hpp"
-#include "compilerlib/instrumentation/vtable.hpp"
+#include "compilerlib/instrumentation/passes.hpp"
+#include "compilerlib/instrumentation/runtime_fastpath.hpp"
+#include "cache/object_cache.hpp"
 #include "emit/llvm_output.hpp"
+#include "session_state.hpp"
 
 #include <clang/Frontend/FrontendActions.h>
 #include <clang/Driver/Compilation.h>
@@ -28,6 +28,7 @@
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/Program.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/thread.h>
 #include <llvm/Support/VirtualFileSystem.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Target/TargetMachine.h>
@@ -36,9 +37,13 @@
 #include <llvm-c/Target.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <thread>
 #include <type_traits>
 
 namespace compilerlib
@@ -48,6 +53,20 @@ namespace compilerlib
     {
         constexpr llvm::StringRef kTargetTriple = LLVM_DEFAULT_TARGET_TRIPLE;
 
+        void initTargetsOnce(void)
+        {
+            static const bool initialized = []
+            {
+                LLVMInitializeAllTargetInfos();
+                LLVMInitializeAllTargets();
+                LLVMInitializeAllTargetMCs();
+                LLVMInitializeAllAsmParsers();
+                LLVMInitializeAllAsmPrinters();
+                return true;
+            }();
+            (void)initialized;
+        }
+
         struct DiagsSaver : clang::DiagnosticConsumer
         {
             std::string message;
@@ -265,6 +284,11 @@ namespace compilerlib
             llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs;
             DiagsSaver dc;
             std::string driver_diagnostics;
+            // Threads for cc1 jobs: CT_JOBS, overridden by -j<n> / -j <n>; -j
+            // alone or 0 means one per hardware thread.
+            unsigned jobs = 1;
+            // Set when compiling for a CompilerSession.
+            SessionState* session = nullptr;
 
             CompileContext(const std::vector<std::string>& args, OutputMode mode, bool instrument)
                 : mode(mode), instrument(instrument), input_args(args),
@@ -282,6 +306,7 @@ namespace compilerlib
             {
                 extractRuntimeConfig(ctx_.input_args, ctx_.filtered_args, ctx_.runtimeConfig);
                 normalizeEqualsArgs(ctx_.filtered_args);
+                extractJobs();
                 if (ctx_.runtimeConfig.bounds_without_alloc)
                 {
                     ctx_.dc.os << "warning: ct: bounds instrumentation requires alloc tracking; "
@@ -421,6 +446,56 @@ namespace compilerlib
                 args.swap(out);
             }
 
+            CT_NODISCARD static bool parseJobCount(llvm::StringRef text, unsigned& jobs)
+            {
+                unsigned value = 0;
+                if (text.getAsInteger(10, value))
+                {
+                    return false;
+                }
+                jobs = value ? value : std::max(1u, std::thread::hardware_concurrency());
+                return true;
+            }
+
+            void extractJobs(void)
+            {
+                if (const char* env = std::getenv("CT_JOBS"))
+                {
+                    (void)parseJobCount(env, ctx_.jobs);
+                }
+
+                std::vector<std::string> out;
+                out.reserve(ctx_.filtered_args.size());
+                auto& args = ctx_.filtered_args;
+                for (size_t i = 0; i < args.size(); ++i)
+                {
+                    llvm::StringRef arg = args[i];
+                    if (arg == "--")
+                    {
+                        out.insert(out.end(), args.begin() + i, args.end());
+                        break;
+                    }
+                    if (arg == "-j")
+                    {
+                        if (i + 1 < args.size() && parseJobCount(args[i + 1], ctx_.jobs))
+                        {
+                            ++i;
+                        }
+                        else
+                        {
+                            (void)parseJobCount("0", ctx_.jobs);
+                        }
+                        continue;
+                    }
+                    if (arg.starts_with("-j") && parseJobCount(arg.drop_front(2), ctx_.jobs))
+                    {
+                        continue;
+                    }
+                    out.push_back(std::move(args[i]));
+                }
+                args.swap(out);
+            }
+
             CT_NODISCARD bool linkRequested(void) const
             {
                 return !(hasArg(ctx_.filtered_args, "-c") || hasArg(ctx_.filtered_args, "-S") ||
@@ -516,8 +591,10 @@ namespace compilerlib
         class Cc1Runner
         {
           public:
-            Cc1Runner(CompileContext& ctx, clang::DiagnosticsEngine& driverDiags)
-                : ctx_(ctx), driverDiags_(driverDiags)
+            // Diagnostics of the jobs this runner executes go to dc, so runners
+            // with their own dc and driverDiags can run jobs concurrently.
+            Cc1Runner(CompileContext& ctx, clang::DiagnosticsEngine& driverDiags, DiagsSaver& dc)
+                : ctx_(ctx), driverDiags_(driverDiags), dc_(dc)
             {
                 initTargetsOnce();
             }
@@ -544,26 +621,30 @@ namespace compilerlib
                     return false;
                 }
 
+                auto objectCache = cache::ObjectCache::fromEnvironment();
+                std::string cacheKey;
+                if (objectCache.enabled() && fetchFromCache(objectCache, ccArgs, cacheKey))
+                {
+                    return true;
+                }
+
                 auto handleModule = [&](std::unique_ptr<llvm::Module> module) -> bool
                 {
-                    if (ctx_.runtimeConfig.trace_enabled)
+                    runInstrumentation(*module, ctx_.runtimeConfig);
+#ifdef CT_RUNTIME_FASTPATH_BC_PATH
+                    // Only objects are linked against the runtime this
+                    // bitcode was built with; IR and bitcode keep the calls.
+                    if (actionKind == clang::frontend::EmitObj &&
+                        ctx_.runtimeConfig.inline_runtime_enabled)
                     {
-                        instrumentModule(*module);
+                        (void)linkRuntimeFastPaths(*module, CT_RUNTIME_FASTPATH_BC_PATH);
                     }
-                    if (ctx_.runtimeConfig.alloc_enabled)
-                    {
-                        wrapAllocCalls(*module);
-                    }
-                    if (ctx_.runtimeConfig.bounds_enabled)
-                    {
-                        instrumentMemoryAccesses(*module);
-                    }
-                    if (ctx_.runtimeConfig.vtable_enabled || ctx_.runtimeConfig.vcall_trace_enabled)
+#endif
+                    if (ctx_.runtimeConfig.post_opt_enabled &&
+                        !emit::optimizeInstrumentedModule(*module, *ci, error))
                     {
-                        instrumentVirtualCalls(*module, ctx_.runtimeConfig.vcall_trace_enabled,
-                                               ctx_.runtimeConfig.vtable_enabled);
+                        return false;
                     }
-                    emitRuntimeConfigGlobals(*module, ctx_.runtimeConfig);
 
                     const char* outputPath = findArgValue(ccArgs, "-o");
                     if (!outputPath)
@@ -585,12 +666,18 @@ namespace compilerlib
                     }
                 };
 
-                if (ctx_.runtimeConfig.optnone_enabled)
+                bool ok = ctx_.runtimeConfig.optnone_enabled
+                              ? runCodegenWithModule<
+                                    frontend::OptNoneAction<clang::EmitLLVMOnlyAction>>(
+                                    *ci, handleModule, error)
+                              : runCodegenWithModule<clang::EmitLLVMOnlyAction>(*ci, handleModule,
+                                                                                error);
+                if (ok && !cacheKey.empty())
                 {
-                    return runCodegenWithModule<frontend::OptNoneAction<clang::EmitLLVMOnlyAction>>(
-                        *ci, handleModule, error);
+                    dc_.os.flush();
+                    objectCache.store(cacheKey, findArgValue(ccArgs, "-o"), dc_.message);
                 }
-                return runCodegenWithModule<clang::EmitLLVMOnlyAction>(*ci, handleModule, error);
+                return ok;
             }
 
             CompileResult runSingle(const clang::driver::Command& job,
@@ -605,7 +692,7 @@ namespace compilerlib
                 {
                     result.success = false;
                     std::string diag =
-                        ctx_.dc.message.empty() ? fallback : std::move(ctx_.dc.message);
+                        dc_.message.empty() ? fallback : std::move(dc_.message);
                     result.diagnostics = includeDriverDiags
                                              ? mergeDiagnostics(ctx_.driver_diagnostics, diag)
                                              : std::move(diag);
@@ -654,18 +741,7 @@ namespace compilerlib
                         {
                             if (ctx_.instrument)
                             {
-                                if (ctx_.runtimeConfig.trace_enabled)
-                                    instrumentModule(*module);
-                                if (ctx_.runtimeConfig.alloc_enabled)
-                                    wrapAllocCalls(*module);
-                                if (ctx_.runtimeConfig.bounds_enabled)
-                                    instrumentMemoryAccesses(*module);
-                                if (ctx_.runtimeConfig.vtable_enabled ||
-                                    ctx_.runtimeConfig.vcall_trace_enabled)
-                                    instrumentVirtualCalls(*module,
-                                                           ctx_.runtimeConfig.vcall_trace_enabled,
-                                                           ctx_.runtimeConfig.vtable_enabled);
-                                emitRuntimeConfigGlobals(*module, ctx_.runtimeConfig);
+                                runInstrumentation(*module, ctx_.runtimeConfig);
                             }
                             std::string llvmIR;
                             llvm::raw_string_ostream rso(llvmIR);
@@ -731,34 +807,46 @@ namespace compilerlib
                 result.success = true;
                 if (includeDriverDiags)
                 {
-                    result.diagnostics = mergeDiagnostics(ctx_.driver_diagnostics, ctx_.dc.message);
+                    result.diagnostics = mergeDiagnostics(ctx_.driver_diagnostics, dc_.message);
                 }
                 else
                 {
-                    result.diagnostics = std::move(ctx_.dc.message);
+                    result.diagnostics = std::move(dc_.message);
                 }
                 return result;
             }
 
           private:
-            static void initTargetsOnce(void)
+            // Copies the cached output of the job to its -o path and replays
+            // its warnings. On a miss, key is left set when the job can be
+            // stored once it has compiled.
+            CT_NODISCARD bool fetchFromCache(const cache::ObjectCache& objectCache,
+                                             const llvm::opt::ArgStringList& ccArgs,
+                                             std::string& key)
             {
-                static bool initialized = false;
-                if (initialized)
-                    return;
-                initialized = true;
+                // Warnings from the preprocessing run would show up twice.
+                DiagsSaver scratch;
+                auto ci = makeCompilerInstance(ccArgs, scratch);
+                if (!ci || !objectCache.computeKey(*ci, ccArgs, ctx_.runtimeConfig, key))
+                {
+                    key.clear();
+                    return false;
+                }
 
-                LLVMInitializeAllTargetInfos();
-                LLVMInitializeAllTargets();
-                LLVMInitializeAllTargetMCs();
-                LLVMInitializeAllAsmParsers();
-                LLVMInitializeAllAsmPrinters();
+                std::string diagnostics;
+                if (!objectCache.fetch(key, findArgValue(ccArgs, "-o"), diagnostics))
+                {
+                    return false;
+                }
+                resetDiagnostics();
+                dc_.os << diagnostics;
+                return true;
             }
 
             void resetDiagnostics(void)
             {
-                ctx_.dc.message.clear();
-                ctx_.dc.os.flush();
+                dc_.message.clear();
+                dc_.os.flush();
             }
 
             template <typename Action, typename Handler>
@@ -769,7 +857,7 @@ namespace compilerlib
                 resetDiagnostics();
                 if (!ci.ExecuteAction(action))
                 {
-                    error = std::move(ctx_.dc.message);
+                    error = std::move(dc_.message);
                     return false;
                 }
                 std::unique_ptr<llvm::Module> module = action.takeModule();
@@ -797,6 +885,13 @@ namespace compilerlib
 
             CT_NODISCARD std::unique_ptr<clang::CompilerInstance>
             makeCompilerInstance(const llvm::opt::ArgStringList& ccArgs)
+            {
+                return makeCompilerInstance(ccArgs, dc_);
+            }
+
+            CT_NODISCARD std::unique_ptr<clang::CompilerInstance>
+            makeCompilerInstance(const llvm::opt::ArgStringList& ccArgs,
+                                 clang::DiagnosticConsumer& consumer)
             {
                 auto invoc = std::make_unique<clang::CompilerInvocation>();
                 clang::CompilerInvocation::CreateFromArgs(*invoc, ccArgs, driverDiags_);
@@ -809,13 +904,25 @@ namespace compilerlib
 // - LLVM 16–18: createDiagnostics(Consumer, ShouldOwnClient)
 // - LLVM 19–20+: the overloads without a VFS have been removed, you must pass the VFS.
 #if LLVM_VERSION_MAJOR >= 19
-                ci->createDiagnostics(*ctx_.fs, &ctx_.dc, false);
+                ci->createDiagnostics(*ctx_.fs, &consumer, false);
 #else
-                ci->createDiagnostics(&ctx_.dc, false);
+                ci->createDiagnostics(&consumer, false);
 #endif
 
                 ci->getDiagnostics().getDiagnosticOptions().ShowCarets = false;
-                ci->createFileManager(ctx_.fs);
+                // A FileManager is not thread-safe: only share it when this
+                // compilation runs its cc1 jobs on the calling thread.
+                clang::FileManager* sharedFiles =
+                    ctx_.session && ctx_.jobs == 1 ? ctx_.session->files.get() : nullptr;
+                if (sharedFiles && sharedFiles->getFileSystemOpts().WorkingDir ==
+                                       ci->getFileSystemOpts().WorkingDir)
+                {
+                    ci->setFileManager(sharedFiles);
+                }
+                else
+                {
+                    ci->createFileManager(ctx_.fs);
+                }
                 ci->createSourceManager(ci->getFileManager());
                 ci->getCodeGenOpts().DisableFree = false;
                 ci->getFrontendOpts().DisableFree = false;
@@ -825,6 +932,7 @@ namespace compilerlib
 
             CompileContext& ctx_;
             clang::DiagnosticsEngine& driverDiags_;
+            DiagsSaver& dc_;
         };
 
         class Linker
@@ -852,13 +960,13 @@ namespace compilerlib
         };
 
         CT_NODISCARD llvm::IntrusiveRefCntPtr<clang::DiagnosticsEngine>
-        createDriverDiagnostics(CompileContext& ctx)
+        createDriverDiagnostics(CompileContext& ctx, DiagsSaver& dc)
         {
             return clang::CompilerInstance::createDiagnostics(
 #if LLVM_VERSION_MAJOR >= 20
                 *ctx.fs,
 #endif
-                new clang::DiagnosticOptions, &ctx.dc, false);
+                new clang::DiagnosticOptions, &dc, false);
         }
 
         CT_NODISCARD CompileResult runNonInstrumentedCompilation(CompileContext& ctx,
@@ -900,50 +1008,86 @@ namespace compilerlib
             return true;
         }
 
-        CT_NODISCARD CompileResult runInstrumentedToFile(CompileContext& ctx, Cc1Runner& cc1,
-                                                         const JobPlan& plan, std::string& error)
+        // What one cc1 job left behind: on failure, diagnostics holds what
+        // explains it.
+        struct Cc1Outcome
         {
-            Linker linker;
-            std::string cc1_diags;
+            bool success = false;
+            std::string diagnostics;
+        };
 
-            for (const auto* job : plan.cc1Jobs)
+        // Runs the cc1 jobs of plan on up to ctx.jobs threads, each job with
+        // its own Cc1Runner and diagnostics. After a failure no job that
+        // follows it is started; every job before the first failure runs,
+        // even if a later one failed first. Outcomes are in job order.
+        template <typename RunJob>
+        CT_NODISCARD std::vector<Cc1Outcome> runCc1Jobs(CompileContext& ctx, const JobPlan& plan,
+                                                        RunJob runJob)
+        {
+            std::vector<Cc1Outcome> outcomes(plan.cc1Jobs.size());
+            std::atomic<size_t> next{0};
+            std::atomic<size_t> firstFailed{outcomes.size()};
+            auto worker = [&]()
             {
-                if (!cc1.runInstrumented(*job, error))
-                    return {false,
-                            mergeDiagnostics(ctx.driver_diagnostics,
-                                             mergeDiagnostics(cc1_diags, error)),
-                            {}};
-                appendDiagnostics(cc1_diags, ctx.dc.message);
-                ctx.dc.message.clear();
-                ctx.dc.os.flush();
-            }
+                for (;;)
+                {
+                    size_t index = next.fetch_add(1, std::memory_order_relaxed);
+                    if (index >= outcomes.size() ||
+                        index > firstFailed.load(std::memory_order_relaxed))
+                        return;
+
+                    DiagsSaver dc;
+                    auto diags = createDriverDiagnostics(ctx, dc);
+                    Cc1Runner cc1(ctx, *diags, dc);
+                    Cc1Outcome& outcome = outcomes[index];
+                    outcome.success = runJob(cc1, dc, *plan.cc1Jobs[index], outcome.diagnostics);
+                    if (outcome.success)
+                        continue;
+                    size_t seen = firstFailed.load(std::memory_order_relaxed);
+                    while (index < seen &&
+                           !firstFailed.compare_exchange_weak(seen, index,
+                                                              std::memory_order_relaxed))
+                    {
+                    }
+                }
+            };
 
-            if (!linker.run(plan.otherJobs, error))
-                return {
-                    false,
-                    mergeDiagnostics(ctx.driver_diagnostics, mergeDiagnostics(cc1_diags, error)),
-                    {}};
+            size_t threads = std::min<size_t>(ctx.jobs, outcomes.size());
+            if (threads <= 1)
+            {
+                worker();
+                return outcomes;
+            }
 
-            return {true, mergeDiagnostics(ctx.driver_diagnostics, cc1_diags), {}};
+            std::vector<llvm::thread> pool;
+            pool.reserve(threads - 1);
+            for (size_t i = 1; i < threads; ++i)
+                pool.emplace_back(kCc1StackSize, worker);
+            worker();
+            for (auto& thread : pool)
+                thread.join();
+            return outcomes;
         }
 
-        CT_NODISCARD CompileResult runPlainToFile(CompileContext& ctx, Cc1Runner& cc1,
-                                                  const JobPlan& plan, std::string& error)
+        // Merges outcomes as if the jobs had run one after another, stopping
+        // at the first failure, so the output does not depend on -j. Jobs
+        // are started in order, so one that never ran follows a failure.
+        CT_NODISCARD CompileResult linkCc1Outcomes(CompileContext& ctx, const JobPlan& plan,
+                                                   const std::vector<Cc1Outcome>& outcomes,
+                                                   std::string& error)
         {
-            Linker linker;
             std::string cc1_diags;
-
-            for (const auto* job : plan.cc1Jobs)
+            for (const auto& outcome : outcomes)
             {
-                CompileResult res = cc1.runSingle(*job, false);
-                if (!res.success)
+                if (!outcome.success)
                     return {false,
                             mergeDiagnostics(ctx.driver_diagnostics,
-                                             mergeDiagnostics(cc1_diags, res.diagnostics)),
+                                             mergeDiagnostics(cc1_diags, outcome.diagnostics)),
                             {}};
-                appendDiagnostics(cc1_diags, res.diagnostics);
+                appendDiagnostics(cc1_diags, outcome.diagnostics);
             }
 
+            Linker linker;
             if (!linker.run(plan.otherJobs, error))
                 return {
                     false,
@@ -953,63 +1097,128 @@ namespace compilerlib
             return {true, mergeDiagnostics(ctx.driver_diagnostics, cc1_diags), {}};
         }
 
-    } // namespace
+        CT_NODISCARD CompileResult runInstrumentedToFile(CompileContext& ctx, const JobPlan& plan,
+                                                         std::string& error)
+        {
+            auto outcomes = runCc1Jobs(
+                ctx, plan,
+                [](Cc1Runner& cc1, DiagsSaver& dc, const clang::driver::Command& job,
+                   std::string& diagnostics)
+                {
+                    std::string jobError;
+                    if (!cc1.runInstrumented(job, jobError))
+                    {
+                        diagnostics = std::move(jobError);
+                        return false;
+                    }
+                    dc.os.flush();
+                    diagnostics = std::move(dc.message);
+                    return true;
+                });
+            return linkCc1Outcomes(ctx, plan, outcomes, error);
+        }
 
-    CT_NODISCARD CompileResult compile(const std::vector<std::string>& input_args, OutputMode mode,
-                                       bool instrument)
-    {
-        CompileContext ctx(input_args, mode, instrument);
-        ArgBuilder argBuilder(ctx);
-        std::string error;
+        CT_NODISCARD CompileResult runPlainToFile(CompileContext& ctx, const JobPlan& plan,
+                                                  std::string& error)
+        {
+            auto outcomes = runCc1Jobs(
+                ctx, plan,
+                [](Cc1Runner& cc1, DiagsSaver&, const clang::driver::Command& job,
+                   std::string& diagnostics)
+                {
+                    CompileResult res = cc1.runSingle(job, false);
+                    diagnostics = std::move(res.diagnostics);
+                    return res.success;
+                });
+            return linkCc1Outcomes(ctx, plan, outcomes, error);
+        }
 
-        if (!argBuilder.build(error))
-            return {false, std::move(error), {}};
+        CT_NODISCARD CompileResult compileWithContext(const std::vector<std::string>& input_args,
+                                                      OutputMode mode, bool instrument,
+                                                      SessionState* session)
+        {
+            CompileContext ctx(input_args, mode, instrument);
+            ctx.session = session;
+            ArgBuilder argBuilder(ctx);
+            std::string error;
 
-        auto diags = createDriverDiagnostics(ctx);
+            if (!argBuilder.build(error))
+                return {false, std::move(error), {}};
 
-        DriverSession driver(ctx, *diags);
-        std::unique_ptr<clang::driver::Compilation> comp = driver.buildCompilation(error);
-        if (!comp)
-        {
-            if (error.empty())
-                error = ctx.dc.message.empty() ? "failed to build compilation"
-                                               : std::move(ctx.dc.message);
-            return {false, std::move(error), {}};
-        }
+            auto diags = createDriverDiagnostics(ctx, ctx.dc);
 
-        if (comp->getJobs().empty())
-            return {
-                false, ctx.dc.message.empty() ? "no jobs to run" : std::move(ctx.dc.message), {}};
+            DriverSession driver(ctx, *diags);
+            std::unique_ptr<clang::driver::Compilation> comp = driver.buildCompilation(error);
+            if (!comp)
+            {
+                if (error.empty())
+                    error = ctx.dc.message.empty() ? "failed to build compilation"
+                                                   : std::move(ctx.dc.message);
+                return {false, std::move(error), {}};
+            }
 
-        if (!instrument && mode == OutputMode::ToFile && !ctx.runtimeConfig.optnone_enabled)
-            return runNonInstrumentedCompilation(ctx, driver, *comp);
+            if (comp->getJobs().empty())
+                return {false,
+                        ctx.dc.message.empty() ? "no jobs to run" : std::move(ctx.dc.message),
+                        {}};
 
-        JobPlan plan = buildJobPlan(*comp);
-        if (!validateJobPlan(plan, mode, error))
-            return {false, std::move(error), {}};
+            // A session runs the cc1 jobs itself, so that they share its
+            // file manager instead of each starting a clang process.
+            if (!instrument && mode == OutputMode::ToFile && !ctx.runtimeConfig.optnone_enabled &&
+                !session)
+                return runNonInstrumentedCompilation(ctx, driver, *comp);
 
-        if (!ctx.dc.message.empty())
-        {
-            ctx.driver_diagnostics = std::move(ctx.dc.message);
-            ctx.dc.message.clear();
-            ctx.dc.os.flush();
-        }
+            JobPlan plan = buildJobPlan(*comp);
+            if (!validateJobPlan(plan, mode, error))
+                return {false, std::move(error), {}};
 
-        Cc1Runner cc1(ctx, *diags);
-        if (mode == OutputMode::ToMemory)
-            return cc1.runSingle(*plan.cc1Jobs.front());
+            if (!ctx.dc.message.empty())
+            {
+                ctx.driver_diagnostics = std::move(ctx.dc.message);
+                ctx.dc.message.clear();
+                ctx.dc.os.flush();
+            }
 
-        if (plan.cc1Jobs.empty())
-        {
-            Linker linker;
-            if (!linker.run(plan.otherJobs, error))
-                return {false, mergeDiagnostics(ctx.driver_diagnostics, error), {}};
-            return {true, mergeDiagnostics(ctx.driver_diagnostics, {}), {}};
+            if (mode == OutputMode::ToMemory)
+            {
+                Cc1Runner cc1(ctx, *diags, ctx.dc);
+                return cc1.runSingle(*plan.cc1Jobs.front());
+            }
+
+            if (plan.cc1Jobs.empty())
+            {
+                Linker linker;
+                if (!linker.run(plan.otherJobs, error))
+                    return {false, mergeDiagnostics(ctx.driver_diagnostics, error), {}};
+                return {true, mergeDiagnostics(ctx.driver_diagnostics, {}), {}};
+            }
+
+            if (instrument)
+                return runInstrumentedToFile(ctx, plan, error);
+            return runPlainToFile(ctx, plan, error);
         }
 
-        if (instrument)
-            return runInstrumentedToFile(ctx, cc1, plan, error);
-        return runPlainToFile(ctx, cc1, plan, error);
+    } // namespace
+
+    CT_NODISCARD CompileResult compile(const std::vector<std::string>& input_args, OutputMode mode,
+                                       bool instrument)
+    {
+        return compileWithContext(input_args, mode, instrument, nullptr);
+    }
+
+    CT_NODISCARD CompileResult compileInSession(const std::vector<std::string>& args,
+                                                OutputMode mode, bool instrument,
+                                                SessionState& state)
+    {
+        return compileWithContext(args, mode, instrument, &state);
+    }
+
+    void prepareCompiler()
+    {
+        initTargetsOnce();
+        DriverConfig config;
+        std::string error;
+        (void)resolveDriverConfig({}, config, error);
     }
 
     extern "C" int compile_c(int argc, const char** argv, char* output_buffer, int buffer_size)
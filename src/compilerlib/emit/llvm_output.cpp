@@ -7,11 +7,19 @@
 #include <llvm/IR/Module.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/MC/TargetRegistry.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Passes/StandardInstrumentations.h>
 #include <llvm/Support/CodeGen.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/TargetParser/Host.h>
+#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/Scalar/EarlyCSE.h>
+#include <llvm/Transforms/Scalar/GVN.h>
+#include <llvm/Transforms/Scalar/LICM.h>
+#include <llvm/Transforms/Scalar/LoopPassManager.h>
+#include <llvm/Transforms/Scalar/SimplifyCFG.h>
 
 #include <memory>
 #include <string>
@@ -115,6 +123,55 @@ namespace compilerlib::emit
         }
     } // namespace
 
+    bool optimizeInstrumentedModule(llvm::Module& module, const clang::CompilerInstance& ci,
+                                    std::string& error)
+    {
+        const unsigned level = ci.getCodeGenOpts().OptimizationLevel;
+        if (level == 0)
+            return true;
+
+        std::unique_ptr<llvm::TargetMachine> targetMachine = createTargetMachine(module, ci, error);
+        if (!targetMachine)
+            return false;
+
+        llvm::LoopAnalysisManager lam;
+        llvm::FunctionAnalysisManager fam;
+        llvm::CGSCCAnalysisManager cgam;
+        llvm::ModuleAnalysisManager mam;
+        // Registers the callbacks that skip optnone functions.
+        llvm::PassInstrumentationCallbacks pic;
+        llvm::StandardInstrumentations si(module.getContext(), false);
+        si.registerCallbacks(pic, &mam);
+
+        llvm::PassBuilder builder(targetMachine.get(), llvm::PipelineTuningOptions(),
+                                  std::nullopt, &pic);
+        builder.registerModuleAnalyses(mam);
+        builder.registerCGSCCAnalyses(cgam);
+        builder.registerFunctionAnalyses(fam);
+        builder.registerLoopAnalyses(lam);
+        builder.crossRegisterProxies(lam, fam, cgam, mam);
+
+        // Folds the blocks the checks split, simplifies the casts and address
+        // arithmetic they add, hoists loop-invariant checks and removes
+        // redundant ones. -O1 uses the cheaper EarlyCSE in place of GVN.
+        llvm::FunctionPassManager fpm;
+        fpm.addPass(llvm::SimplifyCFGPass());
+        fpm.addPass(llvm::InstCombinePass());
+        fpm.addPass(llvm::createFunctionToLoopPassAdaptor(llvm::LICMPass(llvm::LICMOptions()),
+                                                          true));
+        if (level >= 2)
+            fpm.addPass(llvm::GVNPass());
+        else
+            fpm.addPass(llvm::EarlyCSEPass(true));
+        fpm.addPass(llvm::InstCombinePass());
+        fpm.addPass(llvm::SimplifyCFGPass());
+
+        llvm::ModulePassManager mpm;
+        mpm.addPass(llvm::createModuleToFunctionPassAdaptor(std::move(fpm)));
+        mpm.run(module, mam);
+        return true;
+    }
+
     bool emitObjectFile(llvm::Module& module, const clang::CompilerInstance& ci,
                         llvm::StringRef outputPath, std::string& error)
     {
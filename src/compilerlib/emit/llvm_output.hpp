@@ -19,6 +19,11 @@ namespace clang
 
 namespace compilerlib::emit
 {
+    // Runs InstCombine, LICM, GVN and SimplifyCFG over an instrumented
+    // module at the -O level of the compilation; does nothing at -O0.
+    CT_NODISCARD bool optimizeInstrumentedModule(llvm::Module& module,
+                                                 const clang::CompilerInstance& ci,
+                                                 std::string& error);
     CT_NODISCARD bool emitObjectFile(llvm::Module& module, const clang::CompilerInstance& ci,
                                      llvm::StringRef outputPath, std::string& error);
     CT_NODISCARD bool emitLLVMIRFile(llvm::Module& module, llvm::StringRef outputPath,
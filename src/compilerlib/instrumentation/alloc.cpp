@@ -1183,13 +1183,7 @@ namespace compilerlib
 
         CT_NODISCARD bool debugAutofreeEnabled(void)
         {
-            static int initialized = 0;
-            static bool enabled = false;
-            if (!initialized)
-            {
-                enabled = std::getenv("CT_DEBUG_AUTOFREE") != nullptr;
-                initialized = 1;
-            }
+            static const bool enabled = std::getenv("CT_DEBUG_AUTOFREE") != nullptr;
             return enabled;
         }
 
@@ -3,17 +3,38 @@
 #include "compilerlib/instrumentation/common.hpp"
 #include "compilerlib/attributes.hpp"
 
+#include <llvm/Config/llvm-config.h>
 #include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/PostOrderIterator.h>
 #include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/AssumptionCache.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/MemoryBuiltins.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Analysis/ScalarEvolutionExpressions.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/Analysis/ValueTracking.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/Dominators.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Operator.h>
 #include <llvm/IR/Type.h>
 #include <llvm/Support/Casting.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/TargetParser/Triple.h>
+#include <llvm/Transforms/Utils/ScalarEvolutionExpander.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 namespace compilerlib
 {
@@ -142,10 +163,164 @@ namespace compilerlib
             return resolved ? resolved : ptr;
         }
 
-        void emitBoundsCheck(llvm::IRBuilder<>& builder, llvm::FunctionCallee checkFn,
-                             llvm::Value* base, llvm::Value* ptr, llvm::Value* sizeVal,
-                             llvm::Value* site, bool isWrite, llvm::Type* voidPtrTy,
-                             llvm::Type* intTy)
+        // A load, store or atomic access of a fixed size.
+        struct MemoryAccess
+        {
+            llvm::Instruction* inst = nullptr;
+            llvm::Value* ptr = nullptr;
+            uint64_t size = 0;
+            uint64_t align = 1;
+            bool isWrite = true;
+        };
+
+        CT_NODISCARD bool describeAccess(llvm::Instruction* inst, const llvm::DataLayout& layout,
+                                         MemoryAccess& access)
+        {
+            llvm::Type* accessTy = nullptr;
+            access.inst = inst;
+            access.isWrite = true;
+            if (auto* load = llvm::dyn_cast<llvm::LoadInst>(inst))
+            {
+                access.ptr = load->getPointerOperand();
+                accessTy = load->getType();
+                access.align = load->getAlign().value();
+                access.isWrite = false;
+            }
+            else if (auto* store = llvm::dyn_cast<llvm::StoreInst>(inst))
+            {
+                access.ptr = store->getPointerOperand();
+                accessTy = store->getValueOperand()->getType();
+                access.align = store->getAlign().value();
+            }
+            else if (auto* atomic = llvm::dyn_cast<llvm::AtomicRMWInst>(inst))
+            {
+                access.ptr = atomic->getPointerOperand();
+                accessTy = atomic->getValOperand()->getType();
+                access.align = atomic->getAlign().value();
+            }
+            else if (auto* cmpx = llvm::dyn_cast<llvm::AtomicCmpXchgInst>(inst))
+            {
+                access.ptr = cmpx->getPointerOperand();
+                accessTy = cmpx->getCompareOperand()->getType();
+                access.align = cmpx->getAlign().value();
+            }
+            else
+            {
+                return false;
+            }
+            access.size = layout.getTypeStoreSize(accessTy).getFixedValue();
+            return true;
+        }
+
+        // Per-module counters printed when CT_DEBUG_BOUNDS is set.
+        struct BoundsStats
+        {
+            unsigned accesses = 0;
+            unsigned provenInBounds = 0;
+            unsigned hoistedFromLoops = 0;
+            unsigned loopRangeChecks = 0;
+            unsigned dominated = 0;
+            unsigned merged = 0;
+            unsigned emitted = 0;
+            unsigned objectChecks = 0;
+            unsigned nonHeapSkipped = 0;
+        };
+
+        CT_NODISCARD bool debugBoundsEnabled(void)
+        {
+            static const bool enabled = std::getenv("CT_DEBUG_BOUNDS") != nullptr;
+            return enabled;
+        }
+
+        void logBoundsStats(const llvm::Module& module, const BoundsStats& stats)
+        {
+            if (!debugBoundsEnabled())
+            {
+                return;
+            }
+            llvm::errs() << "ct-bounds: " << module.getModuleIdentifier()
+                         << ": accesses=" << stats.accesses
+                         << " removed-in-bounds=" << stats.provenInBounds
+                         << " hoisted-from-loops=" << stats.hoistedFromLoops
+                         << " loop-range-checks=" << stats.loopRangeChecks
+                         << " removed-dominated=" << stats.dominated
+                         << " merged=" << stats.merged << " checks=" << stats.emitted
+                         << " object-checks=" << stats.objectChecks
+                         << " non-heap-skipped=" << stats.nonHeapSkipped << "\n";
+        }
+
+        // True when [ptr, ptr + size) is a constant offset into a stack or
+        // global object of known size and stays inside it, so the check can
+        // never fail. Heap objects always keep their check, which is also what
+        // catches use after free.
+        CT_NODISCARD bool isProvablyInBounds(llvm::Value* ptr, uint64_t size,
+                                             const llvm::DataLayout& layout)
+        {
+            llvm::APInt offset(layout.getIndexTypeSizeInBits(ptr->getType()), 0);
+            const llvm::Value* object =
+                ptr->stripAndAccumulateConstantOffsets(layout, offset, true);
+            if (!llvm::isa<llvm::AllocaInst>(object) && !llvm::isa<llvm::GlobalVariable>(object))
+            {
+                return false;
+            }
+            if (offset.isNegative() || offset.getActiveBits() > 63)
+            {
+                return false;
+            }
+
+            uint64_t objectSize = 0;
+            if (!llvm::getObjectSize(object, objectSize, layout, nullptr))
+            {
+                return false;
+            }
+            const uint64_t begin = offset.getZExtValue();
+            return begin <= objectSize && size <= objectSize - begin;
+        }
+
+        // Object kinds passed to __ct_report_object_bounds; must match
+        // CT_OBJECT_* in src/runtime/ct_runtime_internal.h.
+        constexpr int kObjectStack = 0;
+        constexpr int kObjectGlobal = 1;
+
+        // A stack or global object an access pointer is computed from.
+        struct StaticObject
+        {
+            llvm::Value* object = nullptr;
+            uint64_t size = 0;
+            bool sizeKnown = false;
+            int kind = kObjectStack;
+        };
+
+        // Stack and global objects are not in the runtime allocation table, so
+        // __ct_check_bounds can only look them up and miss. Only pointers
+        // computed from the object itself are classified here: a pointer
+        // loaded back from memory may have been changed to point anywhere, and
+        // keeps its runtime check.
+        CT_NODISCARD bool findStaticObject(llvm::Value* ptr, const llvm::DataLayout& layout,
+                                           StaticObject& result)
+        {
+            llvm::Value* object = stripPointerCastsAndGEPs(ptr);
+            if (llvm::isa<llvm::AllocaInst>(object))
+            {
+                result.kind = kObjectStack;
+            }
+            else if (llvm::isa<llvm::GlobalVariable>(object))
+            {
+                result.kind = kObjectGlobal;
+            }
+            else
+            {
+                return false;
+            }
+            result.object = object;
+            result.sizeKnown = llvm::getObjectSize(object, result.size, layout, nullptr);
+            return true;
+        }
+
+        llvm::CallInst* emitBoundsCheck(llvm::IRBuilder<>& builder, llvm::FunctionCallee checkFn,
+                                        llvm::Value* base, llvm::Value* ptr, llvm::Value* sizeVal,
+                                        llvm::Value* site, bool isWrite, llvm::Type* voidPtrTy,
+                                        llvm::Type* intTy)
         {
             llvm::Value* baseCast = base;
             llvm::Value* ptrCast = ptr;
@@ -159,12 +334,459 @@ namespace compilerlib
                 ptrCast = builder.CreateBitCast(ptrCast, voidPtrTy);
             }
             llvm::Value* writeVal = llvm::ConstantInt::get(intTy, isWrite ? 1 : 0);
-            builder.CreateCall(checkFn, {baseCast, ptrCast, sizeVal, site, writeVal});
+            return builder.CreateCall(checkFn, {baseCast, ptrCast, sizeVal, site, writeVal});
+        }
+
+        // Analyses needed to reason about the loops of one function. Built
+        // before the function is modified and dropped once its loop checks
+        // have been placed.
+        struct LoopAnalyses
+        {
+            LoopAnalyses(llvm::Function& func, llvm::TargetLibraryInfo& tli)
+                : dt(func), li(dt), ac(func), se(func, tli, ac, dt, li)
+            {
+            }
+
+            llvm::DominatorTree dt;
+            llvm::LoopInfo li;
+            llvm::AssumptionCache ac;
+            llvm::ScalarEvolution se;
+        };
+
+        using LoopRangeKey = std::tuple<const llvm::BasicBlock*, const llvm::SCEV*,
+                                        const llvm::SCEV*, uint64_t, unsigned>;
+        using LoopRangeSet = llvm::DenseSet<LoopRangeKey>;
+
+        CT_NODISCARD bool isSafeToExpandAt(llvm::SCEVExpander& expander, llvm::ScalarEvolution& se,
+                                           const llvm::SCEV* expr, llvm::Instruction* at)
+        {
+#if LLVM_VERSION_MAJOR >= 16
+            (void)se;
+            return expander.isSafeToExpandAt(expr, at);
+#else
+            (void)expander;
+            return llvm::isSafeToExpandAt(expr, at, se);
+#endif
+        }
+
+        // Calls other than intrinsics and bounds checks may free or move memory,
+        // after which an earlier check no longer speaks for later accesses.
+        CT_NODISCARD bool mayInvalidateChecks(const llvm::Instruction& inst,
+                                              const llvm::Value* checkCallee)
+        {
+            const auto* call = llvm::dyn_cast<llvm::CallBase>(&inst);
+            return call && !llvm::isa<llvm::IntrinsicInst>(call) &&
+                   call->getCalledOperand() != checkCallee;
+        }
+
+        // A check in the preheader speaks for every iteration. That holds only
+        // if nothing in the loop can free memory the check passed, and if the
+        // loop cannot stop early (exit(), a trap, an unwind) other than through
+        // its exiting blocks, or the check would cover iterations that never
+        // run. Bounds checks themselves only abort on an error they report.
+        CT_NODISCARD bool loopKeepsChecksValid(const llvm::Loop& loop,
+                                               const llvm::Value* checkCallee)
+        {
+            for (const llvm::BasicBlock* block : loop.blocks())
+            {
+                for (const llvm::Instruction& inst : *block)
+                {
+                    const auto* call = llvm::dyn_cast<llvm::CallBase>(&inst);
+                    if (call && call->getCalledOperand() == checkCallee)
+                    {
+                        continue;
+                    }
+                    if (mayInvalidateChecks(inst, checkCallee) ||
+                        !llvm::isGuaranteedToTransferExecutionToSuccessor(&inst))
+                    {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        // Replaces the per-iteration check of an access whose address is an
+        // affine function of its loop's counter with one check, in the loop
+        // preheader, of every address it will touch. Only done when the access
+        // runs on every iteration including the last one (its block dominates
+        // all exiting blocks, see also loopKeepsChecksValid) and the trip count
+        // is known on loop entry, so the range check never covers an address
+        // the loop would not access.
+        CT_NODISCARD bool hoistLoopCheck(LoopAnalyses& analyses, const MemoryAccess& access,
+                                         const llvm::DataLayout& layout,
+                                         llvm::FunctionCallee checkFn, llvm::Value* site,
+                                         llvm::Type* voidPtrTy, llvm::Type* sizeTy,
+                                         llvm::Type* intTy, LoopRangeSet& placed,
+                                         BoundsStats& stats)
+        {
+            llvm::BasicBlock* block = access.inst->getParent();
+            llvm::Loop* loop = analyses.li.getLoopFor(block);
+            if (!loop)
+            {
+                return false;
+            }
+            llvm::BasicBlock* preheader = loop->getLoopPreheader();
+            if (!preheader)
+            {
+                return false;
+            }
+            llvm::SmallVector<llvm::BasicBlock*, 4> exiting;
+            loop->getExitingBlocks(exiting);
+            for (llvm::BasicBlock* exit : exiting)
+            {
+                if (!analyses.dt.dominates(block, exit))
+                {
+                    return false;
+                }
+            }
+            if (!loopKeepsChecksValid(*loop, checkFn.getCallee()))
+            {
+                return false;
+            }
+
+            llvm::ScalarEvolution& se = analyses.se;
+            const llvm::SCEV* backedges = se.getBackedgeTakenCount(loop);
+            if (llvm::isa<llvm::SCEVCouldNotCompute>(backedges))
+            {
+                return false;
+            }
+            auto* rec = llvm::dyn_cast<llvm::SCEVAddRecExpr>(se.getSCEV(access.ptr));
+            if (!rec || rec->getLoop() != loop || !rec->isAffine() ||
+                !rec->getNoWrapFlags(llvm::SCEV::FlagNW))
+            {
+                return false;
+            }
+
+            llvm::Instruction* at = preheader->getTerminator();
+            llvm::Value* base = resolveBasePointer(access.ptr);
+            if (auto* baseInst = llvm::dyn_cast<llvm::Instruction>(base);
+                baseInst && !analyses.dt.dominates(baseInst, at))
+            {
+                return false;
+            }
+
+            const llvm::SCEV* first = rec->getStart();
+            const llvm::SCEV* last = rec->evaluateAtIteration(backedges, se);
+            const llvm::SCEV* step = rec->getStepRecurrence(se);
+            const llvm::SCEV* low = first;
+            const llvm::SCEV* high = last;
+            if (se.isKnownNegative(step))
+            {
+                std::swap(low, high);
+            }
+            else if (!se.isKnownNonNegative(step))
+            {
+                low = se.getUMinExpr(first, last);
+                high = se.getUMaxExpr(first, last);
+            }
+            llvm::SCEVExpander expander(se, layout, "ct.bounds");
+            if (!isSafeToExpandAt(expander, se, low, at) ||
+                !isSafeToExpandAt(expander, se, high, at))
+            {
+                return false;
+            }
+
+            // Accesses with the same range in the same loop share one check.
+            const LoopRangeKey key{preheader, low, high, access.size,
+                                   static_cast<unsigned>(access.isWrite)};
+            if (!placed.insert(key).second)
+            {
+                return true;
+            }
+
+            llvm::Value* lowPtr = expander.expandCodeFor(low, access.ptr->getType(), at);
+            llvm::Value* highPtr = expander.expandCodeFor(high, access.ptr->getType(), at);
+            llvm::IRBuilder<> builder(at);
+            llvm::Value* span = builder.CreateSub(builder.CreatePtrToInt(highPtr, sizeTy),
+                                                  builder.CreatePtrToInt(lowPtr, sizeTy));
+            llvm::Value* length =
+                builder.CreateAdd(span, llvm::ConstantInt::get(sizeTy, access.size));
+            emitBoundsCheck(builder, checkFn, base, lowPtr, length, site, access.isWrite,
+                            voidPtrTy, intTy);
+            ++stats.loopRangeChecks;
+            ++stats.emitted;
+            return true;
+        }
+
+        // Accesses at constant offsets from one pointer are merged into a
+        // single check while the range they cover stays within this many bytes.
+        constexpr int64_t kMaxMergedSpan = 64;
+        // How many earlier checks on the same pointer are tried as dominators.
+        constexpr unsigned kMaxDominatorScan = 16;
+
+        // One check of [root + low, root + high), placed before `at`, that
+        // stands for the accesses in `members`.
+        struct RangeCheck
+        {
+            llvm::Instruction* at = nullptr;
+            llvm::Value* root = nullptr;
+            llvm::Value* base = nullptr;
+            int64_t low = 0;
+            int64_t high = 0;
+            uint64_t align = 1;
+            bool isWrite = false;
+            unsigned segment = 0;
+            llvm::SmallVector<llvm::Instruction*, 2> members;
+        };
+
+        // Fixed-size accesses whose check is not placed right before them.
+        struct CheckPlan
+        {
+            llvm::DenseSet<llvm::Instruction*> hoisted; // covered by a loop range check
+            llvm::DenseSet<llvm::Instruction*> covered; // covered by another access's check
+            llvm::DenseMap<llvm::Instruction*, RangeCheck> widened; // first access of a group
+        };
+
+        // Decides which checks of one function can share a check. Within a
+        // block, accesses at nearby constant offsets from the same pointer
+        // with no call in between get one check of the range they span, placed
+        // at the first of them. The check reports the first access's site, so
+        // only accesses with the same debug location are merged: an overflow
+        // is never blamed on a line that did not make it. A check is then
+        // dropped when an earlier one on the same pointer covers its range and
+        // runs first: in the same block with no call in between, or anywhere
+        // dominating it in a function that makes no calls at all.
+        void planSharedChecks(llvm::Function& func, llvm::ArrayRef<MemoryAccess> accesses,
+                              const llvm::DominatorTree& dt, const llvm::DataLayout& layout,
+                              const llvm::Value* checkCallee, CheckPlan& plan,
+                              BoundsStats& stats)
+        {
+            llvm::DenseMap<const llvm::Instruction*, const MemoryAccess*> byInst;
+            for (const MemoryAccess& access : accesses)
+            {
+                byInst[access.inst] = &access;
+            }
+
+            using GroupKey = std::tuple<const llvm::Value*, const llvm::Value*, unsigned,
+                                        const llvm::DILocation*>;
+            std::vector<RangeCheck> checks;
+            unsigned segment = 0;
+            bool callFree = true;
+            llvm::ReversePostOrderTraversal<llvm::Function*> order(&func);
+            for (llvm::BasicBlock* block : order)
+            {
+                llvm::DenseMap<GroupKey, size_t> open;
+                ++segment;
+                for (llvm::Instruction& inst : *block)
+                {
+                    if (mayInvalidateChecks(inst, checkCallee))
+                    {
+                        callFree = false;
+                        open.clear();
+                        ++segment;
+                        continue;
+                    }
+                    auto found = byInst.find(&inst);
+                    if (found == byInst.end())
+                    {
+                        continue;
+                    }
+                    const MemoryAccess& access = *found->second;
+                    llvm::APInt offset(layout.getIndexTypeSizeInBits(access.ptr->getType()), 0);
+                    llvm::Value* root =
+                        access.ptr->stripAndAccumulateConstantOffsets(layout, offset, true);
+                    if (!offset.isSignedIntN(48))
+                    {
+                        root = access.ptr;
+                        offset = 0;
+                    }
+                    const int64_t low = offset.getSExtValue();
+                    const int64_t high = low + static_cast<int64_t>(access.size);
+                    llvm::Value* base = resolveBasePointer(access.ptr);
+
+                    const GroupKey key{root, base, static_cast<unsigned>(access.isWrite),
+                                       inst.getDebugLoc().get()};
+                    if (auto it = open.find(key); it != open.end())
+                    {
+                        RangeCheck& group = checks[it->second];
+                        const int64_t newLow = std::min(group.low, low);
+                        const int64_t newHigh = std::max(group.high, high);
+                        if (newHigh - newLow <= kMaxMergedSpan)
+                        {
+                            if (low < group.low)
+                            {
+                                group.align = access.align;
+                            }
+                            group.low = newLow;
+                            group.high = newHigh;
+                            group.members.push_back(access.inst);
+                            continue;
+                        }
+                    }
+                    RangeCheck group;
+                    group.at = access.inst;
+                    group.root = root;
+                    group.base = base;
+                    group.low = low;
+                    group.high = high;
+                    group.align = access.align;
+                    group.isWrite = access.isWrite;
+                    group.segment = segment;
+                    group.members.push_back(access.inst);
+                    open[key] = checks.size();
+                    checks.push_back(std::move(group));
+                }
+            }
+
+            llvm::DenseMap<const llvm::Value*, llvm::SmallVector<size_t, 4>> kept;
+            for (size_t index = 0; index < checks.size(); ++index)
+            {
+                RangeCheck& check = checks[index];
+                auto& candidates = kept[check.root];
+                bool isCovered = false;
+                unsigned scanned = 0;
+                for (auto it = candidates.rbegin();
+                     it != candidates.rend() && scanned < kMaxDominatorScan; ++it, ++scanned)
+                {
+                    const RangeCheck& earlier = checks[*it];
+                    if (earlier.base != check.base || earlier.low > check.low ||
+                        earlier.high < check.high)
+                    {
+                        continue;
+                    }
+                    if (earlier.segment == check.segment ||
+                        (callFree && dt.dominates(earlier.at, check.at)))
+                    {
+                        isCovered = true;
+                        break;
+                    }
+                }
+                if (isCovered)
+                {
+                    stats.dominated += check.members.size();
+                    plan.covered.insert(check.members.begin(), check.members.end());
+                    continue;
+                }
+                candidates.push_back(index);
+                if (check.members.size() > 1)
+                {
+                    stats.merged += check.members.size() - 1;
+                    plan.covered.insert(check.members.begin() + 1, check.members.end());
+                    plan.widened[check.at] = std::move(check);
+                }
+            }
+        }
+
+        // Splits the block before inst and emits
+        //     if (len > size || (uintptr)ptr - (uintptr)object > size - len)  // cold
+        //         __ct_report_object_bounds(object, ptr, len, size, site, isWrite, kind);
+        void emitObjectBoundsCheck(llvm::Instruction* inst, llvm::FunctionCallee reportFn,
+                                   const StaticObject& object, llvm::Value* ptr, llvm::Value* len,
+                                   llvm::Value* site, bool isWrite, llvm::MDNode* likely,
+                                   llvm::Type* voidPtrTy, llvm::Type* sizeTy, llvm::Type* intTy)
+        {
+            llvm::IRBuilder<> builder(inst);
+            llvm::Value* size = llvm::ConstantInt::get(sizeTy, object.size);
+            llvm::Value* offset =
+                builder.CreateSub(builder.CreatePtrToInt(ptr, sizeTy),
+                                  builder.CreatePtrToInt(object.object, sizeTy), "ct.object.off");
+            llvm::Value* ok = builder.CreateICmpULE(offset, builder.CreateSub(size, len));
+            auto* constLen = llvm::dyn_cast<llvm::ConstantInt>(len);
+            if (!constLen || constLen->getZExtValue() > object.size)
+            {
+                ok = builder.CreateAnd(builder.CreateICmpULE(len, size), ok);
+            }
+
+            llvm::BasicBlock* head = inst->getParent();
+            llvm::BasicBlock* cont = head->splitBasicBlock(inst, "ct.object.cont");
+            auto* fail = llvm::BasicBlock::Create(inst->getContext(), "ct.object.fail",
+                                                  head->getParent(), cont);
+            head->getTerminator()->eraseFromParent();
+            builder.SetInsertPoint(head);
+            builder.CreateCondBr(ok, cont, fail, likely);
+
+            builder.SetInsertPoint(fail);
+            llvm::CallInst* call = builder.CreateCall(
+                reportFn, {builder.CreateBitCast(object.object, voidPtrTy),
+                           builder.CreateBitCast(ptr, voidPtrTy), len, size, site,
+                           llvm::ConstantInt::get(intTy, isWrite ? 1 : 0),
+                           llvm::ConstantInt::get(intTy, object.kind)});
+            call->addFnAttr(llvm::Attribute::Cold);
+            builder.CreateBr(cont);
+        }
+
+        // Direct-mapped shadow layout; must match src/runtime/ct_runtime_shadow.cpp.
+        // Addresses above the 47-bit shadowed range wrap around the index mask:
+        // whatever byte they hit, the runtime treats them as unshadowed.
+        constexpr unsigned kShadowShift = 3;
+        constexpr uint64_t kShadowIndexMask = (static_cast<uint64_t>(1) << 44) - 1;
+        constexpr uint8_t kShadowAddressable = 0xFF;
+
+        struct InlineShadow
+        {
+            llvm::GlobalVariable* base = nullptr;
+            llvm::MDNode* likely = nullptr;
+        };
+
+        CT_NODISCARD bool supportsInlineShadow(const llvm::Module& module)
+        {
+            llvm::Triple triple(module.getTargetTriple());
+            return !triple.isOSWindows() && module.getDataLayout().getPointerSizeInBits() == 64;
+        }
+
+        // An access can be checked inline when it spans at most two shadow
+        // granules, which are then tested through its first and last byte.
+        CT_NODISCARD bool canCheckInline(uint64_t size, uint64_t align)
+        {
+            return size != 0 && (size <= 8 || (align >= 8 && size <= 16));
+        }
+
+        // Splits the block before inst and emits
+        //     if (__ct_shadow_base && (shadow[first] & shadow[last]) == 0xFF)
+        //         goto inst;
+        //     __ct_check_bounds(base, ptr, size, site, isWrite);  // cold
+        void emitInlineShadowCheck(llvm::Instruction* inst, const InlineShadow& shadow,
+                                   llvm::FunctionCallee checkFn, llvm::Value* base,
+                                   llvm::Value* ptr, uint64_t size, uint64_t align,
+                                   llvm::Value* site, bool isWrite, llvm::Type* voidPtrTy,
+                                   llvm::Type* sizeTy, llvm::Type* intTy)
+        {
+            llvm::LLVMContext& context = inst->getContext();
+            llvm::BasicBlock* head = inst->getParent();
+            llvm::Function* func = head->getParent();
+            llvm::BasicBlock* cont = head->splitBasicBlock(inst, "ct.shadow.cont");
+            auto* fast = llvm::BasicBlock::Create(context, "ct.shadow.check", func, cont);
+            auto* slow = llvm::BasicBlock::Create(context, "ct.shadow.slow", func, cont);
+            head->getTerminator()->eraseFromParent();
+
+            llvm::IRBuilder<> builder(head);
+            llvm::Value* shadowBase = builder.CreateLoad(sizeTy, shadow.base, "ct.shadow.base");
+            builder.CreateCondBr(builder.CreateIsNotNull(shadowBase), fast, slow, shadow.likely);
+
+            builder.SetInsertPoint(fast);
+            llvm::Type* byteTy = llvm::Type::getInt8Ty(context);
+            auto loadShadow = [&](llvm::Value* addr) -> llvm::Value*
+            {
+                llvm::Value* index = builder.CreateAnd(builder.CreateLShr(addr, kShadowShift),
+                                                       kShadowIndexMask);
+                llvm::Value* shadowPtr =
+                    builder.CreateIntToPtr(builder.CreateAdd(shadowBase, index), voidPtrTy);
+                return builder.CreateLoad(byteTy, shadowPtr);
+            };
+            llvm::Value* addr = builder.CreatePtrToInt(ptr, sizeTy);
+            llvm::Value* bits = loadShadow(addr);
+            if (size > 1 && !(align >= 8 && size <= 8))
+            {
+                llvm::Value* last =
+                    builder.CreateAdd(addr, llvm::ConstantInt::get(sizeTy, size - 1));
+                bits = builder.CreateAnd(bits, loadShadow(last));
+            }
+            llvm::Value* ok =
+                builder.CreateICmpEQ(bits, llvm::ConstantInt::get(byteTy, kShadowAddressable));
+            builder.CreateCondBr(ok, cont, slow, shadow.likely);
+
+            builder.SetInsertPoint(slow);
+            llvm::CallInst* call =
+                emitBoundsCheck(builder, checkFn, base, ptr, llvm::ConstantInt::get(sizeTy, size),
+                                site, isWrite, voidPtrTy, intTy);
+            call->addFnAttr(llvm::Attribute::Cold);
+            builder.CreateBr(cont);
         }
 
     } // namespace
 
-    void instrumentMemoryAccesses(llvm::Module& module)
+    void instrumentMemoryAccesses(llvm::Module& module, bool inlineShadow)
     {
         llvm::LLVMContext& context = module.getContext();
         const llvm::DataLayout& layout = module.getDataLayout();
@@ -176,7 +798,35 @@ namespace compilerlib
             llvm::FunctionType::get(llvm::Type::getVoidTy(context),
                                     {voidPtrTy, voidPtrTy, sizeTy, voidPtrTy, intTy}, false);
         llvm::FunctionCallee checkFn = module.getOrInsertFunction("__ct_check_bounds", checkTy);
+        auto* reportTy = llvm::FunctionType::get(
+            llvm::Type::getVoidTy(context),
+            {voidPtrTy, voidPtrTy, sizeTy, sizeTy, voidPtrTy, intTy, intTy}, false);
+        llvm::FunctionCallee reportFn =
+            module.getOrInsertFunction("__ct_report_object_bounds", reportTy);
+        llvm::MDNode* likely = llvm::MDBuilder(context).createBranchWeights(1u << 20, 1);
+
+        InlineShadow shadow;
+        if (inlineShadow && supportsInlineShadow(module))
+        {
+            shadow.base = llvm::cast<llvm::GlobalVariable>(
+                module.getOrInsertGlobal("__ct_shadow_base", sizeTy));
+            shadow.likely = likely;
+        }
 
+        // Both hooks abort on a failed check by default. The memo in
+        // __ct_check_bounds keeps base, and the shadow bytes it faults in are
+        // read by the module itself when shadow checks are inline.
+        setRuntimeHookAttributes(checkFn, /*mayAbort=*/true,
+                                 /*writesModuleMemory=*/shadow.base != nullptr);
+        setRuntimeHookPointerArg(checkFn, 0, /*read=*/false, /*kept=*/true);
+        setRuntimeHookPointerArg(checkFn, 1, /*read=*/false, /*kept=*/false);
+        setRuntimeHookPointerArg(checkFn, 3, /*read=*/true, /*kept=*/false);
+        setRuntimeHookAttributes(reportFn, /*mayAbort=*/true, /*writesModuleMemory=*/false);
+        setRuntimeHookPointerArg(reportFn, 0, /*read=*/false, /*kept=*/false);
+        setRuntimeHookPointerArg(reportFn, 1, /*read=*/false, /*kept=*/false);
+        setRuntimeHookPointerArg(reportFn, 4, /*read=*/true, /*kept=*/false);
+
+        BoundsStats stats;
         llvm::DenseMap<const llvm::DILocation*, llvm::Constant*> siteCache;
         llvm::Constant* unknownSite = nullptr;
         llvm::SmallVector<llvm::Instruction*, 128> worklist;
@@ -202,85 +852,187 @@ namespace compilerlib
             }
         }
 
+        // Loop range checks go in first, while every function still has the
+        // CFG its analyses are built on; the inline shadow checks below split
+        // blocks. The worklist holds each function's accesses contiguously.
+        CheckPlan plan;
+        {
+            llvm::TargetLibraryInfoImpl tlii{llvm::Triple(module.getTargetTriple())};
+            llvm::TargetLibraryInfo tli(tlii);
+            LoopRangeSet placed;
+            for (size_t begin = 0, end = 0; begin < worklist.size(); begin = end)
+            {
+                llvm::Function& func = *worklist[begin]->getFunction();
+                llvm::SmallVector<MemoryAccess, 32> accesses;
+                for (end = begin; end < worklist.size() && worklist[end]->getFunction() == &func;
+                     ++end)
+                {
+                    MemoryAccess access;
+                    StaticObject object;
+                    if (describeAccess(worklist[end], layout, access) &&
+                        !isProvablyInBounds(access.ptr, access.size, layout) &&
+                        !findStaticObject(access.ptr, layout, object))
+                    {
+                        accesses.push_back(access);
+                    }
+                }
+                if (accesses.empty())
+                {
+                    continue;
+                }
+
+                LoopAnalyses analyses(func, tli);
+                llvm::SmallVector<MemoryAccess, 32> remaining;
+                for (const MemoryAccess& access : accesses)
+                {
+                    llvm::Value* site =
+                        getSiteString(module, *access.inst, siteCache, unknownSite);
+                    if (!analyses.li.empty() &&
+                        hoistLoopCheck(analyses, access, layout, checkFn, site, voidPtrTy,
+                                       sizeTy, intTy, placed, stats))
+                    {
+                        plan.hoisted.insert(access.inst);
+                        continue;
+                    }
+                    remaining.push_back(access);
+                }
+                planSharedChecks(func, remaining, analyses.dt, layout, checkFn.getCallee(), plan,
+                                 stats);
+            }
+        }
+
         for (llvm::Instruction* inst : worklist)
         {
+            ++stats.accesses;
             llvm::IRBuilder<> builder(inst);
-            llvm::Value* site = getSiteString(module, *inst, siteCache, unknownSite);
 
-            if (auto* load = llvm::dyn_cast<llvm::LoadInst>(inst))
-            {
-                llvm::Value* ptr = load->getPointerOperand();
-                llvm::Value* base = resolveBasePointer(ptr);
-                size_t size = layout.getTypeStoreSize(load->getType());
-                llvm::Value* sizeVal = llvm::ConstantInt::get(sizeTy, size);
-                emitBoundsCheck(builder, checkFn, base, ptr, sizeVal, site, false, voidPtrTy,
-                                intTy);
-                continue;
-            }
-            if (auto* store = llvm::dyn_cast<llvm::StoreInst>(inst))
-            {
-                llvm::Value* ptr = store->getPointerOperand();
-                llvm::Value* base = resolveBasePointer(ptr);
-                size_t size = layout.getTypeStoreSize(store->getValueOperand()->getType());
-                llvm::Value* sizeVal = llvm::ConstantInt::get(sizeTy, size);
-                emitBoundsCheck(builder, checkFn, base, ptr, sizeVal, site, true, voidPtrTy, intTy);
-                continue;
-            }
-            if (auto* atomic = llvm::dyn_cast<llvm::AtomicRMWInst>(inst))
+            MemoryAccess access;
+            if (describeAccess(inst, layout, access))
             {
-                llvm::Value* ptr = atomic->getPointerOperand();
-                llvm::Value* base = resolveBasePointer(ptr);
-                size_t size = layout.getTypeStoreSize(atomic->getValOperand()->getType());
-                llvm::Value* sizeVal = llvm::ConstantInt::get(sizeTy, size);
-                emitBoundsCheck(builder, checkFn, base, ptr, sizeVal, site, true, voidPtrTy, intTy);
-                continue;
-            }
-            if (auto* cmpx = llvm::dyn_cast<llvm::AtomicCmpXchgInst>(inst))
-            {
-                llvm::Value* ptr = cmpx->getPointerOperand();
-                llvm::Value* base = resolveBasePointer(ptr);
-                size_t size = layout.getTypeStoreSize(cmpx->getCompareOperand()->getType());
-                llvm::Value* sizeVal = llvm::ConstantInt::get(sizeTy, size);
-                emitBoundsCheck(builder, checkFn, base, ptr, sizeVal, site, true, voidPtrTy, intTy);
+                if (isProvablyInBounds(access.ptr, access.size, layout))
+                {
+                    ++stats.provenInBounds;
+                    continue;
+                }
+                if (StaticObject object; findStaticObject(access.ptr, layout, object))
+                {
+                    if (object.sizeKnown)
+                    {
+                        llvm::Value* site = getSiteString(module, *inst, siteCache, unknownSite);
+                        emitObjectBoundsCheck(inst, reportFn, object, access.ptr,
+                                              llvm::ConstantInt::get(sizeTy, access.size), site,
+                                              access.isWrite, likely, voidPtrTy, sizeTy, intTy);
+                        ++stats.objectChecks;
+                    }
+                    else
+                    {
+                        ++stats.nonHeapSkipped;
+                    }
+                    continue;
+                }
+                if (plan.hoisted.contains(inst))
+                {
+                    ++stats.hoistedFromLoops;
+                    continue;
+                }
+                if (plan.covered.contains(inst))
+                {
+                    continue;
+                }
+                llvm::Value* site = getSiteString(module, *inst, siteCache, unknownSite);
+                llvm::Value* base = resolveBasePointer(access.ptr);
+                if (auto it = plan.widened.find(inst); it != plan.widened.end())
+                {
+                    const RangeCheck& range = it->second;
+                    access.ptr = builder.CreatePointerCast(range.root, voidPtrTy);
+                    if (range.low != 0)
+                    {
+                        access.ptr =
+                            builder.CreateConstGEP1_64(llvm::Type::getInt8Ty(context), access.ptr,
+                                                       static_cast<uint64_t>(range.low));
+                    }
+                    access.size = static_cast<uint64_t>(range.high - range.low);
+                    access.align = range.align;
+                    base = range.base;
+                }
+                ++stats.emitted;
+                if (shadow.base && canCheckInline(access.size, access.align))
+                {
+                    emitInlineShadowCheck(inst, shadow, checkFn, base, access.ptr, access.size,
+                                          access.align, site, access.isWrite, voidPtrTy, sizeTy,
+                                          intTy);
+                    continue;
+                }
+                llvm::Value* sizeVal = llvm::ConstantInt::get(sizeTy, access.size);
+                emitBoundsCheck(builder, checkFn, base, access.ptr, sizeVal, site, access.isWrite,
+                                voidPtrTy, intTy);
                 continue;
             }
             if (auto* mem = llvm::dyn_cast<llvm::MemIntrinsic>(inst))
             {
                 llvm::Value* len = mem->getLength();
-                if (auto* constLen = llvm::dyn_cast<llvm::ConstantInt>(len))
+                auto* constLen = llvm::dyn_cast<llvm::ConstantInt>(len);
+                if (constLen && constLen->isZero())
                 {
-                    if (constLen->isZero())
-                    {
-                        continue;
-                    }
+                    continue;
                 }
+                llvm::Value* site = getSiteString(module, *inst, siteCache, unknownSite);
                 if (len->getType() != sizeTy)
                 {
                     len = builder.CreateZExtOrTrunc(len, sizeTy);
                 }
 
+                // Returns false when ptr needs no check at all.
+                auto checkPointer = [&](llvm::Value* ptr, bool isWrite)
+                {
+                    if (constLen && isProvablyInBounds(ptr, constLen->getZExtValue(), layout))
+                    {
+                        return false;
+                    }
+                    if (StaticObject object; findStaticObject(ptr, layout, object))
+                    {
+                        if (object.sizeKnown)
+                        {
+                            emitObjectBoundsCheck(inst, reportFn, object, ptr, len, site, isWrite,
+                                                  likely, voidPtrTy, sizeTy, intTy);
+                            ++stats.objectChecks;
+                        }
+                        else
+                        {
+                            ++stats.nonHeapSkipped;
+                        }
+                        return true;
+                    }
+                    llvm::IRBuilder<> at(inst);
+                    emitBoundsCheck(at, checkFn, resolveBasePointer(ptr), ptr, len, site, isWrite,
+                                    voidPtrTy, intTy);
+                    ++stats.emitted;
+                    return true;
+                };
+
                 if (auto* memSet = llvm::dyn_cast<llvm::MemSetInst>(mem))
                 {
-                    llvm::Value* ptr = memSet->getDest();
-                    llvm::Value* base = resolveBasePointer(ptr);
-                    emitBoundsCheck(builder, checkFn, base, ptr, len, site, true, voidPtrTy, intTy);
+                    if (!checkPointer(memSet->getDest(), true))
+                    {
+                        ++stats.provenInBounds;
+                    }
                     continue;
                 }
 
                 if (auto* memTransfer = llvm::dyn_cast<llvm::MemTransferInst>(mem))
                 {
-                    llvm::Value* dest = memTransfer->getDest();
-                    llvm::Value* src = memTransfer->getSource();
-                    llvm::Value* destBase = resolveBasePointer(dest);
-                    llvm::Value* srcBase = resolveBasePointer(src);
-                    emitBoundsCheck(builder, checkFn, destBase, dest, len, site, true, voidPtrTy,
-                                    intTy);
-                    emitBoundsCheck(builder, checkFn, srcBase, src, len, site, false, voidPtrTy,
-                                    intTy);
+                    const bool destChecked = checkPointer(memTransfer->getDest(), true);
+                    const bool srcChecked = checkPointer(memTransfer->getSource(), false);
+                    if (!destChecked && !srcChecked)
+                    {
+                        ++stats.provenInBounds;
+                    }
                     continue;
                 }
             }
         }
+
+        logBoundsStats(module, stats);
     }
 
 } // namespace compilerlib
@@ -3,16 +3,28 @@
 #include "compilerlib/attributes.hpp"
 
 #include <llvm/ADT/SmallString.h>
+#include <llvm/Config/llvm-config.h>
 #include <llvm/IR/Attributes.h>
 #include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
+#include <llvm/Support/Casting.h>
 #include <llvm/Support/Path.h>
+#if LLVM_VERSION_MAJOR >= 16
+#include <llvm/Support/ModRef.h>
+#endif
 
 namespace compilerlib
 {
     namespace
     {
 
+        CT_NODISCARD llvm::Function* runtimeHookDeclaration(llvm::FunctionCallee hook)
+        {
+            auto* fn = llvm::dyn_cast_or_null<llvm::Function>(hook.getCallee());
+            return fn && fn->isDeclaration() ? fn : nullptr;
+        }
+
         CT_NODISCARD bool isSystemPath(llvm::StringRef path)
         {
             if (path.empty())
@@ -91,4 +103,48 @@ namespace compilerlib
         return true;
     }
 
+    void setRuntimeHookAttributes(llvm::FunctionCallee hook, bool mayAbort,
+                                  bool writesModuleMemory)
+    {
+        llvm::Function* fn = runtimeHookDeclaration(hook);
+        if (!fn)
+            return;
+
+        fn->addFnAttr(llvm::Attribute::NoUnwind);
+        if (!mayAbort)
+            fn->addFnAttr(llvm::Attribute::WillReturn);
+#if LLVM_VERSION_MAJOR >= 16
+        // Reads cover site strings kept from earlier calls, vtables and the
+        // stack walked for backtraces. The runtime restores errno in every
+        // hook that may set it, which is what lets the writes stay
+        // inaccessiblemem.
+        if (!writesModuleMemory)
+        {
+            fn->setMemoryEffects(llvm::MemoryEffects::readOnly() |
+                                 llvm::MemoryEffects::inaccessibleMemOnly());
+        }
+#else
+        (void)writesModuleMemory;
+#endif
+    }
+
+    void setRuntimeHookPointerArg(llvm::FunctionCallee hook, unsigned argNo, bool read,
+                                  bool kept)
+    {
+        llvm::Function* fn = runtimeHookDeclaration(hook);
+        if (!fn || argNo >= fn->arg_size() || !fn->getArg(argNo)->getType()->isPointerTy())
+            return;
+
+        fn->addParamAttr(argNo, read ? llvm::Attribute::ReadOnly : llvm::Attribute::ReadNone);
+        if (!kept)
+        {
+#if LLVM_VERSION_MAJOR >= 21
+            fn->addParamAttr(argNo, llvm::Attribute::getWithCaptureInfo(
+                                        fn->getContext(), llvm::CaptureInfo::none()));
+#else
+            fn->addParamAttr(argNo, llvm::Attribute::NoCapture);
+#endif
+        }
+    }
+
 } // namespace compilerlib
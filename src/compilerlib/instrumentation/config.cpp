@@ -7,6 +7,9 @@
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Type.h>
 
+#include <cstdlib>
+#include <utility>
+
 namespace compilerlib
 {
     namespace
@@ -120,6 +123,37 @@ namespace compilerlib
                 config.shadow_aggressive = true;
                 continue;
             }
+            if (arg == "--ct-shadow-inline")
+            {
+                config.shadow_enabled = true;
+                config.shadow_inline = true;
+                continue;
+            }
+            if (arg == "--ct-no-shadow-inline")
+            {
+                config.shadow_inline = false;
+                continue;
+            }
+            if (arg == "--ct-post-opt")
+            {
+                config.post_opt_enabled = true;
+                continue;
+            }
+            if (arg == "--ct-no-post-opt")
+            {
+                config.post_opt_enabled = false;
+                continue;
+            }
+            if (arg == "--ct-inline-runtime")
+            {
+                config.inline_runtime_enabled = true;
+                continue;
+            }
+            if (arg == "--ct-no-inline-runtime")
+            {
+                config.inline_runtime_enabled = false;
+                continue;
+            }
             if (startsWith(arg, "--ct-shadow="))
             {
                 auto value = arg.substr(std::string("--ct-shadow=").size());
@@ -130,6 +164,17 @@ namespace compilerlib
                 }
                 continue;
             }
+            if (startsWith(arg, "--ct-alloc-table-bits="))
+            {
+                auto value = arg.substr(std::string("--ct-alloc-table-bits=").size());
+                char* end = nullptr;
+                unsigned long bits = std::strtoul(value.c_str(), &end, 10);
+                if (!value.empty() && end && *end == '\0' && bits < 64)
+                {
+                    config.alloc_table_bits = static_cast<unsigned>(bits);
+                }
+                continue;
+            }
             if (arg == "--ct-bounds-no-abort")
             {
                 config.bounds_no_abort = true;
@@ -226,6 +271,39 @@ namespace compilerlib
         setConfigGlobal(module, "__ct_config_disable_alloc_trace",
                         config.alloc_trace_enabled ? 0 : 1);
         setConfigGlobal(module, "__ct_config_vtable_diag", config.vtable_diag_enabled ? 1 : 0);
+        setConfigGlobal(module, "__ct_config_alloc_table_bits",
+                        static_cast<int>(config.alloc_table_bits));
+    }
+
+    std::string describeRuntimeConfig(const RuntimeConfig& config)
+    {
+        const std::pair<const char*, bool> flags[] = {
+            {"shadow", config.shadow_enabled},
+            {"shadow_aggressive", config.shadow_aggressive},
+            {"shadow_inline", config.shadow_inline},
+            {"bounds_no_abort", config.bounds_no_abort},
+            {"trace", config.trace_enabled},
+            {"alloc", config.alloc_enabled},
+            {"bounds", config.bounds_enabled},
+            {"vtable", config.vtable_enabled},
+            {"vcall_trace", config.vcall_trace_enabled},
+            {"vtable_diag", config.vtable_diag_enabled},
+            {"autofree", config.autofree_enabled},
+            {"alloc_trace", config.alloc_trace_enabled},
+            {"bounds_without_alloc", config.bounds_without_alloc},
+            {"optnone", config.optnone_enabled},
+            {"post_opt", config.post_opt_enabled},
+            {"inline_runtime", config.inline_runtime_enabled},
+        };
+
+        std::string out;
+        for (const auto& [name, value] : flags)
+        {
+            out += name;
+            out += value ? "=1;" : "=0;";
+        }
+        out += "alloc_table_bits=" + std::to_string(config.alloc_table_bits) + ";";
+        return out;
     }
 
 } // namespace compilerlib
@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "compilerlib/instrumentation/passes.hpp"
+#include "compilerlib/instrumentation/alloc.hpp"
+#include "compilerlib/instrumentation/bounds.hpp"
+#include "compilerlib/instrumentation/trace.hpp"
+#include "compilerlib/instrumentation/vtable.hpp"
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Passes/OptimizationLevel.h>
+#include <llvm/Passes/PassBuilder.h>
+
+#include <utility>
+
+namespace compilerlib
+{
+    namespace
+    {
+
+        // Named metadata left on instrumented modules.
+        constexpr llvm::StringLiteral kInstrumentedMarker = "coretrace.instrumented";
+
+    } // namespace
+
+    void runInstrumentation(llvm::Module& module, const RuntimeConfig& config)
+    {
+        if (config.trace_enabled)
+        {
+            instrumentModule(module);
+        }
+        if (config.alloc_enabled)
+        {
+            wrapAllocCalls(module);
+        }
+        if (config.bounds_enabled)
+        {
+            instrumentMemoryAccesses(module, config.shadow_inline);
+        }
+        if (config.vtable_enabled || config.vcall_trace_enabled)
+        {
+            instrumentVirtualCalls(module, config.vcall_trace_enabled, config.vtable_enabled);
+        }
+        emitRuntimeConfigGlobals(module, config);
+    }
+
+    llvm::PreservedAnalyses TraceInstrumentationPass::run(llvm::Module& module,
+                                                          llvm::ModuleAnalysisManager&)
+    {
+        instrumentModule(module);
+        return llvm::PreservedAnalyses::none();
+    }
+
+    llvm::PreservedAnalyses AllocInstrumentationPass::run(llvm::Module& module,
+                                                          llvm::ModuleAnalysisManager&)
+    {
+        wrapAllocCalls(module);
+        return llvm::PreservedAnalyses::none();
+    }
+
+    llvm::PreservedAnalyses BoundsInstrumentationPass::run(llvm::Module& module,
+                                                           llvm::ModuleAnalysisManager&)
+    {
+        instrumentMemoryAccesses(module, inlineShadow);
+        return llvm::PreservedAnalyses::none();
+    }
+
+    llvm::PreservedAnalyses VirtualCallInstrumentationPass::run(llvm::Module& module,
+                                                                llvm::ModuleAnalysisManager&)
+    {
+        instrumentVirtualCalls(module, traceCalls, dumpVtable);
+        return llvm::PreservedAnalyses::none();
+    }
+
+    llvm::PreservedAnalyses InstrumentationPass::run(llvm::Module& module,
+                                                     llvm::ModuleAnalysisManager&)
+    {
+        if (module.getNamedMetadata(kInstrumentedMarker))
+        {
+            return llvm::PreservedAnalyses::all();
+        }
+        module.getOrInsertNamedMetadata(kInstrumentedMarker);
+        runInstrumentation(module, config);
+        return llvm::PreservedAnalyses::none();
+    }
+
+    void registerInstrumentationPasses(llvm::PassBuilder& builder, const RuntimeConfig& config,
+                                       bool addToPipeline)
+    {
+        builder.registerPipelineParsingCallback(
+            [config](llvm::StringRef name, llvm::ModulePassManager& passes,
+                     llvm::ArrayRef<llvm::PassBuilder::PipelineElement>)
+            {
+                if (name == "ct-trace")
+                {
+                    passes.addPass(TraceInstrumentationPass());
+                    return true;
+                }
+                if (name == "ct-alloc")
+                {
+                    passes.addPass(AllocInstrumentationPass());
+                    return true;
+                }
+                if (name == "ct-bounds")
+                {
+                    BoundsInstrumentationPass pass;
+                    pass.inlineShadow = config.shadow_inline;
+                    passes.addPass(std::move(pass));
+                    return true;
+                }
+                if (name == "ct-vcall")
+                {
+                    VirtualCallInstrumentationPass pass;
+                    pass.dumpVtable = config.vtable_enabled;
+                    passes.addPass(std::move(pass));
+                    return true;
+                }
+                if (name == "coretrace")
+                {
+                    InstrumentationPass pass;
+                    pass.config = config;
+                    passes.addPass(std::move(pass));
+                    return true;
+                }
+                return false;
+            });
+
+        if (!addToPipeline)
+        {
+            return;
+        }
+        // Early enough for the vectorizer, LICM and the late InstCombine /
+        // SimplifyCFG runs to see the checks. The extra arguments (the LTO
+        // phase, since LLVM 20) are not needed.
+        builder.registerOptimizerEarlyEPCallback(
+            [config](llvm::ModulePassManager& passes, llvm::OptimizationLevel, auto...)
+            {
+                InstrumentationPass pass;
+                pass.config = config;
+                passes.addPass(std::move(pass));
+            });
+    }
+
+} // namespace compilerlib
@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "compilerlib/instrumentation/runtime_fastpath.hpp"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/Casting.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/TargetParser/Triple.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include <memory>
+
+namespace compilerlib
+{
+    namespace
+    {
+
+        // Hooks defined in ct_runtime_fastpath.cpp.
+        constexpr llvm::StringLiteral kFastPathHooks[] = {"__ct_check_bounds"};
+
+        bool callsFastPathHook(const llvm::Module& module)
+        {
+            for (llvm::StringRef name : kFastPathHooks)
+            {
+                const llvm::Function* fn = module.getFunction(name);
+                if (fn && fn->isDeclaration() && !fn->use_empty())
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::unique_ptr<llvm::Module> loadFastPaths(llvm::Module& module,
+                                                    llvm::StringRef bitcodePath)
+        {
+            auto buffer = llvm::MemoryBuffer::getFile(bitcodePath);
+            if (!buffer)
+            {
+                return nullptr;
+            }
+            auto parsed = llvm::parseBitcodeFile((*buffer)->getMemBufferRef(),
+                                                 module.getContext());
+            if (!parsed)
+            {
+                llvm::consumeError(parsed.takeError());
+                return nullptr;
+            }
+
+            std::unique_ptr<llvm::Module> fastPaths = std::move(*parsed);
+            llvm::Triple built(fastPaths->getTargetTriple());
+            llvm::Triple target(module.getTargetTriple());
+            if (built.getArch() != target.getArch() || built.getOS() != target.getOS())
+            {
+                return nullptr;
+            }
+
+            // The fast paths only touch pointers and integers, so the
+            // module's own layout and flags (PIC level, wchar size, ...) win.
+            fastPaths->setDataLayout(module.getDataLayout());
+            fastPaths->setTargetTriple(module.getTargetTriple());
+            if (llvm::NamedMDNode* flags = fastPaths->getModuleFlagsMetadata())
+            {
+                fastPaths->eraseNamedMetadata(flags);
+            }
+            return fastPaths;
+        }
+
+        bool inlineCallsTo(llvm::Function& fn)
+        {
+            llvm::SmallVector<llvm::CallBase*, 32> calls;
+            for (llvm::User* user : fn.users())
+            {
+                auto* call = llvm::dyn_cast<llvm::CallBase>(user);
+                if (call && call->getCalledFunction() == &fn)
+                {
+                    calls.push_back(call);
+                }
+            }
+
+            bool inlined = false;
+            for (llvm::CallBase* call : calls)
+            {
+                llvm::InlineFunctionInfo info;
+                inlined |= llvm::InlineFunction(*call, info).isSuccess();
+            }
+            return inlined;
+        }
+
+    } // namespace
+
+    bool linkRuntimeFastPaths(llvm::Module& module, llvm::StringRef bitcodePath)
+    {
+        if (!callsFastPathHook(module))
+        {
+            return false;
+        }
+
+        std::unique_ptr<llvm::Module> fastPaths = loadFastPaths(module, bitcodePath);
+        if (!fastPaths ||
+            llvm::Linker::linkModules(module, std::move(fastPaths), llvm::Linker::LinkOnlyNeeded))
+        {
+            return false;
+        }
+
+        bool inlined = false;
+        for (llvm::StringRef name : kFastPathHooks)
+        {
+            llvm::Function* fn = module.getFunction(name);
+            if (!fn || fn->isDeclaration())
+            {
+                continue;
+            }
+            // The archive still exports the hook; the copy here only feeds
+            // the inliner and, for calls it could not inline, stays local.
+            fn->setLinkage(llvm::GlobalValue::InternalLinkage);
+            inlined |= inlineCallsTo(*fn);
+            if (fn->use_empty())
+            {
+                fn->eraseFromParent();
+            }
+        }
+        return inlined;
+    }
+
+} // namespace compilerlib
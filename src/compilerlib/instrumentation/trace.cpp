@@ -63,6 +63,14 @@ namespace compilerlib
             module.getOrInsertFunction("__ct_trace_exit_f64", exitF64Ty);
         llvm::FunctionCallee exitUnknownFn =
             module.getOrInsertFunction("__ct_trace_exit_unknown", exitUnknownTy);
+        // The runtime keeps the name as its current site for later reports.
+        for (llvm::FunctionCallee hook :
+             {enterFn, exitVoidFn, exitI64Fn, exitPtrFn, exitF64Fn, exitUnknownFn})
+        {
+            setRuntimeHookAttributes(hook, /*mayAbort=*/false, /*writesModuleMemory=*/false);
+            setRuntimeHookPointerArg(hook, 0, /*read=*/true, /*kept=*/true);
+        }
+        setRuntimeHookPointerArg(exitPtrFn, 1, /*read=*/false, /*kept=*/false);
 
         llvm::StringMap<llvm::Constant*> funcNameCache;
         for (llvm::Function& func : module)
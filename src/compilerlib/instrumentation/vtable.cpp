@@ -188,6 +188,18 @@ namespace compilerlib
 
         llvm::FunctionCallee traceFn = module.getOrInsertFunction("__ct_vcall_trace", traceTy);
         llvm::FunctionCallee dumpFn = module.getOrInsertFunction("__ct_vtable_dump", dumpTy);
+        // Both read the object's vptr and the type names; the call target is
+        // only resolved to a symbol.
+        setRuntimeHookAttributes(traceFn, /*mayAbort=*/false, /*writesModuleMemory=*/false);
+        setRuntimeHookPointerArg(traceFn, 0, /*read=*/true, /*kept=*/false);
+        setRuntimeHookPointerArg(traceFn, 1, /*read=*/false, /*kept=*/false);
+        setRuntimeHookPointerArg(traceFn, 2, /*read=*/true, /*kept=*/false);
+        setRuntimeHookPointerArg(traceFn, 3, /*read=*/true, /*kept=*/false);
+        setRuntimeHookAttributes(dumpFn, /*mayAbort=*/false, /*writesModuleMemory=*/false);
+        for (unsigned argNo = 0; argNo < 3; ++argNo)
+        {
+            setRuntimeHookPointerArg(dumpFn, argNo, /*read=*/true, /*kept=*/false);
+        }
 
         llvm::DenseMap<const llvm::DILocation*, llvm::Constant*> siteCache;
         llvm::Constant* unknownSite = nullptr;
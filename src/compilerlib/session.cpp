@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "compilerlib/session.hpp"
+
+#include "session_state.hpp"
+
+#include <clang/Basic/FileManager.h>
+#include <clang/Basic/FileSystemOptions.h>
+#include <llvm/Support/VirtualFileSystem.h>
+#include <llvm/Support/thread.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace compilerlib
+{
+
+    struct CompilerSession::Impl
+    {
+        using Task = std::function<void(SessionState&)>;
+
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::deque<Task> queue;
+        bool stopping = false;
+        // Bumped by clearFileCache(); a worker whose files are older drops them.
+        std::atomic<uint64_t> fileGeneration{0};
+        std::vector<llvm::thread> workers;
+
+        void enqueue(Task task)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.push_back(std::move(task));
+            }
+            ready.notify_one();
+        }
+
+        void work()
+        {
+            SessionState state;
+            uint64_t generation = fileGeneration.load(std::memory_order_acquire);
+            for (;;)
+            {
+                Task task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    ready.wait(lock, [&] { return stopping || !queue.empty(); });
+                    if (queue.empty())
+                    {
+                        return;
+                    }
+                    task = std::move(queue.front());
+                    queue.pop_front();
+                }
+
+                uint64_t current = fileGeneration.load(std::memory_order_acquire);
+                if (!state.files || generation != current)
+                {
+                    state.files = llvm::makeIntrusiveRefCnt<clang::FileManager>(
+                        clang::FileSystemOptions(), llvm::vfs::getRealFileSystem());
+                    generation = current;
+                }
+                task(state);
+            }
+        }
+    };
+
+    CompilerSession::CompilerSession(unsigned threads) : impl_(std::make_unique<Impl>())
+    {
+        prepareCompiler();
+        if (threads == 0)
+        {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        impl_->workers.reserve(threads);
+        for (unsigned i = 0; i < threads; ++i)
+        {
+            impl_->workers.emplace_back(kCc1StackSize, [impl = impl_.get()] { impl->work(); });
+        }
+    }
+
+    CompilerSession::~CompilerSession()
+    {
+        {
+            std::lock_guard<std::mutex> lock(impl_->mutex);
+            impl_->stopping = true;
+        }
+        impl_->ready.notify_all();
+        for (auto& worker : impl_->workers)
+        {
+            worker.join();
+        }
+    }
+
+    CompileResult CompilerSession::compile(const std::vector<std::string>& args, OutputMode mode,
+                                           bool instrument)
+    {
+        return compileAsync({args, mode, instrument}).get();
+    }
+
+    std::future<CompileResult> CompilerSession::compileAsync(CompileJob job)
+    {
+        // std::function needs a copyable callable.
+        auto promise = std::make_shared<std::promise<CompileResult>>();
+        std::future<CompileResult> result = promise->get_future();
+        impl_->enqueue(
+            [promise, job = std::move(job)](SessionState& state)
+            { promise->set_value(compileInSession(job.args, job.mode, job.instrument, state)); });
+        return result;
+    }
+
+    std::vector<CompileResult> CompilerSession::compileMany(const std::vector<CompileJob>& jobs)
+    {
+        std::vector<std::future<CompileResult>> pending;
+        pending.reserve(jobs.size());
+        for (const CompileJob& job : jobs)
+        {
+            pending.push_back(compileAsync(job));
+        }
+
+        std::vector<CompileResult> results;
+        results.reserve(jobs.size());
+        for (auto& future : pending)
+        {
+            results.push_back(future.get());
+        }
+        return results;
+    }
+
+    void CompilerSession::clearFileCache()
+    {
+        impl_->fileGeneration.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    unsigned CompilerSession::threadCount() const
+    {
+        return static_cast<unsigned>(impl_->workers.size());
+    }
+
+} // namespace compilerlib
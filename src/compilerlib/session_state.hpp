@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include "compilerlib/attributes.hpp"
+#include "compilerlib/compiler.h"
+
+#include <clang/Basic/FileManager.h>
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+#include <llvm/Config/llvm-config.h>
+#if LLVM_VERSION_MAJOR < 16
+#include <llvm/ADT/Optional.h>
+#endif
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace compilerlib
+{
+    // Stack size of the threads that run cc1 jobs: the same as clang's own
+    // cc1 stack, which parsing deeply nested code needs.
+#if LLVM_VERSION_MAJOR >= 16
+    inline const std::optional<unsigned> kCc1StackSize = 8u << 20;
+#else
+    inline const llvm::Optional<unsigned> kCc1StackSize = 8u << 20;
+#endif
+
+    // What a CompilerSession worker carries from one compilation to the next.
+    struct SessionState
+    {
+        // Shared by the compiler instances of compilations that run their
+        // cc1 jobs on the calling thread, when their working directory
+        // matches; null gives each instance its own.
+        llvm::IntrusiveRefCntPtr<clang::FileManager> files;
+    };
+
+    // compile(), reusing what state holds.
+    CT_NODISCARD CompileResult compileInSession(const std::vector<std::string>& args,
+                                                OutputMode mode, bool instrument,
+                                                SessionState& state);
+} // namespace compilerlib
@@ -16,6 +16,8 @@
 #include <llvm/Config/llvm-config.h>
 
 #include <cstdlib>
+#include <map>
+#include <mutex>
 #include <system_error>
 
 namespace compilerlib
@@ -374,6 +376,47 @@ namespace compilerlib
             return {};
         }
 
+        CT_NODISCARD std::string envValue(const char* name)
+        {
+            const char* value = std::getenv(name);
+            return value ? value : "";
+        }
+
+        struct ToolchainLookup
+        {
+            std::string clang_path;
+            std::string resource_dir;
+            std::string sysroot;
+        };
+
+        // The lookups only depend on these variables and on the files they
+        // lead to, so each process (a compile server in particular) does
+        // them once per environment.
+        CT_NODISCARD ToolchainLookup lookupToolchain()
+        {
+            static std::mutex mutex;
+            static std::map<std::string, ToolchainLookup> lookups;
+
+            std::string key;
+            for (const char* name : {"CT_CLANG", "PATH", "SDKROOT", "DEVELOPER_DIR"})
+            {
+                key += envValue(name);
+                key += '\0';
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = lookups.find(key);
+            if (it == lookups.end())
+            {
+                ToolchainLookup found;
+                found.clang_path = findClangPath();
+                found.resource_dir = detectResourceDir(found.clang_path);
+                found.sysroot = detectMacSysroot();
+                it = lookups.emplace(std::move(key), std::move(found)).first;
+            }
+            return it->second;
+        }
+
     } // namespace
 
     CT_NODISCARD bool resolveDriverConfig(const std::vector<std::string>& args, DriverConfig& out,
@@ -409,7 +452,8 @@ namespace compilerlib
         if (scan.has_driver_mode)
             out.force_cxx_driver = false;
 
-        out.clang_path = findClangPath();
+        ToolchainLookup toolchain = lookupToolchain();
+        out.clang_path = std::move(toolchain.clang_path);
         if (out.clang_path.empty())
         {
             error = "unable to find clang executable in PATH";
@@ -418,14 +462,14 @@ namespace compilerlib
 
         if (!scan.has_resource_dir)
         {
-            out.resource_dir = detectResourceDir(out.clang_path);
+            out.resource_dir = std::move(toolchain.resource_dir);
             if (!out.resource_dir.empty())
                 out.add_resource_dir = true;
         }
 
         if (!scan.has_sysroot)
         {
-            out.sysroot = detectMacSysroot();
+            out.sysroot = std::move(toolchain.sysroot);
             if (!out.sysroot.empty())
                 out.add_sysroot = true;
         }
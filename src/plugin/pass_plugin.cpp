@@ -0,0 +1,51 @@
+// SPDX-License-Identifier: Apache-2.0
+// Pass plugin for stock clang and opt:
+//   clang -fpass-plugin=libcoretrace_plugin.so ...
+//   opt -load-pass-plugin=libcoretrace_plugin.so -passes=coretrace ...
+// Instrumentation options are the --ct-* flags of the cc wrapper, read from
+// CT_PLUGIN_ARGS since clang does not forward options to pass plugins.
+#include "compilerlib/instrumentation/config.hpp"
+#include "compilerlib/instrumentation/passes.hpp"
+
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Passes/PassPlugin.h>
+
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+    compilerlib::RuntimeConfig configFromEnvironment()
+    {
+        std::vector<std::string> args;
+        if (const char* env = std::getenv("CT_PLUGIN_ARGS"))
+        {
+            std::istringstream stream(env);
+            std::string arg;
+            while (stream >> arg)
+            {
+                args.push_back(arg);
+            }
+        }
+
+        std::vector<std::string> ignored;
+        compilerlib::RuntimeConfig config;
+        compilerlib::extractRuntimeConfig(args, ignored, config);
+        return config;
+    }
+
+} // namespace
+
+extern "C" LLVM_ATTRIBUTE_WEAK llvm::PassPluginLibraryInfo llvmGetPassPluginInfo()
+{
+    return {LLVM_PLUGIN_API_VERSION, "CoreTrace", LLVM_VERSION_STRING,
+            [](llvm::PassBuilder& builder)
+            {
+                compilerlib::registerInstrumentationPasses(builder, configFromEnvironment(),
+                                                           /*addToPipeline=*/true);
+            }};
+}
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: Apache-2.0
-#include "ct_runtime_internal.h"
+#include "ct_runtime_table.h"
 
 #include <cstdlib>
 #include <new>
@@ -20,17 +20,6 @@
 #include <malloc.h>
 #endif
 
-struct ct_alloc_entry
-{
-    void* ptr;
-    size_t size;
-    size_t req_size;
-    const char* site;
-    unsigned char state;
-    unsigned char kind;
-    unsigned char mark;
-};
-
 struct ct_autofree_free_item
 {
     void* ptr;
@@ -48,18 +37,6 @@ enum
     CT_ALLOC_KIND_SBRK = 4
 };
 
-#define CT_ALLOC_TABLE_BITS 16u
-#define CT_ALLOC_TABLE_MAX_BITS 20u
-#define CT_ALLOC_TABLE_SIZE (1u << CT_ALLOC_TABLE_BITS)
-
-static struct ct_alloc_entry ct_alloc_table_storage[CT_ALLOC_TABLE_SIZE];
-static struct ct_alloc_entry* ct_alloc_table = ct_alloc_table_storage;
-static size_t ct_alloc_table_bits = CT_ALLOC_TABLE_BITS;
-static size_t ct_alloc_table_size = CT_ALLOC_TABLE_SIZE;
-static size_t ct_alloc_table_mask = CT_ALLOC_TABLE_SIZE - 1u;
-static size_t ct_alloc_count = 0;
-static int ct_alloc_lock = 0;
-static int ct_alloc_table_full_logged = 0;
 static std::atomic<int> ct_autofree_scan_initialized{0};
 static std::atomic<int> ct_autofree_scan_enabled{0};
 static std::atomic<int> ct_autofree_scan_start{0};
@@ -75,6 +52,8 @@ static std::atomic<uint64_t> ct_autofree_scan_period_ns{0};
 static std::atomic<uint64_t> ct_autofree_scan_budget_ns{0};
 static std::atomic<uint64_t> ct_autofree_scan_last_ns{0};
 static std::atomic<uint64_t> ct_autofree_scan_last_gc_ns{0};
+// Stamped on every entry a scan visits; only touched by the scanning thread.
+static unsigned ct_autofree_scan_epoch = 0;
 static pthread_t ct_autofree_scan_thread;
 static std::atomic<int> ct_autofree_scan_thread_started{0};
 static size_t ct_autofree_scan_timeout_check_freq = 100;
@@ -88,48 +67,12 @@ extern "C"
     CT_NOINSTR void __ct_autofree_sbrk(void* ptr);
 }
 
-CT_NOINSTR void ct_lock_acquire(void)
-{
-    while (__atomic_exchange_n(&ct_alloc_lock, 1, __ATOMIC_ACQUIRE) != 0)
-    {
-    }
-}
-
-CT_NOINSTR void ct_lock_release(void)
-{
-    __atomic_store_n(&ct_alloc_lock, 0, __ATOMIC_RELEASE);
-}
-
-CT_NODISCARD CT_NOINSTR static size_t ct_hash_ptr(const void* ptr, size_t mask)
-{
-    uintptr_t value = reinterpret_cast<uintptr_t>(ptr);
-    value ^= value >> 4;
-    value ^= value >> 9;
-    return static_cast<size_t>(value) & mask;
-}
-
 CT_NODISCARD CT_NOINSTR static uint64_t ct_time_ns(void)
 {
     auto now = std::chrono::steady_clock::now().time_since_epoch();
     return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
 }
 
-CT_NODISCARD CT_NOINSTR static uint64_t ct_env_u64(const char* name, uint64_t def_value)
-{
-    const char* value = std::getenv(name);
-    if (!value || !*value)
-    {
-        return def_value;
-    }
-    char* end = nullptr;
-    unsigned long long parsed = std::strtoull(value, &end, 10);
-    if (end == value)
-    {
-        return def_value;
-    }
-    return static_cast<uint64_t>(parsed);
-}
-
 CT_NODISCARD CT_NOINSTR static double ct_env_f64(const char* name, double def_value)
 {
     const char* value = std::getenv(name);
@@ -289,74 +232,26 @@ CT_NODISCARD CT_NOINSTR static int ct_scan_time_exceeded_fast(uint64_t start_ns,
     return 0;
 }
 
-CT_NODISCARD CT_NOINSTR static struct ct_alloc_entry* ct_table_find_entry(const void* ptr)
-{
-    size_t idx = ct_hash_ptr(ptr, ct_alloc_table_mask);
-    for (size_t i = 0; i < ct_alloc_table_size; ++i)
-    {
-        size_t pos = (idx + i) & ct_alloc_table_mask;
-        struct ct_alloc_entry* entry = &ct_alloc_table[pos];
-        if (entry->state == CT_ENTRY_EMPTY)
-        {
-            return nullptr;
-        }
-        if (entry->ptr == ptr && (entry->state == CT_ENTRY_USED || entry->state == CT_ENTRY_FREED ||
-                                  entry->state == CT_ENTRY_AUTOFREED))
-        {
-            return entry;
-        }
-    }
-    return nullptr;
-}
-
-CT_NODISCARD CT_NOINSTR static struct ct_alloc_entry*
-ct_table_find_entry_containing(const void* ptr)
-{
-    if (!ptr)
-    {
-        return nullptr;
-    }
-    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
-    for (size_t i = 0; i < ct_alloc_table_size; ++i)
-    {
-        struct ct_alloc_entry* entry = &ct_alloc_table[i];
-        if (entry->state != CT_ENTRY_USED)
-        {
-            continue;
-        }
-        if (!entry->ptr || entry->size == 0)
-        {
-            continue;
-        }
-        uintptr_t base = reinterpret_cast<uintptr_t>(entry->ptr);
-        if (addr >= base && (addr - base) < entry->size)
-        {
-            return entry;
-        }
-    }
-    return nullptr;
-}
-
 CT_NOINSTR static void ct_autofree_mark_value(uintptr_t value)
 {
     if (!value)
     {
         return;
     }
-    struct ct_alloc_entry* entry = ct_table_find_entry(reinterpret_cast<const void*>(value));
-    if (entry && entry->state == CT_ENTRY_USED)
+    struct ct_alloc_meta* entry = ct_table_find_entry_locked(reinterpret_cast<const void*>(value));
+    if (entry && ct_meta_state(entry) == CT_ENTRY_USED)
     {
-        entry->mark = 1;
+        ct_meta_set_mark(entry, 1);
         return;
     }
     if (!ct_autofree_scan_interior.load(std::memory_order_relaxed))
     {
         return;
     }
-    entry = ct_table_find_entry_containing(reinterpret_cast<const void*>(value));
-    if (entry && entry->state == CT_ENTRY_USED)
+    entry = ct_table_find_entry_containing_locked(reinterpret_cast<const void*>(value));
+    if (entry && ct_meta_state(entry) == CT_ENTRY_USED)
     {
-        entry->mark = 1;
+        ct_meta_set_mark(entry, 1);
     }
 }
 
@@ -953,7 +848,7 @@ CT_NOINSTR static void ct_autofree_do_free(const struct ct_autofree_free_item& i
     case CT_ALLOC_KIND_MMAP:
         if (ct_is_enabled(CT_FEATURE_SHADOW))
         {
-            ct_shadow_poison_range(item.ptr, item.size);
+            ct_shadow_release_range(item.ptr, item.size);
         }
         ct_log(CTLevel::Warn, "{}auto-free(scan) kind={} ptr={:p} size={} site={}{}\n",
                ct_color(CTColor::BgBrightYellow), ct_alloc_kind_label(item.kind), item.ptr,
@@ -1003,6 +898,48 @@ CT_NOINSTR static void ct_autofree_do_free(const struct ct_autofree_free_item& i
     }
 }
 
+struct ct_autofree_collect_ctx
+{
+    struct ct_autofree_free_item* items;
+    size_t capacity;
+    size_t count;
+};
+
+CT_NOINSTR static void ct_autofree_clear_mark(void*, struct ct_alloc_meta* entry, void*)
+{
+    ct_meta_begin_scan(entry, ct_autofree_scan_epoch);
+}
+
+// Entries added after the marks were cleared were never eligible for marking.
+CT_NODISCARD CT_NOINSTR static int ct_autofree_is_garbage(const struct ct_alloc_meta* entry)
+{
+    return !ct_meta_mark(entry) && ct_meta_epoch(entry) == ct_autofree_scan_epoch;
+}
+
+CT_NOINSTR static void ct_autofree_count_unmarked(void*, struct ct_alloc_meta* entry, void* ctx)
+{
+    if (ct_autofree_is_garbage(entry))
+    {
+        ++*static_cast<size_t*>(ctx);
+    }
+}
+
+CT_NOINSTR static void ct_autofree_collect_unmarked(void* ptr, struct ct_alloc_meta* entry,
+                                                    void* ctx)
+{
+    auto* collect = static_cast<struct ct_autofree_collect_ctx*>(ctx);
+    if (!ct_autofree_is_garbage(entry) || collect->count >= collect->capacity)
+    {
+        return;
+    }
+    struct ct_autofree_free_item& item = collect->items[collect->count++];
+    item.ptr = ptr;
+    item.size = ct_meta_size(entry);
+    item.site = ct_meta_site(entry);
+    item.kind = ct_meta_kind(entry);
+    ct_table_mark_autofreed_locked(ptr, entry);
+}
+
 CT_NOINSTR static void ct_autofree_gc_scan(int force, const char* reason)
 {
     ct_init_env_once();
@@ -1018,6 +955,7 @@ CT_NOINSTR static void ct_autofree_gc_scan(int force, const char* reason)
     }
     if (!force && !ct_autofree_gc_should_run())
     {
+        ct_autofree_scan_in_progress.store(0, std::memory_order_release);
         return;
     }
 
@@ -1030,7 +968,11 @@ CT_NOINSTR static void ct_autofree_gc_scan(int force, const char* reason)
         return;
     }
 
-    ct_lock_acquire();
+    // Flush the thread caches while their owners still run: a thread
+    // suspended inside a cache update holds that cache's lock. Entries cached
+    // from here on stay out of the walks below.
+    ct_table_lock_all();
+    ct_autofree_scan_epoch = ct_autofree_scan_epoch % CT_META_EPOCH_MASK + 1u;
     thread_t self_thread = mach_thread_self();
     for (mach_msg_type_number_t i = 0; i < thread_count; ++i)
     {
@@ -1042,13 +984,7 @@ CT_NOINSTR static void ct_autofree_gc_scan(int force, const char* reason)
     }
 
     // Single pass: reset marks for used entries
-    for (size_t i = 0; i < ct_alloc_table_size; ++i)
-    {
-        if (ct_alloc_table[i].state == CT_ENTRY_USED)
-        {
-            ct_alloc_table[i].mark = 0;
-        }
-    }
+    ct_table_for_each_live_locked(ct_autofree_clear_mark, nullptr);
 
     int timed_out = 0;
     for (mach_msg_type_number_t i = 0; i < thread_count && !timed_out; ++i)
@@ -1067,50 +1003,28 @@ CT_NOINSTR static void ct_autofree_gc_scan(int force, const char* reason)
 
     // Single pass: count and collect unmarked entries
     size_t to_free_count = 0;
-    size_t idx = 0;
-    struct ct_autofree_free_item* items = nullptr;
+    struct ct_autofree_collect_ctx collect = {nullptr, 0, 0};
 
     if (!timed_out)
     {
-        for (size_t i = 0; i < ct_alloc_table_size; ++i)
-        {
-            if (ct_alloc_table[i].state == CT_ENTRY_USED && ct_alloc_table[i].mark == 0)
-            {
-                ++to_free_count;
-            }
-        }
+        ct_table_for_each_live_locked(ct_autofree_count_unmarked, &to_free_count);
     }
 
-    ct_lock_release();
+    ct_table_unlock_all();
 
     if (!timed_out && to_free_count > 0)
     {
-        items = static_cast<struct ct_autofree_free_item*>(
+        collect.items = static_cast<struct ct_autofree_free_item*>(
             std::malloc(sizeof(struct ct_autofree_free_item) * to_free_count));
+        collect.capacity = to_free_count;
     }
 
-    ct_lock_acquire();
-    if (!timed_out && items)
+    ct_table_lock_shards();
+    if (!timed_out && collect.items)
     {
-        for (size_t i = 0; i < ct_alloc_table_size && idx < to_free_count; ++i)
-        {
-            struct ct_alloc_entry* entry = &ct_alloc_table[i];
-            if (entry->state == CT_ENTRY_USED && entry->mark == 0)
-            {
-                items[idx].ptr = entry->ptr;
-                items[idx].size = entry->size;
-                items[idx].site = entry->site;
-                items[idx].kind = entry->kind;
-                ++idx;
-                entry->state = CT_ENTRY_AUTOFREED;
-                if (ct_alloc_count > 0)
-                {
-                    --ct_alloc_count;
-                }
-            }
-        }
+        ct_table_for_each_live_locked(ct_autofree_collect_unmarked, &collect);
     }
-    ct_lock_release();
+    ct_table_unlock_all();
 
     const int debug_level = ct_autofree_scan_debug.load(std::memory_order_relaxed);
     if (debug_level > 1 || (debug_level == 1 && (timed_out || to_free_count > 0)))
@@ -1120,16 +1034,16 @@ CT_NOINSTR static void ct_autofree_gc_scan(int force, const char* reason)
                to_free_count, ct_color(CTColor::Reset));
     }
 
-    if (!timed_out && items)
+    if (!timed_out && collect.items)
     {
-        for (size_t i = 0; i < idx; ++i)
+        for (size_t i = 0; i < collect.count; ++i)
         {
-            ct_autofree_do_free(items[i]);
+            ct_autofree_do_free(collect.items[i]);
         }
     }
-    if (items)
+    if (collect.items)
     {
-        std::free(items);
+        std::free(collect.items);
     }
 
     for (mach_msg_type_number_t i = 0; i < thread_count; ++i)
@@ -1219,365 +1133,6 @@ CT_NOINSTR __attribute__((constructor)) static void ct_autofree_scan_ctor(void)
     }
 }
 
-CT_NODISCARD CT_NOINSTR static int ct_alloc_rehash_entry(struct ct_alloc_entry* table, size_t mask,
-                                                         size_t size,
-                                                         const struct ct_alloc_entry* entry)
-{
-    size_t idx = ct_hash_ptr(entry->ptr, mask);
-    for (size_t i = 0; i < size; ++i)
-    {
-        size_t pos = (idx + i) & mask;
-        struct ct_alloc_entry* slot = &table[pos];
-
-        if (slot->state == CT_ENTRY_EMPTY)
-        {
-            *slot = *entry;
-            return 1;
-        }
-    }
-    return 0;
-}
-
-CT_NODISCARD CT_NOINSTR static int ct_alloc_grow_locked(void)
-{
-    if (ct_alloc_table_bits >= CT_ALLOC_TABLE_MAX_BITS)
-        return 0;
-
-    size_t new_bits = ct_alloc_table_bits + 1u;
-    size_t new_size = 1u << new_bits;
-    auto* new_table =
-        static_cast<struct ct_alloc_entry*>(std::malloc(sizeof(struct ct_alloc_entry) * new_size));
-    if (!new_table)
-        return 0;
-
-    std::memset(new_table, 0, sizeof(struct ct_alloc_entry) * new_size);
-
-    size_t new_mask = new_size - 1u;
-    size_t new_count = 0;
-    for (size_t i = 0; i < ct_alloc_table_size; ++i)
-    {
-        struct ct_alloc_entry* entry = &ct_alloc_table[i];
-
-        if (entry->state != CT_ENTRY_USED && entry->state != CT_ENTRY_FREED &&
-            entry->state != CT_ENTRY_AUTOFREED)
-            continue;
-
-        if (ct_alloc_rehash_entry(new_table, new_mask, new_size, entry))
-        {
-            if (entry->state == CT_ENTRY_USED)
-                ++new_count;
-        }
-    }
-
-    if (ct_alloc_table != ct_alloc_table_storage)
-        std::free(ct_alloc_table);
-
-    ct_alloc_table = new_table;
-    ct_alloc_table_bits = new_bits;
-    ct_alloc_table_size = new_size;
-    ct_alloc_table_mask = new_mask;
-    ct_alloc_count = new_count;
-    ct_alloc_table_full_logged = 0;
-
-    return 1;
-}
-
-CT_NODISCARD CT_NOINSTR int ct_table_insert(void* ptr, size_t req_size, size_t size,
-                                            const char* site, unsigned char kind)
-{
-    for (int attempt = 0; attempt < 2; ++attempt)
-    {
-        size_t idx = ct_hash_ptr(ptr, ct_alloc_table_mask);
-        size_t tombstone = static_cast<size_t>(-1);
-
-        for (size_t i = 0; i < ct_alloc_table_size; ++i)
-        {
-            size_t pos = (idx + i) & ct_alloc_table_mask;
-            struct ct_alloc_entry* entry = &ct_alloc_table[pos];
-
-            if (entry->state == CT_ENTRY_USED)
-            {
-                if (entry->ptr == ptr)
-                {
-                    entry->size = size;
-                    entry->req_size = req_size;
-                    entry->site = site;
-                    entry->kind = kind;
-                    entry->mark = 0;
-                    return 1;
-                }
-                continue;
-            }
-
-            if ((entry->state == CT_ENTRY_TOMB || entry->state == CT_ENTRY_FREED ||
-                 entry->state == CT_ENTRY_AUTOFREED) &&
-                tombstone == static_cast<size_t>(-1))
-            {
-                tombstone = pos;
-                continue;
-            }
-
-            if (entry->state == CT_ENTRY_EMPTY)
-            {
-                if (tombstone != static_cast<size_t>(-1))
-                {
-                    entry = &ct_alloc_table[tombstone];
-                }
-                entry->ptr = ptr;
-                entry->size = size;
-                entry->req_size = req_size;
-                entry->site = site;
-                entry->kind = kind;
-                entry->mark = 0;
-                entry->state = CT_ENTRY_USED;
-                ++ct_alloc_count;
-                return 1;
-            }
-        }
-
-        if (tombstone != static_cast<size_t>(-1))
-        {
-            struct ct_alloc_entry* entry = &ct_alloc_table[tombstone];
-            entry->ptr = ptr;
-            entry->size = size;
-            entry->req_size = req_size;
-            entry->site = site;
-            entry->kind = kind;
-            entry->mark = 0;
-            entry->state = CT_ENTRY_USED;
-            ++ct_alloc_count;
-            return 1;
-        }
-
-        if (!ct_alloc_grow_locked())
-        {
-            return 0;
-        }
-    }
-
-    return 0;
-}
-
-CT_NODISCARD CT_NOINSTR int ct_table_remove(void* ptr, size_t* size_out, size_t* req_size_out,
-                                            const char** site_out)
-{
-    size_t idx = ct_hash_ptr(ptr, ct_alloc_table_mask);
-
-    for (size_t i = 0; i < ct_alloc_table_size; ++i)
-    {
-        size_t pos = (idx + i) & ct_alloc_table_mask;
-        struct ct_alloc_entry* entry = &ct_alloc_table[pos];
-
-        if (entry->state == CT_ENTRY_EMPTY)
-        {
-            return 0;
-        }
-        if (entry->state == CT_ENTRY_USED && entry->ptr == ptr)
-        {
-            if (size_out)
-            {
-                *size_out = entry->size;
-            }
-            if (req_size_out)
-            {
-                *req_size_out = entry->req_size;
-            }
-            if (site_out)
-            {
-                *site_out = entry->site;
-            }
-            if (ct_alloc_count > 0)
-            {
-                --ct_alloc_count;
-            }
-            entry->state = CT_ENTRY_FREED;
-            return 1;
-        }
-        if ((entry->state == CT_ENTRY_FREED || entry->state == CT_ENTRY_AUTOFREED) &&
-            entry->ptr == ptr)
-        {
-            if (size_out)
-            {
-                *size_out = entry->size;
-            }
-            if (req_size_out)
-            {
-                *req_size_out = entry->req_size;
-            }
-            if (site_out)
-            {
-                *site_out = entry->site;
-            }
-            return -1;
-        }
-    }
-
-    return 0;
-}
-
-CT_NODISCARD CT_NOINSTR int ct_table_remove_autofree(void* ptr, size_t* size_out,
-                                                     size_t* req_size_out, const char** site_out)
-{
-    size_t idx = ct_hash_ptr(ptr, ct_alloc_table_mask);
-
-    for (size_t i = 0; i < ct_alloc_table_size; ++i)
-    {
-        size_t pos = (idx + i) & ct_alloc_table_mask;
-        struct ct_alloc_entry* entry = &ct_alloc_table[pos];
-
-        if (entry->state == CT_ENTRY_EMPTY)
-        {
-            return 0;
-        }
-        if (entry->state == CT_ENTRY_USED && entry->ptr == ptr)
-        {
-            if (size_out)
-            {
-                *size_out = entry->size;
-            }
-            if (req_size_out)
-            {
-                *req_size_out = entry->req_size;
-            }
-            if (site_out)
-            {
-                *site_out = entry->site;
-            }
-            if (ct_alloc_count > 0)
-            {
-                --ct_alloc_count;
-            }
-            entry->state = CT_ENTRY_AUTOFREED;
-            return 1;
-        }
-        if (entry->state == CT_ENTRY_AUTOFREED && entry->ptr == ptr)
-        {
-            if (size_out)
-            {
-                *size_out = entry->size;
-            }
-            if (req_size_out)
-            {
-                *req_size_out = entry->req_size;
-            }
-            if (site_out)
-            {
-                *site_out = entry->site;
-            }
-            return -2;
-        }
-        if (entry->state == CT_ENTRY_FREED && entry->ptr == ptr)
-        {
-            if (size_out)
-            {
-                *size_out = entry->size;
-            }
-            if (req_size_out)
-            {
-                *req_size_out = entry->req_size;
-            }
-            if (site_out)
-            {
-                *site_out = entry->site;
-            }
-            return -1;
-        }
-    }
-
-    return 0;
-}
-
-CT_NODISCARD CT_NOINSTR int ct_table_lookup(const void* ptr, size_t* size_out, size_t* req_size_out,
-                                            const char** site_out, unsigned char* state_out)
-{
-    size_t idx = ct_hash_ptr(ptr, ct_alloc_table_mask);
-
-    for (size_t i = 0; i < ct_alloc_table_size; ++i)
-    {
-        size_t pos = (idx + i) & ct_alloc_table_mask;
-        struct ct_alloc_entry* entry = &ct_alloc_table[pos];
-
-        if (entry->state == CT_ENTRY_EMPTY)
-        {
-            return 0;
-        }
-        if ((entry->state == CT_ENTRY_USED || entry->state == CT_ENTRY_FREED ||
-             entry->state == CT_ENTRY_AUTOFREED) &&
-            entry->ptr == ptr)
-        {
-            if (size_out)
-            {
-                *size_out = entry->size;
-            }
-            if (req_size_out)
-            {
-                *req_size_out = entry->req_size;
-            }
-            if (site_out)
-            {
-                *site_out = entry->site;
-            }
-            if (state_out)
-            {
-                *state_out = entry->state;
-            }
-            return 1;
-        }
-    }
-
-    return 0;
-}
-
-CT_NODISCARD CT_NOINSTR int ct_table_lookup_containing(const void* ptr, void** base_out,
-                                                       size_t* size_out, size_t* req_size_out,
-                                                       const char** site_out,
-                                                       unsigned char* state_out)
-{
-    if (!ptr)
-        return 0;
-
-    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
-
-    for (size_t i = 0; i < ct_alloc_table_size; ++i)
-    {
-        struct ct_alloc_entry* entry = &ct_alloc_table[i];
-        if (entry->state != CT_ENTRY_USED && entry->state != CT_ENTRY_FREED &&
-            entry->state != CT_ENTRY_AUTOFREED)
-            continue;
-
-        if (!entry->ptr || entry->size == 0)
-            continue;
-
-        uintptr_t base = reinterpret_cast<uintptr_t>(entry->ptr);
-        if (addr >= base && (addr - base) < entry->size)
-        {
-            if (base_out)
-            {
-                *base_out = entry->ptr;
-            }
-            if (size_out)
-            {
-                *size_out = entry->size;
-            }
-            if (req_size_out)
-            {
-                *req_size_out = entry->req_size;
-            }
-            if (site_out)
-            {
-                *site_out = entry->site;
-            }
-            if (state_out)
-            {
-                *state_out = entry->state;
-            }
-            return 1;
-        }
-    }
-
-    return 0;
-}
-
 CT_NODISCARD CT_NOINSTR static size_t ct_malloc_usable_size(void* ptr, size_t fallback)
 {
     if (!ptr)
@@ -1597,7 +1152,8 @@ CT_NOINSTR static void ct_shadow_track_alloc(void* ptr, size_t req_size, size_t
     if (!ct_is_enabled(CT_FEATURE_SHADOW) || !ptr)
         return;
 
-    ct_shadow_unpoison_range(ptr, req_size);
+    if (req_size < CT_SHADOW_LAZY_MIN)
+        ct_shadow_unpoison_range(ptr, req_size);
     uintptr_t start = reinterpret_cast<uintptr_t>(ptr) + req_size;
     uintptr_t end = reinterpret_cast<uintptr_t>(ptr) + real_size;
     uintptr_t poison_start = (start + 7u) & ~static_cast<uintptr_t>(7u);
@@ -1650,17 +1206,7 @@ CT_NODISCARD CT_NOINSTR static void* ct_malloc_impl(size_t size, const char* sit
     void* ptr = malloc(size);
     size_t real_size = ct_malloc_usable_size(ptr, size);
 
-    ct_lock_acquire();
-    if (ptr && !ct_table_insert(ptr, size, real_size, site, CT_ALLOC_KIND_MALLOC))
-    {
-        if (!ct_alloc_table_full_logged)
-        {
-            ct_alloc_table_full_logged = 1;
-            ct_log(CTLevel::Warn, "{}alloc table full ({} entries){}\n", ct_color(CTColor::Red),
-                   ct_alloc_table_size, ct_color(CTColor::Reset));
-        }
-    }
-    ct_lock_release();
+    (void)ct_table_insert(ptr, size, real_size, site, CT_ALLOC_KIND_MALLOC);
 
     ct_shadow_track_alloc(ptr, size, real_size);
 
@@ -1704,17 +1250,7 @@ CT_NODISCARD CT_NOINSTR static void* ct_calloc_impl(size_t count, size_t size, c
     size_t real_size = ct_malloc_usable_size(ptr, req_size);
     size_t shadow_size = overflow ? real_size : req_size;
 
-    ct_lock_acquire();
-    if (ptr && !ct_table_insert(ptr, req_size, real_size, site, CT_ALLOC_KIND_MALLOC))
-    {
-        if (!ct_alloc_table_full_logged)
-        {
-            ct_alloc_table_full_logged = 1;
-            ct_log(CTLevel::Warn, "{}alloc table full ({} entries){}\n", ct_color(CTColor::Red),
-                   ct_alloc_table_size, ct_color(CTColor::Reset));
-        }
-    }
-    ct_lock_release();
+    (void)ct_table_insert(ptr, req_size, real_size, site, CT_ALLOC_KIND_MALLOC);
 
     ct_shadow_track_alloc(ptr, shadow_size, real_size);
 
@@ -1752,18 +1288,8 @@ CT_NODISCARD CT_NOINSTR static void* ct_new_impl(size_t size, const char* site,
     void* ptr = is_array ? ::operator new[](size) : ::operator new(size);
     size_t real_size = ct_malloc_usable_size(ptr, size);
 
-    ct_lock_acquire();
     unsigned char kind = is_array ? CT_ALLOC_KIND_NEW_ARRAY : CT_ALLOC_KIND_NEW;
-    if (ptr && !ct_table_insert(ptr, size, real_size, site, kind))
-    {
-        if (!ct_alloc_table_full_logged)
-        {
-            ct_alloc_table_full_logged = 1;
-            ct_log(CTLevel::Warn, "{}alloc table full ({} entries){}\n", ct_color(CTColor::Red),
-                   ct_alloc_table_size, ct_color(CTColor::Reset));
-        }
-    }
-    ct_lock_release();
+    (void)ct_table_insert(ptr, size, real_size, site, kind);
 
     ct_shadow_track_alloc(ptr, size, real_size);
 
@@ -1809,17 +1335,7 @@ CT_NODISCARD CT_NOINSTR static void* ct_new_nothrow_impl(size_t size, const char
     size_t real_size = ct_malloc_usable_size(ptr, size);
 
     unsigned char kind = is_array ? CT_ALLOC_KIND_NEW_ARRAY : CT_ALLOC_KIND_NEW;
-    ct_lock_acquire();
-    if (ptr && !ct_table_insert(ptr, size, real_size, site, kind))
-    {
-        if (!ct_alloc_table_full_logged)
-        {
-            ct_alloc_table_full_logged = 1;
-            ct_log(CTLevel::Warn, "{}alloc table full ({} entries){}\n", ct_color(CTColor::Red),
-                   ct_alloc_table_size, ct_color(CTColor::Reset));
-        }
-    }
-    ct_lock_release();
+    (void)ct_table_insert(ptr, size, real_size, site, kind);
 
     ct_shadow_track_alloc(ptr, size, real_size);
 
@@ -1861,12 +1377,9 @@ CT_NODISCARD CT_NOINSTR static void* ct_realloc_impl(void* ptr, size_t size, con
     size_t old_req_size = 0;
     int had_entry = 0;
 
-    ct_lock_acquire();
     if (ptr)
         had_entry = ct_table_lookup(ptr, &old_size, &old_req_size, nullptr, nullptr);
 
-    ct_lock_release();
-
     void* new_ptr = realloc(ptr, size);
     if (!new_ptr && size > 0)
     {
@@ -1880,27 +1393,20 @@ CT_NODISCARD CT_NOINSTR static void* ct_realloc_impl(void* ptr, size_t size, con
 
     size_t real_size = ct_malloc_usable_size(new_ptr, size);
 
-    ct_lock_acquire();
     if (new_ptr)
     {
         if (ptr && new_ptr != ptr)
             (void)ct_table_remove(ptr, nullptr, nullptr, nullptr);
 
-        if (!ct_table_insert(new_ptr, size, real_size, site, CT_ALLOC_KIND_MALLOC))
-        {
-            if (!ct_alloc_table_full_logged)
-            {
-                ct_alloc_table_full_logged = 1;
-                ct_log(CTLevel::Warn, "{}alloc table full ({} entries){}\n", ct_color(CTColor::Red),
-                       ct_alloc_table_size, ct_color(CTColor::Reset));
-            }
-        }
+        if (new_ptr == ptr)
+            (void)ct_table_update(new_ptr, size, real_size, site, CT_ALLOC_KIND_MALLOC);
+        else
+            (void)ct_table_insert(new_ptr, size, real_size, site, CT_ALLOC_KIND_MALLOC);
     }
     else if (ptr && size == 0)
     {
         (void)ct_table_remove(ptr, nullptr, nullptr, nullptr);
     }
-    ct_lock_release();
 
     if (ct_is_enabled(CT_FEATURE_SHADOW))
     {
@@ -1967,12 +1473,9 @@ CT_NOINSTR static void ct_delete_impl(void* ptr, int is_array)
     int found = 0;
     (void)req_size;
 
-    ct_lock_acquire();
     if (ptr)
         found = ct_table_remove(ptr, &size, &req_size, &site);
 
-    ct_lock_release();
-
     const char* label = is_array ? "tracing-delete-array" : "tracing-delete";
 
     if (!ptr)
@@ -2053,12 +1556,9 @@ CT_NOINSTR static void ct_delete_nothrow_impl(void* ptr, int is_array)
     int found = 0;
     (void)req_size;
 
-    ct_lock_acquire();
     if (ptr)
         found = ct_table_remove(ptr, &size, &req_size, &site);
 
-    ct_lock_release();
-
     const char* label = is_array ? "tracing-delete-array" : "tracing-delete";
 
     if (!ptr)
@@ -2139,12 +1639,9 @@ CT_NOINSTR static void ct_delete_destroying_impl(void* ptr, int is_array)
     int found = 0;
     (void)req_size;
 
-    ct_lock_acquire();
     if (ptr)
         found = ct_table_remove(ptr, &size, &req_size, &site);
 
-    ct_lock_release();
-
     const char* label = is_array ? "tracing-delete-array" : "tracing-delete";
 
     if (!ptr)
@@ -2289,17 +1786,7 @@ extern "C"
         void* ptr = *out;
         size_t real_size = ct_malloc_usable_size(ptr, size);
 
-        ct_lock_acquire();
-        if (!ct_table_insert(ptr, size, real_size, site, CT_ALLOC_KIND_MALLOC))
-        {
-            if (!ct_alloc_table_full_logged)
-            {
-                ct_alloc_table_full_logged = 1;
-                ct_log(CTLevel::Warn, "{}alloc table full ({} entries){}\n", ct_color(CTColor::Red),
-                       ct_alloc_table_size, ct_color(CTColor::Reset));
-            }
-        }
-        ct_lock_release();
+        (void)ct_table_insert(ptr, size, real_size, site, CT_ALLOC_KIND_MALLOC);
 
         ct_shadow_track_alloc(ptr, size, real_size);
 
@@ -2322,17 +1809,7 @@ extern "C"
         void* ptr = aligned_alloc(align, size);
         size_t real_size = ct_malloc_usable_size(ptr, size);
 
-        ct_lock_acquire();
-        if (ptr && !ct_table_insert(ptr, size, real_size, site, CT_ALLOC_KIND_MALLOC))
-        {
-            if (!ct_alloc_table_full_logged)
-            {
-                ct_alloc_table_full_logged = 1;
-                ct_log(CTLevel::Warn, "{}alloc table full ({} entries){}\n", ct_color(CTColor::Red),
-                       ct_alloc_table_size, ct_color(CTColor::Reset));
-            }
-        }
-        ct_lock_release();
+        (void)ct_table_insert(ptr, size, real_size, site, CT_ALLOC_KIND_MALLOC);
 
         ct_shadow_track_alloc(ptr, size, real_size);
 
@@ -2355,17 +1832,7 @@ extern "C"
             return ptr;
         }
 
-        ct_lock_acquire();
-        if (!ct_table_insert(ptr, len, len, site, CT_ALLOC_KIND_MMAP))
-        {
-            if (!ct_alloc_table_full_logged)
-            {
-                ct_alloc_table_full_logged = 1;
-                ct_log(CTLevel::Warn, "{}alloc table full ({} entries){}\n", ct_color(CTColor::Red),
-                       ct_alloc_table_size, ct_color(CTColor::Reset));
-            }
-        }
-        ct_lock_release();
+        (void)ct_table_insert(ptr, len, len, site, CT_ALLOC_KIND_MMAP);
 
         ct_shadow_track_alloc(ptr, len, len);
 
@@ -2387,16 +1854,14 @@ extern "C"
         int found = 0;
         (void)req_size;
 
-        ct_lock_acquire();
         if (addr)
         {
             found = ct_table_remove(addr, &size, &req_size, &alloc_site);
         }
-        ct_lock_release();
 
-        if (ct_is_enabled(CT_FEATURE_SHADOW) && found > 0)
+        if (ct_is_enabled(CT_FEATURE_SHADOW))
         {
-            ct_shadow_poison_range(addr, size);
+            ct_shadow_release_range(addr, found > 0 ? size : len);
         }
 
         if (ct_is_enabled(CT_FEATURE_ALLOC_TRACE))
@@ -2424,17 +1889,7 @@ extern "C"
 
         if (static_cast<intptr_t>(incr) > 0)
         {
-            ct_lock_acquire();
-            if (!ct_table_insert(prev, incr, incr, site, CT_ALLOC_KIND_SBRK))
-            {
-                if (!ct_alloc_table_full_logged)
-                {
-                    ct_alloc_table_full_logged = 1;
-                    ct_log(CTLevel::Warn, "{}alloc table full ({} entries){}\n",
-                           ct_color(CTColor::Red), ct_alloc_table_size, ct_color(CTColor::Reset));
-                }
-            }
-            ct_lock_release();
+            (void)ct_table_insert(prev, incr, incr, site, CT_ALLOC_KIND_SBRK);
 
             if (ct_is_enabled(CT_FEATURE_SHADOW))
             {
@@ -2452,9 +1907,7 @@ extern "C"
             size_t size = 0;
             size_t req_size = 0;
             const char* alloc_site = nullptr;
-            ct_lock_acquire();
             (void)ct_table_remove(new_break, &size, &req_size, &alloc_site);
-            ct_lock_release();
             if (ct_is_enabled(CT_FEATURE_SHADOW) && size)
             {
                 ct_shadow_poison_range(new_break, size);
@@ -2522,9 +1975,7 @@ extern "C"
             ct_autofree_scan_ptr.load(std::memory_order_acquire))
         {
             unsigned char state = CT_ENTRY_EMPTY;
-            ct_lock_acquire();
             int lookup = ct_table_lookup(ptr, &size, &req_size, &site, &state);
-            ct_lock_release();
             if (lookup == 1 && state == CT_ENTRY_USED)
             {
                 if (ct_autofree_scan_for_ptr(ptr, size))
@@ -2534,9 +1985,7 @@ extern "C"
             }
         }
 
-        ct_lock_acquire();
         found = ct_table_remove_autofree(ptr, &size, &req_size, &site);
-        ct_lock_release();
 
         if (found == -2)
         {
@@ -2591,9 +2040,7 @@ extern "C"
             ct_autofree_scan_ptr.load(std::memory_order_acquire))
         {
             unsigned char state = CT_ENTRY_EMPTY;
-            ct_lock_acquire();
             int lookup = ct_table_lookup(ptr, &size, &req_size, &site, &state);
-            ct_lock_release();
             if (lookup == 1 && state == CT_ENTRY_USED)
             {
                 if (ct_autofree_scan_for_ptr(ptr, size))
@@ -2603,9 +2050,7 @@ extern "C"
             }
         }
 
-        ct_lock_acquire();
         found = ct_table_remove_autofree(ptr, &size, &req_size, &site);
-        ct_lock_release();
 
         if (found == -2)
         {
@@ -2655,9 +2100,7 @@ extern "C"
             ct_autofree_scan_ptr.load(std::memory_order_acquire))
         {
             unsigned char state = CT_ENTRY_EMPTY;
-            ct_lock_acquire();
             int lookup = ct_table_lookup(ptr, &size, &req_size, &site, &state);
-            ct_lock_release();
             if (lookup == 1 && state == CT_ENTRY_USED)
             {
                 if (ct_autofree_scan_for_ptr(ptr, size))
@@ -2667,9 +2110,7 @@ extern "C"
             }
         }
 
-        ct_lock_acquire();
         found = ct_table_remove_autofree(ptr, &size, &req_size, &site);
-        ct_lock_release();
 
         if (found == -2)
         {
@@ -2735,9 +2176,7 @@ extern "C"
             ct_autofree_scan_ptr.load(std::memory_order_acquire))
         {
             unsigned char state = CT_ENTRY_EMPTY;
-            ct_lock_acquire();
             int lookup = ct_table_lookup(ptr, &size, &req_size, &site, &state);
-            ct_lock_release();
             if (lookup == 1 && state == CT_ENTRY_USED)
             {
                 if (ct_autofree_scan_for_ptr(ptr, size))
@@ -2747,9 +2186,7 @@ extern "C"
             }
         }
 
-        ct_lock_acquire();
         found = ct_table_remove_autofree(ptr, &size, &req_size, &site);
-        ct_lock_release();
 
         if (found == -2)
         {
@@ -2799,9 +2236,7 @@ extern "C"
             ct_autofree_scan_ptr.load(std::memory_order_acquire))
         {
             unsigned char state = CT_ENTRY_EMPTY;
-            ct_lock_acquire();
             int lookup = ct_table_lookup(ptr, &size, &req_size, &site, &state);
-            ct_lock_release();
             if (lookup == 1 && state == CT_ENTRY_USED)
             {
                 if (ct_autofree_scan_for_ptr(ptr, size))
@@ -2811,9 +2246,7 @@ extern "C"
             }
         }
 
-        ct_lock_acquire();
         found = ct_table_remove_autofree(ptr, &size, &req_size, &site);
-        ct_lock_release();
 
         if (found == -2)
         {
@@ -2853,12 +2286,10 @@ extern "C"
         int found = 0;
         (void)req_size;
 
-        ct_lock_acquire();
         if (ptr)
         {
             found = ct_table_remove(ptr, &size, &req_size, &site);
         }
-        ct_lock_release();
 
         if (!ptr)
         {
@@ -2934,43 +2365,53 @@ extern "C"
 
 } // extern "C"
 
-CT_NOINSTR __attribute__((destructor)) static void ct_report_leaks(void)
+struct ct_leak_report_ctx
 {
-    if (ct_alloc_count == 0)
-        return;
+    size_t reported;
+};
 
-    ct_disable_logging();
+CT_NOINSTR static void ct_report_leak_entry(void* ptr, struct ct_alloc_meta* entry, void* ctx)
+{
+    auto* report = static_cast<struct ct_leak_report_ctx*>(ctx);
+    if (report->reported >= 32)
+        return;
 
-    ct_write_prefix(CTLevel::Error);
-    ct_write_str(ct_color(CTColor::Red));
-    ct_write_cstr("ct: leaks detected count=");
-    ct_write_dec(ct_alloc_count);
+    ct_write_prefix(CTLevel::Warn);
+    ct_write_str(ct_color(CTColor::Yellow));
+    ct_write_cstr("ct: leak ptr=");
+    ct_write_hex(reinterpret_cast<uintptr_t>(ptr));
+    ct_write_cstr(" size=");
+    ct_write_dec(ct_meta_size(entry));
     ct_write_str(ct_color(CTColor::Reset));
     ct_write_cstr("\n");
 
-    size_t reported = 0;
-    for (size_t i = 0; i < ct_alloc_table_size; ++i)
+    if (++report->reported >= 32)
     {
-        if (ct_alloc_table[i].state != CT_ENTRY_USED)
-            continue;
-
         ct_write_prefix(CTLevel::Warn);
         ct_write_str(ct_color(CTColor::Yellow));
-        ct_write_cstr("ct: leak ptr=");
-        ct_write_hex(reinterpret_cast<uintptr_t>(ct_alloc_table[i].ptr));
-        ct_write_cstr(" size=");
-        ct_write_dec(ct_alloc_table[i].size);
+        ct_write_cstr("ct: leak list truncated");
         ct_write_str(ct_color(CTColor::Reset));
         ct_write_cstr("\n");
-
-        if (++reported >= 32)
-        {
-            ct_write_prefix(CTLevel::Warn);
-            ct_write_str(ct_color(CTColor::Yellow));
-            ct_write_cstr("ct: leak list truncated");
-            ct_write_str(ct_color(CTColor::Reset));
-            ct_write_cstr("\n");
-            break;
-        }
     }
 }
+
+CT_NOINSTR __attribute__((destructor)) static void ct_report_leaks(void)
+{
+    const size_t leak_count = ct_table_live_count();
+    if (leak_count == 0)
+        return;
+
+    ct_disable_logging();
+
+    ct_write_prefix(CTLevel::Error);
+    ct_write_str(ct_color(CTColor::Red));
+    ct_write_cstr("ct: leaks detected count=");
+    ct_write_dec(leak_count);
+    ct_write_str(ct_color(CTColor::Reset));
+    ct_write_cstr("\n");
+
+    struct ct_leak_report_ctx report = {0};
+    ct_table_lock_all();
+    ct_table_for_each_live_locked(ct_report_leak_entry, &report);
+    ct_table_unlock_all();
+}
@@ -4,23 +4,25 @@
 #include <cstdint>
 #include <cstdlib>
 
-CT_NOINSTR void ct_report_bounds_error(const void* base, const void* ptr, size_t access_size,
-                                       const char* site, int is_write, size_t req_size,
-                                       size_t alloc_size, const char* alloc_site,
-                                       unsigned char state)
+CT_TLS struct ct_bounds_memo __ct_bounds_memo = {0, 0, nullptr, 0};
+
+CT_NODISCARD CT_NOINSTR static long long ct_signed_offset(const void* base, const void* ptr)
 {
     uintptr_t base_addr = reinterpret_cast<uintptr_t>(base);
     uintptr_t ptr_addr = reinterpret_cast<uintptr_t>(ptr);
-    long long signed_offset = 0;
     if (ptr_addr >= base_addr)
     {
-        signed_offset = static_cast<long long>(ptr_addr - base_addr);
-    }
-    else
-    {
-        signed_offset = -static_cast<long long>(base_addr - ptr_addr);
+        return static_cast<long long>(ptr_addr - base_addr);
     }
+    return -static_cast<long long>(base_addr - ptr_addr);
+}
 
+CT_NOINSTR void ct_report_bounds_error(const void* base, const void* ptr, size_t access_size,
+                                       const char* site, int is_write, size_t req_size,
+                                       size_t alloc_size, const char* alloc_site,
+                                       unsigned char state)
+{
+    long long signed_offset = ct_signed_offset(base, ptr);
     const char* kind = (state == CT_ENTRY_FREED) ? "heap-use-after-free" : "heap-buffer-overflow";
     size_t report_size = req_size ? req_size : alloc_size;
 
@@ -42,12 +44,69 @@ CT_NOINSTR void ct_report_bounds_error(const void* base, const void* ptr, size_t
     }
 }
 
+CT_NODISCARD CT_NOINSTR int ct_shadow_fault_in(const void* base, size_t size, const void* ptr,
+                                               size_t access_size, unsigned char state)
+{
+    if (state != CT_ENTRY_USED || size < CT_SHADOW_LAZY_MIN)
+    {
+        return 0;
+    }
+
+    const uintptr_t alloc_start = reinterpret_cast<uintptr_t>(base);
+    const uintptr_t alloc_end = alloc_start + size;
+    const uintptr_t access_start = reinterpret_cast<uintptr_t>(ptr);
+    const uintptr_t access_end = access_start + access_size;
+    if (access_start >= alloc_end || access_end <= alloc_start)
+    {
+        return 0;
+    }
+
+    uintptr_t start = access_start & ~(CT_SHADOW_LAZY_CHUNK - 1u);
+    uintptr_t end = (access_end + CT_SHADOW_LAZY_CHUNK - 1u) & ~(CT_SHADOW_LAZY_CHUNK - 1u);
+    start = start > alloc_start ? start : alloc_start;
+    end = end < alloc_end ? end : alloc_end;
+    ct_shadow_unpoison_range(reinterpret_cast<const void*>(start),
+                             static_cast<size_t>(end - start));
+    return 1;
+}
+
 extern "C"
 {
 
-    CT_NOINSTR void __ct_check_bounds(const void* base, const void* ptr, size_t access_size,
-                                      const char* site, int is_write)
+    // Called by the bounds pass only once its inline check of an access
+    // against a stack or global object of known size has failed.
+    CT_NOINSTR void __ct_report_object_bounds(const void* object, const void* ptr,
+                                              size_t access_size, size_t object_size,
+                                              const char* site, int is_write,
+                                              int kind) noexcept
+    {
+        ct_errno_guard errno_guard;
+        if (!ct_is_enabled(CT_FEATURE_BOUNDS))
+        {
+            return;
+        }
+        ct_init_env_once();
+
+        ct_log(CTLevel::Error,
+               "ct: {} {} of size {}\n"
+               "  access={} ptr={:p} offset={}\n"
+               "  object_size={} base={:p}\n",
+               kind == CT_OBJECT_GLOBAL ? "global-buffer-overflow" : "stack-buffer-overflow",
+               is_write ? "WRITE" : "READ", access_size, ct_site_name(site), ptr,
+               ct_signed_offset(object, ptr), object_size, object);
+
+        if (ct_bounds_abort_enabled())
+        {
+            abort();
+        }
+    }
+
+    // Everything __ct_check_bounds in ct_runtime_fastpath.cpp cannot answer
+    // from its memo.
+    CT_NOINSTR void __ct_check_bounds_slow(const void* base, const void* ptr, size_t access_size,
+                                           const char* site, int is_write) noexcept
     {
+        ct_errno_guard errno_guard;
         if (!ct_is_enabled(CT_FEATURE_BOUNDS))
         {
             return;
@@ -70,8 +129,10 @@ extern "C"
             return;
         }
 
-        ct_lock_acquire();
-        found = ct_table_lookup(base, &alloc_size, &req_size, &alloc_site, &state);
+        const uint64_t* guard = nullptr;
+        uint64_t stamp = 0;
+        found = ct_table_lookup_guarded(base, &alloc_size, &req_size, &alloc_site, &state, &guard,
+                                        &stamp);
         if (!found && ct_is_enabled(CT_FEATURE_SHADOW) && ct_is_enabled(CT_FEATURE_SHADOW_AGGR))
         {
             void* found_base = nullptr;
@@ -82,12 +143,25 @@ extern "C"
                 alloc_base = found_base;
             }
         }
-        ct_lock_release();
 
         if (!found)
         {
+            // Inline shadow checks send stack and global accesses here until
+            // their shadow is unpoisoned.
+            ct_shadow_unpoison_untracked(ptr, access_size);
             return;
         }
+        // Shadow mode can poison bytes inside a live allocation, so only the
+        // plain extent check is cached.
+        if (state == CT_ENTRY_USED && alloc_base == base && req_size != 0 && guard &&
+            !ct_is_enabled(CT_FEATURE_SHADOW))
+        {
+            const uintptr_t start = reinterpret_cast<uintptr_t>(base);
+            __ct_bounds_memo.guard = guard;
+            __ct_bounds_memo.stamp = stamp;
+            __ct_bounds_memo.base = start;
+            __ct_bounds_memo.end = start + req_size;
+        }
 
         if (state == CT_ENTRY_FREED && !ct_is_enabled(CT_FEATURE_SHADOW))
         {
@@ -21,6 +21,7 @@ extern "C"
     extern int __ct_config_disable_autofree CT_WEAK_IMPORT;
     extern int __ct_config_disable_alloc_trace CT_WEAK_IMPORT;
     extern int __ct_config_vtable_diag CT_WEAK_IMPORT;
+    extern int __ct_config_alloc_table_bits CT_WEAK_IMPORT;
 }
 
 namespace
@@ -28,6 +29,37 @@ namespace
     int ct_env_initialized = 0;
 }
 
+CT_NODISCARD CT_NOINSTR uint64_t ct_env_u64(const char* name, uint64_t def_value)
+{
+    const char* value = std::getenv(name);
+    if (!value || !*value)
+    {
+        return def_value;
+    }
+    char* end = nullptr;
+    unsigned long long parsed = std::strtoull(value, &end, 10);
+    if (end == value)
+    {
+        return def_value;
+    }
+    return static_cast<uint64_t>(parsed);
+}
+
+CT_NODISCARD CT_NOINSTR unsigned ct_alloc_table_bits_hint(void)
+{
+    const int* compiled = &__ct_config_alloc_table_bits;
+    const uint64_t def_value = compiled && *compiled > 0 ? static_cast<uint64_t>(*compiled) : 0;
+    const uint64_t bits = ct_env_u64("CT_ALLOC_TABLE_BITS", def_value);
+    return bits < 64u ? static_cast<unsigned>(bits) : 63u;
+}
+
+CT_NODISCARD CT_NOINSTR size_t ct_shadow_limit_bytes(void)
+{
+    const uint64_t megabytes = ct_env_u64("CT_SHADOW_LIMIT_MB", 0);
+    const uint64_t max_megabytes = static_cast<uint64_t>(SIZE_MAX) >> 20;
+    return static_cast<size_t>(megabytes < max_megabytes ? megabytes : max_megabytes) << 20;
+}
+
 CT_NOINSTR static void ct_apply_compiled_config(void)
 {
     auto readWeak = [](const int* ptr) -> int { return ptr ? *ptr : 0; };
@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: Apache-2.0
+// Hook fast paths. Built into the runtime archive like every other hook, and
+// also to bitcode that the compiler links into instrumented modules and
+// inlines, so that a check which passes costs a few loads and compares.
+// Everything else goes through the out-of-line slow path.
+#include "ct_runtime_fastpath.h"
+
+// Must match CT_FEATURE_BOUNDS in ct_runtime_internal.h.
+#define CT_FASTPATH_FEATURE_BOUNDS (1ull << 2)
+
+extern "C"
+{
+
+    CT_NOINSTR void __ct_check_bounds(const void* base, const void* ptr, size_t access_size,
+                                      const char* site, int is_write) noexcept
+    {
+        if (!(__ct_feature_flags.load(std::memory_order_relaxed) & CT_FASTPATH_FEATURE_BOUNDS))
+        {
+            return;
+        }
+
+        // An access inside the allocation the previous check on this base
+        // found live, with that entry unchanged since, passes.
+        const struct ct_bounds_memo* memo = &__ct_bounds_memo;
+        const uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+        if (base && memo->base == reinterpret_cast<uintptr_t>(base) && addr >= memo->base &&
+            addr <= memo->end && access_size <= memo->end - addr &&
+            __atomic_load_n(memo->guard, __ATOMIC_ACQUIRE) == memo->stamp)
+        {
+            return;
+        }
+
+        __ct_check_bounds_slow(base, ptr, access_size, site, is_write);
+    }
+
+} // extern "C"
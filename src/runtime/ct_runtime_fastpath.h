@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: Apache-2.0
+#ifndef CT_RUNTIME_FASTPATH_H
+#define CT_RUNTIME_FASTPATH_H
+
+// State shared by the runtime and the hook fast paths in
+// ct_runtime_fastpath.cpp. That file is also compiled to bitcode and linked
+// into instrumented modules, so it can only rely on what is declared here.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#ifndef CT_NOINSTR
+#if defined(_MSC_VER)
+#define CT_NOINSTR
+#else
+#define CT_NOINSTR __attribute__((no_instrument_function))
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#define CT_COLD
+#define CT_TLS thread_local
+#else
+#define CT_COLD __attribute__((cold, noinline))
+#define CT_TLS __thread
+#endif
+
+// Extent of the last live allocation a bounds check found by its base,
+// valid while *guard still equals stamp. The guard is a counter of the
+// thread cache or table shard that held the entry, bumped whenever one of
+// its live entries is freed, resized in place or moved elsewhere.
+struct ct_bounds_memo
+{
+    uintptr_t base;
+    uintptr_t end;
+    const uint64_t* guard;
+    uint64_t stamp;
+};
+
+extern "C"
+{
+    // CT_FEATURE_* bits; read through ct_is_enabled() by the runtime itself.
+    extern std::atomic<uint64_t> __ct_feature_flags;
+    extern CT_TLS struct ct_bounds_memo __ct_bounds_memo;
+
+    CT_COLD CT_NOINSTR void __ct_check_bounds_slow(const void* base, const void* ptr,
+                                                   size_t access_size, const char* site,
+                                                   int is_write) noexcept;
+}
+
+#endif // CT_RUNTIME_FASTPATH_H
@@ -73,6 +73,26 @@ inline bool ct_msvc_atomic_compare_exchange(volatile int* object, int* expected,
 #define CT_NOINSTR __attribute__((no_instrument_function))
 #endif
 
+#include "ct_runtime_fastpath.h"
+
+// The bounds, trace and vcall hooks are noexcept and write nothing but
+// runtime state: the passes declare them nounwind with those memory effects
+// (setRuntimeHookAttributes() in compilerlib/instrumentation/common.cpp).
+// errno is module-visible memory, so each of them that can reach logging or
+// allocation starts with a ct_errno_guard.
+struct ct_errno_guard
+{
+    int saved;
+
+    CT_NOINSTR ct_errno_guard() noexcept : saved(errno) {}
+    CT_NOINSTR ~ct_errno_guard()
+    {
+        errno = saved;
+    }
+    ct_errno_guard(const ct_errno_guard&) = delete;
+    ct_errno_guard& operator=(const ct_errno_guard&) = delete;
+};
+
 using CTColor = coretrace::Color;
 using CTLevel = coretrace::Level;
 
@@ -85,6 +105,14 @@ enum
     CT_ENTRY_AUTOFREED = 4
 };
 
+// Object kinds reported by __ct_report_object_bounds; the bounds pass emits
+// the same values.
+enum
+{
+    CT_OBJECT_STACK = 0,
+    CT_OBJECT_GLOBAL = 1
+};
+
 extern int ct_disable_trace;
 extern int ct_disable_alloc;
 extern int ct_disable_bounds;
@@ -128,20 +156,55 @@ CT_NODISCARD CT_NOINSTR int ct_streq(const char* lhs, const char* rhs);
 CT_NODISCARD CT_NOINSTR const char* ct_site_name(const char* site);
 CT_NOINSTR void ct_maybe_install_backtrace(void);
 CT_NOINSTR void ct_init_env_once(void);
-CT_NOINSTR void ct_lock_acquire(void);
-CT_NOINSTR void ct_lock_release(void);
+CT_NODISCARD CT_NOINSTR uint64_t ct_env_u64(const char* name, uint64_t def_value);
+// log2 of the initial allocation table size: CT_ALLOC_TABLE_BITS, else the
+// --ct-alloc-table-bits value compiled into the binary, else 0 (default).
+CT_NODISCARD CT_NOINSTR unsigned ct_alloc_table_bits_hint(void);
+// Shadow memory ceiling from CT_SHADOW_LIMIT_MB, in bytes; 0 means no limit.
+CT_NODISCARD CT_NOINSTR size_t ct_shadow_limit_bytes(void);
+// Zero-filled, page-aligned memory straight from the OS. Blocks of 2 MiB and
+// more are huge-page aligned and advised for transparent huge pages.
+CT_NODISCARD CT_NOINSTR void* ct_os_alloc(size_t size);
+CT_NOINSTR void ct_os_free(void* ptr, size_t size);
+// Allocation table entry points. Each call synchronizes internally, so callers
+// must not hold any runtime lock around them.
 CT_NODISCARD CT_NOINSTR int ct_table_insert(void* ptr, size_t req_size, size_t size,
                                             const char* site, unsigned char kind);
 CT_NODISCARD CT_NOINSTR int ct_table_remove(void* ptr, size_t* size_out, size_t* req_size_out,
                                             const char** site_out);
 CT_NODISCARD CT_NOINSTR int ct_table_lookup(const void* ptr, size_t* size_out, size_t* req_size_out,
                                             const char** site_out, unsigned char* state_out);
+// ct_table_lookup() for bounds check memos (ct_runtime_fastpath.h): a live
+// entry found also yields the counter that changes once the entry is retired
+// or updated, and the counter's value from before the lookup. *guard_out is
+// null when the entry cannot be memoized.
+CT_NODISCARD CT_NOINSTR int ct_table_lookup_guarded(const void* ptr, size_t* size_out,
+                                                    size_t* req_size_out, const char** site_out,
+                                                    unsigned char* state_out,
+                                                    const uint64_t** guard_out,
+                                                    uint64_t* stamp_out);
 CT_NODISCARD CT_NOINSTR int ct_table_lookup_containing(const void* ptr, void** base_out,
                                                        size_t* size_out, size_t* req_size_out,
                                                        const char** site_out,
                                                        unsigned char* state_out);
+// Allocations of at least CT_SHADOW_LAZY_MIN bytes are not unpoisoned when
+// they are made. The first bounds check that lands in a not yet unpoisoned
+// CT_SHADOW_LAZY_CHUNK of such an allocation fills in that chunk's shadow
+// (see ct_shadow_fault_in), so only the parts a program touches are written.
+#define CT_SHADOW_LAZY_MIN (static_cast<size_t>(1) << 20)
+#define CT_SHADOW_LAZY_CHUNK (static_cast<uintptr_t>(1) << 15)
+
 CT_NOINSTR void ct_shadow_poison_range(const void* addr, size_t size);
 CT_NOINSTR void ct_shadow_unpoison_range(const void* addr, size_t size);
+// Called when a bounds check finds no allocation for ptr: unpoisons the stack
+// or the loaded images it may belong to, which no allocation ever covers, or
+// else the granules the access touched.
+CT_NOINSTR void ct_shadow_unpoison_untracked(const void* ptr, size_t access_size);
+// Poisons a range that is no longer mapped and gives back every shadow page
+// that lies entirely inside it.
+CT_NOINSTR void ct_shadow_release_range(const void* addr, size_t size);
+CT_NODISCARD CT_NOINSTR int ct_shadow_fault_in(const void* base, size_t size, const void* ptr,
+                                               size_t access_size, unsigned char state);
 CT_NODISCARD CT_NOINSTR int ct_shadow_check_access(const void* ptr, size_t access_size,
                                                    const void* base, size_t req_size,
                                                    size_t alloc_size, const char* alloc_site,
@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "ct_runtime_internal.h"
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+
+// Runtime tables take their memory straight from the OS: nothing is linked
+// into the binary's BSS, pages are only committed once touched, and large
+// tables can sit on huge pages without going through the allocator.
+#define CT_OS_HUGE_PAGE_SIZE (static_cast<size_t>(2) << 20)
+
+#if defined(_WIN32)
+
+CT_NODISCARD CT_NOINSTR void* ct_os_alloc(size_t size)
+{
+    if (size == 0)
+    {
+        return nullptr;
+    }
+    return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+CT_NOINSTR void ct_os_free(void* ptr, size_t size)
+{
+    (void)size;
+    if (ptr)
+    {
+        VirtualFree(ptr, 0, MEM_RELEASE);
+    }
+}
+
+#else
+
+CT_NODISCARD CT_NOINSTR static size_t ct_os_round_size(size_t size)
+{
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return (size + page - 1u) & ~(page - 1u);
+}
+
+CT_NODISCARD CT_NOINSTR void* ct_os_alloc(size_t size)
+{
+    if (size == 0)
+    {
+        return nullptr;
+    }
+    size = ct_os_round_size(size);
+    if (size < CT_OS_HUGE_PAGE_SIZE)
+    {
+        void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return mem == MAP_FAILED ? nullptr : mem;
+    }
+
+    // Over-reserve so the block can start on a huge page boundary, then give
+    // the unaligned head and tail back.
+    const size_t reserve = size + CT_OS_HUGE_PAGE_SIZE;
+    void* mem = mmap(nullptr, reserve, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    const uintptr_t start = reinterpret_cast<uintptr_t>(mem);
+    const uintptr_t aligned = (start + CT_OS_HUGE_PAGE_SIZE - 1u) & ~(CT_OS_HUGE_PAGE_SIZE - 1u);
+    if (aligned > start)
+    {
+        munmap(mem, aligned - start);
+    }
+    const uintptr_t tail = aligned + size;
+    if (start + reserve > tail)
+    {
+        munmap(reinterpret_cast<void*>(tail), start + reserve - tail);
+    }
+#if defined(MADV_HUGEPAGE)
+    (void)madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+#endif
+    return reinterpret_cast<void*>(aligned);
+}
+
+CT_NOINSTR void ct_os_free(void* ptr, size_t size)
+{
+    if (ptr && size)
+    {
+        munmap(ptr, ct_os_round_size(size));
+    }
+}
+
+#endif
@@ -0,0 +1,453 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "ct_runtime_pagemap.h"
+
+#include "ct_runtime_sync.h"
+
+#include <cstring>
+#include <sys/mman.h>
+
+// Two-level radix tree over 4 KiB pages of a 48-bit address space, in the
+// style of tcmalloc's page map. The root array of leaf pointers is mapped on
+// the first insert and leaves are reserved with MAP_NORESERVE on first use,
+// so only the entries for pages that actually hold allocations get committed.
+//
+// Each page entry records the allocation that covers the whole page, if any,
+// and a small bucket with the ranges that only partially overlap it. A live
+// allocation spanning several pages therefore costs one owner store per
+// interior page and one bucket entry at each end, and any address resolves
+// by reading a single entry.
+//
+// Updates lock one of a few striped spin locks and bump its sequence counter
+// so readers can probe without locking, as the allocation table does. A grown
+// bucket replaces the old one and an emptied bucket is dropped, while an
+// in-flight reader may still be scanning it, so buckets come from size-classed
+// pools that are never unmapped: released buckets go on their class's free
+// list and keep their capacity field, and a reader that raced with the release
+// only reads mapped memory of the same layout before its sequence check
+// throws the result away. Bucket memory is thus bounded by the most buckets
+// of each class ever in use at once, not by address churn.
+#define CT_PAGE_SHIFT 12u
+#define CT_PAGEMAP_ADDRESS_BITS 48u
+#define CT_PAGEMAP_LEAF_BITS 18u
+#define CT_PAGEMAP_ROOT_BITS (CT_PAGEMAP_ADDRESS_BITS - CT_PAGE_SHIFT - CT_PAGEMAP_LEAF_BITS)
+#define CT_PAGEMAP_LEAF_SIZE (static_cast<size_t>(1) << CT_PAGEMAP_LEAF_BITS)
+#define CT_PAGEMAP_STRIPES 64u
+#define CT_PAGEMAP_BUCKET_MIN 4u
+#define CT_PAGEMAP_READ_RETRIES 8u
+#define CT_PAGEMAP_BUCKET_CLASSES 26u
+#define CT_PAGEMAP_POOL_CHUNK (static_cast<size_t>(256) << 10)
+
+struct ct_page_bucket
+{
+    uint32_t count;
+    uint32_t capacity;
+    // struct ct_page_span spans[capacity] follows.
+};
+
+struct ct_page_entry
+{
+    struct ct_page_span owner;
+    struct ct_page_bucket* bucket;
+};
+
+struct alignas(64) ct_page_stripe
+{
+    int lock;
+    unsigned seq;
+};
+
+#define CT_PAGEMAP_ROOT_SIZE (static_cast<size_t>(1) << CT_PAGEMAP_ROOT_BITS)
+
+static struct ct_page_entry** ct_pagemap_root = nullptr;
+static struct ct_page_stripe ct_pagemap_stripes[CT_PAGEMAP_STRIPES];
+
+// Bucket pool: free lists per capacity class (CT_PAGEMAP_BUCKET_MIN << class)
+// and the unused tail of the current chunk.
+static int ct_bucket_pool_lock = 0;
+static struct ct_page_bucket* ct_bucket_free_lists[CT_PAGEMAP_BUCKET_CLASSES];
+static unsigned char* ct_bucket_pool_cursor = nullptr;
+static size_t ct_bucket_pool_left = 0;
+
+CT_NODISCARD CT_NOINSTR static inline struct ct_page_span*
+ct_bucket_spans(struct ct_page_bucket* bucket)
+{
+    return reinterpret_cast<struct ct_page_span*>(bucket + 1);
+}
+
+CT_NODISCARD CT_NOINSTR static inline size_t ct_bucket_bytes(uint32_t capacity)
+{
+    return sizeof(struct ct_page_bucket) + capacity * sizeof(struct ct_page_span);
+}
+
+// Returns an empty bucket of CT_PAGEMAP_BUCKET_MIN << cls spans, or nullptr.
+CT_NODISCARD CT_NOINSTR static struct ct_page_bucket* ct_bucket_alloc(unsigned cls)
+{
+    if (cls >= CT_PAGEMAP_BUCKET_CLASSES)
+    {
+        return nullptr;
+    }
+    const uint32_t capacity = CT_PAGEMAP_BUCKET_MIN << cls;
+    const size_t bytes = ct_bucket_bytes(capacity);
+
+    ct_spin_lock(&ct_bucket_pool_lock);
+    struct ct_page_bucket* bucket = ct_bucket_free_lists[cls];
+    if (bucket)
+    {
+        std::memcpy(&ct_bucket_free_lists[cls], ct_bucket_spans(bucket), sizeof(bucket));
+    }
+    else if (bytes > CT_PAGEMAP_POOL_CHUNK)
+    {
+        void* mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        bucket = mem == MAP_FAILED ? nullptr : static_cast<struct ct_page_bucket*>(mem);
+    }
+    else
+    {
+        if (ct_bucket_pool_left < bytes)
+        {
+            // The rest of the old chunk is abandoned; classes are powers of
+            // two, so that wastes less than one bucket per chunk.
+            void* mem = mmap(nullptr, CT_PAGEMAP_POOL_CHUNK, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (mem != MAP_FAILED)
+            {
+                ct_bucket_pool_cursor = static_cast<unsigned char*>(mem);
+                ct_bucket_pool_left = CT_PAGEMAP_POOL_CHUNK;
+            }
+        }
+        if (ct_bucket_pool_left >= bytes)
+        {
+            bucket = reinterpret_cast<struct ct_page_bucket*>(ct_bucket_pool_cursor);
+            ct_bucket_pool_cursor += bytes;
+            ct_bucket_pool_left -= bytes;
+        }
+    }
+    ct_spin_unlock(&ct_bucket_pool_lock);
+
+    if (bucket)
+    {
+        __atomic_store_n(&bucket->count, 0u, __ATOMIC_RELAXED);
+        __atomic_store_n(&bucket->capacity, capacity, __ATOMIC_RELAXED);
+    }
+    return bucket;
+}
+
+// Gives bucket back to its class. The caller holds the stripe lock of the
+// entry that referenced it, so racing readers of that entry fail their
+// sequence check.
+CT_NOINSTR static void ct_bucket_release(struct ct_page_bucket* bucket)
+{
+    unsigned cls = 0;
+    while ((CT_PAGEMAP_BUCKET_MIN << cls) < bucket->capacity)
+    {
+        ++cls;
+    }
+    ct_spin_lock(&ct_bucket_pool_lock);
+    std::memcpy(ct_bucket_spans(bucket), &ct_bucket_free_lists[cls], sizeof(bucket));
+    ct_bucket_free_lists[cls] = bucket;
+    ct_spin_unlock(&ct_bucket_pool_lock);
+}
+
+CT_NODISCARD CT_NOINSTR static inline int ct_span_contains(uintptr_t base, size_t size,
+                                                           uintptr_t addr)
+{
+    return base && size != 0 && addr >= base && (addr - base) < size;
+}
+
+CT_NODISCARD CT_NOINSTR static struct ct_page_entry* ct_pagemap_entry(uintptr_t page, int create)
+{
+    const uintptr_t root_index = page >> CT_PAGEMAP_LEAF_BITS;
+    if (root_index >= CT_PAGEMAP_ROOT_SIZE)
+    {
+        return nullptr;
+    }
+
+    struct ct_page_entry** root = __atomic_load_n(&ct_pagemap_root, __ATOMIC_ACQUIRE);
+    if (!root)
+    {
+        if (!create)
+        {
+            return nullptr;
+        }
+        // Sparse, so deliberately not huge-page backed like the tables.
+        void* mem = mmap(nullptr, CT_PAGEMAP_ROOT_SIZE * sizeof(struct ct_page_entry*),
+                         PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1,
+                         0);
+        if (mem == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        struct ct_page_entry** expected = nullptr;
+        root = static_cast<struct ct_page_entry**>(mem);
+        if (!__atomic_compare_exchange_n(&ct_pagemap_root, &expected, root, false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            munmap(mem, CT_PAGEMAP_ROOT_SIZE * sizeof(struct ct_page_entry*));
+            root = expected;
+        }
+    }
+
+    struct ct_page_entry* leaf = __atomic_load_n(&root[root_index], __ATOMIC_ACQUIRE);
+    if (!leaf && create)
+    {
+        void* mem = mmap(nullptr, CT_PAGEMAP_LEAF_SIZE * sizeof(struct ct_page_entry),
+                         PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1,
+                         0);
+        if (mem == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        struct ct_page_entry* expected = nullptr;
+        leaf = static_cast<struct ct_page_entry*>(mem);
+        if (!__atomic_compare_exchange_n(&root[root_index], &expected, leaf, false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            munmap(mem, CT_PAGEMAP_LEAF_SIZE * sizeof(struct ct_page_entry));
+            leaf = expected;
+        }
+    }
+    return leaf ? &leaf[page & (CT_PAGEMAP_LEAF_SIZE - 1u)] : nullptr;
+}
+
+CT_NODISCARD CT_NOINSTR static struct ct_page_stripe* ct_pagemap_stripe_begin(uintptr_t page)
+{
+    struct ct_page_stripe* stripe = &ct_pagemap_stripes[page % CT_PAGEMAP_STRIPES];
+    ct_spin_lock(&stripe->lock);
+    __atomic_store_n(&stripe->seq, stripe->seq + 1u, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return stripe;
+}
+
+CT_NOINSTR static void ct_pagemap_stripe_end(struct ct_page_stripe* stripe)
+{
+    __atomic_store_n(&stripe->seq, stripe->seq + 1u, __ATOMIC_RELEASE);
+    ct_spin_unlock(&stripe->lock);
+}
+
+CT_NODISCARD CT_NOINSTR static int ct_bucket_append(struct ct_page_entry* entry,
+                                                    const struct ct_page_span* span)
+{
+    struct ct_page_bucket* bucket = entry->bucket;
+    if (!bucket || bucket->count == bucket->capacity)
+    {
+        unsigned cls = 0;
+        while (bucket && (CT_PAGEMAP_BUCKET_MIN << cls) <= bucket->capacity)
+        {
+            ++cls;
+        }
+        struct ct_page_bucket* grown = ct_bucket_alloc(cls);
+        if (!grown)
+        {
+            return 0;
+        }
+        if (bucket)
+        {
+            std::memcpy(ct_bucket_spans(grown), ct_bucket_spans(bucket),
+                        bucket->count * sizeof(struct ct_page_span));
+            __atomic_store_n(&grown->count, bucket->count, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&entry->bucket, grown, __ATOMIC_RELEASE);
+        if (bucket)
+        {
+            ct_bucket_release(bucket);
+        }
+        bucket = grown;
+    }
+    ct_bucket_spans(bucket)[bucket->count] = *span;
+    __atomic_store_n(&bucket->count, bucket->count + 1u, __ATOMIC_RELEASE);
+    return 1;
+}
+
+CT_NOINSTR static void ct_bucket_erase(struct ct_page_entry* entry, const struct ct_page_span* span)
+{
+    struct ct_page_bucket* bucket = entry->bucket;
+    if (!bucket)
+    {
+        return;
+    }
+    struct ct_page_span* spans = ct_bucket_spans(bucket);
+    for (uint32_t i = bucket->count; i > 0; --i)
+    {
+        if (spans[i - 1u].base == span->base && spans[i - 1u].size == span->size)
+        {
+            // Keep the registration order; lookups report newer ranges first.
+            std::memmove(&spans[i - 1u], &spans[i], (bucket->count - i) * sizeof(*spans));
+            __atomic_store_n(&bucket->count, bucket->count - 1u, __ATOMIC_RELEASE);
+            if (bucket->count == 0)
+            {
+                __atomic_store_n(&entry->bucket, static_cast<struct ct_page_bucket*>(nullptr),
+                                 __ATOMIC_RELEASE);
+                ct_bucket_release(bucket);
+            }
+            return;
+        }
+    }
+}
+
+CT_NODISCARD CT_NOINSTR static inline int ct_span_covers_page(const struct ct_page_span* span,
+                                                              uintptr_t page)
+{
+    const uintptr_t page_start = page << CT_PAGE_SHIFT;
+    return span->base <= page_start &&
+           span->size - (page_start - span->base) >= (static_cast<size_t>(1) << CT_PAGE_SHIFT);
+}
+
+CT_NODISCARD CT_NOINSTR int ct_pagemap_insert(uintptr_t base, size_t size, int live)
+{
+    if (size == 0)
+    {
+        return 1;
+    }
+    const uintptr_t last = base + size - 1u;
+    if (last < base || (last >> CT_PAGEMAP_ADDRESS_BITS) != 0)
+    {
+        return 0;
+    }
+
+    const struct ct_page_span span = {base, size};
+    for (uintptr_t page = base >> CT_PAGE_SHIFT; page <= last >> CT_PAGE_SHIFT; ++page)
+    {
+        struct ct_page_entry* entry = ct_pagemap_entry(page, 1);
+        if (!entry)
+        {
+            return 0;
+        }
+
+        struct ct_page_stripe* stripe = ct_pagemap_stripe_begin(page);
+        int ok = 1;
+        // Live allocations never overlap, so a live range may replace any
+        // owner, which can only be a freed range the allocator has since
+        // reused. A freed range is registered late (thread caches flush it
+        // in batches), when its memory may already belong to a live owner.
+        if (ct_span_covers_page(&span, page) && (live || !entry->owner.base))
+        {
+            __atomic_store_n(&entry->owner.base, span.base, __ATOMIC_RELAXED);
+            __atomic_store_n(&entry->owner.size, span.size, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            ok = ct_bucket_append(entry, &span);
+        }
+        ct_pagemap_stripe_end(stripe);
+        if (!ok)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+CT_NOINSTR void ct_pagemap_remove(uintptr_t base, size_t size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+    const uintptr_t last = base + size - 1u;
+    if (last < base || (last >> CT_PAGEMAP_ADDRESS_BITS) != 0)
+    {
+        return;
+    }
+
+    const struct ct_page_span span = {base, size};
+    for (uintptr_t page = base >> CT_PAGE_SHIFT; page <= last >> CT_PAGE_SHIFT; ++page)
+    {
+        struct ct_page_entry* entry = ct_pagemap_entry(page, 0);
+        if (!entry)
+        {
+            continue;
+        }
+
+        struct ct_page_stripe* stripe = ct_pagemap_stripe_begin(page);
+        if (entry->owner.base == span.base && entry->owner.size == span.size)
+        {
+            __atomic_store_n(&entry->owner.base, static_cast<uintptr_t>(0), __ATOMIC_RELAXED);
+            __atomic_store_n(&entry->owner.size, static_cast<size_t>(0), __ATOMIC_RELAXED);
+        }
+        else
+        {
+            ct_bucket_erase(entry, &span);
+        }
+        ct_pagemap_stripe_end(stripe);
+    }
+}
+
+// Collects the ranges of one entry that contain addr. Also used by optimistic
+// readers, so every load is relaxed and the bucket count is clamped to its
+// capacity; a torn result is discarded by the caller's sequence check.
+CT_NODISCARD CT_NOINSTR static size_t ct_pagemap_collect(const struct ct_page_entry* entry,
+                                                         uintptr_t addr, struct ct_page_span* out,
+                                                         size_t max)
+{
+    const uintptr_t owner_base = __atomic_load_n(&entry->owner.base, __ATOMIC_RELAXED);
+    const size_t owner_size = __atomic_load_n(&entry->owner.size, __ATOMIC_RELAXED);
+    const int owner_hit = ct_span_contains(owner_base, owner_size, addr);
+    // Keep a slot for the owner: it is the likeliest live candidate, and the
+    // bucket may hold any number of freed ranges around it.
+    if (owner_hit && max > 0)
+    {
+        --max;
+    }
+
+    size_t found = 0;
+    struct ct_page_bucket* bucket = __atomic_load_n(&entry->bucket, __ATOMIC_ACQUIRE);
+    if (bucket)
+    {
+        uint32_t count = __atomic_load_n(&bucket->count, __ATOMIC_ACQUIRE);
+        const uint32_t capacity = __atomic_load_n(&bucket->capacity, __ATOMIC_RELAXED);
+        count = count < capacity ? count : capacity;
+        const struct ct_page_span* spans = ct_bucket_spans(bucket);
+        for (uint32_t i = count; i > 0 && found < max; --i)
+        {
+            const uintptr_t base = __atomic_load_n(&spans[i - 1u].base, __ATOMIC_RELAXED);
+            const size_t size = __atomic_load_n(&spans[i - 1u].size, __ATOMIC_RELAXED);
+            if (ct_span_contains(base, size, addr))
+            {
+                out[found].base = base;
+                out[found].size = size;
+                ++found;
+            }
+        }
+    }
+
+    if (owner_hit)
+    {
+        out[found].base = owner_base;
+        out[found].size = owner_size;
+        ++found;
+    }
+    return found;
+}
+
+CT_NODISCARD CT_NOINSTR size_t ct_pagemap_find(uintptr_t addr, struct ct_page_span* out,
+                                               size_t max)
+{
+    const uintptr_t page = addr >> CT_PAGE_SHIFT;
+    const struct ct_page_entry* entry = ct_pagemap_entry(page, 0);
+    if (!entry || max == 0)
+    {
+        return 0;
+    }
+
+    struct ct_page_stripe* stripe = &ct_pagemap_stripes[page % CT_PAGEMAP_STRIPES];
+    for (unsigned attempt = 0; attempt < CT_PAGEMAP_READ_RETRIES; ++attempt)
+    {
+        const unsigned seq = __atomic_load_n(&stripe->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1u)
+        {
+            ct_cpu_relax();
+            continue;
+        }
+        const size_t found = ct_pagemap_collect(entry, addr, out, max);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&stripe->seq, __ATOMIC_RELAXED) == seq)
+        {
+            return found;
+        }
+    }
+
+    ct_spin_lock(&stripe->lock);
+    const size_t found = ct_pagemap_collect(entry, addr, out, max);
+    ct_spin_unlock(&stripe->lock);
+    return found;
+}
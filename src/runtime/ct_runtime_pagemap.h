@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: Apache-2.0
+#ifndef CT_RUNTIME_PAGEMAP_H
+#define CT_RUNTIME_PAGEMAP_H
+
+#include "ct_runtime_internal.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Address-to-allocation page map used for interior-pointer lookups. The
+// allocation table registers every tracked range (live or still in the freed
+// history) here and drops it once the table forgets the pointer; the map only
+// answers "which ranges may contain this address", the table stays the source
+// of truth for their state.
+
+struct ct_page_span
+{
+    uintptr_t base;
+    size_t size;
+};
+
+#define CT_PAGEMAP_MAX_CANDIDATES 8u
+
+// Registers [base, base + size), which is a live allocation when live is set
+// and a freed one otherwise. A freed range never displaces the owner of a
+// page. Returns 0 when the range cannot be mapped (address outside the mapped
+// space or out of memory); callers must then fall back to scanning.
+CT_NODISCARD CT_NOINSTR int ct_pagemap_insert(uintptr_t base, size_t size, int live);
+CT_NOINSTR void ct_pagemap_remove(uintptr_t base, size_t size);
+
+// Copies up to max registered ranges containing addr into out, most recently
+// registered first, and returns how many were found.
+CT_NODISCARD CT_NOINSTR size_t ct_pagemap_find(uintptr_t addr, struct ct_page_span* out,
+                                               size_t max);
+
+#endif // CT_RUNTIME_PAGEMAP_H
@@ -1,209 +1,394 @@
 // SPDX-License-Identifier: Apache-2.0
 #include "ct_runtime_internal.h"
 
-#include <cstdlib>
-#include <cstring>
+#include "ct_runtime_sync.h"
 
-enum
+#include <cstring>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__APPLE__)
+#include <mach-o/dyld.h>
+#include <mach-o/loader.h>
+#else
+#include <dlfcn.h>
+#include <link.h>
+#endif
+
+// Direct-mapped shadow memory: one shadow byte per 8-byte granule of the
+// application address space, at __ct_shadow_base + (addr >> 3). The whole
+// shadow is reserved once with MAP_NORESERVE, so only the shadow pages that
+// are actually written get committed, and lookups take no lock.
+//
+// Shadow bytes hold the complement of the usual encoding: 0xFF means all
+// eight bytes are addressable, 0xFF ^ k means only the first k are, and 0
+// means none are. Shadow that was never written therefore reads as
+// poisoned, which keeps memory that no tracked allocation ever covered
+// (allocator headers, unknown regions) inaccessible.
+#define CT_SHADOW_SHIFT 3u
+#define CT_SHADOW_GRANULE (1u << CT_SHADOW_SHIFT)
+#define CT_SHADOW_APP_BITS 47u
+#define CT_SHADOW_APP_END (static_cast<uintptr_t>(1) << CT_SHADOW_APP_BITS)
+#define CT_SHADOW_SIZE (static_cast<size_t>(1) << (CT_SHADOW_APP_BITS - CT_SHADOW_SHIFT))
+#define CT_SHADOW_ADDRESSABLE 0xFFu
+#define CT_SHADOW_POISONED 0x00u
+// Poisoning at least this many shadow bytes drops the whole shadow pages
+// inside the span instead of writing them (a fresh page reads as poisoned).
+#define CT_SHADOW_RELEASE_MIN (64u * 1024u)
+
+// Stack and global memory is never tracked, so its shadow starts out
+// poisoned. A bounds check that finds no allocation for an address on the
+// thread's stack unpoisons the stack from there up in chunks of this size;
+// one in a loaded image unpoisons the segments of every image loaded since
+// the last sweep, and any other one only the granules it accessed.
+#define CT_SHADOW_STACK_CHUNK (static_cast<uintptr_t>(64) * 1024u)
+
+// With CT_SHADOW_LIMIT_MB set, unpoisoned shadow is tracked per 2 MiB region
+// in a sparse bitmap (reserved like the shadow) with a summary bit per bitmap
+// word. After every quarter of the limit written, the resident shadow of the
+// marked regions is measured with mincore(); above the limit, pages that are
+// entirely poisoned again are returned to the OS.
+#define CT_SHADOW_REGION_BITS 21u
+#define CT_SHADOW_REGION_SIZE (static_cast<size_t>(1) << CT_SHADOW_REGION_BITS)
+#define CT_SHADOW_REGIONS (CT_SHADOW_SIZE >> CT_SHADOW_REGION_BITS)
+#define CT_SHADOW_DIRTY_WORDS (CT_SHADOW_REGIONS / 64u)
+#define CT_SHADOW_SUMMARY_WORDS (CT_SHADOW_DIRTY_WORDS / 64u)
+#define CT_SHADOW_REGION_MAX_PAGES (CT_SHADOW_REGION_SIZE / 4096u)
+#define CT_SHADOW_ACCOUNT_BATCH (64u * 1024u)
+
+#if defined(__APPLE__)
+using ct_mincore_vec_t = char;
+#else
+using ct_mincore_vec_t = unsigned char;
+#endif
+
+extern "C"
 {
-    CT_SHADOW_ENTRY_EMPTY = 0,
-    CT_SHADOW_ENTRY_USED = 1,
-    CT_SHADOW_ENTRY_TOMB = 2
-};
+    // Read by instrumented code; 0 until the shadow has been reserved.
+    uintptr_t __ct_shadow_base = 0;
+}
 
-#define CT_SHADOW_SHIFT 3u
-#define CT_SHADOW_PAGE_BITS 12u
-#define CT_SHADOW_PAGE_SIZE (1u << CT_SHADOW_PAGE_BITS)
-#define CT_SHADOW_PAGE_MASK (CT_SHADOW_PAGE_SIZE - 1u)
-#define CT_SHADOW_TABLE_BITS 16u
-#define CT_SHADOW_TABLE_MAX_BITS 20u
-#define CT_SHADOW_TABLE_SIZE (1u << CT_SHADOW_TABLE_BITS)
-
-struct ct_shadow_page_entry
+static int ct_shadow_reserve_failed = 0;
+static int ct_shadow_reserve_lock = 0;
+
+// Set before __ct_shadow_base is published and never changed afterwards.
+static size_t ct_shadow_limit = 0;
+static size_t ct_shadow_page_size = 0;
+static uint64_t* ct_shadow_dirty = nullptr;
+static uint64_t ct_shadow_dirty_summary[CT_SHADOW_SUMMARY_WORDS];
+static size_t ct_shadow_written = 0;
+static int ct_shadow_sweep_lock = 0;
+static int ct_shadow_sweeping = 0;
+static int ct_shadow_writers = 0;
+static int ct_shadow_limit_logged = 0;
+static thread_local size_t ct_shadow_written_local = 0;
+// Image count (macOS) or dlpi_adds (Linux) when the images were last unpoisoned.
+static unsigned long long ct_shadow_images_seen = 0;
+// Stack bounds of this thread, and the lowest stack address unpoisoned so far.
+static thread_local uintptr_t ct_shadow_stack_lo = 0;
+static thread_local uintptr_t ct_shadow_stack_hi = 0;
+static thread_local uintptr_t ct_shadow_stack_open = 0;
+
+CT_NODISCARD CT_NOINSTR static unsigned char* ct_shadow_reserve_slow(void)
 {
-    uintptr_t page;
-    unsigned char* data;
-    unsigned char state;
-};
+    int log_failure = 0;
+    ct_spin_lock(&ct_shadow_reserve_lock);
+    if (!__ct_shadow_base && !ct_shadow_reserve_failed)
+    {
+        void* mem = mmap(nullptr, CT_SHADOW_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem == MAP_FAILED)
+        {
+            ct_shadow_reserve_failed = 1;
+            log_failure = 1;
+        }
+        else
+        {
+#if defined(MADV_NOHUGEPAGE)
+            // Shadow is touched sparsely; huge pages would commit 2 MiB per hit.
+            (void)madvise(mem, CT_SHADOW_SIZE, MADV_NOHUGEPAGE);
+#endif
+            ct_shadow_page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            ct_shadow_limit = ct_shadow_limit_bytes();
+            if (ct_shadow_limit)
+            {
+                void* dirty = mmap(nullptr, CT_SHADOW_DIRTY_WORDS * sizeof(uint64_t),
+                                   PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+                if (dirty == MAP_FAILED || ct_shadow_page_size > CT_SHADOW_REGION_SIZE ||
+                    CT_SHADOW_REGION_SIZE / ct_shadow_page_size > CT_SHADOW_REGION_MAX_PAGES)
+                {
+                    ct_shadow_limit = 0;
+                }
+                else
+                {
+                    ct_shadow_dirty = static_cast<uint64_t*>(dirty);
+                }
+            }
+            __atomic_store_n(&__ct_shadow_base, reinterpret_cast<uintptr_t>(mem),
+                             __ATOMIC_RELEASE);
+        }
+    }
+    ct_spin_unlock(&ct_shadow_reserve_lock);
 
-static struct ct_shadow_page_entry ct_shadow_table_storage[CT_SHADOW_TABLE_SIZE];
-static struct ct_shadow_page_entry* ct_shadow_table = ct_shadow_table_storage;
-static size_t ct_shadow_table_bits = CT_SHADOW_TABLE_BITS;
-static size_t ct_shadow_table_size = CT_SHADOW_TABLE_SIZE;
-static size_t ct_shadow_table_mask = CT_SHADOW_TABLE_SIZE - 1u;
-static int ct_shadow_lock = 0;
-static int ct_shadow_table_full_logged = 0;
+    if (log_failure)
+    {
+        ct_log(CTLevel::Warn, "{}cannot reserve shadow memory ({} bytes), shadow disabled{}\n",
+               ct_color(CTColor::Red), static_cast<size_t>(CT_SHADOW_SIZE),
+               ct_color(CTColor::Reset));
+    }
+    return reinterpret_cast<unsigned char*>(__atomic_load_n(&__ct_shadow_base, __ATOMIC_ACQUIRE));
+}
 
-CT_NOINSTR static void ct_shadow_lock_acquire(void)
+// Returns the shadow base, reserving the shadow on first use, or nullptr if
+// it cannot be reserved.
+CT_NODISCARD CT_NOINSTR static inline unsigned char* ct_shadow_base(void)
 {
-    while (__atomic_exchange_n(&ct_shadow_lock, 1, __ATOMIC_ACQUIRE) != 0)
+    const uintptr_t base = __atomic_load_n(&__ct_shadow_base, __ATOMIC_ACQUIRE);
+    if (base)
     {
+        return reinterpret_cast<unsigned char*>(base);
     }
+    return ct_shadow_reserve_slow();
 }
 
-CT_NOINSTR static void ct_shadow_lock_release(void)
+// Clamps [start, end) to the shadowed address space. Returns 0 when nothing
+// of the range is shadowed.
+CT_NODISCARD CT_NOINSTR static inline int ct_shadow_clamp(uintptr_t start, uintptr_t* end)
 {
-    __atomic_store_n(&ct_shadow_lock, 0, __ATOMIC_RELEASE);
+    if (start >= CT_SHADOW_APP_END)
+    {
+        return 0;
+    }
+    if (*end > CT_SHADOW_APP_END)
+    {
+        *end = CT_SHADOW_APP_END;
+    }
+    return 1;
 }
 
-CT_NODISCARD CT_NOINSTR static size_t ct_shadow_hash(uintptr_t page, size_t mask)
+// Replaces whole shadow pages with fresh ones, which read as poisoned.
+CT_NODISCARD CT_NOINSTR static int ct_shadow_zero_pages(void* begin, size_t length)
 {
-    uintptr_t value = page;
-    value ^= value >> 33;
-    value *= 0xff51afd7ed558ccdULL;
-    value ^= value >> 33;
-    return static_cast<size_t>(value) & mask;
+#if defined(__linux__)
+    return madvise(begin, length, MADV_DONTNEED) == 0;
+#else
+    // MADV_DONTNEED does not zero anonymous memory everywhere; a new mapping does.
+    return mmap(begin, length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0) != MAP_FAILED;
+#endif
 }
 
-CT_NODISCARD CT_NOINSTR static int ct_shadow_rehash_entry(struct ct_shadow_page_entry* table,
-                                                          size_t mask, size_t size,
-                                                          const struct ct_shadow_page_entry* entry)
+// Sets length shadow bytes. A poisoned span of at least release_min bytes
+// drops its page-aligned middle instead, which also gives that shadow memory
+// back, and only writes the edges.
+CT_NOINSTR static void ct_shadow_fill(unsigned char* begin, size_t length, unsigned char value,
+                                      size_t release_min)
 {
-    size_t idx = ct_shadow_hash(entry->page, mask);
-    for (size_t i = 0; i < size; ++i)
+    if (value == CT_SHADOW_POISONED && length >= release_min)
     {
-        size_t pos = (idx + i) & mask;
-        struct ct_shadow_page_entry* slot = &table[pos];
-        if (slot->state == CT_SHADOW_ENTRY_EMPTY)
+        const uintptr_t page = static_cast<uintptr_t>(ct_shadow_page_size);
+        const uintptr_t start = reinterpret_cast<uintptr_t>(begin);
+        const uintptr_t end = start + length;
+        const uintptr_t inner_start = (start + page - 1u) & ~(page - 1u);
+        const uintptr_t inner_end = end & ~(page - 1u);
+        if (inner_end > inner_start &&
+            ct_shadow_zero_pages(reinterpret_cast<void*>(inner_start), inner_end - inner_start))
         {
-            *slot = *entry;
-            return 1;
+            std::memset(begin, value, inner_start - start);
+            std::memset(reinterpret_cast<void*>(inner_end), value, end - inner_end);
+            return;
         }
     }
-    return 0;
+    std::memset(begin, value, length);
 }
 
-CT_NODISCARD CT_NOINSTR static int ct_shadow_grow_locked(void)
+// Unpoisoning writers and the reclaim sweep exclude each other, so a page is
+// never dropped between the sweep finding it poisoned and a writer making
+// part of it addressable. Only used when a limit is set.
+CT_NOINSTR static void ct_shadow_writer_enter(void)
 {
-    if (ct_shadow_table_bits >= CT_SHADOW_TABLE_MAX_BITS)
+    for (;;)
     {
-        return 0;
+        __atomic_add_fetch(&ct_shadow_writers, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&ct_shadow_sweeping, __ATOMIC_SEQ_CST))
+        {
+            return;
+        }
+        __atomic_sub_fetch(&ct_shadow_writers, 1, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&ct_shadow_sweeping, __ATOMIC_ACQUIRE))
+        {
+            ct_cpu_relax();
+        }
     }
+}
 
-    size_t new_bits = ct_shadow_table_bits + 1u;
-    size_t new_size = 1u << new_bits;
-    auto* new_table = static_cast<struct ct_shadow_page_entry*>(
-        std::malloc(sizeof(struct ct_shadow_page_entry) * new_size));
-    if (!new_table)
-    {
-        return 0;
-    }
-    std::memset(new_table, 0, sizeof(struct ct_shadow_page_entry) * new_size);
+CT_NOINSTR static void ct_shadow_writer_exit(void)
+{
+    __atomic_sub_fetch(&ct_shadow_writers, 1, __ATOMIC_RELEASE);
+}
 
-    size_t new_mask = new_size - 1u;
-    for (size_t i = 0; i < ct_shadow_table_size; ++i)
+CT_NOINSTR static void ct_shadow_mark_dirty(uintptr_t shadow_start, uintptr_t shadow_end)
+{
+    for (uintptr_t region = shadow_start >> CT_SHADOW_REGION_BITS;
+         region <= (shadow_end - 1u) >> CT_SHADOW_REGION_BITS; ++region)
     {
-        struct ct_shadow_page_entry* entry = &ct_shadow_table[i];
-        if (entry->state != CT_SHADOW_ENTRY_USED)
+        const uintptr_t word = region / 64u;
+        const uint64_t bit = static_cast<uint64_t>(1) << (region % 64u);
+        if (__atomic_load_n(&ct_shadow_dirty[word], __ATOMIC_RELAXED) & bit)
         {
             continue;
         }
-        (void)ct_shadow_rehash_entry(new_table, new_mask, new_size, entry);
+        __atomic_fetch_or(&ct_shadow_dirty[word], bit, __ATOMIC_RELAXED);
+        __atomic_fetch_or(&ct_shadow_dirty_summary[word / 64u],
+                          static_cast<uint64_t>(1) << (word % 64u), __ATOMIC_RELAXED);
     }
+}
 
-    if (ct_shadow_table != ct_shadow_table_storage)
+CT_NODISCARD CT_NOINSTR static int ct_shadow_page_poisoned(const unsigned char* page, size_t size)
+{
+    for (size_t offset = 0; offset < size; offset += sizeof(uint64_t))
     {
-        std::free(ct_shadow_table);
+        uint64_t word;
+        std::memcpy(&word, page + offset, sizeof(word));
+        if (word != 0)
+        {
+            return 0;
+        }
     }
-
-    ct_shadow_table = new_table;
-    ct_shadow_table_bits = new_bits;
-    ct_shadow_table_size = new_size;
-    ct_shadow_table_mask = new_mask;
-    ct_shadow_table_full_logged = 0;
     return 1;
 }
 
-CT_NODISCARD CT_NOINSTR static unsigned char* ct_shadow_get_page_locked(uintptr_t page, int create)
+// Returns the resident size of one marked region. With reclaim set, pages
+// that are entirely poisoned are dropped first and *empty reports whether
+// nothing of the region stays resident.
+CT_NODISCARD CT_NOINSTR static size_t ct_shadow_sweep_region(unsigned char* region, int reclaim,
+                                                             int* empty)
 {
-    for (int attempt = 0; attempt < 2; ++attempt)
+    const size_t page = ct_shadow_page_size;
+    const size_t pages = CT_SHADOW_REGION_SIZE / page;
+    ct_mincore_vec_t vec[CT_SHADOW_REGION_MAX_PAGES];
+    *empty = 0;
+    if (mincore(region, CT_SHADOW_REGION_SIZE, vec) != 0)
     {
-        size_t idx = ct_shadow_hash(page, ct_shadow_table_mask);
-        size_t tombstone = static_cast<size_t>(-1);
+        return 0;
+    }
 
-        for (size_t i = 0; i < ct_shadow_table_size; ++i)
+    size_t kept = 0;
+    size_t run_start = pages;
+    for (size_t i = 0; i <= pages; ++i)
+    {
+        const int drop = i < pages && (vec[i] & 1) && reclaim &&
+                         ct_shadow_page_poisoned(region + i * page, page);
+        if (drop)
         {
-            size_t pos = (idx + i) & ct_shadow_table_mask;
-            struct ct_shadow_page_entry* entry = &ct_shadow_table[pos];
-
-            if (entry->state == CT_SHADOW_ENTRY_USED)
+            if (run_start == pages)
             {
-                if (entry->page == page)
-                {
-                    return entry->data;
-                }
-                continue;
+                run_start = i;
             }
-
-            if (entry->state == CT_SHADOW_ENTRY_TOMB && tombstone == static_cast<size_t>(-1))
+            continue;
+        }
+        if (run_start != pages)
+        {
+            if (!ct_shadow_zero_pages(region + run_start * page, (i - run_start) * page))
             {
-                tombstone = pos;
-                continue;
+                kept += i - run_start;
             }
+            run_start = pages;
+        }
+        if (i < pages && (vec[i] & 1))
+        {
+            ++kept;
+        }
+    }
+    *empty = kept == 0;
+    return kept * page;
+}
 
-            if (entry->state == CT_SHADOW_ENTRY_EMPTY)
+// Walks the marked regions and returns the resident shadow size. With
+// reclaim set, the caller excludes writers and fully poisoned pages are
+// dropped; regions left with nothing resident are unmarked.
+CT_NODISCARD CT_NOINSTR static size_t ct_shadow_sweep(unsigned char* shadow, int reclaim)
+{
+    size_t resident = 0;
+    for (size_t summary = 0; summary < CT_SHADOW_SUMMARY_WORDS; ++summary)
+    {
+        uint64_t words = __atomic_load_n(&ct_shadow_dirty_summary[summary], __ATOMIC_RELAXED);
+        while (words)
+        {
+            const size_t word = summary * 64u + static_cast<size_t>(__builtin_ctzll(words));
+            words &= words - 1u;
+            uint64_t bits = __atomic_load_n(&ct_shadow_dirty[word], __ATOMIC_RELAXED);
+            while (bits)
             {
-                if (!create)
-                {
-                    return nullptr;
-                }
-
-                if (tombstone != static_cast<size_t>(-1))
-                {
-                    entry = &ct_shadow_table[tombstone];
-                }
-
-                unsigned char* data = static_cast<unsigned char*>(std::malloc(CT_SHADOW_PAGE_SIZE));
-                if (!data)
+                const unsigned bit = static_cast<unsigned>(__builtin_ctzll(bits));
+                bits &= bits - 1u;
+                const size_t region = word * 64u + bit;
+                int empty = 0;
+                resident += ct_shadow_sweep_region(shadow + (region << CT_SHADOW_REGION_BITS),
+                                                   reclaim, &empty);
+                if (empty)
                 {
-                    return nullptr;
+                    __atomic_and_fetch(&ct_shadow_dirty[word], ~(static_cast<uint64_t>(1) << bit),
+                                       __ATOMIC_RELAXED);
                 }
-                std::memset(data, 0xFF, CT_SHADOW_PAGE_SIZE);
-
-                entry->page = page;
-                entry->data = data;
-                entry->state = CT_SHADOW_ENTRY_USED;
-                return entry->data;
             }
-        }
-
-        if (!create || !ct_shadow_grow_locked())
-        {
-            if (create && !ct_shadow_table_full_logged)
+            if (reclaim && __atomic_load_n(&ct_shadow_dirty[word], __ATOMIC_RELAXED) == 0)
             {
-                ct_shadow_table_full_logged = 1;
-                ct_log(CTLevel::Warn, "{}shadow table full ({} entries){}\n",
-                       ct_color(CTColor::Red), ct_shadow_table_size, ct_color(CTColor::Reset));
+                __atomic_and_fetch(&ct_shadow_dirty_summary[summary],
+                                   ~(static_cast<uint64_t>(1) << (word % 64u)), __ATOMIC_RELAXED);
             }
-            return nullptr;
         }
     }
-
-    return nullptr;
+    return resident;
 }
 
-CT_NODISCARD CT_NOINSTR static unsigned char ct_shadow_get_byte_locked(uintptr_t shadow_index)
+CT_NOINSTR static void ct_shadow_enforce_limit(unsigned char* shadow)
 {
-    uintptr_t page = shadow_index >> CT_SHADOW_PAGE_BITS;
-    size_t offset = static_cast<size_t>(shadow_index & CT_SHADOW_PAGE_MASK);
-    unsigned char* data = ct_shadow_get_page_locked(page, 0);
-    if (!data)
+    if (__atomic_exchange_n(&ct_shadow_sweep_lock, 1, __ATOMIC_ACQUIRE) != 0)
     {
-        return 0xFF;
+        return;
+    }
+
+    size_t resident = ct_shadow_sweep(shadow, 0);
+    if (resident > ct_shadow_limit)
+    {
+        __atomic_store_n(&ct_shadow_sweeping, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&ct_shadow_writers, __ATOMIC_ACQUIRE) != 0)
+        {
+            ct_cpu_relax();
+        }
+        resident = ct_shadow_sweep(shadow, 1);
+        __atomic_store_n(&ct_shadow_sweeping, 0, __ATOMIC_RELEASE);
+    }
+    ct_spin_unlock(&ct_shadow_sweep_lock);
+
+    if (resident > ct_shadow_limit && !ct_shadow_limit_logged)
+    {
+        ct_shadow_limit_logged = 1;
+        ct_log(CTLevel::Warn, "{}shadow memory above CT_SHADOW_LIMIT_MB: {} bytes still in use{}\n",
+               ct_color(CTColor::Red), resident, ct_color(CTColor::Reset));
     }
-    return data[offset];
 }
 
-CT_NOINSTR static void ct_shadow_set_byte_locked(uintptr_t shadow_index, unsigned char value)
+// Counts unpoisoned shadow bytes, batched per thread, and checks the limit
+// each time another quarter of it has been written.
+CT_NOINSTR static void ct_shadow_account(unsigned char* shadow, size_t length)
 {
-    uintptr_t page = shadow_index >> CT_SHADOW_PAGE_BITS;
-    size_t offset = static_cast<size_t>(shadow_index & CT_SHADOW_PAGE_MASK);
-    unsigned char* data = ct_shadow_get_page_locked(page, 1);
-    if (!data)
+    ct_shadow_written_local += length;
+    if (ct_shadow_written_local < CT_SHADOW_ACCOUNT_BATCH)
     {
         return;
     }
-    data[offset] = value;
+    const size_t total =
+        __atomic_add_fetch(&ct_shadow_written, ct_shadow_written_local, __ATOMIC_RELAXED);
+    ct_shadow_written_local = 0;
+    const size_t quantum = ct_shadow_limit / 4u;
+    if (total >= quantum && __atomic_exchange_n(&ct_shadow_written, 0, __ATOMIC_RELAXED) >= quantum)
+    {
+        ct_shadow_enforce_limit(shadow);
+    }
 }
 
 CT_NOINSTR void ct_shadow_poison_range(const void* addr, size_t size)
@@ -215,20 +400,47 @@ CT_NOINSTR void ct_shadow_poison_range(const void* addr, size_t size)
 
     uintptr_t start = reinterpret_cast<uintptr_t>(addr);
     uintptr_t end = start + size;
-    if (end <= start)
+    if (end <= start || !ct_shadow_clamp(start, &end))
+    {
+        return;
+    }
+    unsigned char* shadow = ct_shadow_base();
+    if (!shadow)
     {
         return;
     }
 
-    uintptr_t shadow_start = start >> CT_SHADOW_SHIFT;
-    uintptr_t shadow_end = (end - 1) >> CT_SHADOW_SHIFT;
+    const uintptr_t shadow_start = start >> CT_SHADOW_SHIFT;
+    const uintptr_t shadow_end = (end - 1) >> CT_SHADOW_SHIFT;
+    ct_shadow_fill(shadow + shadow_start, static_cast<size_t>(shadow_end - shadow_start + 1u),
+                   CT_SHADOW_POISONED, CT_SHADOW_RELEASE_MIN);
+}
 
-    ct_shadow_lock_acquire();
-    for (uintptr_t idx = shadow_start; idx <= shadow_end; ++idx)
+CT_NOINSTR void ct_shadow_release_range(const void* addr, size_t size)
+{
+    if (!ct_is_enabled(CT_FEATURE_SHADOW) || !addr || size == 0)
     {
-        ct_shadow_set_byte_locked(idx, 0xFF);
+        return;
     }
-    ct_shadow_lock_release();
+
+    uintptr_t start = reinterpret_cast<uintptr_t>(addr);
+    uintptr_t end = start + size;
+    if (end <= start || !ct_shadow_clamp(start, &end))
+    {
+        return;
+    }
+    unsigned char* shadow = ct_shadow_base();
+    if (!shadow)
+    {
+        return;
+    }
+
+    // Nothing else can live in an unmapped range, so every whole shadow page
+    // inside it goes, not only those of large spans.
+    const uintptr_t shadow_start = start >> CT_SHADOW_SHIFT;
+    const uintptr_t shadow_end = (end - 1) >> CT_SHADOW_SHIFT;
+    ct_shadow_fill(shadow + shadow_start, static_cast<size_t>(shadow_end - shadow_start + 1u),
+                   CT_SHADOW_POISONED, ct_shadow_page_size);
 }
 
 CT_NOINSTR void ct_shadow_unpoison_range(const void* addr, size_t size)
@@ -239,69 +451,284 @@ CT_NOINSTR void ct_shadow_unpoison_range(const void* addr, size_t size)
     }
 
     uintptr_t start = reinterpret_cast<uintptr_t>(addr);
-    uintptr_t shadow_index = start >> CT_SHADOW_SHIFT;
-    size_t full = size / 8;
-    size_t tail = size % 8;
+    uintptr_t end = start + size;
+    if (end <= start || !ct_shadow_clamp(start, &end))
+    {
+        return;
+    }
+    unsigned char* shadow = ct_shadow_base();
+    if (!shadow)
+    {
+        return;
+    }
 
-    ct_shadow_lock_acquire();
-    for (size_t i = 0; i < full; ++i)
+    const uintptr_t shadow_index = start >> CT_SHADOW_SHIFT;
+    const size_t length = static_cast<size_t>(end - start);
+    const size_t full = length / CT_SHADOW_GRANULE;
+    const size_t tail = length % CT_SHADOW_GRANULE;
+    const size_t written = full + (tail != 0 ? 1u : 0u);
+    if (ct_shadow_limit)
     {
-        ct_shadow_set_byte_locked(shadow_index + i, 0);
+        ct_shadow_writer_enter();
+        ct_shadow_mark_dirty(shadow_index, shadow_index + written);
     }
+    ct_shadow_fill(shadow + shadow_index, full, CT_SHADOW_ADDRESSABLE, 0);
     if (tail != 0)
     {
-        ct_shadow_set_byte_locked(shadow_index + full, static_cast<unsigned char>(tail));
+        shadow[shadow_index + full] = static_cast<unsigned char>(CT_SHADOW_ADDRESSABLE ^ tail);
+    }
+    if (ct_shadow_limit)
+    {
+        ct_shadow_writer_exit();
+        ct_shadow_account(shadow, written);
     }
-    ct_shadow_lock_release();
 }
 
-CT_NODISCARD CT_NOINSTR int ct_shadow_check_access(const void* ptr, size_t access_size,
-                                                   const void* base, size_t req_size,
-                                                   size_t alloc_size, const char* alloc_site,
-                                                   const char* site, int is_write,
-                                                   unsigned char state)
+CT_NODISCARD CT_NOINSTR static int ct_shadow_stack_bounds(uintptr_t* lo, uintptr_t* hi)
 {
-    uintptr_t start = reinterpret_cast<uintptr_t>(ptr);
-    uintptr_t end = start + access_size;
-    if (end <= start)
+#if defined(__APPLE__)
+    pthread_t thread = pthread_self();
+    *hi = reinterpret_cast<uintptr_t>(pthread_get_stackaddr_np(thread));
+    *lo = *hi - pthread_get_stacksize_np(thread);
+    return *lo < *hi;
+#else
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0)
+    {
+        return 0;
+    }
+    void* base = nullptr;
+    size_t size = 0;
+    const int rc = pthread_attr_getstack(&attr, &base, &size);
+    pthread_attr_destroy(&attr);
+    *lo = reinterpret_cast<uintptr_t>(base);
+    *hi = *lo + size;
+    return rc == 0 && size != 0;
+#endif
+}
+
+// Returns 1 if addr is on this thread's stack, after unpoisoning the stack
+// from addr up.
+CT_NODISCARD CT_NOINSTR static int ct_shadow_unpoison_stack(uintptr_t addr)
+{
+    if (!ct_shadow_stack_hi)
+    {
+        uintptr_t lo = 0;
+        uintptr_t hi = 0;
+        if (!ct_shadow_stack_bounds(&lo, &hi))
+        {
+            // Never look again on this thread.
+            lo = hi = 1;
+        }
+        ct_shadow_stack_lo = lo;
+        ct_shadow_stack_hi = hi;
+        ct_shadow_stack_open = hi;
+    }
+    if (addr < ct_shadow_stack_lo || addr >= ct_shadow_stack_hi)
     {
         return 0;
     }
+    if (addr < ct_shadow_stack_open)
+    {
+        uintptr_t start = addr & ~(CT_SHADOW_STACK_CHUNK - 1u);
+        start = start > ct_shadow_stack_lo ? start : ct_shadow_stack_lo;
+        ct_shadow_unpoison_range(reinterpret_cast<const void*>(start),
+                                 static_cast<size_t>(ct_shadow_stack_open - start));
+        ct_shadow_stack_open = start;
+    }
+    return 1;
+}
+
+#if defined(__APPLE__)
+CT_NOINSTR static void ct_shadow_unpoison_images(void)
+{
+    const uint32_t count = _dyld_image_count();
+    if (count == __atomic_load_n(&ct_shadow_images_seen, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const struct mach_header* header = _dyld_get_image_header(i);
+        if (!header || header->magic != MH_MAGIC_64)
+        {
+            continue;
+        }
+        const uintptr_t slide = static_cast<uintptr_t>(_dyld_get_image_vmaddr_slide(i));
+        const uint8_t* cmd_ptr =
+            reinterpret_cast<const uint8_t*>(header) + sizeof(struct mach_header_64);
+        for (uint32_t cmd_index = 0; cmd_index < header->ncmds; ++cmd_index)
+        {
+            const auto* cmd = reinterpret_cast<const struct load_command*>(cmd_ptr);
+            if (cmd->cmd == LC_SEGMENT_64)
+            {
+                const auto* seg = reinterpret_cast<const struct segment_command_64*>(cmd);
+                // __PAGEZERO and other guard segments are never mapped.
+                if (seg->initprot != 0)
+                {
+                    ct_shadow_unpoison_range(reinterpret_cast<const void*>(seg->vmaddr + slide),
+                                             static_cast<size_t>(seg->vmsize));
+                }
+            }
+            cmd_ptr += cmd->cmdsize;
+        }
+    }
+    __atomic_store_n(&ct_shadow_images_seen, count, __ATOMIC_RELEASE);
+}
+#else
+struct ct_shadow_image_sweep
+{
+    unsigned long long seen;
+    unsigned long long adds;
+};
+
+CT_NOINSTR static int ct_shadow_unpoison_image(struct dl_phdr_info* info, size_t, void* ctx)
+{
+    auto* sweep = static_cast<struct ct_shadow_image_sweep*>(ctx);
+    sweep->adds = info->dlpi_adds;
+    if (sweep->adds == sweep->seen)
+    {
+        // Nothing was loaded since the last sweep.
+        return 1;
+    }
+    for (size_t i = 0; i < info->dlpi_phnum; ++i)
+    {
+        const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+        if (phdr.p_type == PT_LOAD)
+        {
+            ct_shadow_unpoison_range(reinterpret_cast<const void*>(info->dlpi_addr + phdr.p_vaddr),
+                                     static_cast<size_t>(phdr.p_memsz));
+        }
+    }
+    return 0;
+}
 
+CT_NOINSTR static void ct_shadow_unpoison_images(void)
+{
+    struct ct_shadow_image_sweep sweep = {
+        __atomic_load_n(&ct_shadow_images_seen, __ATOMIC_ACQUIRE), 0};
+    (void)dl_iterate_phdr(ct_shadow_unpoison_image, &sweep);
+    __atomic_store_n(&ct_shadow_images_seen, sweep.adds, __ATOMIC_RELEASE);
+}
+#endif
+
+// Returns 1 if any byte of [start, end) is not addressable.
+CT_NODISCARD CT_NOINSTR static int ct_shadow_scan(const unsigned char* shadow, uintptr_t start,
+                                                  uintptr_t end)
+{
     uintptr_t shadow_start = start >> CT_SHADOW_SHIFT;
-    uintptr_t shadow_end = (end - 1) >> CT_SHADOW_SHIFT;
+    const uintptr_t shadow_end = (end - 1) >> CT_SHADOW_SHIFT;
+
+    // Skip fully addressable granules eight at a time; only a word holding a
+    // partial or poisoned granule needs the exact check below.
+    while (shadow_end - shadow_start >= sizeof(uint64_t))
+    {
+        uint64_t word;
+        std::memcpy(&word, shadow + shadow_start, sizeof(word));
+        if (word != ~static_cast<uint64_t>(0))
+        {
+            break;
+        }
+        shadow_start += sizeof(uint64_t);
+    }
 
-    int oob = 0;
-    ct_shadow_lock_acquire();
     for (uintptr_t idx = shadow_start; idx <= shadow_end; ++idx)
     {
-        unsigned char value = ct_shadow_get_byte_locked(idx);
+        const unsigned value = shadow[idx] ^ CT_SHADOW_ADDRESSABLE;
         if (value == 0)
         {
             continue;
         }
 
-        uintptr_t block_start = idx << CT_SHADOW_SHIFT;
-        uintptr_t block_end = block_start + 8;
-        uintptr_t access_start = start > block_start ? start : block_start;
-        uintptr_t access_end = end < block_end ? end : block_end;
-
-        if (value == 0xFF)
+        const uintptr_t block_start = idx << CT_SHADOW_SHIFT;
+        const uintptr_t block_end = block_start + CT_SHADOW_GRANULE;
+        const uintptr_t access_end = end < block_end ? end : block_end;
+        if (value >= CT_SHADOW_GRANULE || access_end > block_start + value)
         {
-            oob = 1;
-            break;
+            return 1;
         }
+    }
+    return 0;
+}
 
-        uintptr_t allowed_end = block_start + static_cast<uintptr_t>(value);
-        if (access_end > allowed_end)
+// Returns 0 if ptr lies in no loaded image, without taking the loader lock.
+// Where that cannot be told, every address may belong to one.
+CT_NODISCARD CT_NOINSTR static int ct_shadow_maybe_image(const void* ptr)
+{
+#if defined(DLFO_STRUCT_HAS_EH_DBASE)
+    struct dl_find_object object;
+    return _dl_find_object(const_cast<void*>(ptr), &object) == 0;
+#else
+    (void)ptr;
+    return 1;
+#endif
+}
+
+CT_NOINSTR void ct_shadow_unpoison_untracked(const void* ptr, size_t access_size)
+{
+    if (!ct_is_enabled(CT_FEATURE_SHADOW) || !ptr || !ct_shadow_base())
+    {
+        return;
+    }
+    uintptr_t start = reinterpret_cast<uintptr_t>(ptr);
+    uintptr_t end = start + (access_size ? access_size : 1u);
+    if (end <= start || !ct_shadow_clamp(start, &end))
+    {
+        return;
+    }
+    const unsigned char* shadow = ct_shadow_base();
+    // Out-of-line checks come here on every access to untracked memory, the
+    // inline ones only until the range is unpoisoned below.
+    if (!ct_shadow_scan(shadow, start, end) || ct_shadow_unpoison_stack(start))
+    {
+        return;
+    }
+    if (ct_shadow_maybe_image(ptr))
+    {
+        ct_shadow_unpoison_images();
+        if (!ct_shadow_scan(shadow, start, end))
         {
-            oob = 1;
-            break;
+            return;
         }
     }
-    ct_shadow_lock_release();
+    // Memory of another thread's stack or of an uninstrumented allocator.
+    // Unless it is the redzone or freed memory of an allocation, whose shadow
+    // must stay poisoned, make the granules this access touched addressable
+    // so that the next access takes the inline path.
+    if (ct_table_lookup_containing(ptr, nullptr, nullptr, nullptr, nullptr, nullptr))
+    {
+        return;
+    }
+    start &= ~static_cast<uintptr_t>(CT_SHADOW_GRANULE - 1u);
+    end = (end + CT_SHADOW_GRANULE - 1u) & ~static_cast<uintptr_t>(CT_SHADOW_GRANULE - 1u);
+    ct_shadow_unpoison_range(reinterpret_cast<const void*>(start),
+                             static_cast<size_t>(end - start));
+}
 
-    if (!oob)
+CT_NODISCARD CT_NOINSTR int ct_shadow_check_access(const void* ptr, size_t access_size,
+                                                   const void* base, size_t req_size,
+                                                   size_t alloc_size, const char* alloc_site,
+                                                   const char* site, int is_write,
+                                                   unsigned char state)
+{
+    uintptr_t start = reinterpret_cast<uintptr_t>(ptr);
+    uintptr_t end = start + access_size;
+    if (end <= start || !ct_shadow_clamp(start, &end))
+    {
+        return 0;
+    }
+    const unsigned char* shadow = ct_shadow_base();
+    if (!shadow)
+    {
+        return 0;
+    }
+
+    if (!ct_shadow_scan(shadow, start, end))
+    {
+        return 0;
+    }
+    if (ct_shadow_fault_in(base, req_size ? req_size : alloc_size, ptr, access_size, state) &&
+        !ct_shadow_scan(shadow, start, end))
     {
         return 0;
     }
@@ -0,0 +1,192 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "ct_runtime_table.h"
+
+#include "ct_runtime_sync.h"
+
+#include <cstdlib>
+
+// Allocation sites are string literals emitted by the instrumentation pass,
+// one per call site, so they are interned by address. IDs index a chunked
+// array that never moves; a pointer-keyed open-addressing index maps a site
+// back to its ID. Both only ever grow, and readers go through them without
+// the lock: a site is published in the index after its ID slot is written,
+// and an index that has been replaced by a larger one is kept alive.
+#define CT_SITE_CHUNK_BITS 12u
+#define CT_SITE_CHUNK_SIZE (1u << CT_SITE_CHUNK_BITS)
+#define CT_SITE_MAX_CHUNKS 1024u
+#define CT_SITE_MAX_IDS (CT_SITE_MAX_CHUNKS * CT_SITE_CHUNK_SIZE)
+#define CT_SITE_INDEX_MIN 1024u
+
+struct ct_site_index
+{
+    size_t mask;
+    const char** keys;
+    uint32_t* ids;
+};
+
+static const char** ct_site_chunks[CT_SITE_MAX_CHUNKS];
+static struct ct_site_index* ct_site_index_current = nullptr;
+static uint32_t ct_site_next_id = 1; // 0 stands for "no site"
+static int ct_site_lock = 0;
+static int ct_site_full_logged = 0;
+
+static thread_local const char* ct_site_cached_key = nullptr;
+static thread_local uint32_t ct_site_cached_id = 0;
+
+CT_NODISCARD CT_NOINSTR static inline size_t ct_site_hash(const char* site)
+{
+    uint64_t value = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(site));
+    value ^= value >> 33;
+    value *= 0xFF51AFD7ED558CCDull;
+    value ^= value >> 33;
+    return static_cast<size_t>(value);
+}
+
+CT_NODISCARD CT_NOINSTR static uint32_t ct_site_index_find(const struct ct_site_index* index,
+                                                           const char* site)
+{
+    for (size_t pos = ct_site_hash(site) & index->mask;; pos = (pos + 1u) & index->mask)
+    {
+        const char* key = __atomic_load_n(&index->keys[pos], __ATOMIC_ACQUIRE);
+        if (key == site)
+        {
+            return __atomic_load_n(&index->ids[pos], __ATOMIC_RELAXED);
+        }
+        if (!key)
+        {
+            return 0;
+        }
+    }
+}
+
+CT_NOINSTR static void ct_site_index_put(struct ct_site_index* index, const char* site,
+                                         uint32_t id)
+{
+    size_t pos = ct_site_hash(site) & index->mask;
+    while (index->keys[pos])
+    {
+        pos = (pos + 1u) & index->mask;
+    }
+    __atomic_store_n(&index->ids[pos], id, __ATOMIC_RELAXED);
+    __atomic_store_n(&index->keys[pos], site, __ATOMIC_RELEASE);
+}
+
+// Rebuilds the index at twice its size from the ID chunks. The old index is
+// left to in-flight readers.
+CT_NODISCARD CT_NOINSTR static int ct_site_index_grow_locked(void)
+{
+    const struct ct_site_index* old_index = ct_site_index_current;
+    const size_t size = old_index ? (old_index->mask + 1u) * 2u : CT_SITE_INDEX_MIN;
+    const size_t bytes =
+        sizeof(struct ct_site_index) + size * (sizeof(const char*) + sizeof(uint32_t));
+    auto* block = static_cast<unsigned char*>(std::calloc(1, bytes));
+    if (!block)
+    {
+        return 0;
+    }
+
+    auto* index = reinterpret_cast<struct ct_site_index*>(block);
+    index->mask = size - 1u;
+    index->keys = reinterpret_cast<const char**>(block + sizeof(struct ct_site_index));
+    index->ids = reinterpret_cast<uint32_t*>(index->keys + size);
+    for (uint32_t id = 1; id < ct_site_next_id; ++id)
+    {
+        const char** chunk = ct_site_chunks[id >> CT_SITE_CHUNK_BITS];
+        ct_site_index_put(index, chunk[id & (CT_SITE_CHUNK_SIZE - 1u)], id);
+    }
+    __atomic_store_n(&ct_site_index_current, index, __ATOMIC_RELEASE);
+    return 1;
+}
+
+CT_NODISCARD CT_NOINSTR static uint32_t ct_site_add_locked(const char* site)
+{
+    const uint32_t id = ct_site_next_id;
+    if (id >= CT_SITE_MAX_IDS)
+    {
+        return 0;
+    }
+    const struct ct_site_index* index = ct_site_index_current;
+    if ((!index || (static_cast<size_t>(id) + 1u) * 2u > index->mask + 1u) &&
+        !ct_site_index_grow_locked())
+    {
+        return 0;
+    }
+
+    const char** chunk = ct_site_chunks[id >> CT_SITE_CHUNK_BITS];
+    if (!chunk)
+    {
+        chunk = static_cast<const char**>(std::calloc(CT_SITE_CHUNK_SIZE, sizeof(const char*)));
+        if (!chunk)
+        {
+            return 0;
+        }
+        __atomic_store_n(&ct_site_chunks[id >> CT_SITE_CHUNK_BITS], chunk, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&chunk[id & (CT_SITE_CHUNK_SIZE - 1u)], site, __ATOMIC_RELAXED);
+    __atomic_store_n(&ct_site_next_id, id + 1u, __ATOMIC_RELEASE);
+    ct_site_index_put(ct_site_index_current, site, id);
+    return id;
+}
+
+CT_NODISCARD CT_NOINSTR uint32_t ct_site_intern(const char* site)
+{
+    if (!site)
+    {
+        return 0;
+    }
+    if (ct_site_cached_key == site)
+    {
+        return ct_site_cached_id;
+    }
+
+    const struct ct_site_index* index =
+        __atomic_load_n(&ct_site_index_current, __ATOMIC_ACQUIRE);
+    uint32_t id = index ? ct_site_index_find(index, site) : 0;
+    if (!id)
+    {
+        int log_full = 0;
+        ct_spin_lock(&ct_site_lock);
+        id = ct_site_index_current ? ct_site_index_find(ct_site_index_current, site) : 0;
+        if (!id)
+        {
+            id = ct_site_add_locked(site);
+            if (!id && !ct_site_full_logged)
+            {
+                ct_site_full_logged = 1;
+                log_full = 1;
+            }
+        }
+        ct_spin_unlock(&ct_site_lock);
+
+        if (log_full)
+        {
+            ct_log(CTLevel::Warn, "{}site table full, further sites are not recorded{}\n",
+                   ct_color(CTColor::Red), ct_color(CTColor::Reset));
+        }
+        if (!id)
+        {
+            return 0;
+        }
+    }
+
+    ct_site_cached_key = site;
+    ct_site_cached_id = id;
+    return id;
+}
+
+CT_NODISCARD CT_NOINSTR const char* ct_site_from_id(uint32_t site_id)
+{
+    if (site_id == 0 || site_id >= __atomic_load_n(&ct_site_next_id, __ATOMIC_ACQUIRE))
+    {
+        return nullptr;
+    }
+    const char* const* chunk =
+        __atomic_load_n(&ct_site_chunks[site_id >> CT_SITE_CHUNK_BITS], __ATOMIC_ACQUIRE);
+    return chunk ? __atomic_load_n(&chunk[site_id & (CT_SITE_CHUNK_SIZE - 1u)], __ATOMIC_RELAXED)
+                 : nullptr;
+}
+
+CT_NODISCARD CT_NOINSTR uint32_t ct_site_count(void)
+{
+    return __atomic_load_n(&ct_site_next_id, __ATOMIC_ACQUIRE) - 1u;
+}
@@ -8,7 +8,6 @@ namespace
     constexpr uint64_t kDefaultFeatures = CT_FEATURE_TRACE | CT_FEATURE_ALLOC | CT_FEATURE_BOUNDS |
                                           CT_FEATURE_AUTOFREE | CT_FEATURE_ALLOC_TRACE;
 
-    std::atomic<uint64_t> ct_feature_flags{kDefaultFeatures};
     std::atomic<int> ct_bounds_abort_state{1};
     std::atomic<size_t> ct_early_trace_count_state{0};
     std::atomic<size_t> ct_early_trace_limit_state{200};
@@ -31,6 +30,8 @@ namespace
     }
 } // namespace
 
+std::atomic<uint64_t> __ct_feature_flags{kDefaultFeatures};
+
 int ct_disable_trace = 0;
 int ct_disable_alloc = 0;
 int ct_disable_bounds = 0;
@@ -53,7 +54,7 @@ namespace
     {
         CT_NOINSTR CtRuntimeLegacyInit()
         {
-            ct_sync_legacy_flags(ct_feature_flags.load(std::memory_order_relaxed));
+            ct_sync_legacy_flags(__ct_feature_flags.load(std::memory_order_relaxed));
         }
     };
 
@@ -64,25 +65,25 @@ extern "C"
 {
     CT_NODISCARD CT_NOINSTR int ct_is_enabled(uint64_t feature)
     {
-        return (ct_feature_flags.load(std::memory_order_relaxed) & feature) != 0;
+        return (__ct_feature_flags.load(std::memory_order_relaxed) & feature) != 0;
     }
 
     CT_NOINSTR void ct_set_enabled(uint64_t feature, int enabled)
     {
         if (enabled)
         {
-            uint64_t previous = ct_feature_flags.fetch_or(feature, std::memory_order_relaxed);
+            uint64_t previous = __ct_feature_flags.fetch_or(feature, std::memory_order_relaxed);
             ct_sync_legacy_flags(previous | feature);
             return;
         }
 
-        uint64_t previous = ct_feature_flags.fetch_and(~feature, std::memory_order_relaxed);
+        uint64_t previous = __ct_feature_flags.fetch_and(~feature, std::memory_order_relaxed);
         ct_sync_legacy_flags(previous & ~feature);
     }
 
     CT_NODISCARD CT_NOINSTR uint64_t ct_get_features(void)
     {
-        return ct_feature_flags.load(std::memory_order_relaxed);
+        return __ct_feature_flags.load(std::memory_order_relaxed);
     }
 
     CT_NODISCARD CT_NOINSTR int ct_bounds_abort_enabled(void)
@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: Apache-2.0
+#ifndef CT_RUNTIME_SYNC_H
+#define CT_RUNTIME_SYNC_H
+
+#include "ct_runtime_internal.h"
+
+#include <sched.h>
+
+// Minimal spin lock for the runtime's internal tables. It must not allocate or
+// call back into instrumented code, which rules out std::mutex in the hooks.
+#define CT_LOCK_SPIN_LIMIT 128u
+
+CT_NOINSTR inline void ct_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+CT_NOINSTR inline void ct_spin_lock(int* lock)
+{
+    unsigned spins = 0;
+    for (;;)
+    {
+        if (__atomic_load_n(lock, __ATOMIC_RELAXED) == 0 &&
+            __atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE) == 0)
+        {
+            return;
+        }
+        if (spins < CT_LOCK_SPIN_LIMIT)
+        {
+            ++spins;
+            ct_cpu_relax();
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+}
+
+CT_NOINSTR inline void ct_spin_unlock(int* lock)
+{
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+#endif // CT_RUNTIME_SYNC_H
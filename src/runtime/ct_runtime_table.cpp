@@ -0,0 +1,2091 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "ct_runtime_table.h"
+
+#include "ct_runtime_pagemap.h"
+#include "ct_runtime_sync.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// The table is split into address-hashed shards so that threads allocating
+// unrelated pointers do not serialize on a single lock. Each shard owns its
+// lock, live count, an open-addressing table of live allocations and a small
+// history of recently freed ones.
+//
+// Live tables use a SwissTable-style layout: one control byte per slot
+// (0 = empty, 1 = deleted, 0x80 | 7-bit hash tag = occupied) probed sixteen at
+// a time, the keys in their own array and the cold metadata in a third one. A
+// lookup touches one control group and, on a tag hit, a single key; metadata
+// is only read for the matching slot.
+//
+// Tables grow without bound and never rehash in one go: a resize installs the
+// new table and keeps the previous one as the migration source. Every write
+// to the shard then moves a couple of groups across, and lookups consult the
+// new table first and the old one second. Migrated slots are marked deleted in
+// the old table so probe chains there stay intact.
+//
+// Freed pointers leave the live table and go to the shard's history: a FIFO
+// ring bounded by CT_FREED_HISTORY_ENTRIES / CT_FREED_HISTORY_BYTES with a
+// linear-probing index, consulted only to classify double frees and
+// use-after-free accesses. A churn-heavy program therefore keeps a live table
+// sized by its live allocations.
+//
+// Every range the shard knows about, live or in the history, is also
+// registered in the page map so containing lookups resolve an interior
+// pointer from its page instead of scanning all shards.
+//
+// Lookups do not take the shard lock: writers bump the shard sequence counter
+// to an odd value while they mutate and back to even when done, and readers
+// copy the entry out and retry if the counter moved. Table memory is never
+// returned to the allocator (the previous generation is kept as a spare for
+// the next same-sized rebuild) so an in-flight reader never touches released
+// memory.
+//
+// Tables are mapped from the OS on first use rather than linked in as static
+// arrays, so a short-lived tool only pays for the slots it touches. The
+// initial size comes from CT_ALLOC_TABLE_BITS or the --ct-alloc-table-bits
+// hint compiled into the binary (log2 of the slots over all shards).
+#define CT_ALLOC_SHARD_BITS 6u
+#define CT_ALLOC_SHARDS (1u << CT_ALLOC_SHARD_BITS)
+#define CT_ALLOC_TABLE_DEFAULT_BITS 12u
+#define CT_ALLOC_TABLE_MAX_BITS 36u
+// Larger hints would reserve gigabytes up front; tables still grow past it.
+#define CT_ALLOC_TABLE_MAX_INITIAL_BITS 26u
+#define CT_ALLOC_GROUP_WIDTH 16u
+#define CT_ALLOC_MIGRATE_GROUPS 2u
+#define CT_CTRL_EMPTY 0u
+#define CT_CTRL_DELETED 1u
+#define CT_CTRL_FULL 0x80u
+#define CT_SLOT_NONE (~static_cast<size_t>(0))
+#define CT_FREED_HISTORY_DEFAULT_ENTRIES 65536u
+#define CT_SEQ_READ_RETRIES 8u
+
+struct ct_alloc_table
+{
+    size_t size;
+    size_t group_mask;
+    unsigned char* ctrl;
+    void** keys;
+    struct ct_alloc_meta* meta;
+};
+
+struct ct_freed_record
+{
+    void* ptr;
+    struct ct_alloc_meta meta;
+};
+
+// Ring of freed records, oldest at head. index maps a pointer to its record
+// (ring position + 1, 0 = empty); records whose pointer was freed again or
+// became live again are orphaned with ptr = nullptr and simply age out.
+struct ct_freed_history
+{
+    struct ct_freed_record* ring;
+    uint32_t* index;
+    size_t capacity;
+    size_t index_mask;
+    size_t head;
+    size_t count;
+    size_t bytes;
+    int init_failed;
+};
+
+struct alignas(64) ct_alloc_shard
+{
+    int lock;
+    int full_logged;
+    unsigned seq;
+    struct ct_alloc_table* table;
+    struct ct_alloc_table* old;
+    struct ct_alloc_table* spare;
+    size_t migrate_group;
+    size_t used;
+    size_t count;
+    struct ct_freed_history history;
+};
+
+// One-group tables a shard falls back to when the OS refuses its first table.
+alignas(64) static unsigned char ct_alloc_fallback_ctrl[CT_ALLOC_SHARDS][CT_ALLOC_GROUP_WIDTH];
+static void* ct_alloc_fallback_keys[CT_ALLOC_SHARDS][CT_ALLOC_GROUP_WIDTH];
+static struct ct_alloc_meta ct_alloc_fallback_meta[CT_ALLOC_SHARDS][CT_ALLOC_GROUP_WIDTH];
+static struct ct_alloc_table ct_alloc_fallback_tables[CT_ALLOC_SHARDS];
+static struct ct_alloc_shard ct_alloc_shards[CT_ALLOC_SHARDS];
+
+// Bumped whenever a live entry of the shard is retired or refreshed. Bounds
+// check memos of shard entries are validated against it; it has a line of
+// its own so that those reads do not share the shard's busy one.
+struct alignas(64) ct_shard_guard
+{
+    uint64_t epoch;
+};
+static struct ct_shard_guard ct_shard_guards[CT_ALLOC_SHARDS];
+
+// Set once a range could not be registered in the page map; containing
+// lookups then fall back to scanning the tables.
+static int ct_pagemap_incomplete = 0;
+static int ct_freed_history_configured = 0;
+static size_t ct_freed_history_entries = 0;
+static size_t ct_freed_history_bytes = 0;
+
+CT_NODISCARD CT_NOINSTR static struct ct_alloc_table* ct_table_create(size_t size)
+{
+    const size_t header = (sizeof(struct ct_alloc_table) + 63u) & ~static_cast<size_t>(63u);
+    const size_t bytes =
+        header + size * (sizeof(unsigned char) + sizeof(void*) + sizeof(struct ct_alloc_meta));
+    auto* block = static_cast<unsigned char*>(ct_os_alloc(bytes));
+    if (!block)
+    {
+        return nullptr;
+    }
+
+    auto* table = reinterpret_cast<struct ct_alloc_table*>(block);
+    table->size = size;
+    table->group_mask = size / CT_ALLOC_GROUP_WIDTH - 1u;
+    table->ctrl = block + header;
+    table->keys = reinterpret_cast<void**>(table->ctrl + size);
+    table->meta = reinterpret_cast<struct ct_alloc_meta*>(table->keys + size);
+    return table;
+}
+
+static int ct_table_bits_logged = 0;
+static int ct_table_fallback_logged = 0;
+static int ct_table_fixed_logged = 0;
+
+// Callers hold a shard lock, so this writes directly instead of going through
+// ct_log, which may allocate.
+CT_NOINSTR static void ct_table_warn_once(int* logged, const char* message, size_t value,
+                                          const char* tail)
+{
+    if (__atomic_exchange_n(logged, 1, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+    ct_write_prefix(CTLevel::Warn);
+    ct_write_str(ct_color(CTColor::Yellow));
+    ct_write_cstr(message);
+    ct_write_dec(value);
+    ct_write_cstr(tail);
+    ct_write_str(ct_color(CTColor::Reset));
+    ct_write_cstr("\n");
+}
+
+CT_NODISCARD CT_NOINSTR static unsigned ct_table_initial_bits(void)
+{
+    unsigned bits = ct_alloc_table_bits_hint();
+    if (bits == 0)
+    {
+        bits = CT_ALLOC_TABLE_DEFAULT_BITS;
+    }
+    const unsigned min_bits = CT_ALLOC_SHARD_BITS + 4u; // one probe group per shard
+    if (bits < min_bits)
+    {
+        bits = min_bits;
+    }
+    if (bits > CT_ALLOC_TABLE_MAX_INITIAL_BITS)
+    {
+        ct_table_warn_once(&ct_table_bits_logged, "ct: alloc table bits ", bits,
+                           " too large, using the maximum");
+        bits = CT_ALLOC_TABLE_MAX_INITIAL_BITS;
+    }
+    return bits;
+}
+
+CT_NOINSTR static void ct_shard_lock(struct ct_alloc_shard* shard)
+{
+    ct_spin_lock(&shard->lock);
+    if (!shard->table)
+    {
+        const unsigned bits = ct_table_initial_bits();
+        struct ct_alloc_table* table =
+            ct_table_create(static_cast<size_t>(1) << (bits - CT_ALLOC_SHARD_BITS));
+        if (!table && bits > CT_ALLOC_TABLE_DEFAULT_BITS)
+        {
+            ct_table_warn_once(&ct_table_fallback_logged, "ct: cannot map an alloc table of 2^",
+                               bits, " entries, using the default size");
+            table = ct_table_create(static_cast<size_t>(1)
+                                    << (CT_ALLOC_TABLE_DEFAULT_BITS - CT_ALLOC_SHARD_BITS));
+        }
+        if (!table)
+        {
+            ct_table_warn_once(&ct_table_fixed_logged,
+                               "ct: cannot map the alloc table, using a fixed one of ",
+                               CT_ALLOC_SHARDS * CT_ALLOC_GROUP_WIDTH, " entries");
+            const size_t shard_index = static_cast<size_t>(shard - ct_alloc_shards);
+            table = &ct_alloc_fallback_tables[shard_index];
+            table->size = CT_ALLOC_GROUP_WIDTH;
+            table->group_mask = 0;
+            table->ctrl = ct_alloc_fallback_ctrl[shard_index];
+            table->keys = ct_alloc_fallback_keys[shard_index];
+            table->meta = ct_alloc_fallback_meta[shard_index];
+        }
+        __atomic_store_n(&shard->table, table, __ATOMIC_RELEASE);
+    }
+}
+
+CT_NOINSTR static void ct_shard_unlock(struct ct_alloc_shard* shard)
+{
+    ct_spin_unlock(&shard->lock);
+}
+
+// Writer side of the shard seqlock; must be called with the shard lock held.
+CT_NOINSTR static void ct_shard_write_begin(struct ct_alloc_shard* shard)
+{
+    __atomic_store_n(&shard->seq, shard->seq + 1u, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+CT_NOINSTR static void ct_shard_write_end(struct ct_alloc_shard* shard)
+{
+    __atomic_store_n(&shard->seq, shard->seq + 1u, __ATOMIC_RELEASE);
+}
+
+struct ct_shard_view
+{
+    const struct ct_alloc_table* table;
+    const struct ct_alloc_table* old;
+    const uint32_t* history_index;
+    unsigned seq;
+};
+
+// Snapshots the shard tables for an optimistic read. Returns 0 while a writer
+// is active. The returned tables stay valid memory even if the shard resizes
+// afterwards, so probing them is safe until ct_shard_read_validate().
+CT_NODISCARD CT_NOINSTR static int ct_shard_read_begin(const struct ct_alloc_shard* shard,
+                                                       struct ct_shard_view* view)
+{
+    view->seq = __atomic_load_n(&shard->seq, __ATOMIC_ACQUIRE);
+    if (view->seq & 1u)
+    {
+        return 0;
+    }
+    view->table = __atomic_load_n(&shard->table, __ATOMIC_ACQUIRE);
+    view->old = __atomic_load_n(&shard->old, __ATOMIC_ACQUIRE);
+    view->history_index = __atomic_load_n(&shard->history.index, __ATOMIC_ACQUIRE);
+    return 1;
+}
+
+CT_NODISCARD CT_NOINSTR static int ct_shard_read_validate(const struct ct_alloc_shard* shard,
+                                                          const struct ct_shard_view* view)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&shard->seq, __ATOMIC_RELAXED) == view->seq;
+}
+
+CT_NOINSTR static void ct_meta_load_relaxed(const struct ct_alloc_meta* meta,
+                                            struct ct_alloc_meta* out)
+{
+    out->bits = __atomic_load_n(&meta->bits, __ATOMIC_RELAXED);
+    out->site_id = __atomic_load_n(&meta->site_id, __ATOMIC_RELAXED);
+    out->slack = __atomic_load_n(&meta->slack, __ATOMIC_RELAXED);
+}
+
+// Finalizer of MurmurHash3: malloc pointers share their low alignment bits
+// and often their high bits, so every output bit must depend on the middle.
+CT_NODISCARD CT_NOINSTR static inline uint64_t ct_hash_ptr(const void* ptr)
+{
+    uint64_t value = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(ptr));
+    value ^= value >> 33;
+    value *= 0xFF51AFD7ED558CCDull;
+    value ^= value >> 33;
+    value *= 0xC4CEB9FE1A85EC53ull;
+    value ^= value >> 33;
+    return value;
+}
+
+CT_NODISCARD CT_NOINSTR static inline unsigned char ct_hash_tag(uint64_t hash)
+{
+    return static_cast<unsigned char>(CT_CTRL_FULL | (hash & 0x7Fu));
+}
+
+CT_NODISCARD CT_NOINSTR static inline size_t ct_hash_group(uint64_t hash, size_t group_mask)
+{
+    return static_cast<size_t>(hash >> 7) & group_mask;
+}
+
+// Bit i of the result is set when control byte i of the group equals tag.
+CT_NODISCARD CT_NOINSTR static inline unsigned ct_group_match(const unsigned char* group,
+                                                              unsigned char tag)
+{
+#if defined(__SSE2__)
+    const __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    const __m128i match = _mm_cmpeq_epi8(ctrl, _mm_set1_epi8(static_cast<char>(tag)));
+    return static_cast<unsigned>(_mm_movemask_epi8(match));
+#else
+    unsigned mask = 0;
+    for (unsigned i = 0; i < CT_ALLOC_GROUP_WIDTH; ++i)
+    {
+        mask |= static_cast<unsigned>(group[i] == tag) << i;
+    }
+    return mask;
+#endif
+}
+
+CT_NODISCARD CT_NOINSTR static inline unsigned ct_group_match_full(const unsigned char* group)
+{
+#if defined(__SSE2__)
+    const __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return static_cast<unsigned>(_mm_movemask_epi8(ctrl));
+#else
+    unsigned mask = 0;
+    for (unsigned i = 0; i < CT_ALLOC_GROUP_WIDTH; ++i)
+    {
+        mask |= static_cast<unsigned>((group[i] & CT_CTRL_FULL) != 0) << i;
+    }
+    return mask;
+#endif
+}
+
+CT_NODISCARD CT_NOINSTR static inline size_t ct_table_max_load(size_t size)
+{
+    return size - size / 8u;
+}
+
+CT_NODISCARD CT_NOINSTR static struct ct_alloc_shard* ct_shard_for(uint64_t hash)
+{
+    // The top bits pick the shard; ct_hash_group() and ct_hash_tag() use the
+    // low bits, so the in-shard position stays independent of the shard.
+    return &ct_alloc_shards[hash >> (64u - CT_ALLOC_SHARD_BITS)];
+}
+
+CT_NODISCARD CT_NOINSTR static struct ct_alloc_shard* ct_shard_acquire_write(uint64_t hash)
+{
+    struct ct_alloc_shard* shard = ct_shard_for(hash);
+    ct_shard_lock(shard);
+    ct_shard_write_begin(shard);
+    return shard;
+}
+
+CT_NODISCARD CT_NOINSTR static uint64_t* ct_shard_guard_for(const struct ct_alloc_shard* shard)
+{
+    return &ct_shard_guards[shard - ct_alloc_shards].epoch;
+}
+
+// Called in the shard's write section, after the change.
+CT_NOINSTR static void ct_shard_bump_guard(const struct ct_alloc_shard* shard)
+{
+    (void)__atomic_add_fetch(ct_shard_guard_for(shard), 1u, __ATOMIC_RELEASE);
+}
+
+CT_NOINSTR static void ct_shard_release_write(struct ct_alloc_shard* shard)
+{
+    ct_shard_write_end(shard);
+    ct_shard_unlock(shard);
+}
+
+CT_NOINSTR static void ct_meta_copy_out(const struct ct_alloc_meta* meta, size_t* size_out,
+                                        size_t* req_size_out, const char** site_out)
+{
+    if (size_out)
+    {
+        *size_out = ct_meta_size(meta);
+    }
+    if (req_size_out)
+    {
+        *req_size_out = ct_meta_req_size(meta);
+    }
+    if (site_out)
+    {
+        *site_out = ct_meta_site(meta);
+    }
+}
+
+// Returns the slot holding ptr or CT_SLOT_NONE. Also used by optimistic
+// readers: every index is masked and the probe length is bounded, so a torn
+// view can only produce a result that ct_shard_read_validate() rejects.
+CT_NODISCARD CT_NOINSTR static size_t ct_table_find_slot(const struct ct_alloc_table* table,
+                                                         const void* ptr, uint64_t hash)
+{
+    const unsigned char tag = ct_hash_tag(hash);
+    size_t group = ct_hash_group(hash, table->group_mask);
+    for (size_t step = 1; step <= table->group_mask + 1u; ++step)
+    {
+        const unsigned char* ctrl = &table->ctrl[group * CT_ALLOC_GROUP_WIDTH];
+        unsigned match = ct_group_match(ctrl, tag);
+        while (match)
+        {
+            const size_t slot = group * CT_ALLOC_GROUP_WIDTH + __builtin_ctz(match);
+            if (__atomic_load_n(&table->keys[slot], __ATOMIC_RELAXED) == ptr)
+            {
+                return slot;
+            }
+            match &= match - 1u;
+        }
+        if (ct_group_match(ctrl, CT_CTRL_EMPTY))
+        {
+            return CT_SLOT_NONE;
+        }
+        group = (group + step) & table->group_mask;
+    }
+    return CT_SLOT_NONE;
+}
+
+// First empty or deleted slot on the probe sequence of hash.
+CT_NODISCARD CT_NOINSTR static size_t ct_table_find_free_slot(const struct ct_alloc_table* table,
+                                                              uint64_t hash)
+{
+    size_t group = ct_hash_group(hash, table->group_mask);
+    for (size_t step = 1; step <= table->group_mask + 1u; ++step)
+    {
+        const unsigned free_mask =
+            ~ct_group_match_full(&table->ctrl[group * CT_ALLOC_GROUP_WIDTH]) & 0xFFFFu;
+        if (free_mask)
+        {
+            return group * CT_ALLOC_GROUP_WIDTH + __builtin_ctz(free_mask);
+        }
+        group = (group + step) & table->group_mask;
+    }
+    return CT_SLOT_NONE;
+}
+
+// Finds ptr in the current table, then in the table being migrated from.
+CT_NODISCARD CT_NOINSTR static size_t ct_shard_find_slot_locked(struct ct_alloc_shard* shard,
+                                                                const void* ptr, uint64_t hash,
+                                                                struct ct_alloc_table** table_out)
+{
+    size_t slot = ct_table_find_slot(shard->table, ptr, hash);
+    *table_out = shard->table;
+    if (slot == CT_SLOT_NONE && shard->old)
+    {
+        slot = ct_table_find_slot(shard->old, ptr, hash);
+        *table_out = shard->old;
+    }
+    return slot;
+}
+
+// Places an entry known to be absent into the current table, which must have
+// room for it.
+CT_NOINSTR static size_t ct_shard_place_locked(struct ct_alloc_shard* shard, void* ptr,
+                                               uint64_t hash, const struct ct_alloc_meta* meta)
+{
+    struct ct_alloc_table* table = shard->table;
+    const size_t slot = ct_table_find_free_slot(table, hash);
+    if (table->ctrl[slot] == CT_CTRL_EMPTY)
+    {
+        ++shard->used;
+    }
+    table->keys[slot] = ptr;
+    table->meta[slot] = *meta;
+    table->ctrl[slot] = ct_hash_tag(hash);
+    return slot;
+}
+
+// Removes a slot from a live table. A slot of the current table can go back
+// to empty when its group still has an empty slot, because no probe sequence
+// ever continued past that group; otherwise it becomes a tombstone.
+CT_NOINSTR static void ct_shard_erase_slot_locked(struct ct_alloc_shard* shard,
+                                                  struct ct_alloc_table* table, size_t slot)
+{
+    if (table == shard->table)
+    {
+        const size_t group_base = slot & ~static_cast<size_t>(CT_ALLOC_GROUP_WIDTH - 1u);
+        if (ct_group_match(&table->ctrl[group_base], CT_CTRL_EMPTY))
+        {
+            table->ctrl[slot] = CT_CTRL_EMPTY;
+            --shard->used;
+            return;
+        }
+    }
+    table->ctrl[slot] = CT_CTRL_DELETED;
+}
+
+CT_NOINSTR static void ct_shard_migrate_locked(struct ct_alloc_shard* shard, size_t groups)
+{
+    struct ct_alloc_table* old_table = shard->old;
+    for (; groups > 0 && shard->migrate_group <= old_table->group_mask; --groups)
+    {
+        const size_t base = shard->migrate_group * CT_ALLOC_GROUP_WIDTH;
+        unsigned full = ct_group_match_full(&old_table->ctrl[base]);
+        while (full)
+        {
+            const size_t slot = base + __builtin_ctz(full);
+            void* ptr = old_table->keys[slot];
+            (void)ct_shard_place_locked(shard, ptr, ct_hash_ptr(ptr), &old_table->meta[slot]);
+            old_table->ctrl[slot] = CT_CTRL_DELETED;
+            full &= full - 1u;
+        }
+        ++shard->migrate_group;
+    }
+
+    if (shard->migrate_group > old_table->group_mask)
+    {
+        // The drained table becomes the spare for the next same-sized
+        // resize. A spare of another size is simply dropped: optimistic
+        // readers may still hold it, and growth is geometric so the total
+        // stays bounded.
+        __atomic_store_n(&shard->old, static_cast<struct ct_alloc_table*>(nullptr),
+                         __ATOMIC_RELEASE);
+        shard->spare = old_table;
+    }
+}
+
+// Installs an empty table of new_size slots and starts draining the current
+// one into it.
+CT_NODISCARD CT_NOINSTR static int ct_shard_resize_locked(struct ct_alloc_shard* shard,
+                                                          size_t new_size)
+{
+    struct ct_alloc_table* new_table = shard->spare;
+    if (new_table && new_table->size == new_size)
+    {
+        shard->spare = nullptr;
+        std::memset(new_table->ctrl, CT_CTRL_EMPTY, new_size);
+    }
+    else
+    {
+        // Fresh mappings are already zero, i.e. all slots empty.
+        new_table = ct_table_create(new_size);
+        if (!new_table)
+            return 0;
+    }
+
+    __atomic_store_n(&shard->old, shard->table, __ATOMIC_RELEASE);
+    __atomic_store_n(&shard->table, new_table, __ATOMIC_RELEASE);
+    shard->migrate_group = 0;
+    shard->used = 0;
+    shard->full_logged = 0;
+    return 1;
+}
+
+// Makes room for one more occupied slot in the current table. When it is at
+// its load limit the shard resizes: it doubles when live entries fill more
+// than half of the usable capacity, otherwise it moves to a fresh table of
+// the same size to shed tombstones. A resize still in progress is finished
+// first; the migration rate keeps that rare.
+CT_NODISCARD CT_NOINSTR static int ct_shard_reserve_locked(struct ct_alloc_shard* shard)
+{
+    if (shard->used + 1u <= ct_table_max_load(shard->table->size))
+    {
+        return 1;
+    }
+    if (shard->old)
+    {
+        ct_shard_migrate_locked(shard, ~static_cast<size_t>(0));
+    }
+
+    const size_t size = shard->table->size;
+    const int grow = shard->count + 1u > ct_table_max_load(size) / 2u;
+    if (!ct_shard_resize_locked(shard, grow ? size * 2u : size))
+    {
+        return 0;
+    }
+    ct_shard_migrate_locked(shard, CT_ALLOC_MIGRATE_GROUPS);
+    return 1;
+}
+
+CT_NOINSTR static void ct_table_map_range(const void* ptr, size_t size, int live)
+{
+    if (!ct_pagemap_insert(reinterpret_cast<uintptr_t>(ptr), size, live))
+    {
+        __atomic_store_n(&ct_pagemap_incomplete, 1, __ATOMIC_RELEASE);
+    }
+}
+
+CT_NOINSTR static void ct_table_unmap_range(const void* ptr, size_t size)
+{
+    ct_pagemap_remove(reinterpret_cast<uintptr_t>(ptr), size);
+}
+
+CT_NOINSTR static void ct_freed_history_configure(void)
+{
+    if (__atomic_load_n(&ct_freed_history_configured, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    // Racing initializers compute the same values.
+    ct_freed_history_entries = static_cast<size_t>(
+        ct_env_u64("CT_FREED_HISTORY_ENTRIES", CT_FREED_HISTORY_DEFAULT_ENTRIES));
+    ct_freed_history_bytes = static_cast<size_t>(ct_env_u64("CT_FREED_HISTORY_BYTES", 0));
+    __atomic_store_n(&ct_freed_history_configured, 1, __ATOMIC_RELEASE);
+}
+
+// Allocates the shard's ring and index on first use. Returns 0 when history
+// is disabled or could not be allocated.
+CT_NODISCARD CT_NOINSTR static int ct_history_ready_locked(struct ct_freed_history* history)
+{
+    if (history->index)
+    {
+        return 1;
+    }
+    if (history->init_failed)
+    {
+        return 0;
+    }
+
+    ct_freed_history_configure();
+    const size_t capacity = (ct_freed_history_entries + CT_ALLOC_SHARDS - 1u) / CT_ALLOC_SHARDS;
+    size_t index_size = 1;
+    while (index_size < capacity * 2u)
+    {
+        index_size <<= 1;
+    }
+
+    // Ring and index share one mapping; ring pages are only committed as the
+    // history fills up.
+    const size_t ring_bytes = sizeof(struct ct_freed_record) * capacity;
+    auto* block = capacity ? static_cast<unsigned char*>(
+                                 ct_os_alloc(ring_bytes + index_size * sizeof(uint32_t)))
+                           : nullptr;
+    if (!block)
+    {
+        history->init_failed = 1;
+        return 0;
+    }
+    auto* ring = reinterpret_cast<struct ct_freed_record*>(block);
+    auto* index = reinterpret_cast<uint32_t*>(block + ring_bytes);
+
+    history->ring = ring;
+    history->capacity = capacity;
+    history->index_mask = index_size - 1u;
+    __atomic_store_n(&history->index, index, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Returns the ring position of ptr's record or CT_SLOT_NONE, and its index
+// position through index_pos_out. Safe for optimistic readers for the same
+// reasons as ct_table_find_slot().
+CT_NODISCARD CT_NOINSTR static size_t ct_history_find(const struct ct_freed_history* history,
+                                                      const uint32_t* index, const void* ptr,
+                                                      uint64_t hash, size_t* index_pos_out)
+{
+    const size_t mask = history->index_mask;
+    size_t pos = static_cast<size_t>(hash) & mask;
+    for (size_t i = 0; i <= mask; ++i)
+    {
+        const uint32_t ref = __atomic_load_n(&index[pos], __ATOMIC_RELAXED);
+        if (ref == 0)
+        {
+            return CT_SLOT_NONE;
+        }
+        const size_t record = ref - 1u;
+        if (record < history->capacity &&
+            __atomic_load_n(&history->ring[record].ptr, __ATOMIC_RELAXED) == ptr)
+        {
+            if (index_pos_out)
+            {
+                *index_pos_out = pos;
+            }
+            return record;
+        }
+        pos = (pos + 1u) & mask;
+    }
+    return CT_SLOT_NONE;
+}
+
+// Backward-shift deletion keeps the linear-probing index free of tombstones.
+CT_NOINSTR static void ct_history_index_erase(struct ct_freed_history* history, size_t pos)
+{
+    const size_t mask = history->index_mask;
+    size_t hole = pos;
+    size_t next = (pos + 1u) & mask;
+    while (history->index[next] != 0)
+    {
+        const void* ptr = history->ring[history->index[next] - 1u].ptr;
+        const size_t home = static_cast<size_t>(ct_hash_ptr(ptr)) & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask))
+        {
+            history->index[hole] = history->index[next];
+            hole = next;
+        }
+        next = (next + 1u) & mask;
+    }
+    history->index[hole] = 0;
+}
+
+// Drops the record of ptr, if any, and unregisters its range. The ring slot
+// is orphaned and ages out like any other.
+CT_NOINSTR static void ct_history_forget_locked(struct ct_freed_history* history, const void* ptr,
+                                                uint64_t hash)
+{
+    if (!history->index)
+    {
+        return;
+    }
+    size_t pos = 0;
+    const size_t record = ct_history_find(history, history->index, ptr, hash, &pos);
+    if (record != CT_SLOT_NONE)
+    {
+        ct_history_index_erase(history, pos);
+        ct_table_unmap_range(ptr, ct_meta_size(&history->ring[record].meta));
+        history->ring[record].ptr = nullptr;
+    }
+}
+
+CT_NOINSTR static void ct_history_evict_oldest(struct ct_alloc_shard* shard)
+{
+    struct ct_freed_history* history = &shard->history;
+    struct ct_freed_record* record = &history->ring[history->head];
+    if (record->ptr)
+    {
+        const uint64_t hash = ct_hash_ptr(record->ptr);
+        size_t pos = 0;
+        if (ct_history_find(history, history->index, record->ptr, hash, &pos) == history->head)
+        {
+            ct_history_index_erase(history, pos);
+        }
+        // Never take the page map registration of a live entry with it.
+        struct ct_alloc_table* table = nullptr;
+        if (ct_shard_find_slot_locked(shard, record->ptr, hash, &table) == CT_SLOT_NONE)
+        {
+            ct_table_unmap_range(record->ptr, ct_meta_size(&record->meta));
+        }
+    }
+    history->bytes -= ct_meta_size(&record->meta);
+    history->head = (history->head + 1u) % history->capacity;
+    --history->count;
+}
+
+// Records a freed entry. Returns 0 when the history is disabled, in which
+// case the caller forgets the pointer entirely.
+CT_NODISCARD CT_NOINSTR static int ct_history_push_locked(struct ct_alloc_shard* shard, void* ptr,
+                                                          uint64_t hash,
+                                                          const struct ct_alloc_meta* meta)
+{
+    struct ct_freed_history* history = &shard->history;
+    if (!ct_history_ready_locked(history))
+    {
+        return 0;
+    }
+
+    // Only a pointer reused and freed again inside one thread cache can still
+    // have a record here (ct_shard_insert_locked drops the others), and the
+    // cache registered the new range before flushing it.
+    ct_history_forget_locked(history, ptr, hash);
+
+    const size_t size = ct_meta_size(meta);
+    while (history->count > 0 &&
+           (history->count == history->capacity ||
+            (ct_freed_history_bytes && history->bytes + size > ct_freed_history_bytes)))
+    {
+        ct_history_evict_oldest(shard);
+    }
+
+    const size_t record = (history->head + history->count) % history->capacity;
+    history->ring[record].ptr = ptr;
+    history->ring[record].meta = *meta;
+    ++history->count;
+    history->bytes += size;
+
+    size_t pos = static_cast<size_t>(hash) & history->index_mask;
+    while (history->index[pos] != 0)
+    {
+        pos = (pos + 1u) & history->index_mask;
+    }
+    history->index[pos] = static_cast<uint32_t>(record + 1u);
+    return 1;
+}
+
+CT_NODISCARD CT_NOINSTR static int ct_shard_insert_locked(struct ct_alloc_shard* shard, void* ptr,
+                                                          uint64_t hash,
+                                                          const struct ct_alloc_meta* meta)
+{
+    if (shard->old)
+    {
+        ct_shard_migrate_locked(shard, CT_ALLOC_MIGRATE_GROUPS);
+    }
+
+    struct ct_alloc_table* table = nullptr;
+    size_t slot = ct_shard_find_slot_locked(shard, ptr, hash, &table);
+    if (slot != CT_SLOT_NONE)
+    {
+        // Already live (the allocator handed the pointer out again without a
+        // tracked free): refresh the entry in place.
+        if (ct_meta_size(&table->meta[slot]) != ct_meta_size(meta))
+        {
+            ct_table_unmap_range(ptr, ct_meta_size(&table->meta[slot]));
+            ct_table_map_range(ptr, ct_meta_size(meta), 1);
+        }
+        table->meta[slot] = *meta;
+        ct_shard_bump_guard(shard);
+        return 1;
+    }
+
+    const size_t target = ct_table_find_free_slot(shard->table, hash);
+    if (shard->table->ctrl[target] == CT_CTRL_EMPTY && !ct_shard_reserve_locked(shard))
+    {
+        return 0;
+    }
+    (void)ct_shard_place_locked(shard, ptr, hash, meta);
+    ++shard->count;
+    // The freed record of an earlier allocation at ptr is stale now, and its
+    // range would otherwise be unregistered under the live one when it ages
+    // out.
+    ct_history_forget_locked(&shard->history, ptr, hash);
+    ct_table_map_range(ptr, ct_meta_size(meta), 1);
+    return 1;
+}
+
+// Moves a live entry to the freed history with the given state.
+CT_NOINSTR static void ct_shard_retire_locked(struct ct_alloc_shard* shard,
+                                              struct ct_alloc_table* table, size_t slot,
+                                              uint64_t hash, unsigned char state)
+{
+    struct ct_alloc_meta meta = table->meta[slot];
+    ct_meta_set_state(&meta, state);
+    ct_meta_set_mark(&meta, 0);
+    if (!ct_history_push_locked(shard, table->keys[slot], hash, &meta))
+    {
+        ct_table_unmap_range(table->keys[slot], ct_meta_size(&meta));
+    }
+    ct_shard_erase_slot_locked(shard, table, slot);
+    if (shard->count > 0)
+    {
+        --shard->count;
+    }
+    ct_shard_bump_guard(shard);
+}
+
+// Finds ptr among live entries, then in the history. Copies the metadata
+// into *out and returns 1, or returns 0.
+CT_NODISCARD CT_NOINSTR static int ct_shard_find_any_locked(struct ct_alloc_shard* shard,
+                                                            const void* ptr, uint64_t hash,
+                                                            struct ct_alloc_meta* out)
+{
+    struct ct_alloc_table* table = nullptr;
+    const size_t slot = ct_shard_find_slot_locked(shard, ptr, hash, &table);
+    if (slot != CT_SLOT_NONE)
+    {
+        *out = table->meta[slot];
+        return 1;
+    }
+
+    const struct ct_freed_history* history = &shard->history;
+    if (!history->index)
+    {
+        return 0;
+    }
+    const size_t record = ct_history_find(history, history->index, ptr, hash, nullptr);
+    if (record == CT_SLOT_NONE)
+    {
+        return 0;
+    }
+    *out = history->ring[record].meta;
+    return 1;
+}
+
+// Lock-free probe used by lookups. Copies the matching metadata into *out and
+// returns 1, returns 0 when the pointer is not tracked, or -1 when a writer
+// raced with the probe and the caller must retry.
+CT_NODISCARD CT_NOINSTR static int ct_shard_find_optimistic(const struct ct_alloc_shard* shard,
+                                                            const void* ptr, uint64_t hash,
+                                                            struct ct_alloc_meta* out)
+{
+    struct ct_shard_view view;
+    if (!ct_shard_read_begin(shard, &view))
+    {
+        return -1;
+    }
+    if (!view.table)
+    {
+        return 0;
+    }
+
+    int found = 0;
+    const struct ct_alloc_table* table = view.table;
+    size_t slot = ct_table_find_slot(table, ptr, hash);
+    if (slot == CT_SLOT_NONE && view.old)
+    {
+        table = view.old;
+        slot = ct_table_find_slot(table, ptr, hash);
+    }
+    if (slot != CT_SLOT_NONE)
+    {
+        ct_meta_load_relaxed(&table->meta[slot], out);
+        found = 1;
+    }
+    else if (view.history_index)
+    {
+        const struct ct_freed_history* history = &shard->history;
+        const size_t record = ct_history_find(history, view.history_index, ptr, hash, nullptr);
+        if (record != CT_SLOT_NONE)
+        {
+            ct_meta_load_relaxed(&history->ring[record].meta, out);
+            found = 1;
+        }
+    }
+
+    return ct_shard_read_validate(shard, &view) ? found : -1;
+}
+
+// Publishes a live entry to its shard. Returns 0 when the shard cannot grow.
+CT_NODISCARD CT_NOINSTR static int ct_shared_insert(void* ptr, const struct ct_alloc_meta* meta)
+{
+    const uint64_t hash = ct_hash_ptr(ptr);
+    struct ct_alloc_shard* shard = ct_shard_acquire_write(hash);
+    const int inserted = ct_shard_insert_locked(shard, ptr, hash, meta);
+    int log_full = 0;
+    size_t capacity = 0;
+    if (!inserted && !shard->full_logged)
+    {
+        shard->full_logged = 1;
+        log_full = 1;
+        capacity = shard->table->size;
+    }
+    ct_shard_release_write(shard);
+
+    if (log_full)
+    {
+        ct_log(CTLevel::Warn, "{}alloc table full ({} entries per shard){}\n",
+               ct_color(CTColor::Red), capacity, ct_color(CTColor::Reset));
+    }
+    return inserted;
+}
+
+// Retires the live shard entry of ptr with new_state and returns 1, or
+// returns -1 when only a freed record exists. *out receives the entry as it
+// was before the call. Returns 0 for pointers the shards do not know.
+CT_NODISCARD CT_NOINSTR static int ct_shared_retire(void* ptr, unsigned char new_state,
+                                                    struct ct_alloc_meta* out)
+{
+    const uint64_t hash = ct_hash_ptr(ptr);
+    struct ct_alloc_shard* shard = ct_shard_acquire_write(hash);
+    if (shard->old)
+    {
+        ct_shard_migrate_locked(shard, CT_ALLOC_MIGRATE_GROUPS);
+    }
+
+    int result = 0;
+    struct ct_alloc_table* table = nullptr;
+    const size_t slot = ct_shard_find_slot_locked(shard, ptr, hash, &table);
+    if (slot != CT_SLOT_NONE)
+    {
+        *out = table->meta[slot];
+        ct_shard_retire_locked(shard, table, slot, hash, new_state);
+        result = 1;
+    }
+    else if (ct_shard_find_any_locked(shard, ptr, hash, out))
+    {
+        result = -1;
+    }
+    ct_shard_release_write(shard);
+    return result;
+}
+
+// Copies the live or freed shard entry of ptr into *out. Returns 1 when found.
+CT_NODISCARD CT_NOINSTR static int ct_shared_lookup_meta(const void* ptr,
+                                                         struct ct_alloc_meta* out)
+{
+    const uint64_t hash = ct_hash_ptr(ptr);
+    struct ct_alloc_shard* shard = ct_shard_for(hash);
+    int found = -1;
+    for (unsigned attempt = 0; attempt < CT_SEQ_READ_RETRIES && found < 0; ++attempt)
+    {
+        found = ct_shard_find_optimistic(shard, ptr, hash, out);
+        if (found < 0)
+        {
+            ct_cpu_relax();
+        }
+    }
+
+    if (found < 0)
+    {
+        // Heavy write traffic on this shard; fall back to the lock.
+        ct_shard_lock(shard);
+        found = ct_shard_find_any_locked(shard, ptr, hash, out);
+        ct_shard_unlock(shard);
+    }
+    return found;
+}
+
+CT_NODISCARD CT_NOINSTR static int ct_range_contains(uintptr_t base, size_t size, uintptr_t addr)
+{
+    return base && size != 0 && addr >= base && (addr - base) < size;
+}
+
+// Scans a live table for the entry whose [ptr, ptr + size) range contains
+// addr, skipping empty slots through the control bytes. Used both under the
+// lock and by optimistic readers, hence the relaxed loads.
+CT_NODISCARD CT_NOINSTR static size_t ct_table_find_containing(const struct ct_alloc_table* table,
+                                                               uintptr_t addr)
+{
+    for (size_t group = 0; group <= table->group_mask; ++group)
+    {
+        unsigned full = ct_group_match_full(&table->ctrl[group * CT_ALLOC_GROUP_WIDTH]);
+        while (full)
+        {
+            const size_t slot = group * CT_ALLOC_GROUP_WIDTH + __builtin_ctz(full);
+            full &= full - 1u;
+
+            const uintptr_t base =
+                reinterpret_cast<uintptr_t>(__atomic_load_n(&table->keys[slot], __ATOMIC_RELAXED));
+            struct ct_alloc_meta meta;
+            ct_meta_load_relaxed(&table->meta[slot], &meta);
+            if (ct_range_contains(base, ct_meta_size(&meta), addr))
+            {
+                return slot;
+            }
+        }
+    }
+    return CT_SLOT_NONE;
+}
+
+// Same for the history ring, newest record first.
+CT_NODISCARD CT_NOINSTR static size_t
+ct_history_find_containing(const struct ct_freed_history* history, uintptr_t addr)
+{
+    const size_t count = __atomic_load_n(&history->count, __ATOMIC_RELAXED);
+    const size_t head = __atomic_load_n(&history->head, __ATOMIC_RELAXED);
+    for (size_t i = count; i > 0 && i <= history->capacity; --i)
+    {
+        const size_t record = (head + i - 1u) % history->capacity;
+        const uintptr_t base = reinterpret_cast<uintptr_t>(
+            __atomic_load_n(&history->ring[record].ptr, __ATOMIC_RELAXED));
+        struct ct_alloc_meta meta;
+        ct_meta_load_relaxed(&history->ring[record].meta, &meta);
+        if (ct_range_contains(base, ct_meta_size(&meta), addr))
+        {
+            return record;
+        }
+    }
+    return CT_SLOT_NONE;
+}
+
+// Range search over one shard, either its live tables or its history.
+// Returns 1 with the owning pointer and metadata copied out, or 0.
+CT_NODISCARD CT_NOINSTR static int ct_shard_find_containing(const struct ct_alloc_shard* shard,
+                                                            const struct ct_shard_view* view,
+                                                            uintptr_t addr, int freed,
+                                                            void** base_out,
+                                                            struct ct_alloc_meta* out)
+{
+    if (freed)
+    {
+        if (!view->history_index)
+        {
+            return 0;
+        }
+        const struct ct_freed_history* history = &shard->history;
+        const size_t record = ct_history_find_containing(history, addr);
+        if (record == CT_SLOT_NONE)
+        {
+            return 0;
+        }
+        *base_out = __atomic_load_n(&history->ring[record].ptr, __ATOMIC_RELAXED);
+        ct_meta_load_relaxed(&history->ring[record].meta, out);
+        return 1;
+    }
+
+    const struct ct_alloc_table* tables[2] = {view->table, view->old};
+    for (const struct ct_alloc_table* table : tables)
+    {
+        if (!table)
+        {
+            continue;
+        }
+        const size_t slot = ct_table_find_containing(table, addr);
+        if (slot != CT_SLOT_NONE)
+        {
+            *base_out = __atomic_load_n(&table->keys[slot], __ATOMIC_RELAXED);
+            ct_meta_load_relaxed(&table->meta[slot], out);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+CT_NODISCARD CT_NOINSTR static int ct_shard_lookup_containing(struct ct_alloc_shard* shard,
+                                                              uintptr_t addr, int freed,
+                                                              void** base_out,
+                                                              struct ct_alloc_meta* out)
+{
+    struct ct_shard_view view;
+    for (unsigned attempt = 0; attempt < CT_SEQ_READ_RETRIES; ++attempt)
+    {
+        if (!ct_shard_read_begin(shard, &view))
+        {
+            continue;
+        }
+        if (!view.table)
+        {
+            return 0;
+        }
+        const int found = ct_shard_find_containing(shard, &view, addr, freed, base_out, out);
+        if (ct_shard_read_validate(shard, &view))
+        {
+            return found;
+        }
+    }
+
+    ct_shard_lock(shard);
+    view.table = shard->table;
+    view.old = shard->old;
+    view.history_index = shard->history.index;
+    const int found = ct_shard_find_containing(shard, &view, addr, freed, base_out, out);
+    ct_shard_unlock(shard);
+    return found;
+}
+
+// Resolves addr through the page map. Each candidate range is confirmed
+// against the table, which also drops stale ranges of pointers that were
+// reallocated with another size.
+CT_NODISCARD CT_NOINSTR static int ct_table_resolve_containing(uintptr_t addr, void** base_out,
+                                                               struct ct_alloc_meta* out)
+{
+    struct ct_page_span spans[CT_PAGEMAP_MAX_CANDIDATES];
+    const size_t count = ct_pagemap_find(addr, spans, CT_PAGEMAP_MAX_CANDIDATES);
+    int found = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        struct ct_alloc_meta meta;
+        void* base = reinterpret_cast<void*>(spans[i].base);
+        if (!ct_shared_lookup_meta(base, &meta) ||
+            !ct_range_contains(spans[i].base, ct_meta_size(&meta), addr))
+        {
+            continue;
+        }
+        // Live allocations take precedence over freed ranges the allocator
+        // may since have reused; otherwise keep the most recent freed range.
+        const int live = ct_meta_state(&meta) == CT_ENTRY_USED;
+        if (live || !found)
+        {
+            *base_out = base;
+            *out = meta;
+            found = 1;
+            if (live)
+            {
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+// Fallback used once the page map missed a range: scans every shard.
+CT_NODISCARD CT_NOINSTR static int ct_table_scan_containing(uintptr_t addr, void** base_out,
+                                                            struct ct_alloc_meta* out)
+{
+    for (int freed = 0; freed < 2; ++freed)
+    {
+        for (size_t i = 0; i < CT_ALLOC_SHARDS; ++i)
+        {
+            if (ct_shard_lookup_containing(&ct_alloc_shards[i], addr, freed, base_out, out))
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+CT_NODISCARD CT_NOINSTR static int ct_shared_lookup_containing(uintptr_t addr, void** base_out,
+                                                               struct ct_alloc_meta* out)
+{
+    return __atomic_load_n(&ct_pagemap_incomplete, __ATOMIC_ACQUIRE)
+               ? ct_table_scan_containing(addr, base_out, out)
+               : ct_table_resolve_containing(addr, base_out, out);
+}
+
+// Per-thread allocation caches.
+//
+// New allocations land in a small cache owned by the allocating thread and
+// reach the shards in batches, so memory allocated and freed by one thread in
+// quick succession never takes a shard lock for either operation. Freed
+// records are buffered the same way and spill into the shard histories one
+// shard at a time. A cache is flushed when it overflows, when its thread
+// exits and before the whole table is locked (GC, leak report).
+//
+// Cached entries stay visible to other threads: lookups that miss the shards
+// probe the registered caches, skipping those whose address window cannot
+// hold the pointer. A lookup or free that finds its pointer live in another
+// thread's cache publishes that cache's live entries to the shards. Each
+// cache has its own lock and sequence counter, normally only touched by the
+// owning thread. Caches are recycled on thread exit and never released, so a
+// reader can always dereference one.
+#define CT_THREAD_CACHE_LIVE 32u
+#define CT_THREAD_CACHE_FREED 64u
+
+struct ct_cached_entry
+{
+    void* ptr;
+    struct ct_alloc_meta meta;
+};
+
+struct alignas(64) ct_thread_cache
+{
+    int lock;
+    unsigned seq;
+    int in_use;
+    uint32_t live_count;
+    uint32_t freed_count;
+    // Bumped whenever a live entry is retired, updated or moved to its shard:
+    // what ct_shard_guards are to shard entries.
+    uint64_t guard;
+    // Addresses covered by the cached entries, [window_lo, window_hi).
+    uintptr_t window_lo;
+    uintptr_t window_hi;
+    struct ct_thread_cache* next;
+    struct ct_cached_entry live[CT_THREAD_CACHE_LIVE];
+    struct ct_cached_entry freed[CT_THREAD_CACHE_FREED];
+};
+
+static struct ct_thread_cache* ct_thread_caches = nullptr;
+static pthread_key_t ct_thread_cache_key;
+static pthread_once_t ct_thread_cache_once = PTHREAD_ONCE_INIT;
+static int ct_thread_cache_enabled = 0;
+static thread_local struct ct_thread_cache* ct_thread_cache_self = nullptr;
+static thread_local int ct_thread_cache_detached = 0;
+
+CT_NOINSTR static void ct_cache_write_begin(struct ct_thread_cache* cache)
+{
+    ct_spin_lock(&cache->lock);
+    __atomic_store_n(&cache->seq, cache->seq + 1u, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+CT_NOINSTR static void ct_cache_write_end(struct ct_thread_cache* cache)
+{
+    __atomic_store_n(&cache->seq, cache->seq + 1u, __ATOMIC_RELEASE);
+    ct_spin_unlock(&cache->lock);
+}
+
+// Called in the cache's write section, after the change.
+CT_NOINSTR static void ct_cache_bump_guard(struct ct_thread_cache* cache)
+{
+    (void)__atomic_add_fetch(&cache->guard, 1u, __ATOMIC_RELEASE);
+}
+
+CT_NOINSTR static void ct_cache_widen(struct ct_thread_cache* cache,
+                                      const struct ct_cached_entry* entry)
+{
+    const uintptr_t base = reinterpret_cast<uintptr_t>(entry->ptr);
+    const size_t size = ct_meta_size(&entry->meta);
+    const uintptr_t end = base + (size ? size : 1u);
+    const int empty = cache->window_lo == cache->window_hi;
+    if (empty || base < cache->window_lo)
+    {
+        __atomic_store_n(&cache->window_lo, base, __ATOMIC_RELAXED);
+    }
+    if (empty || end > cache->window_hi)
+    {
+        __atomic_store_n(&cache->window_hi, end, __ATOMIC_RELAXED);
+    }
+}
+
+CT_NOINSTR static void ct_cache_reset_window(struct ct_thread_cache* cache)
+{
+    __atomic_store_n(&cache->window_lo, static_cast<uintptr_t>(0), __ATOMIC_RELAXED);
+    __atomic_store_n(&cache->window_hi, static_cast<uintptr_t>(0), __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < cache->live_count; ++i)
+    {
+        ct_cache_widen(cache, &cache->live[i]);
+    }
+    for (uint32_t i = 0; i < cache->freed_count; ++i)
+    {
+        ct_cache_widen(cache, &cache->freed[i]);
+    }
+}
+
+CT_NOINSTR static void ct_cache_flush_live_locked(struct ct_thread_cache* cache)
+{
+    if (cache->live_count == 0)
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < cache->live_count; ++i)
+    {
+        (void)ct_shared_insert(cache->live[i].ptr, &cache->live[i].meta);
+    }
+    __atomic_store_n(&cache->live_count, 0u, __ATOMIC_RELAXED);
+    ct_cache_bump_guard(cache);
+}
+
+// Moves the freed records to the shard histories, taking each shard lock once
+// and keeping the records of a shard in the order they were freed.
+CT_NOINSTR static void ct_cache_flush_freed_locked(struct ct_thread_cache* cache)
+{
+    const uint32_t count = cache->freed_count;
+    uint64_t hashes[CT_THREAD_CACHE_FREED];
+    unsigned char done[CT_THREAD_CACHE_FREED] = {};
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        hashes[i] = ct_hash_ptr(cache->freed[i].ptr);
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (done[i])
+        {
+            continue;
+        }
+        struct ct_alloc_shard* shard = ct_shard_acquire_write(hashes[i]);
+        for (uint32_t j = i; j < count; ++j)
+        {
+            if (done[j] || ct_shard_for(hashes[j]) != shard)
+            {
+                continue;
+            }
+            done[j] = 1;
+            // A record whose pointer is live in the shard again predates that
+            // allocation.
+            const struct ct_cached_entry* record = &cache->freed[j];
+            struct ct_alloc_table* table = nullptr;
+            if (ct_shard_find_slot_locked(shard, record->ptr, hashes[j], &table) != CT_SLOT_NONE)
+            {
+                continue;
+            }
+            const size_t size = ct_meta_size(&record->meta);
+            ct_table_map_range(record->ptr, size, 0);
+            if (!ct_history_push_locked(shard, record->ptr, hashes[j], &record->meta))
+            {
+                ct_table_unmap_range(record->ptr, size);
+            }
+        }
+        ct_shard_release_write(shard);
+    }
+    __atomic_store_n(&cache->freed_count, 0u, __ATOMIC_RELAXED);
+}
+
+CT_NOINSTR static void ct_cache_flush_locked(struct ct_thread_cache* cache)
+{
+    ct_cache_flush_live_locked(cache);
+    ct_cache_flush_freed_locked(cache);
+    ct_cache_reset_window(cache);
+}
+
+// Finds addr among the live or freed entries of a cache, newest first, either
+// as an exact pointer or, when containing is set, inside an entry's range.
+// Used by optimistic readers: loads are relaxed and the count is clamped.
+CT_NODISCARD CT_NOINSTR static int ct_cache_probe(const struct ct_thread_cache* cache, int freed,
+                                                  uintptr_t addr, int containing,
+                                                  void** base_out, struct ct_alloc_meta* out)
+{
+    if (addr < __atomic_load_n(&cache->window_lo, __ATOMIC_RELAXED) ||
+        addr >= __atomic_load_n(&cache->window_hi, __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+
+    const struct ct_cached_entry* entries = freed ? cache->freed : cache->live;
+    const uint32_t capacity = freed ? CT_THREAD_CACHE_FREED : CT_THREAD_CACHE_LIVE;
+    uint32_t count = __atomic_load_n(freed ? &cache->freed_count : &cache->live_count,
+                                     __ATOMIC_RELAXED);
+    count = count < capacity ? count : capacity;
+    for (uint32_t i = count; i > 0; --i)
+    {
+        const uintptr_t base =
+            reinterpret_cast<uintptr_t>(__atomic_load_n(&entries[i - 1u].ptr, __ATOMIC_RELAXED));
+        if (!containing && base != addr)
+        {
+            continue;
+        }
+        struct ct_alloc_meta meta;
+        ct_meta_load_relaxed(&entries[i - 1u].meta, &meta);
+        if (containing && !ct_range_contains(base, ct_meta_size(&meta), addr))
+        {
+            continue;
+        }
+        if (base_out)
+        {
+            *base_out = reinterpret_cast<void*>(base);
+        }
+        *out = meta;
+        return 1;
+    }
+    return 0;
+}
+
+CT_NODISCARD CT_NOINSTR static int ct_cache_lookup(struct ct_thread_cache* cache, int freed,
+                                                   uintptr_t addr, int containing,
+                                                   void** base_out, struct ct_alloc_meta* out)
+{
+    for (unsigned attempt = 0; attempt < CT_SEQ_READ_RETRIES; ++attempt)
+    {
+        const unsigned seq = __atomic_load_n(&cache->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1u)
+        {
+            ct_cpu_relax();
+            continue;
+        }
+        const int found = ct_cache_probe(cache, freed, addr, containing, base_out, out);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&cache->seq, __ATOMIC_RELAXED) == seq)
+        {
+            return found;
+        }
+    }
+
+    ct_spin_lock(&cache->lock);
+    const int found = ct_cache_probe(cache, freed, addr, containing, base_out, out);
+    ct_spin_unlock(&cache->lock);
+    return found;
+}
+
+CT_NODISCARD CT_NOINSTR static int ct_cache_find_locked(const struct ct_thread_cache* cache,
+                                                        int freed, const void* ptr)
+{
+    const struct ct_cached_entry* entries = freed ? cache->freed : cache->live;
+    for (uint32_t i = freed ? cache->freed_count : cache->live_count; i > 0; --i)
+    {
+        if (entries[i - 1u].ptr == ptr)
+        {
+            return static_cast<int>(i - 1u);
+        }
+    }
+    return -1;
+}
+
+CT_NOINSTR static void ct_cache_erase_locked(struct ct_thread_cache* cache, int freed, int index)
+{
+    struct ct_cached_entry* entries = freed ? cache->freed : cache->live;
+    uint32_t* count = freed ? &cache->freed_count : &cache->live_count;
+    const uint32_t tail = *count - static_cast<uint32_t>(index) - 1u;
+    std::memmove(&entries[index], &entries[index + 1], tail * sizeof(entries[0]));
+    __atomic_store_n(count, *count - 1u, __ATOMIC_RELAXED);
+}
+
+// Overwrites the live entry of ptr in the caller's own cache. Returns 0 when
+// the cache does not hold it.
+CT_NODISCARD CT_NOINSTR static int ct_cache_update_locked(struct ct_thread_cache* cache, void* ptr,
+                                                          const struct ct_alloc_meta* meta)
+{
+    const int index = ct_cache_find_locked(cache, 0, ptr);
+    if (index < 0)
+    {
+        return 0;
+    }
+    cache->live[index].meta = *meta;
+    ct_cache_widen(cache, &cache->live[index]);
+    ct_cache_bump_guard(cache);
+    return 1;
+}
+
+CT_NOINSTR static void ct_cache_insert(struct ct_thread_cache* cache, void* ptr,
+                                       const struct ct_alloc_meta* meta)
+{
+    ct_cache_write_begin(cache);
+    // A pointer handed out again without a tracked free keeps one entry.
+    if (!ct_cache_update_locked(cache, ptr, meta))
+    {
+        if (cache->live_count == CT_THREAD_CACHE_LIVE)
+        {
+            ct_cache_flush_live_locked(cache);
+            ct_cache_reset_window(cache);
+        }
+        struct ct_cached_entry* entry = &cache->live[cache->live_count];
+        entry->ptr = ptr;
+        entry->meta = *meta;
+        ct_cache_widen(cache, entry);
+        __atomic_store_n(&cache->live_count, cache->live_count + 1u, __ATOMIC_RELAXED);
+    }
+    ct_cache_write_end(cache);
+}
+
+CT_NODISCARD CT_NOINSTR static int ct_cache_update(struct ct_thread_cache* cache, void* ptr,
+                                                   const struct ct_alloc_meta* meta)
+{
+    ct_cache_write_begin(cache);
+    const int updated = ct_cache_update_locked(cache, ptr, meta);
+    ct_cache_write_end(cache);
+    return updated;
+}
+
+// Retires ptr if it is live in the caller's own cache: the entry becomes a
+// freed record of the same cache. Returns 1 with the live entry in *out.
+CT_NODISCARD CT_NOINSTR static int ct_cache_retire(struct ct_thread_cache* cache, void* ptr,
+                                                   unsigned char new_state,
+                                                   struct ct_alloc_meta* out)
+{
+    const uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+    if (!ct_cache_lookup(cache, 0, addr, 0, nullptr, out))
+    {
+        return 0;
+    }
+
+    ct_cache_write_begin(cache);
+    const int index = ct_cache_find_locked(cache, 0, ptr);
+    if (index >= 0)
+    {
+        *out = cache->live[index].meta;
+        // The shard history keeps one record per pointer; drop the older one
+        // here rather than flushing it only to orphan it.
+        const int previous = ct_cache_find_locked(cache, 1, ptr);
+        if (previous >= 0)
+        {
+            ct_cache_erase_locked(cache, 1, previous);
+        }
+        else if (cache->freed_count == CT_THREAD_CACHE_FREED)
+        {
+            ct_cache_flush_freed_locked(cache);
+            ct_cache_reset_window(cache);
+        }
+        struct ct_cached_entry* record = &cache->freed[cache->freed_count];
+        record->ptr = ptr;
+        record->meta = cache->live[index].meta;
+        ct_meta_set_state(&record->meta, new_state);
+        ct_meta_set_mark(&record->meta, 0);
+        __atomic_store_n(&cache->freed_count, cache->freed_count + 1u, __ATOMIC_RELAXED);
+        ct_cache_erase_locked(cache, 0, index);
+        ct_cache_bump_guard(cache);
+    }
+    ct_cache_write_end(cache);
+    return index >= 0;
+}
+
+// Moves the live entries of another thread's cache to their shards, so that
+// the next lookups and frees of these pointers from other threads find them
+// there directly.
+CT_NOINSTR static void ct_cache_publish(struct ct_thread_cache* cache)
+{
+    ct_cache_write_begin(cache);
+    ct_cache_flush_live_locked(cache);
+    ct_cache_reset_window(cache);
+    ct_cache_write_end(cache);
+}
+
+// Publishes another thread's cache if ptr is live in it. Returns 1 if it was.
+CT_NODISCARD CT_NOINSTR static int ct_cache_steal(struct ct_thread_cache* cache, void* ptr)
+{
+    struct ct_alloc_meta meta;
+    if (!ct_cache_lookup(cache, 0, reinterpret_cast<uintptr_t>(ptr), 0, nullptr, &meta))
+    {
+        return 0;
+    }
+    ct_cache_publish(cache);
+    return 1;
+}
+
+CT_NOINSTR static void ct_thread_cache_release(void* arg)
+{
+    auto* cache = static_cast<struct ct_thread_cache*>(arg);
+    ct_cache_write_begin(cache);
+    ct_cache_flush_locked(cache);
+    ct_cache_write_end(cache);
+
+    // Later frees from other TLS destructors go straight to the shards.
+    ct_thread_cache_self = nullptr;
+    ct_thread_cache_detached = 1;
+    __atomic_store_n(&cache->in_use, 0, __ATOMIC_RELEASE);
+}
+
+CT_NOINSTR static void ct_thread_cache_init_once(void)
+{
+    ct_thread_cache_enabled =
+        ct_env_u64("CT_THREAD_CACHE", 1) != 0 &&
+        pthread_key_create(&ct_thread_cache_key, ct_thread_cache_release) == 0;
+}
+
+CT_NODISCARD CT_NOINSTR static struct ct_thread_cache* ct_thread_cache_attach(void)
+{
+    ct_thread_cache_detached = 1;
+    pthread_once(&ct_thread_cache_once, ct_thread_cache_init_once);
+    if (!ct_thread_cache_enabled)
+    {
+        return nullptr;
+    }
+
+    struct ct_thread_cache* cache = nullptr;
+    for (struct ct_thread_cache* it = __atomic_load_n(&ct_thread_caches, __ATOMIC_ACQUIRE); it;
+         it = it->next)
+    {
+        int expected = 0;
+        if (__atomic_load_n(&it->in_use, __ATOMIC_RELAXED) == 0 &&
+            __atomic_compare_exchange_n(&it->in_use, &expected, 1, false, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+        {
+            cache = it;
+            break;
+        }
+    }
+
+    if (!cache)
+    {
+        void* mem = nullptr;
+        if (posix_memalign(&mem, alignof(struct ct_thread_cache), sizeof(struct ct_thread_cache)) !=
+            0)
+        {
+            return nullptr;
+        }
+        std::memset(mem, 0, sizeof(struct ct_thread_cache));
+        cache = static_cast<struct ct_thread_cache*>(mem);
+        cache->in_use = 1;
+        cache->next = __atomic_load_n(&ct_thread_caches, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&ct_thread_caches, &cache->next, cache, true,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {
+        }
+    }
+
+    if (pthread_setspecific(ct_thread_cache_key, cache) != 0)
+    {
+        __atomic_store_n(&cache->in_use, 0, __ATOMIC_RELEASE);
+        return nullptr;
+    }
+    ct_thread_cache_self = cache;
+    ct_thread_cache_detached = 0;
+    return cache;
+}
+
+CT_NODISCARD CT_NOINSTR static struct ct_thread_cache* ct_thread_cache_get(void)
+{
+    struct ct_thread_cache* cache = ct_thread_cache_self;
+    if (cache || ct_thread_cache_detached)
+    {
+        return cache;
+    }
+    return ct_thread_cache_attach();
+}
+
+CT_NOINSTR static void ct_thread_cache_flush_all(void)
+{
+    for (struct ct_thread_cache* it = __atomic_load_n(&ct_thread_caches, __ATOMIC_ACQUIRE); it;
+         it = it->next)
+    {
+        ct_cache_write_begin(it);
+        ct_cache_flush_locked(it);
+        ct_cache_write_end(it);
+    }
+}
+
+CT_NODISCARD CT_NOINSTR static int ct_foreign_cache_lookup(const struct ct_thread_cache* self,
+                                                           int freed, uintptr_t addr,
+                                                           int containing, void** base_out,
+                                                           struct ct_alloc_meta* out)
+{
+    for (struct ct_thread_cache* it = __atomic_load_n(&ct_thread_caches, __ATOMIC_ACQUIRE); it;
+         it = it->next)
+    {
+        if (it != self && ct_cache_lookup(it, freed, addr, containing, base_out, out))
+        {
+            if (!freed)
+            {
+                ct_cache_publish(it);
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+CT_NODISCARD CT_NOINSTR static int ct_shared_lookup_any(uintptr_t addr, int containing,
+                                                        void** base_out, struct ct_alloc_meta* out)
+{
+    return containing ? ct_shared_lookup_containing(addr, base_out, out)
+                      : ct_shared_lookup_meta(reinterpret_cast<void*>(addr), out);
+}
+
+// Counter that changes when the live entry a lookup found stops being valid,
+// and its value from before the lookup; counter is null when the entry cannot
+// be memoized.
+struct ct_lookup_guard
+{
+    const uint64_t* counter;
+    uint64_t stamp;
+};
+
+CT_NOINSTR static void ct_lookup_guard_sample(struct ct_lookup_guard* guard,
+                                              const uint64_t* counter)
+{
+    if (guard)
+    {
+        guard->counter = counter;
+        guard->stamp = __atomic_load_n(counter, __ATOMIC_ACQUIRE);
+    }
+}
+
+// Looks addr up everywhere: the caller's cache, the shards, then the other
+// threads' caches. A live entry wins over freed records, wherever they are:
+// libc may hand a freed address to another thread before the record ages out.
+// The shards are consulted again after the foreign caches because an owner
+// may have flushed the entry there in between. When guard is set, the lookup
+// is by exact pointer and *guard is filled in for a live entry.
+CT_NODISCARD CT_NOINSTR static int ct_table_lookup_any(uintptr_t addr, int containing,
+                                                       void** base_out, struct ct_alloc_meta* out,
+                                                       struct ct_lookup_guard* guard)
+{
+    struct ct_thread_cache* self = ct_thread_cache_self;
+    if (self)
+    {
+        ct_lookup_guard_sample(guard, &self->guard);
+        if (ct_cache_lookup(self, 0, addr, containing, base_out, out))
+        {
+            return 1;
+        }
+    }
+
+    const uint64_t* shard_guard = nullptr;
+    if (guard)
+    {
+        shard_guard = ct_shard_guard_for(ct_shard_for(ct_hash_ptr(reinterpret_cast<void*>(addr))));
+        ct_lookup_guard_sample(guard, shard_guard);
+    }
+    int shared = ct_shared_lookup_any(addr, containing, base_out, out);
+    if (shared && ct_meta_state(out) == CT_ENTRY_USED)
+    {
+        return 1;
+    }
+    if (ct_foreign_cache_lookup(self, 0, addr, containing, base_out, out))
+    {
+        // Published to the shards since the guard was sampled.
+        if (guard)
+        {
+            guard->counter = nullptr;
+        }
+        return 1;
+    }
+    ct_lookup_guard_sample(guard, shard_guard);
+    shared = ct_shared_lookup_any(addr, containing, base_out, out);
+    if (shared && ct_meta_state(out) == CT_ENTRY_USED)
+    {
+        return 1;
+    }
+    if (guard)
+    {
+        guard->counter = nullptr;
+    }
+
+    // Only freed records are left; the caller's unflushed ones are the newest.
+    struct ct_alloc_meta freed;
+    void* freed_base = nullptr;
+    if (self && ct_cache_lookup(self, 1, addr, containing, &freed_base, &freed))
+    {
+        if (base_out)
+        {
+            *base_out = freed_base;
+        }
+        *out = freed;
+        return 1;
+    }
+    return shared || ct_foreign_cache_lookup(self, 1, addr, containing, base_out, out);
+}
+
+CT_NODISCARD CT_NOINSTR int ct_table_insert(void* ptr, size_t req_size, size_t size,
+                                            const char* site, unsigned char kind)
+{
+    if (!ptr)
+    {
+        return 0;
+    }
+
+    struct ct_alloc_meta meta;
+    ct_meta_init(&meta, size, req_size, site, CT_ENTRY_USED, kind);
+
+    struct ct_thread_cache* cache = ct_thread_cache_get();
+    if (cache)
+    {
+        ct_cache_insert(cache, ptr, &meta);
+        return 1;
+    }
+    return ct_shared_insert(ptr, &meta);
+}
+
+CT_NODISCARD CT_NOINSTR int ct_table_update(void* ptr, size_t req_size, size_t size,
+                                            const char* site, unsigned char kind)
+{
+    if (!ptr)
+    {
+        return 0;
+    }
+
+    struct ct_alloc_meta meta;
+    ct_meta_init(&meta, size, req_size, site, CT_ENTRY_USED, kind);
+
+    struct ct_thread_cache* self = ct_thread_cache_get();
+    if (self && ct_cache_update(self, ptr, &meta))
+    {
+        return 1;
+    }
+    // Anywhere else the entry is in its shard once any cache holding it has
+    // been published, and the shard insert refreshes it in place.
+    for (struct ct_thread_cache* it = __atomic_load_n(&ct_thread_caches, __ATOMIC_ACQUIRE); it;
+         it = it->next)
+    {
+        if (it != self && ct_cache_steal(it, ptr))
+        {
+            break;
+        }
+    }
+    return ct_shared_insert(ptr, &meta);
+}
+
+// Shared body of ct_table_remove() and ct_table_remove_autofree(): retires a
+// live entry with new_state and returns 1, or reports the state of a freed one
+// through *prior_state and returns -1. Returns 0 for unknown pointers.
+CT_NODISCARD CT_NOINSTR static int ct_table_retire(void* ptr, unsigned char new_state,
+                                                   size_t* size_out, size_t* req_size_out,
+                                                   const char** site_out,
+                                                   unsigned char* prior_state)
+{
+    if (!ptr)
+    {
+        return 0;
+    }
+
+    const uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+    struct ct_thread_cache* self = ct_thread_cache_get();
+    struct ct_alloc_meta meta;
+    int result = self ? ct_cache_retire(self, ptr, new_state, &meta) : 0;
+    if (!result)
+    {
+        result = ct_shared_retire(ptr, new_state, &meta);
+    }
+    if (result <= 0)
+    {
+        // Cross-thread free of an entry still cached by its allocating thread,
+        // or flushed by it since the shard was checked: either way the entry
+        // is in its shard afterwards.
+        for (struct ct_thread_cache* it = __atomic_load_n(&ct_thread_caches, __ATOMIC_ACQUIRE);
+             it; it = it->next)
+        {
+            if (it != self && ct_cache_steal(it, ptr))
+            {
+                break;
+            }
+        }
+        result = ct_shared_retire(ptr, new_state, &meta);
+    }
+    if (result <= 0)
+    {
+        if (self && ct_cache_lookup(self, 1, addr, 0, nullptr, &meta))
+        {
+            result = -1;
+        }
+        else if (result == 0 && ct_foreign_cache_lookup(self, 1, addr, 0, nullptr, &meta))
+        {
+            result = -1;
+        }
+    }
+
+    if (result != 0)
+    {
+        ct_meta_copy_out(&meta, size_out, req_size_out, site_out);
+        *prior_state = ct_meta_state(&meta);
+    }
+    return result;
+}
+
+CT_NODISCARD CT_NOINSTR int ct_table_remove(void* ptr, size_t* size_out, size_t* req_size_out,
+                                            const char** site_out)
+{
+    unsigned char prior_state = CT_ENTRY_EMPTY;
+    return ct_table_retire(ptr, CT_ENTRY_FREED, size_out, req_size_out, site_out, &prior_state);
+}
+
+CT_NODISCARD CT_NOINSTR int ct_table_remove_autofree(void* ptr, size_t* size_out,
+                                                     size_t* req_size_out, const char** site_out)
+{
+    unsigned char prior_state = CT_ENTRY_EMPTY;
+    const int result =
+        ct_table_retire(ptr, CT_ENTRY_AUTOFREED, size_out, req_size_out, site_out, &prior_state);
+    if (result < 0 && prior_state == CT_ENTRY_AUTOFREED)
+    {
+        return -2;
+    }
+    return result;
+}
+
+CT_NODISCARD CT_NOINSTR static int ct_table_lookup_exact(const void* ptr, size_t* size_out,
+                                                         size_t* req_size_out,
+                                                         const char** site_out,
+                                                         unsigned char* state_out,
+                                                         struct ct_lookup_guard* guard)
+{
+    if (!ptr)
+    {
+        return 0;
+    }
+
+    struct ct_alloc_meta snapshot;
+    if (!ct_table_lookup_any(reinterpret_cast<uintptr_t>(ptr), 0, nullptr, &snapshot, guard))
+    {
+        return 0;
+    }
+    ct_meta_copy_out(&snapshot, size_out, req_size_out, site_out);
+    if (state_out)
+    {
+        *state_out = ct_meta_state(&snapshot);
+    }
+    return 1;
+}
+
+CT_NODISCARD CT_NOINSTR int ct_table_lookup(const void* ptr, size_t* size_out, size_t* req_size_out,
+                                            const char** site_out, unsigned char* state_out)
+{
+    return ct_table_lookup_exact(ptr, size_out, req_size_out, site_out, state_out, nullptr);
+}
+
+CT_NODISCARD CT_NOINSTR int ct_table_lookup_guarded(const void* ptr, size_t* size_out,
+                                                    size_t* req_size_out, const char** site_out,
+                                                    unsigned char* state_out,
+                                                    const uint64_t** guard_out,
+                                                    uint64_t* stamp_out)
+{
+    struct ct_lookup_guard guard = {nullptr, 0};
+    const int found =
+        ct_table_lookup_exact(ptr, size_out, req_size_out, site_out, state_out, &guard);
+    *guard_out = guard.counter;
+    *stamp_out = guard.stamp;
+    return found;
+}
+
+CT_NODISCARD CT_NOINSTR int ct_table_lookup_containing(const void* ptr, void** base_out,
+                                                       size_t* size_out, size_t* req_size_out,
+                                                       const char** site_out,
+                                                       unsigned char* state_out)
+{
+    if (!ptr)
+        return 0;
+
+    struct ct_alloc_meta snapshot;
+    void* base = nullptr;
+    if (!ct_table_lookup_any(reinterpret_cast<uintptr_t>(ptr), 1, &base, &snapshot, nullptr))
+    {
+        return 0;
+    }
+
+    if (base_out)
+    {
+        *base_out = base;
+    }
+    ct_meta_copy_out(&snapshot, size_out, req_size_out, site_out);
+    if (state_out)
+    {
+        *state_out = ct_meta_state(&snapshot);
+    }
+    return 1;
+}
+
+CT_NODISCARD CT_NOINSTR size_t ct_table_live_count(void)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < CT_ALLOC_SHARDS; ++i)
+    {
+        total += __atomic_load_n(&ct_alloc_shards[i].count, __ATOMIC_RELAXED);
+    }
+    for (struct ct_thread_cache* it = __atomic_load_n(&ct_thread_caches, __ATOMIC_ACQUIRE); it;
+         it = it->next)
+    {
+        total += __atomic_load_n(&it->live_count, __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+CT_NOINSTR void ct_table_lock_all(void)
+{
+    // Caches are flushed first so whole-table walks see every entry; entries
+    // cached after this point are simply not visited.
+    ct_thread_cache_flush_all();
+    ct_table_lock_shards();
+}
+
+CT_NOINSTR void ct_table_lock_shards(void)
+{
+    // Always lock in shard order; single-pointer operations only ever hold one
+    // shard lock, so this cannot deadlock against them.
+    for (size_t i = 0; i < CT_ALLOC_SHARDS; ++i)
+    {
+        ct_shard_lock(&ct_alloc_shards[i]);
+    }
+}
+
+CT_NOINSTR void ct_table_unlock_all(void)
+{
+    for (size_t i = CT_ALLOC_SHARDS; i > 0; --i)
+    {
+        ct_shard_unlock(&ct_alloc_shards[i - 1]);
+    }
+}
+
+CT_NOINSTR static void ct_table_for_each_live(struct ct_alloc_table* table, ct_table_visit_fn fn,
+                                              void* ctx)
+{
+    for (size_t group = 0; group <= table->group_mask; ++group)
+    {
+        unsigned full = ct_group_match_full(&table->ctrl[group * CT_ALLOC_GROUP_WIDTH]);
+        while (full)
+        {
+            const size_t slot = group * CT_ALLOC_GROUP_WIDTH + __builtin_ctz(full);
+            full &= full - 1u;
+            fn(table->keys[slot], &table->meta[slot], ctx);
+        }
+    }
+}
+
+CT_NOINSTR void ct_table_for_each_live_locked(ct_table_visit_fn fn, void* ctx)
+{
+    for (size_t i = 0; i < CT_ALLOC_SHARDS; ++i)
+    {
+        struct ct_alloc_shard* shard = &ct_alloc_shards[i];
+        ct_table_for_each_live(shard->table, fn, ctx);
+        if (shard->old)
+        {
+            ct_table_for_each_live(shard->old, fn, ctx);
+        }
+    }
+}
+
+CT_NODISCARD CT_NOINSTR struct ct_alloc_meta* ct_table_find_entry_locked(const void* ptr)
+{
+    if (!ptr)
+    {
+        return nullptr;
+    }
+    const uint64_t hash = ct_hash_ptr(ptr);
+    struct ct_alloc_table* table = nullptr;
+    const size_t slot = ct_shard_find_slot_locked(ct_shard_for(hash), ptr, hash, &table);
+    return slot != CT_SLOT_NONE ? &table->meta[slot] : nullptr;
+}
+
+CT_NODISCARD CT_NOINSTR struct ct_alloc_meta*
+ct_table_find_entry_containing_locked(const void* ptr)
+{
+    if (!ptr)
+    {
+        return nullptr;
+    }
+    const uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+    if (!__atomic_load_n(&ct_pagemap_incomplete, __ATOMIC_ACQUIRE))
+    {
+        // Writers hold a shard lock while they update the page map, so it is
+        // stable here.
+        struct ct_page_span spans[CT_PAGEMAP_MAX_CANDIDATES];
+        const size_t count = ct_pagemap_find(addr, spans, CT_PAGEMAP_MAX_CANDIDATES);
+        for (size_t i = 0; i < count; ++i)
+        {
+            struct ct_alloc_meta* meta =
+                ct_table_find_entry_locked(reinterpret_cast<const void*>(spans[i].base));
+            if (meta && ct_range_contains(spans[i].base, ct_meta_size(meta), addr))
+            {
+                return meta;
+            }
+        }
+        return nullptr;
+    }
+
+    for (size_t i = 0; i < CT_ALLOC_SHARDS; ++i)
+    {
+        struct ct_alloc_shard* shard = &ct_alloc_shards[i];
+        struct ct_alloc_table* tables[2] = {shard->table, shard->old};
+        for (struct ct_alloc_table* table : tables)
+        {
+            const size_t slot = table ? ct_table_find_containing(table, addr) : CT_SLOT_NONE;
+            if (slot != CT_SLOT_NONE)
+            {
+                return &table->meta[slot];
+            }
+        }
+    }
+    return nullptr;
+}
+
+CT_NOINSTR void ct_table_mark_autofreed_locked(const void* ptr, struct ct_alloc_meta* meta)
+{
+    if (!meta)
+    {
+        return;
+    }
+    const uint64_t hash = ct_hash_ptr(ptr);
+    struct ct_alloc_shard* shard = ct_shard_for(hash);
+    struct ct_alloc_table* table = shard->table;
+    if (meta < table->meta || meta >= table->meta + table->size)
+    {
+        table = shard->old;
+    }
+
+    ct_shard_write_begin(shard);
+    ct_shard_retire_locked(shard, table, static_cast<size_t>(meta - table->meta), hash,
+                           CT_ENTRY_AUTOFREED);
+    ct_shard_write_end(shard);
+}
@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: Apache-2.0
+#ifndef CT_RUNTIME_TABLE_H
+#define CT_RUNTIME_TABLE_H
+
+#include "ct_runtime_internal.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Allocation table internals shared by the POSIX allocation hooks and the
+// autofree collector. The ct_table_* entry points declared in
+// ct_runtime_internal.h lock the owning shard themselves; the *_locked
+// helpers below require ct_table_lock_all() to be held.
+
+// Per-allocation metadata, packed into 16 bytes. The tracked pointer itself
+// lives in a separate key array and is passed alongside the metadata where
+// callers need it. Use the ct_meta_* accessors rather than the raw fields.
+//
+// bits: usable size (48 bits) | state (3) | kind (3) | GC mark (1) | GC epoch (8)
+// site_id: interned allocation site, see ct_site_intern()
+// slack: size - req_size, saturated at UINT32_MAX
+struct ct_alloc_meta
+{
+    uint64_t bits;
+    uint32_t site_id;
+    uint32_t slack;
+};
+
+static_assert(sizeof(struct ct_alloc_meta) == 16, "ct_alloc_meta must stay 16 bytes");
+
+#define CT_META_SIZE_BITS 48u
+#define CT_META_SIZE_MASK ((static_cast<uint64_t>(1) << CT_META_SIZE_BITS) - 1u)
+#define CT_META_STATE_SHIFT 48u
+#define CT_META_KIND_SHIFT 51u
+#define CT_META_MARK_SHIFT 54u
+#define CT_META_EPOCH_SHIFT 55u
+#define CT_META_EPOCH_MASK 0xFFu
+#define CT_META_FIELD_MASK 0x7u
+
+// Returns the ID of a site string, 0 for null. IDs are dense, so per-site
+// data can live in plain arrays indexed by them.
+CT_NODISCARD CT_NOINSTR uint32_t ct_site_intern(const char* site);
+CT_NODISCARD CT_NOINSTR const char* ct_site_from_id(uint32_t site_id);
+CT_NODISCARD CT_NOINSTR uint32_t ct_site_count(void);
+
+CT_NODISCARD CT_NOINSTR inline uint64_t ct_meta_field(unsigned value, unsigned shift)
+{
+    return static_cast<uint64_t>(value & CT_META_FIELD_MASK) << shift;
+}
+
+CT_NOINSTR inline void ct_meta_init(struct ct_alloc_meta* meta, size_t size, size_t req_size,
+                                    const char* site, unsigned char state, unsigned char kind)
+{
+    const uint64_t size_bits = size < CT_META_SIZE_MASK ? size : CT_META_SIZE_MASK;
+    const size_t slack = size > req_size ? size - req_size : 0;
+    meta->bits = size_bits | ct_meta_field(state, CT_META_STATE_SHIFT) |
+                 ct_meta_field(kind, CT_META_KIND_SHIFT);
+    meta->site_id = ct_site_intern(site);
+    meta->slack = slack < UINT32_MAX ? static_cast<uint32_t>(slack) : UINT32_MAX;
+}
+
+CT_NODISCARD CT_NOINSTR inline size_t ct_meta_size(const struct ct_alloc_meta* meta)
+{
+    return static_cast<size_t>(meta->bits & CT_META_SIZE_MASK);
+}
+
+CT_NODISCARD CT_NOINSTR inline size_t ct_meta_req_size(const struct ct_alloc_meta* meta)
+{
+    const size_t size = ct_meta_size(meta);
+    return meta->slack < size ? size - meta->slack : 0;
+}
+
+CT_NODISCARD CT_NOINSTR inline const char* ct_meta_site(const struct ct_alloc_meta* meta)
+{
+    return ct_site_from_id(meta->site_id);
+}
+
+CT_NODISCARD CT_NOINSTR inline unsigned char ct_meta_state(const struct ct_alloc_meta* meta)
+{
+    return static_cast<unsigned char>((meta->bits >> CT_META_STATE_SHIFT) & CT_META_FIELD_MASK);
+}
+
+CT_NODISCARD CT_NOINSTR inline unsigned char ct_meta_kind(const struct ct_alloc_meta* meta)
+{
+    return static_cast<unsigned char>((meta->bits >> CT_META_KIND_SHIFT) & CT_META_FIELD_MASK);
+}
+
+CT_NODISCARD CT_NOINSTR inline int ct_meta_mark(const struct ct_alloc_meta* meta)
+{
+    return static_cast<int>((meta->bits >> CT_META_MARK_SHIFT) & 1u);
+}
+
+CT_NOINSTR inline void ct_meta_set_state(struct ct_alloc_meta* meta, unsigned char state)
+{
+    meta->bits = (meta->bits & ~ct_meta_field(CT_META_FIELD_MASK, CT_META_STATE_SHIFT)) |
+                 ct_meta_field(state, CT_META_STATE_SHIFT);
+}
+
+// The GC marks live entries while lock-free lookups may read them; the store
+// is atomic so readers never see a torn word.
+CT_NOINSTR inline void ct_meta_set_mark(struct ct_alloc_meta* meta, int mark)
+{
+    const uint64_t bit = static_cast<uint64_t>(1) << CT_META_MARK_SHIFT;
+    const uint64_t bits = __atomic_load_n(&meta->bits, __ATOMIC_RELAXED);
+    __atomic_store_n(&meta->bits, mark ? (bits | bit) : (bits & ~bit), __ATOMIC_RELAXED);
+}
+
+// Epoch of the last GC scan that cleared the mark of this entry; 0 for entries
+// no scan has visited yet.
+CT_NODISCARD CT_NOINSTR inline unsigned ct_meta_epoch(const struct ct_alloc_meta* meta)
+{
+    return static_cast<unsigned>((meta->bits >> CT_META_EPOCH_SHIFT) & CT_META_EPOCH_MASK);
+}
+
+// Clears the mark and stamps the scan epoch in one store, so the collector
+// can tell entries that existed while it marked from ones added since.
+CT_NOINSTR inline void ct_meta_begin_scan(struct ct_alloc_meta* meta, unsigned epoch)
+{
+    const uint64_t clear = (static_cast<uint64_t>(1) << CT_META_MARK_SHIFT) |
+                           (static_cast<uint64_t>(CT_META_EPOCH_MASK) << CT_META_EPOCH_SHIFT);
+    const uint64_t bits = __atomic_load_n(&meta->bits, __ATOMIC_RELAXED);
+    __atomic_store_n(&meta->bits,
+                     (bits & ~clear) |
+                         (static_cast<uint64_t>(epoch & CT_META_EPOCH_MASK) << CT_META_EPOCH_SHIFT),
+                     __ATOMIC_RELAXED);
+}
+
+using ct_table_visit_fn = void (*)(void* ptr, struct ct_alloc_meta* meta, void* ctx);
+
+// Replaces the live entry of ptr, wherever it is, after a realloc() that
+// kept the pointer; inserts one if there is none. ct_table_insert() would add
+// a second entry when ptr is live in a shard or another thread's cache.
+CT_NODISCARD CT_NOINSTR int ct_table_update(void* ptr, size_t req_size, size_t size,
+                                            const char* site, unsigned char kind);
+CT_NODISCARD CT_NOINSTR int ct_table_remove_autofree(void* ptr, size_t* size_out,
+                                                     size_t* req_size_out, const char** site_out);
+CT_NODISCARD CT_NOINSTR size_t ct_table_live_count(void);
+
+// Flushes every thread cache into the shared table, then locks all shards.
+// Takes each thread's cache lock in turn, so it must not run while other
+// threads are suspended.
+CT_NOINSTR void ct_table_lock_all(void);
+// Locks all shards without flushing; entries still cached are not visited.
+CT_NOINSTR void ct_table_lock_shards(void);
+CT_NOINSTR void ct_table_unlock_all(void);
+CT_NOINSTR void ct_table_for_each_live_locked(ct_table_visit_fn fn, void* ctx);
+CT_NODISCARD CT_NOINSTR struct ct_alloc_meta* ct_table_find_entry_locked(const void* ptr);
+CT_NODISCARD CT_NOINSTR struct ct_alloc_meta*
+ct_table_find_entry_containing_locked(const void* ptr);
+CT_NOINSTR void ct_table_mark_autofreed_locked(const void* ptr, struct ct_alloc_meta* meta);
+
+#endif // CT_RUNTIME_TABLE_H
@@ -8,8 +8,9 @@
 extern "C"
 {
 
-    CT_NOINSTR void __ct_trace_enter(const char* func)
+    CT_NOINSTR void __ct_trace_enter(const char* func) noexcept
     {
+        ct_errno_guard errno_guard;
         if (!func)
         {
             return;
@@ -86,18 +87,21 @@ extern "C"
         }
     }
 
-    CT_NOINSTR void __ct_trace_exit_void(const char* func)
+    CT_NOINSTR void __ct_trace_exit_void(const char* func) noexcept
     {
+        ct_errno_guard errno_guard;
         ct_log_exit_value(func, "void");
     }
 
-    CT_NOINSTR void __ct_trace_exit_i64(const char* func, long long value)
+    CT_NOINSTR void __ct_trace_exit_i64(const char* func, long long value) noexcept
     {
+        ct_errno_guard errno_guard;
         ct_log_exit_value(func, std::format("{}", value));
     }
 
-    CT_NOINSTR void __ct_trace_exit_ptr(const char* func, const void* value)
+    CT_NOINSTR void __ct_trace_exit_ptr(const char* func, const void* value) noexcept
     {
+        ct_errno_guard errno_guard;
         if (!value)
         {
             ct_log_exit_value(func, "nullptr");
@@ -106,13 +110,15 @@ extern "C"
         ct_log_exit_value(func, std::format("{:p}", value));
     }
 
-    CT_NOINSTR void __ct_trace_exit_f64(const char* func, double value)
+    CT_NOINSTR void __ct_trace_exit_f64(const char* func, double value) noexcept
     {
+        ct_errno_guard errno_guard;
         ct_log_exit_value(func, std::format("{}", value));
     }
 
-    CT_NOINSTR void __ct_trace_exit_unknown(const char* func)
+    CT_NOINSTR void __ct_trace_exit_unknown(const char* func) noexcept
     {
+        ct_errno_guard errno_guard;
         ct_log_exit_value(func, "<non-scalar>");
     }
 
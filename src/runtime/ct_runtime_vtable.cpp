@@ -717,8 +717,10 @@ namespace
 extern "C"
 {
 
-    CT_NOINSTR void __ct_vtable_dump(void* this_ptr, const char* site, const char* static_type)
+    CT_NOINSTR void __ct_vtable_dump(void* this_ptr, const char* site,
+                                     const char* static_type) noexcept
     {
+        ct_errno_guard errno_guard;
         ct_init_env_once();
         if (!ct_log_is_enabled())
         {
@@ -807,8 +809,9 @@ extern "C"
     }
 
     CT_NOINSTR void __ct_vcall_trace(void* this_ptr, void* target, const char* site,
-                                     const char* static_type)
+                                     const char* static_type) noexcept
     {
+        ct_errno_guard errno_guard;
         ct_init_env_once();
         if (!ct_log_is_enabled())
         {
@@ -49,6 +49,24 @@ namespace
 
     std::mutex ct_alloc_mutex;
     std::unordered_map<void*, CtAllocEntry> ct_alloc_table;
+    // Bumped under ct_alloc_mutex whenever a live entry is freed or replaced;
+    // guards every bounds check memo (ct_runtime_fastpath.h).
+    uint64_t ct_alloc_table_guard = 0;
+
+    CT_NOINSTR void ct_alloc_table_bump_guard(void)
+    {
+        (void)__atomic_add_fetch(&ct_alloc_table_guard, 1u, __ATOMIC_RELEASE);
+    }
+
+    CT_NOINSTR void ct_lock_acquire(void)
+    {
+        ct_alloc_mutex.lock();
+    }
+
+    CT_NOINSTR void ct_lock_release(void)
+    {
+        ct_alloc_mutex.unlock();
+    }
 
     CT_NODISCARD CT_NOINSTR const char* ct_kind_name(unsigned char kind)
     {
@@ -246,6 +264,7 @@ namespace
         }
 
         entry.state = new_state;
+        ct_alloc_table_bump_guard();
         return 1;
     }
 
@@ -407,9 +426,7 @@ namespace
             return ptr;
         }
 
-        ct_lock_acquire();
         (void)ct_table_insert(ptr, req_size, alloc_size, site, kind);
-        ct_lock_release();
 
         ct_track_shadow_alloc(ptr, req_size, alloc_size);
         ct_log_alloc_event("alloc", ptr, req_size ? req_size : alloc_size, site, kind);
@@ -436,6 +453,7 @@ namespace
         entry.site = site;
         entry.state = CT_ENTRY_USED;
         entry.kind = CT_ALLOC_KIND_MALLOC;
+        ct_alloc_table_bump_guard();
         ct_lock_release();
 
         ct_track_shadow_alloc(new_ptr, size, size);
@@ -536,16 +554,6 @@ namespace
     CtLeakReporter ct_leak_reporter;
 } // namespace
 
-CT_NOINSTR void ct_lock_acquire(void)
-{
-    ct_alloc_mutex.lock();
-}
-
-CT_NOINSTR void ct_lock_release(void)
-{
-    ct_alloc_mutex.unlock();
-}
-
 CT_NODISCARD CT_NOINSTR int ct_table_insert(void* ptr, size_t req_size, size_t size,
                                             const char* site, unsigned char kind)
 {
@@ -554,9 +562,14 @@ CT_NODISCARD CT_NOINSTR int ct_table_insert(void* ptr, size_t req_size, size_t s
         return 0;
     }
 
+    std::lock_guard<std::mutex> lock(ct_alloc_mutex);
     try
     {
         auto& entry = ct_alloc_table[ptr];
+        if (entry.state == CT_ENTRY_USED)
+        {
+            ct_alloc_table_bump_guard();
+        }
         entry.size = size;
         entry.req_size = req_size;
         entry.site = site;
@@ -573,6 +586,7 @@ CT_NODISCARD CT_NOINSTR int ct_table_insert(void* ptr, size_t req_size, size_t s
 CT_NODISCARD CT_NOINSTR int ct_table_remove(void* ptr, size_t* size_out, size_t* req_size_out,
                                             const char** site_out)
 {
+    std::lock_guard<std::mutex> lock(ct_alloc_mutex);
     return ct_table_remove_with_state(ptr, CT_ENTRY_FREED, size_out, req_size_out, site_out,
                                       nullptr);
 }
@@ -585,6 +599,7 @@ CT_NODISCARD CT_NOINSTR int ct_table_lookup(const void* ptr, size_t* size_out, s
         return 0;
     }
 
+    std::lock_guard<std::mutex> lock(ct_alloc_mutex);
     auto it = ct_alloc_table.find(const_cast<void*>(ptr));
     if (it == ct_alloc_table.end())
     {
@@ -611,6 +626,18 @@ CT_NODISCARD CT_NOINSTR int ct_table_lookup(const void* ptr, size_t* size_out, s
     return 1;
 }
 
+CT_NODISCARD CT_NOINSTR int ct_table_lookup_guarded(const void* ptr, size_t* size_out,
+                                                    size_t* req_size_out, const char** site_out,
+                                                    unsigned char* state_out,
+                                                    const uint64_t** guard_out,
+                                                    uint64_t* stamp_out)
+{
+    // The table is locked as a whole, so one counter guards every entry.
+    *guard_out = &ct_alloc_table_guard;
+    *stamp_out = __atomic_load_n(&ct_alloc_table_guard, __ATOMIC_ACQUIRE);
+    return ct_table_lookup(ptr, size_out, req_size_out, site_out, state_out);
+}
+
 CT_NODISCARD CT_NOINSTR int ct_table_lookup_containing(const void* ptr, void** base_out,
                                                        size_t* size_out, size_t* req_size_out,
                                                        const char** site_out,
@@ -621,6 +648,7 @@ CT_NODISCARD CT_NOINSTR int ct_table_lookup_containing(const void* ptr, void** b
         return 0;
     }
 
+    std::lock_guard<std::mutex> lock(ct_alloc_mutex);
     const uintptr_t value = reinterpret_cast<uintptr_t>(ptr);
     for (const auto& [base_ptr, entry] : ct_alloc_table)
     {
@@ -871,7 +899,10 @@ extern "C"
             ct_lock_acquire();
             (void)ct_remove_for_release(addr, CT_ENTRY_FREED, &size, &alloc_site, &kind);
             ct_lock_release();
-            ct_track_shadow_free(addr, size);
+            if (ct_is_enabled(CT_FEATURE_SHADOW) && size != 0)
+            {
+                ct_shadow_release_range(addr, size);
+            }
         }
 
         const BOOL ok = addr ? VirtualFree(addr, 0, MEM_RELEASE) : TRUE;
@@ -0,0 +1,449 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "ct_runtime_internal.h"
+
+#include <cstdlib>
+#include <cstring>
+
+enum
+{
+    CT_SHADOW_ENTRY_EMPTY = 0,
+    CT_SHADOW_ENTRY_USED = 1,
+    CT_SHADOW_ENTRY_TOMB = 2
+};
+
+#define CT_SHADOW_SHIFT 3u
+#define CT_SHADOW_PAGE_BITS 12u
+#define CT_SHADOW_PAGE_SIZE (1u << CT_SHADOW_PAGE_BITS)
+#define CT_SHADOW_PAGE_MASK (CT_SHADOW_PAGE_SIZE - 1u)
+#define CT_SHADOW_TABLE_BITS 16u
+#define CT_SHADOW_TABLE_MAX_BITS 20u
+#define CT_SHADOW_TABLE_SIZE (1u << CT_SHADOW_TABLE_BITS)
+
+struct ct_shadow_page_entry
+{
+    uintptr_t page;
+    unsigned char* data;
+    unsigned char state;
+};
+
+// Mapped on first use so binaries that never enable shadow memory carry no
+// table at all.
+static struct ct_shadow_page_entry* ct_shadow_table = nullptr;
+static size_t ct_shadow_table_bits = CT_SHADOW_TABLE_BITS;
+static size_t ct_shadow_table_size = CT_SHADOW_TABLE_SIZE;
+static size_t ct_shadow_table_mask = CT_SHADOW_TABLE_SIZE - 1u;
+static int ct_shadow_lock = 0;
+static int ct_shadow_table_full_logged = 0;
+// Shadow pages in use, and the CT_SHADOW_LIMIT_MB ceiling in pages (0: none),
+// read when the table is created. Sweeps start at ct_shadow_sweep_at, which
+// moves up after a sweep that could not get back under the limit.
+static size_t ct_shadow_page_count = 0;
+static size_t ct_shadow_page_limit = 0;
+static size_t ct_shadow_sweep_at = 0;
+static int ct_shadow_limit_logged = 0;
+
+CT_NOINSTR static void ct_shadow_lock_acquire(void)
+{
+    while (__atomic_exchange_n(&ct_shadow_lock, 1, __ATOMIC_ACQUIRE) != 0)
+    {
+    }
+}
+
+CT_NOINSTR static void ct_shadow_lock_release(void)
+{
+    __atomic_store_n(&ct_shadow_lock, 0, __ATOMIC_RELEASE);
+}
+
+CT_NODISCARD CT_NOINSTR static size_t ct_shadow_hash(uintptr_t page, size_t mask)
+{
+    uintptr_t value = page;
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    return static_cast<size_t>(value) & mask;
+}
+
+CT_NODISCARD CT_NOINSTR static int ct_shadow_rehash_entry(struct ct_shadow_page_entry* table,
+                                                          size_t mask, size_t size,
+                                                          const struct ct_shadow_page_entry* entry)
+{
+    size_t idx = ct_shadow_hash(entry->page, mask);
+    for (size_t i = 0; i < size; ++i)
+    {
+        size_t pos = (idx + i) & mask;
+        struct ct_shadow_page_entry* slot = &table[pos];
+        if (slot->state == CT_SHADOW_ENTRY_EMPTY)
+        {
+            *slot = *entry;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+CT_NODISCARD CT_NOINSTR static int ct_shadow_grow_locked(void)
+{
+    if (ct_shadow_table_bits >= CT_SHADOW_TABLE_MAX_BITS)
+    {
+        return 0;
+    }
+
+    size_t new_bits = ct_shadow_table_bits + 1u;
+    size_t new_size = 1u << new_bits;
+    auto* new_table = static_cast<struct ct_shadow_page_entry*>(
+        ct_os_alloc(sizeof(struct ct_shadow_page_entry) * new_size));
+    if (!new_table)
+    {
+        return 0;
+    }
+
+    size_t new_mask = new_size - 1u;
+    for (size_t i = 0; i < ct_shadow_table_size; ++i)
+    {
+        struct ct_shadow_page_entry* entry = &ct_shadow_table[i];
+        if (entry->state != CT_SHADOW_ENTRY_USED)
+        {
+            continue;
+        }
+        (void)ct_shadow_rehash_entry(new_table, new_mask, new_size, entry);
+    }
+
+    ct_os_free(ct_shadow_table, sizeof(struct ct_shadow_page_entry) * ct_shadow_table_size);
+
+    ct_shadow_table = new_table;
+    ct_shadow_table_bits = new_bits;
+    ct_shadow_table_size = new_size;
+    ct_shadow_table_mask = new_mask;
+    ct_shadow_table_full_logged = 0;
+    return 1;
+}
+
+// A missing page reads as poisoned, so a fully poisoned page can be freed.
+CT_NOINSTR static void ct_shadow_drop_entry_locked(struct ct_shadow_page_entry* entry)
+{
+    std::free(entry->data);
+    entry->data = nullptr;
+    entry->state = CT_SHADOW_ENTRY_TOMB;
+    --ct_shadow_page_count;
+}
+
+CT_NODISCARD CT_NOINSTR static int ct_shadow_page_poisoned(const unsigned char* data)
+{
+    for (size_t i = 0; i < CT_SHADOW_PAGE_SIZE; ++i)
+    {
+        if (data[i] != 0xFF)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Frees every fully poisoned page once the ceiling is reached. The pages
+// still in use all cover live memory, so if that is not enough the limit is
+// only reported.
+CT_NOINSTR static void ct_shadow_enforce_limit_locked(void)
+{
+    for (size_t i = 0; i < ct_shadow_table_size; ++i)
+    {
+        struct ct_shadow_page_entry* entry = &ct_shadow_table[i];
+        if (entry->state == CT_SHADOW_ENTRY_USED && ct_shadow_page_poisoned(entry->data))
+        {
+            ct_shadow_drop_entry_locked(entry);
+        }
+    }
+    ct_shadow_sweep_at = ct_shadow_page_count + ct_shadow_page_limit / 4u + 1u;
+    if (ct_shadow_sweep_at < ct_shadow_page_limit)
+    {
+        ct_shadow_sweep_at = ct_shadow_page_limit;
+    }
+    if (ct_shadow_page_count >= ct_shadow_page_limit && !ct_shadow_limit_logged)
+    {
+        ct_shadow_limit_logged = 1;
+        ct_log(CTLevel::Warn, "{}shadow memory above CT_SHADOW_LIMIT_MB: {} pages still in use{}\n",
+               ct_color(CTColor::Red), ct_shadow_page_count, ct_color(CTColor::Reset));
+    }
+}
+
+CT_NOINSTR static void ct_shadow_drop_page_locked(uintptr_t page)
+{
+    if (!ct_shadow_table)
+    {
+        return;
+    }
+    size_t idx = ct_shadow_hash(page, ct_shadow_table_mask);
+    for (size_t i = 0; i < ct_shadow_table_size; ++i)
+    {
+        struct ct_shadow_page_entry* entry = &ct_shadow_table[(idx + i) & ct_shadow_table_mask];
+        if (entry->state == CT_SHADOW_ENTRY_EMPTY)
+        {
+            return;
+        }
+        if (entry->state == CT_SHADOW_ENTRY_USED && entry->page == page)
+        {
+            ct_shadow_drop_entry_locked(entry);
+            return;
+        }
+    }
+}
+
+CT_NODISCARD CT_NOINSTR static unsigned char* ct_shadow_get_page_locked(uintptr_t page, int create)
+{
+    if (!ct_shadow_table)
+    {
+        if (!create)
+        {
+            return nullptr;
+        }
+        ct_shadow_table = static_cast<struct ct_shadow_page_entry*>(
+            ct_os_alloc(sizeof(struct ct_shadow_page_entry) * ct_shadow_table_size));
+        if (!ct_shadow_table)
+        {
+            return nullptr;
+        }
+        ct_shadow_page_limit = ct_shadow_limit_bytes() / CT_SHADOW_PAGE_SIZE;
+        ct_shadow_sweep_at = ct_shadow_page_limit;
+    }
+
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        size_t idx = ct_shadow_hash(page, ct_shadow_table_mask);
+        size_t tombstone = static_cast<size_t>(-1);
+
+        for (size_t i = 0; i < ct_shadow_table_size; ++i)
+        {
+            size_t pos = (idx + i) & ct_shadow_table_mask;
+            struct ct_shadow_page_entry* entry = &ct_shadow_table[pos];
+
+            if (entry->state == CT_SHADOW_ENTRY_USED)
+            {
+                if (entry->page == page)
+                {
+                    return entry->data;
+                }
+                continue;
+            }
+
+            if (entry->state == CT_SHADOW_ENTRY_TOMB && tombstone == static_cast<size_t>(-1))
+            {
+                tombstone = pos;
+                continue;
+            }
+
+            if (entry->state == CT_SHADOW_ENTRY_EMPTY)
+            {
+                if (!create)
+                {
+                    return nullptr;
+                }
+
+                if (tombstone != static_cast<size_t>(-1))
+                {
+                    entry = &ct_shadow_table[tombstone];
+                }
+                if (ct_shadow_page_limit && ct_shadow_page_count >= ct_shadow_sweep_at)
+                {
+                    ct_shadow_enforce_limit_locked();
+                }
+
+                unsigned char* data = static_cast<unsigned char*>(std::malloc(CT_SHADOW_PAGE_SIZE));
+                if (!data)
+                {
+                    return nullptr;
+                }
+                std::memset(data, 0xFF, CT_SHADOW_PAGE_SIZE);
+
+                entry->page = page;
+                entry->data = data;
+                entry->state = CT_SHADOW_ENTRY_USED;
+                ++ct_shadow_page_count;
+                return entry->data;
+            }
+        }
+
+        if (!create || !ct_shadow_grow_locked())
+        {
+            if (create && !ct_shadow_table_full_logged)
+            {
+                ct_shadow_table_full_logged = 1;
+                ct_log(CTLevel::Warn, "{}shadow table full ({} entries){}\n",
+                       ct_color(CTColor::Red), ct_shadow_table_size, ct_color(CTColor::Reset));
+            }
+            return nullptr;
+        }
+    }
+
+    return nullptr;
+}
+
+CT_NODISCARD CT_NOINSTR static unsigned char ct_shadow_get_byte_locked(uintptr_t shadow_index)
+{
+    uintptr_t page = shadow_index >> CT_SHADOW_PAGE_BITS;
+    size_t offset = static_cast<size_t>(shadow_index & CT_SHADOW_PAGE_MASK);
+    unsigned char* data = ct_shadow_get_page_locked(page, 0);
+    if (!data)
+    {
+        return 0xFF;
+    }
+    return data[offset];
+}
+
+CT_NOINSTR static void ct_shadow_set_byte_locked(uintptr_t shadow_index, unsigned char value)
+{
+    uintptr_t page = shadow_index >> CT_SHADOW_PAGE_BITS;
+    size_t offset = static_cast<size_t>(shadow_index & CT_SHADOW_PAGE_MASK);
+    unsigned char* data = ct_shadow_get_page_locked(page, 1);
+    if (!data)
+    {
+        return;
+    }
+    data[offset] = value;
+}
+
+// Sets count shadow bytes starting at shadow_index, resolving each shadow
+// page once and filling the part of it that the range covers. Pages that end
+// up entirely poisoned are freed instead.
+CT_NOINSTR static void ct_shadow_fill_locked(uintptr_t shadow_index, size_t count,
+                                             unsigned char value)
+{
+    while (count != 0)
+    {
+        size_t offset = static_cast<size_t>(shadow_index & CT_SHADOW_PAGE_MASK);
+        size_t span = CT_SHADOW_PAGE_SIZE - offset;
+        if (span > count)
+        {
+            span = count;
+        }
+        if (value == 0xFF && span == CT_SHADOW_PAGE_SIZE)
+        {
+            ct_shadow_drop_page_locked(shadow_index >> CT_SHADOW_PAGE_BITS);
+        }
+        else if (unsigned char* data =
+                     ct_shadow_get_page_locked(shadow_index >> CT_SHADOW_PAGE_BITS, 1))
+        {
+            std::memset(data + offset, value, span);
+        }
+        shadow_index += span;
+        count -= span;
+    }
+}
+
+CT_NOINSTR void ct_shadow_poison_range(const void* addr, size_t size)
+{
+    if (!ct_is_enabled(CT_FEATURE_SHADOW) || !addr || size == 0)
+    {
+        return;
+    }
+
+    uintptr_t start = reinterpret_cast<uintptr_t>(addr);
+    uintptr_t end = start + size;
+    if (end <= start)
+    {
+        return;
+    }
+
+    uintptr_t shadow_start = start >> CT_SHADOW_SHIFT;
+    uintptr_t shadow_end = (end - 1) >> CT_SHADOW_SHIFT;
+
+    ct_shadow_lock_acquire();
+    ct_shadow_fill_locked(shadow_start, static_cast<size_t>(shadow_end - shadow_start + 1u), 0xFF);
+    ct_shadow_lock_release();
+}
+
+CT_NOINSTR void ct_shadow_unpoison_range(const void* addr, size_t size)
+{
+    if (!ct_is_enabled(CT_FEATURE_SHADOW) || !addr || size == 0)
+    {
+        return;
+    }
+
+    uintptr_t start = reinterpret_cast<uintptr_t>(addr);
+    uintptr_t shadow_index = start >> CT_SHADOW_SHIFT;
+    size_t full = size / 8;
+    size_t tail = size % 8;
+
+    ct_shadow_lock_acquire();
+    ct_shadow_fill_locked(shadow_index, full, 0);
+    if (tail != 0)
+    {
+        ct_shadow_set_byte_locked(shadow_index + full, static_cast<unsigned char>(tail));
+    }
+    ct_shadow_lock_release();
+}
+
+CT_NOINSTR void ct_shadow_release_range(const void* addr, size_t size)
+{
+    // Poisoning already frees every shadow page the range covers entirely.
+    ct_shadow_poison_range(addr, size);
+}
+
+CT_NOINSTR void ct_shadow_unpoison_untracked(const void*, size_t)
+{
+    // Shadow checks are never inlined on Windows, so untracked memory only
+    // ever reaches the runtime through lookups that ignore the shadow.
+}
+
+// Returns 1 if any byte of [start, end) is not addressable.
+CT_NODISCARD CT_NOINSTR static int ct_shadow_scan(uintptr_t start, uintptr_t end)
+{
+    uintptr_t shadow_start = start >> CT_SHADOW_SHIFT;
+    uintptr_t shadow_end = (end - 1) >> CT_SHADOW_SHIFT;
+
+    int oob = 0;
+    ct_shadow_lock_acquire();
+    for (uintptr_t idx = shadow_start; idx <= shadow_end; ++idx)
+    {
+        unsigned char value = ct_shadow_get_byte_locked(idx);
+        if (value == 0)
+        {
+            continue;
+        }
+
+        uintptr_t block_start = idx << CT_SHADOW_SHIFT;
+        uintptr_t block_end = block_start + 8;
+        uintptr_t access_end = end < block_end ? end : block_end;
+
+        if (value == 0xFF)
+        {
+            oob = 1;
+            break;
+        }
+
+        uintptr_t allowed_end = block_start + static_cast<uintptr_t>(value);
+        if (access_end > allowed_end)
+        {
+            oob = 1;
+            break;
+        }
+    }
+    ct_shadow_lock_release();
+    return oob;
+}
+
+CT_NODISCARD CT_NOINSTR int ct_shadow_check_access(const void* ptr, size_t access_size,
+                                                   const void* base, size_t req_size,
+                                                   size_t alloc_size, const char* alloc_site,
+                                                   const char* site, int is_write,
+                                                   unsigned char state)
+{
+    uintptr_t start = reinterpret_cast<uintptr_t>(ptr);
+    uintptr_t end = start + access_size;
+    if (end <= start)
+    {
+        return 0;
+    }
+
+    if (!ct_shadow_scan(start, end))
+    {
+        return 0;
+    }
+    if (ct_shadow_fault_in(base, req_size ? req_size : alloc_size, ptr, access_size, state) &&
+        !ct_shadow_scan(start, end))
+    {
+        return 0;
+    }
+
+    ct_report_bounds_error(base, ptr, access_size, site, is_write, req_size, alloc_size, alloc_site,
+                           state);
+    return 1;
+}
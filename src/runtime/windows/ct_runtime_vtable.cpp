@@ -471,6 +471,7 @@ extern "C"
 {
     CT_NOINSTR void __ct_vtable_dump(void* this_ptr, const char* site, const char* static_type)
     {
+        ct_errno_guard errno_guard;
         ct_init_env_once();
         if (!ct_log_is_enabled())
         {
@@ -530,10 +531,8 @@ extern "C"
         if (ct_is_enabled(CT_FEATURE_ALLOC))
         {
             unsigned char state = 0;
-            ct_lock_acquire();
             const int found =
                 ct_table_lookup_containing(this_ptr, nullptr, nullptr, nullptr, nullptr, &state);
-            ct_lock_release();
             if (found && state == CT_ENTRY_FREED)
             {
                 warnings.push_back("vptr on freed object");
@@ -557,6 +556,7 @@ extern "C"
     CT_NOINSTR void __ct_vcall_trace(void* this_ptr, void* target, const char* site,
                                      const char* static_type)
     {
+        ct_errno_guard errno_guard;
         ct_init_env_once();
         if (!ct_log_is_enabled())
         {
@@ -643,10 +643,8 @@ extern "C"
         if (ct_is_enabled(CT_FEATURE_ALLOC))
         {
             unsigned char state = 0;
-            ct_lock_acquire();
             const int found =
                 ct_table_lookup_containing(this_ptr, nullptr, nullptr, nullptr, nullptr, &state);
-            ct_lock_release();
             if (found && state == CT_ENTRY_FREED)
             {
                 warnings.push_back("vptr on freed object");
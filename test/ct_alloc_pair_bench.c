@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: Apache-2.0
+// Measures the cost of a tracked malloc/free pair, single-threaded and with
+// every thread churning its own allocations. Build it with the instrumenting
+// compiler and compare against a plain build.
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define THREAD_COUNT 4
+#define PAIRS 2000000
+#define BATCH 16
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void* worker(void* arg)
+{
+    (void)arg;
+    void* batch[BATCH];
+
+    for (int i = 0; i < PAIRS / BATCH; ++i)
+    {
+        for (int j = 0; j < BATCH; ++j)
+        {
+            batch[j] = malloc((size_t)(16 + 8 * j));
+        }
+        for (int j = BATCH; j > 0; --j)
+        {
+            free(batch[j - 1]);
+        }
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    double start = now_ns();
+    for (int i = 0; i < PAIRS; ++i)
+    {
+        void* ptr = malloc(64);
+        if (ptr)
+        {
+            ((volatile char*)ptr)[0] = (char)i;
+        }
+        free(ptr);
+    }
+    printf("single pair: %.1f ns\n", (now_ns() - start) / PAIRS);
+
+    start = now_ns();
+    worker(NULL);
+    printf("single batch of %d: %.1f ns/pair\n", BATCH, (now_ns() - start) / PAIRS);
+
+    pthread_t threads[THREAD_COUNT];
+    int started = 0;
+    start = now_ns();
+    for (; started < THREAD_COUNT; ++started)
+    {
+        if (pthread_create(&threads[started], NULL, worker, NULL) != 0)
+        {
+            break;
+        }
+    }
+    for (int i = 0; i < started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    printf("%d threads: %.1f ns/pair\n", started, (now_ns() - start) / PAIRS);
+    return 0;
+}
@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: Apache-2.0
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define THREAD_COUNT 8
+#define ITERATIONS 50000
+#define BATCH 64
+
+static void* worker(void* arg)
+{
+    (void)arg;
+    void* batch[BATCH];
+
+    for (int i = 0; i < ITERATIONS / BATCH; ++i)
+    {
+        for (int j = 0; j < BATCH; ++j)
+        {
+            batch[j] = malloc((size_t)(16 + j));
+            if (batch[j])
+            {
+                ((char*)batch[j])[j] = (char)j; // bounds-checked against the shared table
+            }
+        }
+        for (int j = 0; j < BATCH; ++j)
+        {
+            free(batch[j]);
+        }
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    pthread_t threads[THREAD_COUNT];
+    int started = 0;
+
+    for (; started < THREAD_COUNT; ++started)
+    {
+        if (pthread_create(&threads[started], NULL, worker, NULL) != 0)
+        {
+            printf("pthread_create failed at %d\n", started);
+            break;
+        }
+    }
+
+    for (int i = 0; i < started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: Apache-2.0
+// Periodic GC scans run while worker threads keep allocating. Every block
+// stays reachable from a global until its thread frees it, so a scan must
+// neither free one (the pattern check or the free would fail) nor hang on a
+// thread it suspended in the middle of an allocation.
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define THREAD_COUNT 4
+#define SLOTS 64
+#define RUN_SECONDS 2
+
+static unsigned char* live[THREAD_COUNT][SLOTS];
+static size_t live_size[THREAD_COUNT][SLOTS];
+static volatile int failed = 0;
+
+static void* worker(void* arg)
+{
+    const int id = (int)(size_t)arg;
+    const time_t stop = time(NULL) + RUN_SECONDS;
+    unsigned seed = (unsigned)id * 2654435761u;
+
+    for (unsigned long round = 0; time(NULL) < stop; ++round)
+    {
+        const int slot = (int)(round % SLOTS);
+        unsigned char* old = live[id][slot];
+        if (old)
+        {
+            for (size_t i = 0; i < live_size[id][slot]; ++i)
+            {
+                if (old[i] != (unsigned char)(id + slot))
+                {
+                    failed = 1;
+                    break;
+                }
+            }
+            free(old);
+        }
+
+        seed = seed * 1103515245u + 12345u;
+        const size_t size = 16 + (seed >> 16) % 512;
+        unsigned char* block = malloc(size);
+        if (!block)
+        {
+            failed = 1;
+            break;
+        }
+        memset(block, id + slot, size);
+        live_size[id][slot] = size;
+        live[id][slot] = block;
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    pthread_t threads[THREAD_COUNT];
+    int started = 0;
+
+    for (; started < THREAD_COUNT; ++started)
+    {
+        if (pthread_create(&threads[started], NULL, worker, (void*)(size_t)started) != 0)
+        {
+            printf("pthread_create failed at %d\n", started);
+            return 1;
+        }
+    }
+    for (int i = 0; i < started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int t = 0; t < THREAD_COUNT; ++t)
+    {
+        for (int s = 0; s < SLOTS; ++s)
+        {
+            free(live[t][s]);
+        }
+    }
+    if (failed)
+    {
+        printf("live block corrupted or freed by a scan\n");
+        return 1;
+    }
+    return 0;
+}
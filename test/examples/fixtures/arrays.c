@@ -0,0 +1,11 @@
+// SPDX-License-Identifier: Apache-2.0
+int values[16];
+
+int main(int argc, char** argv)
+{
+    (void)argv;
+    int local[8] = {0};
+    local[argc & 7] = argc;
+    values[argc & 15] = local[argc & 7];
+    return 0;
+}
@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: Apache-2.0
+#include <stdlib.h>
+
+struct point
+{
+    int x;
+    int y;
+    int z;
+};
+
+int local_constant(int v)
+{
+    volatile int local[4];
+    local[2] = v;
+    return local[1];
+}
+
+void set_point(struct point* p, int v)
+{
+    p->x = v;
+    p->y = v + 1;
+    p->z = v + 2;
+}
+
+int read_around_free(const int* p, void* other)
+{
+    int first = p[0];
+    free(other);
+    return first + p[1];
+}
@@ -0,0 +1,6 @@
+// SPDX-License-Identifier: Apache-2.0
+#error stops here
+int bad(void)
+{
+    return 0;
+}
@@ -0,0 +1,6 @@
+// SPDX-License-Identifier: Apache-2.0
+#warning compiled first
+int good(void)
+{
+    return 1;
+}
@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: Apache-2.0
+#include <stdlib.h>
+
+int sum(const int* p, int n)
+{
+    int s = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        s += p[i];
+    }
+    return s;
+}
+
+int sum_then_free(int* p, int n, int k)
+{
+    int s = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        s += p[i];
+        if (i == k)
+        {
+            free(p);
+        }
+    }
+    return s;
+}
+
+int exit_on_zero(const int* p, int n)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        if (p[i] == 0)
+        {
+            exit(1);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,27 @@
+// SPDX-License-Identifier: Apache-2.0
+#include <stdlib.h>
+
+// Volatile so that every access below is checked at run time.
+static volatile size_t big = 4000;
+static volatile size_t small = 16;
+static volatile int at = 99;
+
+int main(void)
+{
+    char* p = malloc(big);
+    if (!p)
+    {
+        return 1;
+    }
+    p[at] = 1;
+    // Usually shrinks in place: the check above must not vouch for q.
+    char* q = realloc(p, small);
+    if (!q)
+    {
+        free(p);
+        return 1;
+    }
+    q[at] = 2;
+    free(q);
+    return 0;
+}
@@ -0,0 +1,7 @@
+; SPDX-License-Identifier: Apache-2.0
+define i32 @load_at(ptr %p, i64 %i) {
+entry:
+  %q = getelementptr inbounds i32, ptr %p, i64 %i
+  %v = load i32, ptr %q, align 4
+  ret i32 %v
+}
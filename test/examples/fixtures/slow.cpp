@@ -0,0 +1,13 @@
+// SPDX-License-Identifier: Apache-2.0
+// Takes the constant evaluator tens of seconds, to keep a compilation running.
+constexpr unsigned long long spin(unsigned long long n)
+{
+    unsigned long long sum = 0;
+    for (unsigned long long i = 0; i < n; ++i)
+    {
+        sum += i * i;
+    }
+    return sum;
+}
+
+static_assert(spin(1ull << 30) != 1, "never fails");
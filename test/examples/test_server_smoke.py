@@ -0,0 +1,151 @@
+# SPDX-License-Identifier: Apache-2.0
+from __future__ import annotations
+from pathlib import Path
+import os
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = Path(__file__).resolve().parents[2]
+FIXTURES = ROOT / "test" / "examples" / "fixtures"
+WORK = ROOT / "test" / "examples" / ".work"
+
+
+def start_server(cc: Path, socket: Path, **kwargs) -> subprocess.Popen:
+    server = subprocess.Popen([str(cc), f"--server={socket}"], stderr=subprocess.PIPE,
+                              text=True, **kwargs)
+    for _ in range(100):
+        if socket.exists():
+            return server
+        if server.poll() is not None:
+            break
+        time.sleep(0.05)
+    server.kill()
+    raise RuntimeError(f"server did not start: {server.stderr.read()}")
+
+
+def client(cc: Path, socket: Path, args: list[str], ws: Path) -> subprocess.CompletedProcess:
+    env = dict(os.environ, CT_SERVER_SOCKET=str(socket))
+    return subprocess.run([str(cc), *args], cwd=str(ws), env=env, capture_output=True,
+                          text=True)
+
+
+def server_children(server: subprocess.Popen) -> list[str]:
+    out = subprocess.run(["pgrep", "-P", str(server.pid)], capture_output=True, text=True)
+    return out.stdout.split()
+
+
+def stop_server(server: subprocess.Popen) -> None:
+    for pid in server_children(server):
+        os.kill(int(pid), signal.SIGKILL)
+    server.kill()
+    server.wait()
+
+
+def test_round_trip(cc: Path, ws: Path) -> None:
+    socket = ws / "ct.sock"
+    server = start_server(cc, socket)
+    try:
+        res = client(cc, socket, ["-c", "hello.c", "-o", "hello.o"], ws)
+        assert res.returncode == 0, res.stderr
+        assert (ws / "hello.o").exists(), "no object written"
+
+        # Exit code and diagnostics come back through the forwarded stdio.
+        res = client(cc, socket, ["-c", "jobs_bad.c", "-o", "bad.o"], ws)
+        assert res.returncode == 1, res.returncode
+        assert "jobs_bad.c:2:2: error: stops here" in res.stderr, res.stderr
+    finally:
+        stop_server(server)
+
+
+def test_client_killed(cc: Path, ws: Path) -> None:
+    socket = ws / "ct.sock"
+    server = start_server(cc, socket)
+    try:
+        env = dict(os.environ, CT_SERVER_SOCKET=str(socket))
+        slow = subprocess.Popen([str(cc), "-fconstexpr-steps=2147483647", "-fsyntax-only",
+                                 "slow.cpp"], cwd=str(ws), env=env,
+                                stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        for _ in range(100):
+            if server_children(server):
+                break
+            time.sleep(0.05)
+        assert server_children(server), "the compilation never reached the server"
+        slow.kill()
+        slow.wait()
+
+        # The forked compilation notices the hang-up and goes away with it.
+        for _ in range(100):
+            if not server_children(server):
+                return
+            time.sleep(0.05)
+        raise AssertionError("compilation kept running after its client was killed")
+    finally:
+        stop_server(server)
+
+
+def test_foreign_server(cc: Path, ws: Path) -> None:
+    # A server run by another user must not get this user's compilations.
+    if not hasattr(os, "geteuid") or os.geteuid() != 0:
+        print("  skipped: needs root to run a server as another user")
+        return
+    # The server only listens, so a copy nobody can reach will do.
+    shared = Path(tempfile.mkdtemp(prefix="ct_foreign_"))
+    shared.chmod(0o777)
+    socket = shared / "ct.sock"
+    foreign_cc = shared / cc.name
+    shutil.copy2(cc, foreign_cc)
+    foreign_cc.chmod(0o755)
+
+    def as_nobody() -> None:
+        os.setgid(65534)
+        os.setuid(65534)
+
+    try:
+        server = start_server(foreign_cc, socket, preexec_fn=as_nobody)
+    except (OSError, RuntimeError) as e:
+        shutil.rmtree(shared, ignore_errors=True)
+        print(f"  skipped: cannot run the server as nobody ({e})")
+        return
+    try:
+        res = client(cc, socket, ["-c", "hello.c", "-o", "local.o"], ws)
+        assert res.returncode == 0, res.stderr
+        assert "ignoring compile server" in res.stderr, res.stderr
+        assert (ws / "local.o").exists(), "not compiled locally"
+        assert not server_children(server), "the foreign server ran the compilation"
+    finally:
+        stop_server(server)
+        shutil.rmtree(shared, ignore_errors=True)
+
+
+def main() -> int:
+    if os.name == "nt":
+        print("the compile server is Unix-only")
+        return 0
+    cc = (ROOT / "build" / "cc").resolve()
+    if not cc.exists():
+        print(f"cc binary not found: {cc}")
+        return 1
+
+    WORK.mkdir(parents=True, exist_ok=True)
+    failures = 0
+    for test in (test_round_trip, test_client_killed, test_foreign_server):
+        with tempfile.TemporaryDirectory(prefix=f"{test.__name__}_", dir=str(WORK)) as d:
+            ws = Path(d)
+            for name in ("hello.c", "jobs_bad.c", "slow.cpp"):
+                shutil.copy2(FIXTURES / name, ws / name)
+            print(test.__name__)
+            try:
+                test(cc, ws)
+                print("  ok")
+            except (AssertionError, RuntimeError) as e:
+                failures += 1
+                print(f"  FAILED: {e}")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
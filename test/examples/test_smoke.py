@@ -1,7 +1,10 @@
 # SPDX-License-Identifier: Apache-2.0
 import os
 from pathlib import Path
+import re
 import shutil
+import subprocess
+import tempfile
 
 from ctestfw.runner import CompilerRunner, RunnerConfig
 from ctestfw.plan import CompilePlan
@@ -51,6 +54,100 @@ def assert_stderr_contains(text: str) -> Assertion:
                 f"stderr does not contain '{text}'\nstderr:\n{res.run.stderr}")
     return Assertion(name=f"stderr_contains_{text}", check=_check)
 
+def assert_stderr_sequence(texts: list[str]) -> Assertion:
+    # Each text once, in this order.
+    def _check(res) -> None:
+        stderr = res.run.stderr or ""
+        pos = 0
+        for text in texts:
+            require(stderr.count(text) == 1,
+                    f"stderr should contain '{text}' once\nstderr:\n{stderr}")
+            found = stderr.find(text)
+            require(found >= pos, f"'{text}' is out of order\nstderr:\n{stderr}")
+            pos = found + len(text)
+    return Assertion(name=f"stderr_sequence_{len(texts)}", check=_check)
+
+def assert_files_identical(first: str, second: str) -> Assertion:
+    def _check(res) -> None:
+        require(_read_artifact_bytes(res, first) == _read_artifact_bytes(res, second),
+                f"{first} and {second} differ")
+    return Assertion(name=f"files_identical_{Path(first).name}_{Path(second).name}",
+                     check=_check)
+
+def _function_ir(ir: str, function: str) -> str:
+    match = re.search(rf"^define [^\n]*@{re.escape(function)}\(.*?^}}$", ir, re.M | re.S)
+    require(match is not None, f"function @{function} not found in output")
+    return match.group(0)
+
+def _bounds_check_sizes(res, function: str) -> list[str]:
+    body = _function_ir(res.run.stdout or "", function)
+    return re.findall(r"call void @__ct_check_bounds\(ptr [^,]+, ptr [^,]+, i64 ([^,]+),", body)
+
+def assert_loop_check_hoisted(function: str) -> Assertion:
+    # A check hoisted out of a loop covers a computed length; a check left in
+    # the loop covers the constant size of one access.
+    def _check(res) -> None:
+        sizes = _bounds_check_sizes(res, function)
+        require(sizes and not any(size.isdigit() for size in sizes),
+                f"@{function}: expected only range checks, got sizes {sizes}")
+    return Assertion(name=f"loop_check_hoisted_{function}", check=_check)
+
+def assert_loop_check_kept(function: str) -> Assertion:
+    def _check(res) -> None:
+        sizes = _bounds_check_sizes(res, function)
+        require(sizes and all(size.isdigit() for size in sizes),
+                f"@{function}: expected per-access checks, got sizes {sizes}")
+    return Assertion(name=f"loop_check_kept_{function}", check=_check)
+
+def assert_bounds_check_sizes(function: str, sizes: list) -> Assertion:
+    # None stands for a check of a computed length, such as a loop range check.
+    def _check(res) -> None:
+        found = _bounds_check_sizes(res, function)
+        actual = [int(size) if size.isdigit() else None for size in found]
+        require(actual == sizes, f"@{function}: expected check sizes {sizes}, got {found}")
+    return Assertion(name=f"bounds_check_sizes_{function}", check=_check)
+
+def assert_no_bounds_checks(function: str) -> Assertion:
+    def _check(res) -> None:
+        body = _function_ir(res.run.stdout or "", function)
+        require("@__ct_check_bounds(" not in body and "@__ct_report_object_bounds(" not in body,
+                f"@{function}: expected no bounds checks\n{body}")
+    return Assertion(name=f"no_bounds_checks_{function}", check=_check)
+
+def assert_function_contains(function: str, text: str) -> Assertion:
+    def _check(res) -> None:
+        body = _function_ir(res.run.stdout or "", function)
+        require(text in body, f"@{function} does not contain '{text}'\n{body}")
+    return Assertion(name=f"function_contains_{function}_{text}", check=_check)
+
+def assert_file_mentions(path: str, present: list[str], absent: list[str]) -> Assertion:
+    # Raw bytes, so that symbol names can be looked for in object files.
+    def _check(res) -> None:
+        data = _read_artifact_bytes(res, path)
+        for text in present:
+            require(text.encode() in data, f"{path} does not mention '{text}'")
+        for text in absent:
+            require(text.encode() not in data, f"{path} mentions '{text}'")
+    return Assertion(name=f"file_mentions_{Path(path).name}", check=_check)
+
+def assert_program_stderr_contains(path: str, text: str) -> Assertion:
+    def _check(res) -> None:
+        program = Path(path)
+        if not program.is_absolute():
+            program = res.run.cwd / program
+        require(program.exists(), f"program does not exist: {program}")
+        run = subprocess.run([str(program)], cwd=res.run.cwd, capture_output=True, text=True,
+                             timeout=60)
+        require(text in run.stderr,
+                f"{program.name} stderr does not contain '{text}'\nstderr:\n{run.stderr}")
+    return Assertion(name=f"program_stderr_contains_{text}", check=_check)
+
+def assert_stdout_count(text: str, count: int) -> Assertion:
+    def _check(res) -> None:
+        found = (res.run.stdout or "").count(text)
+        require(found == count, f"expected {count} x '{text}' in stdout, found {found}")
+    return Assertion(name=f"stdout_count_{text}", check=_check)
+
 def _read_artifact_bytes(res, path: str) -> bytes:
     artifact = Path(path)
     if not artifact.is_absolute():
@@ -100,6 +197,34 @@ def resolve_compiler_binary() -> Path | None:
 
     return None
 
+def _read_cache_var(key: str) -> str | None:
+    cache = ROOT / "build" / "CMakeCache.txt"
+    if not cache.exists():
+        return None
+    for line in cache.read_text(errors="ignore").splitlines():
+        if line.startswith(f"{key}:") and "=" in line:
+            return line.split("=", 1)[1].strip()
+    return None
+
+def resolve_opt_binary() -> Path | None:
+    env_override = os.environ.get("CORETRACE_TEST_OPT")
+    if env_override:
+        return Path(env_override)
+    llvm_dir = _read_cache_var("LLVM_DIR")
+    if llvm_dir:
+        candidate = Path(llvm_dir).parents[2] / "bin" / "opt"
+        if candidate.exists():
+            return candidate
+    found = shutil.which("opt")
+    return Path(found) if found else None
+
+def resolve_pass_plugin() -> Path | None:
+    for name in ("libcoretrace_plugin.so", "libcoretrace_plugin.dylib"):
+        candidate = ROOT / "build" / name
+        if candidate.exists():
+            return candidate.resolve()
+    return None
+
 def main() -> int:
     platform = detect_platform()
     cc_bin = resolve_compiler_binary()
@@ -125,6 +250,16 @@ def main() -> int:
     cpp_src = FIXTURES / "hello.cpp"
     cpp_as_c_src = FIXTURES / "cpp_as_c.c"
     vtable_src = FIXTURES / "vtable.cpp"
+    arrays_src = FIXTURES / "arrays.c"
+    loops_src = FIXTURES / "loops.c"
+    checks_src = FIXTURES / "checks.c"
+    plugin_src = FIXTURES / "plugin_input.ll"
+    jobs_good_src = FIXTURES / "jobs_good.c"
+    jobs_bad_src = FIXTURES / "jobs_bad.c"
+    memo_src = FIXTURES / "memo.c"
+    # Built next to cc when a matching clang is found; without it the checks
+    # stay calls to the out-of-line hook.
+    fastpath_bc = cc_bin.parent / "ct_runtime_fastpath.bc"
 
     def base_out_assertions(out_name: str):
         assertions = [
@@ -314,6 +449,193 @@ def main() -> int:
         ],
     )
 
+    tc_instrument_alloc_table_bits = TestCase(
+        name="compile_instrument_alloc_table_bits",
+        plan=CompilePlan(
+            name="compile_instrument_alloc_table_bits",
+            sources=[Path("hello.c")],
+            out=None,
+            extra_args=["--instrument", "--ct-alloc-table-bits=18", "-S", "-emit-llvm", "-o", "-"],
+        ),
+        assertions=[
+            assert_exit_code(0),
+            assert_argv_contains(["--instrument", "--ct-alloc-table-bits=18"]),
+            assert_stdout_contains("@__ct_config_alloc_table_bits = weak_odr global i32 18"),
+        ],
+    )
+
+    tc_instrument_shadow_inline = TestCase(
+        name="compile_instrument_shadow_inline",
+        plan=CompilePlan(
+            name="compile_instrument_shadow_inline",
+            sources=[Path("checks.c")],
+            out=None,
+            extra_args=["--instrument", "--ct-shadow-inline", "-S", "-emit-llvm", "-o", "-"],
+        ),
+        assertions=[
+            assert_exit_code(0),
+            assert_argv_contains(["--instrument", "--ct-shadow-inline"]),
+            assert_stdout_contains("@__ct_shadow_base = external global i64"),
+            assert_stdout_contains("ct.shadow.slow"),
+        ],
+    )
+
+    tc_instrument_object_bounds = TestCase(
+        name="compile_instrument_object_bounds",
+        plan=CompilePlan(
+            name="compile_instrument_object_bounds",
+            sources=[Path("arrays.c")],
+            out=None,
+            extra_args=["--instrument", "-S", "-emit-llvm", "-o", "-"],
+        ),
+        assertions=[
+            assert_exit_code(0),
+            assert_argv_contains(["--instrument"]),
+            assert_stdout_contains("@__ct_report_object_bounds("),
+            assert_stdout_contains("ct.object.fail"),
+        ],
+    )
+
+    # Both arrays.c indices are masked to their array, which the instrumenter
+    # does not prove: at -O2 the object checks stay, and only the post-opt
+    # pass folds them away.
+    tc_instrument_no_post_opt = TestCase(
+        name="compile_instrument_no_post_opt",
+        plan=CompilePlan(
+            name="compile_instrument_no_post_opt",
+            sources=[Path("arrays.c")],
+            out=None,
+            extra_args=["--instrument", "-O2", "-S", "-emit-llvm", "-o", "-"],
+        ),
+        assertions=[
+            assert_exit_code(0),
+            assert_argv_contains(["--instrument", "-O2"]),
+            assert_function_contains("main", "@__ct_report_object_bounds("),
+        ],
+    )
+
+    tc_instrument_post_opt = TestCase(
+        name="compile_instrument_post_opt",
+        plan=CompilePlan(
+            name="compile_instrument_post_opt",
+            sources=[Path("arrays.c")],
+            out=None,
+            extra_args=["--instrument", "--ct-post-opt", "-O2", "-S", "-emit-llvm", "-o", "-"],
+        ),
+        assertions=[
+            assert_exit_code(0),
+            assert_argv_contains(["--instrument", "--ct-post-opt", "-O2"]),
+            assert_no_bounds_checks("main"),
+        ],
+    )
+
+    tc_instrument_hook_attributes = TestCase(
+        name="compile_instrument_hook_attributes",
+        plan=CompilePlan(
+            name="compile_instrument_hook_attributes",
+            sources=[Path("arrays.c")],
+            out=None,
+            extra_args=["--instrument", "-S", "-emit-llvm", "-o", "-"],
+        ),
+        assertions=[
+            assert_exit_code(0),
+            assert_argv_contains(["--instrument"]),
+            assert_stdout_contains("declare void @__ct_check_bounds(ptr readnone, ptr "),
+            assert_stdout_contains("declare void @__ct_trace_enter(ptr readonly)"),
+            assert_stdout_contains("memory(read, inaccessiblemem: readwrite)"),
+        ],
+    )
+
+    # A loop that frees or exits early must keep its per-iteration check: a
+    # check hoisted before it would pass accesses to freed memory, or report
+    # iterations that never run.
+    tc_instrument_loop_hoist = TestCase(
+        name="compile_instrument_loop_hoist",
+        plan=CompilePlan(
+            name="compile_instrument_loop_hoist",
+            sources=[Path("loops.c")],
+            out=None,
+            extra_args=["--instrument", "-O1", "-S", "-emit-llvm", "-o", "-"],
+        ),
+        assertions=[
+            assert_exit_code(0),
+            assert_argv_contains(["--instrument", "-O1"]),
+            assert_loop_check_hoisted("sum"),
+            assert_loop_check_kept("sum_then_free"),
+            assert_loop_check_kept("exit_on_zero"),
+        ],
+    )
+
+    tc_instrument_check_placement = TestCase(
+        name="compile_instrument_check_placement",
+        plan=CompilePlan(
+            name="compile_instrument_check_placement",
+            sources=[Path("checks.c")],
+            out=None,
+            extra_args=["--instrument", "-O1", "-S", "-emit-llvm", "-o", "-"],
+        ),
+        assertions=[
+            assert_exit_code(0),
+            assert_argv_contains(["--instrument", "-O1"]),
+            assert_no_bounds_checks("local_constant"),
+            assert_bounds_check_sizes("set_point", [12]),
+            assert_bounds_check_sizes("read_around_free", [4, 4]),
+        ],
+    )
+
+    # With debug info each field store has its own line, so each keeps its
+    # own check and an overflow is reported where it happens.
+    tc_instrument_check_sites = TestCase(
+        name="compile_instrument_check_sites",
+        plan=CompilePlan(
+            name="compile_instrument_check_sites",
+            sources=[Path("checks.c")],
+            out=None,
+            extra_args=["--instrument", "-O1", "-g", "-S", "-emit-llvm", "-o", "-"],
+        ),
+        assertions=[
+            assert_exit_code(0),
+            assert_argv_contains(["--instrument", "-O1", "-g"]),
+            assert_bounds_check_sizes("set_point", [4, 4, 4]),
+            assert_stdout_contains("checks.c:22:"),
+        ],
+    )
+
+    tc_instrument_loop_range_check = TestCase(
+        name="compile_instrument_loop_range_check",
+        plan=CompilePlan(
+            name="compile_instrument_loop_range_check",
+            sources=[Path("loops.c")],
+            out=None,
+            extra_args=["--instrument", "-O1", "-S", "-emit-llvm", "-o", "-"],
+        ),
+        assertions=[
+            assert_exit_code(0),
+            assert_argv_contains(["--instrument", "-O1"]),
+            assert_bounds_check_sizes("sum", [None]),
+        ],
+    )
+
+    # With -j2 the second source can fail before the first has started;
+    # the first must still be compiled and its warning printed first.
+    tc_instrument_jobs_failure = TestCase(
+        name="compile_instrument_jobs_failure",
+        plan=CompilePlan(
+            name="compile_instrument_jobs_failure",
+            sources=[Path("jobs_good.c"), Path("jobs_bad.c")],
+            out=None,
+            extra_args=["--instrument", "-j2", "-c"],
+        ),
+        assertions=[
+            assert_exit_code(1),
+            assert_argv_contains(["--instrument", "-j2"]),
+            assert_stderr_sequence([
+                "jobs_good.c:2:2: warning: compiled first",
+                "jobs_bad.c:2:2: error: stops here",
+            ]),
+        ],
+    )
+
     tc_instrument_emit_bc = TestCase(
         name="compile_instrument_emit_bc",
         plan=CompilePlan(
@@ -514,12 +836,145 @@ def main() -> int:
         ],
     )
 
+    # Run by opt, not cc: the plugin's pipeline element instruments once even
+    # when it is listed twice, thanks to the coretrace.instrumented marker.
+    plugin = resolve_pass_plugin()
+    tc_plugin_opt = TestCase(
+        name="plugin_opt_coretrace",
+        plan=CompilePlan(
+            name="plugin_opt_coretrace",
+            sources=[Path("plugin_input.ll")],
+            out=None,
+            extra_args=[f"-load-pass-plugin={plugin}", "-passes=coretrace,coretrace", "-S",
+                        "-o", "-"],
+        ),
+        assertions=[
+            assert_exit_code(0),
+            assert_stdout_contains("!coretrace.instrumented"),
+            assert_stdout_count("call void @__ct_trace_enter(", 1),
+            assert_stdout_count("call void @__ct_check_bounds(", 1),
+        ],
+    )
+
+    # Run in order in one workspace with CT_CACHE_DIR set: a miss that stores
+    # the object, a hit that replays the warning, then the statistics.
+    cache_cases = [
+        TestCase(
+            name="cache_first_compile",
+            plan=CompilePlan(
+                name="cache_first_compile",
+                sources=[Path("jobs_good.c")],
+                out=None,
+                extra_args=["--instrument", "-c", "-o", "cached_first.o"],
+            ),
+            assertions=[
+                assert_exit_code(0),
+                assert_output_exists_at("cached_first.o"),
+                assert_stderr_contains("warning: compiled first"),
+            ],
+        ),
+        TestCase(
+            name="cache_second_compile",
+            plan=CompilePlan(
+                name="cache_second_compile",
+                sources=[Path("jobs_good.c")],
+                out=None,
+                extra_args=["--instrument", "-c", "-o", "cached_second.o"],
+            ),
+            assertions=[
+                assert_exit_code(0),
+                assert_stderr_contains("warning: compiled first"),
+                assert_files_identical("cached_first.o", "cached_second.o"),
+            ],
+        ),
+        TestCase(
+            name="cache_stats",
+            plan=CompilePlan(
+                name="cache_stats",
+                sources=[],
+                out=None,
+                extra_args=["--ct-cache-stats"],
+            ),
+            assertions=[
+                assert_exit_code(0),
+                assert_stdout_contains("hits:        1\n"),
+                assert_stdout_contains("misses:      1\n"),
+                assert_stdout_contains("entries:     1 "),
+            ],
+        ),
+    ]
+
+    # A passing check memoizes the allocation it found; the realloc() that
+    # shrinks it must drop the memo before the next check of the same base.
+    tc_instrument_memo_realloc = TestCase(
+        name="compile_instrument_memo_realloc",
+        plan=CompilePlan(
+            name="compile_instrument_memo_realloc",
+            sources=[Path("memo.c")],
+            out=None,
+            extra_args=["--instrument", "--ct-modules=alloc,bounds", "--ct-bounds-no-abort",
+                        "-o", "memo_app"],
+        ),
+        assertions=[
+            assert_exit_code(0),
+            assert_argv_contains(["--instrument", "--ct-bounds-no-abort"]),
+            assert_output_exists_at("memo_app"),
+            assert_program_stderr_contains("memo_app", "heap-buffer-overflow"),
+        ],
+    )
+
+    # Inlined, __ct_check_bounds leaves only its out-of-line slow path behind.
+    if fastpath_bc.exists():
+        inline_symbols = (["__ct_check_bounds_slow"], [])
+    else:
+        inline_symbols = (["__ct_check_bounds"], ["__ct_check_bounds_slow"])
+    tc_instrument_inline_runtime = TestCase(
+        name="compile_instrument_inline_runtime",
+        plan=CompilePlan(
+            name="compile_instrument_inline_runtime",
+            sources=[Path("memo.c")],
+            out=None,
+            extra_args=["--instrument", "--ct-modules=alloc,bounds", "-c", "-o", "memo.o"],
+        ),
+        assertions=[
+            assert_exit_code(0),
+            assert_argv_contains(["--instrument", "-c"]),
+            assert_file_mentions("memo.o", *inline_symbols),
+        ],
+    )
+
+    tc_instrument_no_inline_runtime = TestCase(
+        name="compile_instrument_no_inline_runtime",
+        plan=CompilePlan(
+            name="compile_instrument_no_inline_runtime",
+            sources=[Path("memo.c")],
+            out=None,
+            extra_args=["--instrument", "--ct-modules=alloc,bounds", "--ct-no-inline-runtime",
+                        "-c", "-o", "memo.o"],
+        ),
+        assertions=[
+            assert_exit_code(0),
+            assert_argv_contains(["--instrument", "--ct-no-inline-runtime"]),
+            assert_file_mentions("memo.o", ["__ct_check_bounds"], ["__ct_check_bounds_slow"]),
+        ],
+    )
+
     common_cases = [tc_o_eq, tc_d_space, tc_d_compact, tc_cpp, tc_x_cxx]
     instrument_cases = [
         tc_instrument_c,
         tc_instrument_cpp,
         tc_instrument_x_cxx,
         tc_instrument_emit_llvm,
+        tc_instrument_alloc_table_bits,
+        tc_instrument_object_bounds,
+        tc_instrument_no_post_opt,
+        tc_instrument_post_opt,
+        tc_instrument_hook_attributes,
+        tc_instrument_loop_hoist,
+        tc_instrument_check_placement,
+        tc_instrument_check_sites,
+        tc_instrument_loop_range_check,
+        tc_instrument_jobs_failure,
         tc_instrument_emit_bc,
     ]
     readme_cases = [
@@ -535,10 +990,30 @@ def main() -> int:
         tc_optnone_emit_llvm,
         tc_optnone_disable_o0,
     ]
+    # The fast path bitcode is not built for Windows targets.
+    fastpath_cases = [
+        tc_instrument_memo_realloc,
+        tc_instrument_inline_runtime,
+        tc_instrument_no_inline_runtime,
+    ]
     if platform.os == OS.MACOS:
-        cases = [tc_macho, *common_cases, *instrument_cases, *readme_cases]
+        cases = [
+            tc_macho,
+            *common_cases,
+            *instrument_cases,
+            tc_instrument_shadow_inline,
+            *fastpath_cases,
+            *readme_cases,
+        ]
     elif platform.os == OS.LINUX:
-        cases = [tc_elf, *common_cases, *instrument_cases, *readme_cases]
+        cases = [
+            tc_elf,
+            *common_cases,
+            *instrument_cases,
+            tc_instrument_shadow_inline,
+            *fastpath_cases,
+            *readme_cases,
+        ]
     else:
         windows_readme_cases = [
             tc_readme_emit_llvm,
@@ -558,12 +1033,37 @@ def main() -> int:
     reports = []
     WORK.mkdir(parents=True, exist_ok=True)
     for case in suite.cases:
-        import tempfile
         with tempfile.TemporaryDirectory(prefix=f"{case.name}_", dir=str(WORK)) as d:
             ws = Path(d)
-            copy_fixtures(ws, [src, debug_src, cpp_src, cpp_as_c_src, vtable_src])
+            copy_fixtures(ws, [src, debug_src, cpp_src, cpp_as_c_src, vtable_src, arrays_src,
+                              loops_src, checks_src, jobs_good_src, jobs_bad_src, memo_src])
             reports.append(case.run(runner, ws))
 
+    with tempfile.TemporaryDirectory(prefix="cache_", dir=str(WORK)) as d:
+        ws = Path(d)
+        copy_fixtures(ws, [jobs_good_src])
+        saved = os.environ.get("CT_CACHE_DIR")
+        os.environ["CT_CACHE_DIR"] = str(ws / "cache")
+        try:
+            for case in cache_cases:
+                reports.append(case.run(runner, ws))
+        finally:
+            if saved is None:
+                del os.environ["CT_CACHE_DIR"]
+            else:
+                os.environ["CT_CACHE_DIR"] = saved
+
+    # The plugin is not built on Windows, nor when BUILD_PASS_PLUGIN is off.
+    opt_bin = resolve_opt_binary()
+    if platform.os != OS.WINDOWS and plugin is not None and opt_bin is not None:
+        opt_runner = CompilerRunner(RunnerConfig(executable=opt_bin))
+        with tempfile.TemporaryDirectory(prefix=f"{tc_plugin_opt.name}_", dir=str(WORK)) as d:
+            ws = Path(d)
+            copy_fixtures(ws, [plugin_src])
+            reports.append(tc_plugin_opt.run(opt_runner, ws))
+    elif platform.os != OS.WINDOWS:
+        print(f"skipping {tc_plugin_opt.name}: pass plugin or opt not found")
+
     rep = type("Tmp", (), {"name": suite.name, "reports": reports})()
     return ConsoleReporter().render(rep)
 
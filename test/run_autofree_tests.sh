@@ -63,6 +63,26 @@ expect_nonzero_exit() {
   esac
 }
 
+# Tests whose allocations all stay reachable while periodic scans run.
+expect_no_scan_free() {
+  case "$1" in
+    ct_autofree_scan_threads.c)
+      return 0
+      ;;
+    *)
+      return 1
+      ;;
+  esac
+}
+
+test_env() {
+  case "$1" in
+    ct_autofree_scan_threads.c)
+      echo "CT_AUTOFREE_SCAN=1 CT_AUTOFREE_SCAN_START=1 CT_AUTOFREE_SCAN_PERIOD_MS=1"
+      ;;
+  esac
+}
+
 TESTS=(
   ct_autofree_local.c
   ct_autofree_return_unused.c
@@ -78,6 +98,7 @@ TESTS=(
   ct_autofree_mmap.c
   ct_autofree_sbrk.c
   ct_autofree_brk.c
+  ct_autofree_scan_threads.c
 )
 
 PASS=0
@@ -99,8 +120,12 @@ run_one() {
       return 1
     }
 
+  local run_env
+  run_env="$(test_env "${test_file}")"
+
   set +e
-  "${bin}" >"${run_log}" 2>&1
+  # shellcheck disable=SC2086 # run_env is a list of VAR=value words.
+  env ${run_env} "${bin}" >"${run_log}" 2>&1
   local run_rc=$?
   set -e
 
@@ -135,6 +160,13 @@ run_one() {
     fi
   fi
 
+  if expect_no_scan_free "${test_file}"; then
+    if has_match "auto-free.scan." "${run_log}"; then
+      echo "  FAIL: scan freed a reachable allocation"
+      return 1
+    fi
+  fi
+
   echo "  OK"
   return 0
 }
@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: Apache-2.0
+// Checks that CompilerSession compiles like compile(). Built with
+// -DBUILD_TESTS=ON and run by ctest.
+#include "compilerlib/compiler.h"
+#include "compilerlib/session.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace
+{
+    namespace fs = std::filesystem;
+
+    int failures = 0;
+
+    void check(bool ok, const std::string& what)
+    {
+        if (!ok)
+        {
+            ++failures;
+            std::cerr << "FAILED: " << what << '\n';
+        }
+    }
+
+    void writeFile(const fs::path& path, const std::string& contents)
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << contents;
+    }
+
+    std::string readFile(const fs::path& path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    // A fresh directory under the system temporary directory, removed on exit.
+    class ScratchDir
+    {
+      public:
+        ScratchDir()
+        {
+            auto stamp = std::chrono::steady_clock::now().time_since_epoch().count();
+            path_ = fs::temp_directory_path() / ("ct_test_compiler_" + std::to_string(stamp));
+            fs::create_directories(path_);
+        }
+
+        ~ScratchDir()
+        {
+            std::error_code ec;
+            fs::remove_all(path_, ec);
+        }
+
+        std::string file(const std::string& name) const
+        {
+            return (path_ / name).string();
+        }
+
+      private:
+        fs::path path_;
+    };
+
+    // Plain -c builds take the in-process cc1 path in a session but spawn
+    // clang from compile(); both must report and write the same.
+    void testSessionMatchesCompile(const ScratchDir& dir)
+    {
+        writeFile(dir.file("warn.c"), "int unused(void)\n{\n    int x;\n    return 0;\n}\n");
+        writeFile(dir.file("broken.c"), "int broken(void)\n{\n    return missing;\n}\n");
+
+        compilerlib::CompilerSession session(1);
+        for (const char* name : {"warn", "broken"})
+        {
+            std::string src = dir.file(std::string(name) + ".c");
+            std::string direct = dir.file(std::string(name) + "_direct.o");
+            std::string pooled = dir.file(std::string(name) + "_session.o");
+
+            auto expected = compilerlib::compile({"-Wall", "-c", src, "-o", direct});
+            auto actual = session.compile({"-Wall", "-c", src, "-o", pooled});
+
+            check(expected.success == actual.success, std::string(name) + ": success differs");
+            check(expected.diagnostics == actual.diagnostics,
+                  std::string(name) + ": diagnostics differ\n  compile(): " +
+                      expected.diagnostics + "\n  session:   " + actual.diagnostics);
+            check(!expected.diagnostics.empty(), std::string(name) + ": no diagnostics");
+            check(fs::exists(direct) == fs::exists(pooled),
+                  std::string(name) + ": only one of them wrote an object");
+            if (expected.success && fs::exists(direct) && fs::exists(pooled))
+            {
+                check(readFile(direct) == readFile(pooled),
+                      std::string(name) + ": objects differ");
+            }
+        }
+    }
+
+    // Results come back in job order, however the jobs were scheduled.
+    void testCompileManyOrder(const ScratchDir& dir)
+    {
+        std::vector<compilerlib::CompileJob> jobs;
+        for (int i = 0; i < 8; ++i)
+        {
+            std::string name = "job" + std::to_string(i);
+            std::string body = i % 3 == 0 ? "#error " + name + "\n"
+                                          : "int " + name + "(void) { return " +
+                                                std::to_string(i) + "; }\n";
+            writeFile(dir.file(name + ".c"), body);
+            jobs.push_back({{"-c", dir.file(name + ".c"), "-o", dir.file(name + ".o")}});
+        }
+
+        compilerlib::CompilerSession session(4);
+        auto results = session.compileMany(jobs);
+        check(results.size() == jobs.size(), "compileMany: wrong number of results");
+        for (size_t i = 0; i < results.size() && i < jobs.size(); ++i)
+        {
+            std::string name = "job" + std::to_string(i);
+            bool shouldFail = i % 3 == 0;
+            check(results[i].success != shouldFail, "compileMany: " + name + " success");
+            if (shouldFail)
+            {
+                check(results[i].diagnostics.find("error: " + name + "\n") != std::string::npos,
+                      "compileMany: " + name + " has another job's diagnostics: " +
+                          results[i].diagnostics);
+            }
+        }
+    }
+
+    // A file rewritten with the same size keeps its stat cache entry, so
+    // only clearFileCache() makes the session read it again.
+    void testClearFileCache(const ScratchDir& dir)
+    {
+        std::string src = dir.file("value.c");
+        writeFile(src, "int value(void) { return 1; }\n");
+
+        compilerlib::CompilerSession session(1);
+        std::vector<std::string> args = {"-O1", "-S", "-emit-llvm", src};
+        auto first = session.compile(args, compilerlib::OutputMode::ToMemory);
+        check(first.success && first.llvmIR.find("ret i32 1") != std::string::npos,
+              "clearFileCache: first compile");
+
+        writeFile(src, "int value(void) { return 2; }\n");
+        session.clearFileCache();
+        auto second = session.compile(args, compilerlib::OutputMode::ToMemory);
+        check(second.success && second.llvmIR.find("ret i32 2") != std::string::npos,
+              "clearFileCache: the rewritten file was not read again");
+    }
+} // namespace
+
+int main()
+{
+    ScratchDir dir;
+    testSessionMatchesCompile(dir);
+    testCompileManyOrder(dir);
+    testClearFileCache(dir);
+    if (failures != 0)
+    {
+        std::cerr << failures << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "all session checks passed\n";
+    return 0;
+}
@@ -0,0 +1,204 @@
+// SPDX-License-Identifier: Apache-2.0
+// Checks the bookkeeping of the POSIX allocation table. The pointers are
+// addresses inside arenas that are never dereferenced, so the table and the
+// page map see exactly the sequences each test builds. Built with
+// -DBUILD_TESTS=ON and run by ctest.
+#include "ct_runtime_internal.h"
+#include "ct_runtime_table.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+extern "C"
+{
+    // Compiled-in configuration the instrumented module would provide.
+    int __ct_config_bounds_no_abort = 1;
+    int __ct_config_disable_alloc_trace = 1;
+
+    void* __ct_malloc(size_t size, const char* site);
+    void* __ct_realloc(void* ptr, size_t size, const char* site);
+    void __ct_free(void* ptr);
+    void __ct_check_bounds(const void* base, const void* ptr, size_t access_size,
+                           const char* site, int is_write) noexcept;
+}
+
+namespace
+{
+    constexpr size_t kPage = 4096;
+    // CT_ALLOC_KIND_MALLOC in ct_runtime_alloc.cpp.
+    constexpr unsigned char kKindMalloc = 0;
+
+    int failures = 0;
+
+    void check(bool ok, const std::string& what)
+    {
+        if (!ok)
+        {
+            ++failures;
+            std::cerr << "FAILED: " << what << '\n';
+        }
+    }
+
+    unsigned char* arena(size_t pages)
+    {
+        return static_cast<unsigned char*>(std::aligned_alloc(kPage, pages * kPage));
+    }
+
+    void insert(void* ptr, size_t size)
+    {
+        check(ct_table_insert(ptr, size, size, "test", kKindMalloc) == 1, "insert");
+    }
+
+    void remove(void* ptr)
+    {
+        check(ct_table_remove(ptr, nullptr, nullptr, nullptr) == 1, "remove");
+    }
+
+    // Runs fn with stderr redirected to a temporary file and returns what it
+    // wrote.
+    template <typename Fn> std::string captureStderr(Fn fn)
+    {
+        std::fflush(stderr);
+        FILE* capture = std::tmpfile();
+        const int saved = dup(STDERR_FILENO);
+        dup2(fileno(capture), STDERR_FILENO);
+        fn();
+        std::fflush(stderr);
+        dup2(saved, STDERR_FILENO);
+        close(saved);
+
+        std::string text;
+        std::rewind(capture);
+        for (int c = std::fgetc(capture); c != EOF; c = std::fgetc(capture))
+        {
+            text.push_back(static_cast<char>(c));
+        }
+        std::fclose(capture);
+        return text;
+    }
+
+    // Frees count distinct pointers of base, one after the other.
+    void churn(unsigned char* base, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            unsigned char* ptr = base + (i % kPage) * 16u;
+            insert(ptr, 16);
+            remove(ptr);
+        }
+    }
+
+    // A freed record of ptr that ages out after ptr was allocated again must
+    // not unregister the page map range of the live allocation.
+    void testReuseOutlivesFreedRecord()
+    {
+        unsigned char* reused = arena(3);
+        unsigned char* others = arena(16);
+        unsigned char* live = arena(1);
+        const size_t size = 3 * kPage;
+        unsigned char* interior = reused + kPage + 8;
+
+        insert(reused, size);
+        remove(reused);
+        churn(others, 256); // flushes the freed record to its shard
+
+        insert(reused, size);
+        for (size_t i = 0; i < 64; ++i) // flushes the live entry to its shard
+        {
+            insert(live + i * 16u, 16);
+        }
+        for (size_t i = 0; i < 64; ++i)
+        {
+            remove(live + i * 16u);
+        }
+        churn(others, 1u << 18); // ages every earlier record out
+
+        void* base = nullptr;
+        unsigned char state = 0;
+        const int found =
+            ct_table_lookup_containing(interior, &base, nullptr, nullptr, nullptr, &state);
+        check(found == 1 && base == reused && state == CT_ENTRY_USED,
+              "reuse: interior pointer of the live allocation not found");
+
+        remove(reused);
+        base = nullptr;
+        const int freed =
+            ct_table_lookup_containing(interior, &base, nullptr, nullptr, nullptr, &state);
+        check(freed == 1 && base == reused && state == CT_ENTRY_FREED,
+              "reuse: interior pointer of the freed allocation not found");
+    }
+
+    // A realloc() that shrinks in place must leave one entry, so the free that
+    // follows retires the allocation: later accesses are use-after-free and
+    // nothing is left to report as a leak.
+    void testReallocInPlace()
+    {
+        const size_t before = ct_table_live_count();
+        auto* ptr = static_cast<unsigned char*>(__ct_malloc(4000, "test"));
+        auto* shrunk = static_cast<unsigned char*>(__ct_realloc(ptr, 16, "test"));
+        if (shrunk != ptr)
+        {
+            std::cout << "realloc moved the block; skipping the in-place checks\n";
+            __ct_free(shrunk);
+            return;
+        }
+        check(ct_table_live_count() == before + 1, "realloc: more than one live entry");
+
+        __ct_free(shrunk);
+        const std::string report =
+            captureStderr([&] { __ct_check_bounds(shrunk, shrunk + 4, 4, "test", 0); });
+        check(report.find("heap-use-after-free") != std::string::npos,
+              "realloc: no use-after-free report, got: " + report);
+        check(ct_table_live_count() == before, "realloc: an entry is still live after the free");
+    }
+
+    // A check that passed memoizes the extent of its allocation. Shrinking
+    // the allocation in place, from this thread or another one, must drop the
+    // memo, so the same access is an overflow afterwards.
+    void testMemoAfterShrink(bool fromOtherThread)
+    {
+        auto* ptr = static_cast<unsigned char*>(__ct_malloc(4000, "test"));
+        const std::string before =
+            captureStderr([&] { __ct_check_bounds(ptr, ptr + 99, 1, "test", 0); });
+        check(before.empty(), "memo: in-bounds access reported: " + before);
+
+        unsigned char* shrunk = nullptr;
+        auto shrink = [&] { shrunk = static_cast<unsigned char*>(__ct_realloc(ptr, 16, "test")); };
+        if (fromOtherThread)
+        {
+            std::thread(shrink).join();
+        }
+        else
+        {
+            shrink();
+        }
+        if (shrunk == ptr)
+        {
+            const std::string after =
+                captureStderr([&] { __ct_check_bounds(shrunk, shrunk + 99, 1, "test", 0); });
+            check(after.find("heap-buffer-overflow") != std::string::npos,
+                  "memo: no overflow report after an in-place shrink, got: " + after);
+        }
+        __ct_free(shrunk);
+    }
+} // namespace
+
+int main()
+{
+    testReuseOutlivesFreedRecord();
+    testReallocInPlace();
+    testMemoAfterShrink(false);
+    testMemoAfterShrink(true);
+    if (failures != 0)
+    {
+        std::cerr << failures << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "all table checks passed\n";
+    return 0;
+}